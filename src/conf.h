@@ -1,8 +1,11 @@
 #ifndef CONF_H_
 #define CONF_H_
+/* conf.h is included by the assembly interpreter core as well , see vm_asm.h */
+#ifndef __ASSEMBLER__
 #include <inttypes.h>
 #include <assert.h>
 #include <limits.h>
+#endif /* __ASSEMBLER__ */
 
 #if defined(__GNUC__) || defined(__clang__)
 /* Likely unlikely stuff for static branch predication.
@@ -15,6 +18,13 @@
 /* Inline flag , mostly used to help when we port to some sick
  * compiler suit like MSVC or older version of c */
 #define SPARROW_INLINE inline
+
+/* Hint CPU to fetch the memory into cache before we touch it */
+#define SP_PREFETCH(X) __builtin_prefetch((X))
+
+/* Bit scanning of 64 bits words , used to walk bitmaps */
+#define SP_CTZ64(X) __builtin_ctzll((X))
+#define SP_POPCOUNT64(X) __builtin_popcountll((X))
 #else
 #error "Compiler not supported!"
 #endif /* __GNUC__ || __clang__ */
@@ -31,8 +41,9 @@
 #define SPARROW_DEFAULT_STACK_SIZE 1024*128
 #endif /* SPARROW_DEFAULT_STACK_SIZE */
 
+/* Bytes held by GC objects before a major GC kicks in */
 #ifndef SPARROW_DEFAULT_GC_THRESHOLD
-#define SPARROW_DEFAULT_GC_THRESHOLD 25000
+#define SPARROW_DEFAULT_GC_THRESHOLD (1<<21)
 #endif /* SPARROW_DEFAULT_GC_THRESHOLD */
 
 #ifndef SPARROW_DEFAULT_GC_RATIO
@@ -43,6 +54,162 @@
 #define SPARROW_DEFAULT_GC_PENALTY_RATIO 0.3
 #endif /* SPARROW_DEFAULT_GC_PENALTY_RATIO */
 
+/* Number of young objects allowed in nursery before a minor GC kicks in */
+#ifndef SPARROW_DEFAULT_GC_NURSERY_SIZE
+#define SPARROW_DEFAULT_GC_NURSERY_SIZE 4096
+#endif /* SPARROW_DEFAULT_GC_NURSERY_SIZE */
+
+/* Number of collections a young object needs to survive before it gets
+ * promoted into the old generation , must be in range [1,255] */
+#ifndef SPARROW_DEFAULT_GC_PROMOTE_AGE
+#define SPARROW_DEFAULT_GC_PROMOTE_AGE 2
+#endif /* SPARROW_DEFAULT_GC_PROMOTE_AGE */
+#if SPARROW_DEFAULT_GC_PROMOTE_AGE < 1 || SPARROW_DEFAULT_GC_PROMOTE_AGE > 255
+#error "SPARROW_DEFAULT_GC_PROMOTE_AGE must be in range [1,255]!"
+#endif /* SPARROW_DEFAULT_GC_PROMOTE_AGE */
+
+/* Number of objects visited by each step of an incremental major GC , 0
+ * means major GC is stop the world */
+#ifndef SPARROW_DEFAULT_GC_BUDGET
+#define SPARROW_DEFAULT_GC_BUDGET 0
+#endif /* SPARROW_DEFAULT_GC_BUDGET */
+
+/* Small GC objects are allocated from pages segregated by size class. Each
+ * page is SPARROW_GC_PAGE_SIZE bytes and must be a power of 2. Define
+ * SPARROW_GC_NO_SLAB to allocate every object with malloc , which is useful
+ * for memory debugging tools */
+#ifndef SPARROW_GC_PAGE_SIZE
+#define SPARROW_GC_PAGE_SIZE (1<<16)
+#endif /* SPARROW_GC_PAGE_SIZE */
+
+/* Define SPARROW_GC_CONCURRENT ( and link with -pthread ) to let major GC
+ * mark the heap on a helper thread while the interpreter keeps running.
+ * It can still be turned off at runtime by gc.config */
+#ifndef SPARROW_DEFAULT_GC_CONCURRENT
+#ifdef SPARROW_GC_CONCURRENT
+#define SPARROW_DEFAULT_GC_CONCURRENT 1
+#else
+#define SPARROW_DEFAULT_GC_CONCURRENT 0
+#endif /* SPARROW_GC_CONCURRENT */
+#endif /* SPARROW_DEFAULT_GC_CONCURRENT */
+
+/* Number of objects the marker thread scans before it checks whether the
+ * interpreter is waiting for the heap lock */
+#ifndef SPARROW_GC_CONCURRENT_STEP
+#define SPARROW_GC_CONCURRENT_STEP 64
+#endif /* SPARROW_GC_CONCURRENT_STEP */
+
+/* Number of buckets of GC pause histograms , bucket i counts collections
+ * that take [2^i,2^(i+1)) microseconds , see struct GCStat */
+#ifndef SPARROW_GC_HISTOGRAM_SIZE
+#define SPARROW_GC_HISTOGRAM_SIZE 24
+#endif /* SPARROW_GC_HISTOGRAM_SIZE */
+
+/* Number of latest collections whose pause time is kept */
+#ifndef SPARROW_GC_HISTORY_SIZE
+#define SPARROW_GC_HISTORY_SIZE 16
+#endif /* SPARROW_GC_HISTORY_SIZE */
+
+/* Number of map layouts an attribute inline cache remembers before the
+ * instruction becomes megamorphic , see struct InlineCache */
+#ifndef SPARROW_IC_SIZE
+#define SPARROW_IC_SIZE 4
+#endif /* SPARROW_IC_SIZE */
+
+/* Limitations of record maps , a map becomes dictionary when it has more
+ * keys than SPARROW_SHAPE_MAX_SIZE , or a shape has more transitions than
+ * SPARROW_SHAPE_MAX_TRANSITION , or SPARROW_SHAPE_MAX_COUNT shapes have
+ * been created. See struct Shape */
+#ifndef SPARROW_SHAPE_MAX_SIZE
+#define SPARROW_SHAPE_MAX_SIZE 16
+#endif /* SPARROW_SHAPE_MAX_SIZE */
+
+#ifndef SPARROW_SHAPE_MAX_TRANSITION
+#define SPARROW_SHAPE_MAX_TRANSITION 32
+#endif /* SPARROW_SHAPE_MAX_TRANSITION */
+
+#ifndef SPARROW_SHAPE_MAX_COUNT
+#define SPARROW_SHAPE_MAX_COUNT 4096
+#endif /* SPARROW_SHAPE_MAX_COUNT */
+
+/* Baseline JIT compiler , only available on x86-64. Define SPARROW_NO_JIT
+ * to run everything in the interpreter */
+#if defined(__x86_64__) && !defined(SPARROW_NO_JIT)
+#define SPARROW_JIT
+#endif /* __x86_64__ && !SPARROW_NO_JIT */
+
+/* Hotness of a function before it is tiered up , ie compiled into native
+ * code. Each entry of the function and each iteration of its for loops count
+ * one , see BC_CLOSURE and BC_LOOP */
+#ifndef SPARROW_JIT_THRESHOLD
+#define SPARROW_JIT_THRESHOLD 64
+#endif /* SPARROW_JIT_THRESHOLD */
+
+/* Hotness of a function before it starts to collect type feedback , see
+ * struct FeedbackSlot. It is below SPARROW_JIT_THRESHOLD so a function has
+ * feedback by the time it is compiled */
+#ifndef SPARROW_FEEDBACK_THRESHOLD
+#define SPARROW_FEEDBACK_THRESHOLD (SPARROW_JIT_THRESHOLD/4)
+#endif /* SPARROW_FEEDBACK_THRESHOLD */
+
+/* Number of map shapes or callees a feedback slot remembers before the site
+ * is megamorphic */
+#ifndef SPARROW_FEEDBACK_SIZE
+#define SPARROW_FEEDBACK_SIZE 4
+#endif /* SPARROW_FEEDBACK_SIZE */
+
+/* Bytes of executable memory used by native code of a Sparrow instance ,
+ * functions that get hot after the limit is reached stay interpreted */
+#ifndef SPARROW_JIT_CACHE_SIZE
+#define SPARROW_JIT_CACHE_SIZE (1<<24)
+#endif /* SPARROW_JIT_CACHE_SIZE */
+
+/* Iterations a for loop runs in baseline native code before the optimizing
+ * JIT compiles it , see jit.h */
+#ifndef SPARROW_JIT_LOOP_THRESHOLD
+#define SPARROW_JIT_LOOP_THRESHOLD 1024
+#endif /* SPARROW_JIT_LOOP_THRESHOLD */
+
+/* Failed guards of an optimized loop before it is thrown away and the loop
+ * stays in baseline code */
+#ifndef SPARROW_JIT_DEOPT_LIMIT
+#define SPARROW_JIT_DEOPT_LIMIT 16
+#endif /* SPARROW_JIT_DEOPT_LIMIT */
+
+/* Loader of modules compiled ahead of time into C , see aot.h. It is plain
+ * C so it is available on every platform , define SPARROW_NO_AOT to drop it */
+#ifndef SPARROW_NO_AOT
+#define SPARROW_AOT
+#endif /* SPARROW_NO_AOT */
+
+/* Interpreter core written in assembly , only available on x86-64 Linux and
+ * off by default. Define SPARROW_VM_ASM to run the hot instructions in vm_x64.S , vm_main
+ * then executes the rest of them one at a time , see vm_asm.h */
+#ifdef SPARROW_VM_ASM
+#if !defined(__x86_64__) || !defined(__linux__)
+#error "SPARROW_VM_ASM is only supported on x86-64 Linux!"
+#endif /* !__x86_64__ || !__linux__ */
+#endif /* SPARROW_VM_ASM */
+
+/* Native code of either compiler runs on the interpreter's stack and steps
+ * the interpreter for what it cannot do , see JitStep. The assembly
+ * interpreter steps vm_main the same way */
+#if defined(SPARROW_JIT) || defined(SPARROW_AOT) || defined(SPARROW_VM_ASM)
+#define SPARROW_NATIVE
+#endif /* SPARROW_JIT || SPARROW_AOT || SPARROW_VM_ASM */
+
+/* Interpreter dispatch. By default vm_main is a threaded interpreter using
+ * computed goto and a jump table indexed by opcode. Define
+ * SPARROW_VM_DIRECT_THREADING to pre-decode the handler address of every
+ * instruction when a function is entered first , or SPARROW_VM_NO_THREADING
+ * for a plain switch loop */
+#if defined(SPARROW_VM_DIRECT_THREADING) && defined(SPARROW_VM_NO_THREADING)
+#error "SPARROW_VM_DIRECT_THREADING needs computed goto!"
+#endif /* SPARROW_VM_DIRECT_THREADING && SPARROW_VM_NO_THREADING */
+#if defined(SPARROW_VM_DIRECT_THREADING) && defined(SPARROW_VM_ASM)
+#error "SPARROW_VM_DIRECT_THREADING does not work with SPARROW_VM_ASM!"
+#endif /* SPARROW_VM_DIRECT_THREADING && SPARROW_VM_ASM */
+
 /* Data type size boundary limitation define */
 #ifndef SPARROW_SIZE_MAX
 #define SPARROW_SIZE_MAX UINT_MAX
@@ -0,0 +1,724 @@
+#include "aot.h"
+
+#ifdef SPARROW_AOT
+#include "vm.h"
+#include "bc.h"
+#include "parser.h"
+#include <string.h>
+#include <math.h>
+
+/* Operand of arithmetic and comparison , a stack slot relative to top , a
+ * register slot relative to base or a number constant , see jit.c */
+enum {
+  OPERAND_STACK,
+  OPERAND_REG,
+  OPERAND_NUM
+};
+
+struct Operand {
+  int kind;
+  uint32_t idx;
+  double num;
+  int nonzero; /* zero goes to interpreter , ie divide by zero error */
+};
+
+/* Where the result goes */
+enum {
+  DEST_PUSH,    /* push onto stack */
+  DEST_REPLACE, /* replace stack top */
+  DEST_POP,     /* pop 2 operands and push */
+  DEST_REG      /* register slot */
+};
+
+/* Translation state of a proto. The body is translated twice , the first
+ * pass only collects jump targets so the second pass defines labels that
+ * are actually used */
+struct Emitter {
+  struct StrBuf* out;
+  const struct ObjProto* proto;
+  char* label;  /* pc that is target of a goto */
+  int pass;
+  /* instruction being translated */
+  uint32_t pc;
+  uint32_t next;
+  int32_t target;
+};
+
+uint32_t AotChecksum( const struct ObjProto* proto ) {
+  /* FNV-1a */
+  uint32_t h = 2166136261u;
+  size_t i;
+#define MIX(V) \
+  do { \
+    uint64_t word = (V); \
+    int b; \
+    for( b = 0 ; b < 64 ; b += 8 ) { \
+      h ^= (uint32_t)((word >> b) & 0xff); \
+      h *= 16777619u; \
+    } \
+  } while(0)
+
+  MIX(proto->code_buf.pos);
+  for( i = 0 ; i < proto->code_buf.pos ; ++i )
+    MIX(proto->code_buf.buf[i]);
+  MIX(proto->num_size);
+  for( i = 0 ; i < proto->num_size ; ++i ) {
+    Value num;
+    Vset_number(&num,proto->num_arr[i]);
+    MIX(num.ipart);
+  }
+
+#undef MIX /* MIX */
+  return h;
+}
+
+static void emit( struct Emitter* em , const char* fmt , ... ) {
+  va_list vl;
+  va_start(vl,fmt);
+  StrBufVAppendF(em->out,fmt,vl);
+  va_end(vl);
+}
+
+static void emit_goto( struct Emitter* em , uint32_t pc ) {
+  em->label[pc] = 1;
+  emit(em,"goto L%u;",pc);
+}
+
+static void emit_step( struct Emitter* em ) {
+  emit(em,"      AOT_STEP(%u)\n",em->pc);
+}
+
+static struct Operand operand_stack( uint32_t idx ) {
+  struct Operand ret;
+  ret.kind = OPERAND_STACK;
+  ret.idx = idx;
+  ret.num = 0;
+  ret.nonzero = 0;
+  return ret;
+}
+
+static struct Operand operand_reg( uint32_t idx ) {
+  struct Operand ret;
+  ret.kind = OPERAND_REG;
+  ret.idx = idx;
+  ret.num = 0;
+  ret.nonzero = 0;
+  return ret;
+}
+
+static struct Operand operand_num( double num ) {
+  struct Operand ret;
+  ret.kind = OPERAND_NUM;
+  ret.idx = 0;
+  ret.num = num;
+  ret.nonzero = 0;
+  return ret;
+}
+
+static struct Operand operand_nonzero( struct Operand opd ) {
+  opd.nonzero = 1;
+  return opd;
+}
+
+/* Number literal , hex float is exact. Infinity and NaN have no literal ,
+ * the instruction goes to interpreter */
+static int literal( char* buf , double num ) {
+  if(!isfinite(num)) return -1;
+  sprintf(buf,"(%a)",num);
+  return 0;
+}
+
+/* Address of a slot operand */
+static void slot( char* buf , const struct Operand* opd ) {
+  if(opd->kind == OPERAND_STACK)
+    sprintf(buf,"top-%u",opd->idx+1);
+  else
+    sprintf(buf,"base+%u",opd->idx);
+}
+
+/* Number value of an operand , returns -1 if it must go to interpreter */
+static int operand( char* buf , char* guard , const struct Operand* opd ) {
+  char s[64];
+  if(opd->kind == OPERAND_NUM) {
+    if(opd->nonzero && opd->num == 0) return -1;
+    return literal(buf,opd->num);
+  }
+  slot(s,opd);
+  sprintf(buf,"Vget_number(%s)",s);
+  sprintf(guard+strlen(guard),"%s!Vis_number(%s)",*guard ? " || " : "",s);
+  if(opd->nonzero)
+    sprintf(guard+strlen(guard)," || Vget_number(%s) == 0",s);
+  return 0;
+}
+
+static void emit_binary( struct Emitter* em , const char* cop , int cmp ,
+    struct Operand l , struct Operand r , int dest , uint32_t dreg ) {
+  char lv[128], rv[128], guard[512] = "";
+  if(dest == DEST_PUSH) strcpy(guard,"top >= limit");
+  if(operand(lv,guard,&l) || operand(rv,guard,&r)) {
+    emit_step(em);
+    return;
+  }
+  emit(em,"      if(%s) AOT_STEP(%u)\n",guard,em->pc);
+  emit(em,"      %s(",cmp ? "Vset_boolean" : "Vset_number");
+  switch(dest) {
+    case DEST_PUSH: emit(em,"top"); break;
+    case DEST_REPLACE: emit(em,"top-1"); break;
+    case DEST_POP: emit(em,"top-2"); break;
+    default: emit(em,"base+%u",dreg); break;
+  }
+  emit(em,",%s %s %s);\n",lv,cop,rv);
+  if(dest == DEST_PUSH) emit(em,"      ++top;\n");
+  else if(dest == DEST_POP) emit(em,"      --top;\n");
+}
+
+/* Modulo , result replaces the left operand */
+static void emit_mod( struct Emitter* em , struct Operand l ,
+    struct Operand r , const char* dest ) {
+  char lv[128], rv[128], guard[512] = "";
+  if(operand(lv,guard,&l) || operand(rv,guard,&r)) {
+    emit_step(em);
+    return;
+  }
+  emit(em,"      if(%s || AotMod(%s,%s,%s)) AOT_STEP(%u)\n",guard,lv,rv,dest,
+      em->pc);
+}
+
+/* Compare and BC_JF */
+static void emit_compare_jf( struct Emitter* em , const char* cop ,
+    struct Operand l , struct Operand r ) {
+  char lv[128], rv[128], guard[512] = "";
+  if(operand(lv,guard,&l) || operand(rv,guard,&r)) {
+    emit_step(em);
+    return;
+  }
+  emit(em,"      if(%s) AOT_STEP(%u)\n",guard,em->pc);
+  emit(em,"      if(!(%s %s %s)) ",lv,cop,rv);
+  emit_goto(em,(uint32_t)em->target);
+  emit(em,"\n      ");
+  emit_goto(em,em->next);
+  emit(em,"\n");
+}
+
+static void emit_push_num( struct Emitter* em , double num ) {
+  char v[128];
+  if(literal(v,num)) {
+    emit_step(em);
+    return;
+  }
+  emit(em,"      if(top >= limit) AOT_STEP(%u)\n",em->pc);
+  emit(em,"      Vset_number(top,%s);\n",v);
+  emit(em,"      ++top;\n");
+}
+
+/* set is one of Vset_true , Vset_false and Vset_null */
+static void emit_push_imm( struct Emitter* em , const char* set ) {
+  emit(em,"      if(top >= limit) AOT_STEP(%u)\n",em->pc);
+  emit(em,"      %s(top);\n",set);
+  emit(em,"      ++top;\n");
+}
+
+static void emit_move_num( struct Emitter* em , uint32_t idx , double num ) {
+  char v[128];
+  if(literal(v,num)) {
+    emit_step(em);
+    return;
+  }
+  emit(em,"      Vset_number(base+%u,%s);\n",idx,v);
+}
+
+/* Branch on stack top , the jump is taken when it is jv and not taken when it
+ * is fv. Other values are converted to boolean by interpreter */
+static void emit_branch( struct Emitter* em , const char* jv ,
+    const char* fv , int pop_on_jump , uint32_t target ) {
+  emit(em,"      if(top[-1].ipart == %s) { %s",jv,pop_on_jump ? "--top; " : "");
+  emit_goto(em,target);
+  emit(em," }\n");
+  emit(em,"      if(top[-1].ipart != %s) AOT_STEP(%u)\n",fv,em->pc);
+  emit(em,"      --top;\n");
+}
+
+/* BC_FORLOOP over loop() , the iterator is popc slots below stack top */
+static void emit_forloop( struct Emitter* em , uint32_t popc ) {
+  emit(em,"      pc = AotForLoop(top-%u);\n",popc+1);
+  emit(em,"      if(pc < 0) AOT_STEP(%u)\n",em->pc);
+  if(popc) emit(em,"      top -= %u;\n",popc);
+  emit(em,"      if(pc) ");
+  emit_goto(em,(uint32_t)em->target);
+  emit(em,"\n");
+  if(em->next != em->pc + 1) {
+    emit(em,"      ");
+    emit_goto(em,em->next);
+    emit(em,"\n");
+  }
+}
+
+/* BC_FORLOOPN , the hidden slots are popc slots below stack top and always
+ * hold numbers */
+static void emit_forloopn( struct Emitter* em , uint32_t popc ) {
+  if(popc) emit(em,"      top -= %u;\n",popc);
+  emit(em,"      top[-3].num += top[-1].num;\n");
+  emit(em,"      if(top[-3].num < top[-2].num) ");
+  emit_goto(em,(uint32_t)em->target);
+  emit(em,"\n");
+  if(em->next != em->pc + 1) {
+    emit(em,"      ");
+    emit_goto(em,em->next);
+    emit(em,"\n");
+  }
+}
+
+static int32_t jump_target( uint32_t ins ) {
+  switch(BCINS_OP(ins)) {
+    case BC_JMP: case BC_JT: case BC_JF: case BC_BRT: case BC_BRF:
+    case BC_FORPREP: case BC_FORLOOP:
+    case BC_FORPREPN: case BC_FORPREPR: case BC_FORLOOPN:
+      return (int32_t)BCINS_A(ins);
+    default:
+      return -1;
+  }
+}
+
+/* Instructions leave generated code , interpreter takes care of them */
+static int is_exit( int op ) {
+  switch(op) {
+    case BC_CALL: case BC_CALL0: case BC_CALL1: case BC_CALL2:
+    case BC_CALL3: case BC_CALL4:
+    case BC_RET: case BC_RETN: case BC_RETS: case BC_RETT: case BC_RETF:
+    case BC_RETN0: case BC_RETN1: case BC_RETNN1: case BC_RETNULL:
+    case BC_OP: case BC_A:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+/* Translate an instruction , the ones without translation go to interpreter.
+ * It mirrors emit_template of jit.c */
+static void emit_instruction( struct Emitter* em , int op , uint32_t opr ) {
+  const double* num = em->proto->num_arr;
+
+#define NUM(IDX) operand_num(num[IDX])
+#define STK(IDX) operand_stack(IDX)
+#define REG(IDX) operand_reg(IDX)
+#define NZ(OPD) operand_nonzero(OPD)
+
+  switch(op) {
+    /* NV , VN and VV */
+#define DO(INSTR,COP,CMP) \
+    case BC_##INSTR##NV: \
+      emit_binary(em,COP,CMP,NUM(opr),STK(0),DEST_REPLACE,0); return; \
+    case BC_##INSTR##VN: \
+      emit_binary(em,COP,CMP,STK(0),NUM(opr),DEST_REPLACE,0); return; \
+    case BC_##INSTR##VV: \
+      emit_binary(em,COP,CMP,STK(1),STK(0),DEST_POP,0); return;
+
+    DO(ADD,"+",0)
+    DO(SUB,"-",0)
+    DO(MUL,"*",0)
+    DO(LT,"<",1)
+    DO(LE,"<=",1)
+    DO(GT,">",1)
+    DO(GE,">=",1)
+    DO(EQ,"==",1)
+    DO(NE,"!=",1)
+
+#undef DO /* DO */
+
+    /* interpreter checks the left operand of BC_DIVVN against zero */
+    case BC_DIVNV:
+      emit_binary(em,"/",0,NUM(opr),NZ(STK(0)),DEST_REPLACE,0); return;
+    case BC_DIVVN:
+      emit_binary(em,"/",0,NZ(STK(0)),NUM(opr),DEST_REPLACE,0); return;
+    case BC_DIVVV: case BC_DIVNN:
+      emit_binary(em,"/",0,STK(1),NZ(STK(0)),DEST_POP,0); return;
+
+    /* the JIT leaves modulo to interpreter , it is cheap enough in C */
+    case BC_MODNV:
+      emit_mod(em,NUM(opr),STK(0),"top-1"); return;
+    case BC_MODVN:
+      emit_mod(em,STK(0),NUM(opr),"top-1"); return;
+    case BC_MODVV:
+      emit_mod(em,STK(1),STK(0),"top-2");
+      emit(em,"      --top;\n");
+      return;
+
+    /* quickened VV */
+#define DO(INSTR,COP,CMP) \
+    case BC_##INSTR##NN: \
+      emit_binary(em,COP,CMP,STK(1),STK(0),DEST_POP,0); return;
+
+    DO(ADD,"+",0)
+    DO(SUB,"-",0)
+    DO(MUL,"*",0)
+    DO(LT,"<",1)
+    DO(LE,"<=",1)
+    DO(GT,">",1)
+    DO(GE,">=",1)
+
+#undef DO /* DO */
+
+    /* register instructions , generic ones and quickened ones */
+#define DO(INSTR,COP,R) \
+    case BC_##INSTR##LL: case BC_##INSTR##LLNN: \
+      emit_binary(em,COP,0,REG(BCREG2_B(opr)),R(REG(BCREG2_C(opr))), \
+          DEST_PUSH,0); \
+      return; \
+    case BC_R##INSTR##LL: case BC_R##INSTR##LLNN: \
+      emit_binary(em,COP,0,REG(BCREG3_B(opr)),R(REG(BCREG3_C(opr))), \
+          DEST_REG,BCREG3_A(opr)); \
+      return;
+
+    DO(ADD,"+",)
+    DO(SUB,"-",)
+    DO(MUL,"*",)
+    DO(DIV,"/",NZ)
+
+#undef DO /* DO */
+
+#define DO(INSTR,COP) \
+    case BC_##INSTR##LL: case BC_##INSTR##LLNN: \
+      emit_binary(em,COP,1,REG(BCREG2_B(opr)),REG(BCREG2_C(opr)), \
+          DEST_PUSH,0); \
+      return;
+
+    DO(LT,"<")
+    DO(LE,"<=")
+    DO(GT,">")
+    DO(GE,">=")
+
+#undef DO /* DO */
+
+    case BC_EQLL:
+      emit_binary(em,"==",1,REG(BCREG2_B(opr)),REG(BCREG2_C(opr)),
+          DEST_PUSH,0);
+      return;
+    case BC_NELL:
+      emit_binary(em,"!=",1,REG(BCREG2_B(opr)),REG(BCREG2_C(opr)),
+          DEST_PUSH,0);
+      return;
+
+#define DO(INSTR,COP,CMP) \
+    case BC_##INSTR##LN: \
+      emit_binary(em,COP,CMP,REG(BCREG2_B(opr)),NUM(BCREG2_C(opr)), \
+          DEST_PUSH,0); \
+      return;
+
+    DO(ADD,"+",0)
+    DO(SUB,"-",0)
+    DO(MUL,"*",0)
+    DO(LT,"<",1)
+    DO(LE,"<=",1)
+    DO(GT,">",1)
+    DO(GE,">=",1)
+    DO(EQ,"==",1)
+    DO(NE,"!=",1)
+
+#undef DO /* DO */
+
+#define DO(INSTR,COP) \
+    case BC_R##INSTR##LN: \
+      emit_binary(em,COP,0,REG(BCREG3_B(opr)),NUM(BCREG3_C(opr)), \
+          DEST_REG,BCREG3_A(opr)); \
+      return;
+
+    DO(ADD,"+")
+    DO(SUB,"-")
+    DO(MUL,"*")
+
+#undef DO /* DO */
+
+    /* compare and BC_JF */
+#define DO(INSTR,COP) \
+    case BC_##INSTR##LNJF: \
+      emit_compare_jf(em,COP,REG(BCREG2_B(opr)),NUM(BCREG2_C(opr))); \
+      return; \
+    case BC_##INSTR##LLJF: \
+      emit_compare_jf(em,COP,REG(BCREG2_B(opr)),REG(BCREG2_C(opr))); \
+      return;
+
+    DO(LT,"<")
+    DO(LE,"<=")
+    DO(GT,">")
+    DO(GE,">=")
+    DO(EQ,"==")
+    DO(NE,"!=")
+
+#undef DO /* DO */
+
+    /* loads */
+    case BC_LOADN: emit_push_num(em,num[opr]); return;
+    case BC_LOADN0: emit_push_num(em,0); return;
+    case BC_LOADN1: emit_push_num(em,1); return;
+    case BC_LOADN2: emit_push_num(em,2); return;
+    case BC_LOADN3: emit_push_num(em,3); return;
+    case BC_LOADN4: emit_push_num(em,4); return;
+    case BC_LOADN5: emit_push_num(em,5); return;
+    case BC_LOADNN1: emit_push_num(em,-1); return;
+    case BC_LOADNN2: emit_push_num(em,-2); return;
+    case BC_LOADNN3: emit_push_num(em,-3); return;
+    case BC_LOADNN4: emit_push_num(em,-4); return;
+    case BC_LOADNN5: emit_push_num(em,-5); return;
+    case BC_LOADNULL: emit_push_imm(em,"Vset_null"); return;
+    case BC_LOADTRUE: emit_push_imm(em,"Vset_true"); return;
+    case BC_LOADFALSE: emit_push_imm(em,"Vset_false"); return;
+    case BC_LOADV:
+      emit(em,"      if(top >= limit) AOT_STEP(%u)\n",em->pc);
+      emit(em,"      *top = base[%u];\n",opr);
+      emit(em,"      ++top;\n");
+      return;
+
+    /* moves */
+    case BC_MOVE:
+      emit(em,"      base[%u] = top[-1];\n",opr);
+      emit(em,"      --top;\n");
+      return;
+    case BC_MOVETRUE: emit(em,"      Vset_true(base+%u);\n",opr); return;
+    case BC_MOVEFALSE: emit(em,"      Vset_false(base+%u);\n",opr); return;
+    case BC_MOVENULL: emit(em,"      Vset_null(base+%u);\n",opr); return;
+    case BC_MOVEN0: emit_move_num(em,opr,0); return;
+    case BC_MOVEN1: emit_move_num(em,opr,1); return;
+    case BC_MOVEN2: emit_move_num(em,opr,2); return;
+    case BC_MOVEN3: emit_move_num(em,opr,3); return;
+    case BC_MOVEN4: emit_move_num(em,opr,4); return;
+    case BC_MOVEN5: emit_move_num(em,opr,5); return;
+    case BC_MOVENN1: emit_move_num(em,opr,-1); return;
+    case BC_MOVENN2: emit_move_num(em,opr,-2); return;
+    case BC_MOVENN3: emit_move_num(em,opr,-3); return;
+    case BC_MOVENN4: emit_move_num(em,opr,-4); return;
+    case BC_MOVENN5: emit_move_num(em,opr,-5); return;
+
+    case BC_POP:
+      if(opr) emit(em,"      top -= %u;\n",opr);
+      return;
+    /* hotness only matters to the interpreter and the JIT */
+    case BC_NOP: case BC_CLOSURE: case BC_LOOP:
+      return;
+
+    /* for loop over loop() */
+    case BC_IDREFK:
+      emit(em,"      if(top >= limit || AotIdrefK(top-1)) AOT_STEP(%u)\n",
+          em->pc);
+      emit(em,"      ++top;\n");
+      return;
+    case BC_FORLOOP:
+      emit_forloop(em,0);
+      return;
+    case BC_POPFORLOOP:
+      emit_forloop(em,opr);
+      return;
+
+    /* numeric for loop , its prolog is stepped */
+    case BC_FORLOOPN:
+      emit_forloopn(em,0);
+      return;
+    case BC_POPFORLOOPN:
+      emit_forloopn(em,opr);
+      return;
+
+    /* jumps */
+    case BC_JMP:
+      emit(em,"      ");
+      emit_goto(em,opr);
+      emit(em,"\n");
+      return;
+    case BC_JT:
+      emit_branch(em,"VALUE_TRUE","VALUE_FALSE",1,opr);
+      return;
+    case BC_JF:
+      emit_branch(em,"VALUE_FALSE","VALUE_TRUE",1,opr);
+      return;
+    case BC_BRT:
+      emit_branch(em,"VALUE_TRUE","VALUE_FALSE",0,opr);
+      return;
+    case BC_BRF:
+      emit_branch(em,"VALUE_FALSE","VALUE_TRUE",0,opr);
+      return;
+
+    default:
+      emit_step(em);
+      return;
+  }
+
+#undef NZ /* NZ */
+#undef REG /* REG */
+#undef STK /* STK */
+#undef NUM /* NUM */
+}
+
+static void emit_body( struct Emitter* em ) {
+  const uint32_t* code = em->proto->code_buf.buf;
+  uint32_t n = (uint32_t)em->proto->code_buf.pos;
+  uint32_t i;
+
+  for( i = 0 ; i < n ; ++i ) {
+    int op = BCINS_OP(code[i]);
+    int first = BytecodeUnfuse(op);
+    emit(em,"    case %u:",i);
+    if(em->pass && em->label[i]) emit(em," L%u:",i);
+    emit(em," /* %s */\n",BytecodeGetName(op));
+    em->pc = i;
+    if(first != SIZE_OF_BYTECODE && i+1 < n) {
+      /* BC_LOADVLOADV is translated as its first BC_LOADV , the other
+       * superinstructions without translation are stepped as a whole */
+      em->next = i+2;
+      em->target = jump_target(code[i+1]);
+      if(op == BC_LOADVLOADV) op = first;
+    } else {
+      em->next = i+1;
+      em->target = jump_target(code[i]);
+    }
+
+    if(is_exit(op)) {
+      emit(em,"      AOT_EXIT(%u)\n",i);
+    } else {
+      emit_instruction(em,op,BCINS_A(code[i]));
+    }
+  }
+  emit(em,"    case %u:",n);
+  if(em->pass && em->label[n]) emit(em," L%u:",n);
+  emit(em,"\n    default:\n      AOT_EXIT(pc)\n");
+}
+
+static void emit_proto( struct StrBuf* out , const struct ObjProto* proto ,
+    size_t idx ) {
+  struct Emitter em;
+  struct StrBuf temp;
+
+  em.proto = proto;
+  em.label = calloc(proto->code_buf.pos+1,1);
+
+  /* first pass collects labels */
+  StrBufInit(&temp,1024);
+  em.out = &temp;
+  em.pass = 0;
+  emit_body(&em);
+  StrBufDestroy(&temp);
+
+  em.out = out;
+  em.pass = 1;
+  emit(&em,"/* %s */\n",proto->proto.str);
+  emit(&em,"static int proto%zu( struct JitState* st , int pc ) {\n",idx);
+  emit(&em,"  Value* base = st->base;\n");
+  emit(&em,"  Value* top = st->top;\n");
+  emit(&em,"  Value* limit = st->limit;\n");
+  emit(&em,"  (void)base;\n");
+  emit(&em,"  (void)limit;\n");
+  emit(&em,"  for(;;) {\n");
+  emit(&em,"    switch(pc) {\n");
+  emit_body(&em);
+  emit(&em,"    }\n");
+  emit(&em,"  }\n");
+  emit(&em,"}\n\n");
+  free(em.label);
+}
+
+/* C string literal , one source line per line */
+static void emit_string( struct StrBuf* out , const char* str , size_t len ) {
+  size_t i;
+  StrBufAppendStr(out,"\"");
+  for( i = 0 ; i < len ; ++i ) {
+    unsigned char c = (unsigned char)str[i];
+    switch(c) {
+      case '\\': StrBufAppendStr(out,"\\\\"); break;
+      case '"': StrBufAppendStr(out,"\\\""); break;
+      case '\n':
+        StrBufAppendStr(out,"\\n\"");
+        if(i+1 < len) StrBufAppendStr(out,"\n  \"");
+        else return;
+        break;
+      default:
+        /* ? is escaped as well , no trigraph */
+        if(c < 0x20 || c >= 0x7f || c == '?')
+          StrBufAppendF(out,"\\%03o",c);
+        else
+          StrBufPush(out,(char)c);
+        break;
+    }
+  }
+  StrBufAppendStr(out,"\"");
+}
+
+int AotEmit( struct ObjModule* mod , const char* symbol , FILE* output ) {
+  struct StrBuf out;
+  size_t i;
+
+  StrBufInit(&out,4096);
+  StrBufAppendF(&out,"/* Generated by AotEmit from %s , do not edit */\n",
+      mod->source_path.len ? mod->source_path.str : "<string>");
+  StrBufAppendStr(&out,"#include \"fe/aot.h\"\n\n");
+
+  for( i = 0 ; i < mod->cls_size ; ++i )
+    emit_proto(&out,mod->cls_arr[i],i);
+
+  StrBufAppendF(&out,"static const struct AotFunc %s_func[] = {\n",symbol);
+  for( i = 0 ; i < mod->cls_size ; ++i ) {
+    StrBufAppendF(&out,"  { 0x%08" PRIx32 "u , proto%zu },\n",
+        AotChecksum(mod->cls_arr[i]),i);
+  }
+  StrBufAppendStr(&out,"};\n\n");
+
+  StrBufAppendF(&out,"static const char %s_source[] =\n  ",symbol);
+  emit_string(&out,mod->source.str,mod->source.len);
+  StrBufAppendStr(&out,";\n\n");
+
+  StrBufAppendF(&out,"const struct AotModule %s = {\n  ",symbol);
+  if(mod->source_path.len)
+    emit_string(&out,mod->source_path.str,mod->source_path.len);
+  else
+    StrBufAppendStr(&out,"NULL");
+  StrBufAppendF(&out,",\n  %s_source,\n  %zu,\n  %s_func\n};\n",
+      symbol,mod->cls_size,symbol);
+
+  fwrite(out.buf,1,out.size,output);
+  StrBufDestroy(&out);
+  return ferror(output) ? -1 : 0;
+}
+
+int AotLoad( struct ObjModule* mod , const struct AotModule* aot ) {
+  size_t i;
+  if(mod->cls_size != aot->size) return -1;
+  for( i = 0 ; i < mod->cls_size ; ++i ) {
+    const struct ObjProto* proto = mod->cls_arr[i];
+    if(proto->aot == aot->func_arr + i) continue; /* loaded */
+    if(AotChecksum(proto) != aot->func_arr[i].checksum) return -1;
+  }
+  for( i = 0 ; i < mod->cls_size ; ++i )
+    mod->cls_arr[i]->aot = aot->func_arr + i;
+  return 0;
+}
+
+int AotExecute( struct Sparrow* sparrow , const struct AotModule* aot ,
+    struct ObjMap* env , Value* ret , struct CStr* err ) {
+  struct ObjModule* mod;
+  struct ObjComponent* component;
+  mod = Parse(sparrow,aot->path,aot->source,err);
+  if(!mod) return -1;
+  /* a mismatch leaves the module interpreted */
+  AotLoad(mod,aot);
+  /* see run_code of sparrow.c for why NOGC version is used */
+  if(!env) env = ObjNewMapNoGC(sparrow,8);
+  component = ObjNewComponentNoGC(sparrow,mod,env);
+  return Execute(sparrow,component,ret,err);
+}
+
+int AotRun( struct Runtime* rt , struct ObjProto* proto ) {
+  struct CallThread* thread = RTCallThread(rt);
+  struct CallFrame* frame = RTCurFrame(rt);
+  struct JitState st;
+  int pc;
+
+  st.rt = rt;
+  st.base = thread->stack + frame->base_ptr;
+  st.top = thread->stack + thread->stack_size;
+  st.limit = thread->stack + thread->stack_cap;
+  pc = proto->aot->entry(&st,(int)frame->pc);
+  if(pc < 0) return -1;
+
+  /* the stack and frames may be reallocated by JitStep */
+  thread->stack_size = (size_t)(st.top - thread->stack);
+  RTCurFrame(rt)->pc = (size_t)pc;
+  return 0;
+}
+
+#endif /* SPARROW_AOT */
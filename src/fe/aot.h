@@ -0,0 +1,119 @@
+#ifndef AOT_H_
+#define AOT_H_
+#include "../conf.h"
+#include "object.h"
+#include "jit.h"
+#include <stdio.h>
+
+#ifdef SPARROW_AOT
+
+/* Ahead of time compilation of modules into C.
+ *
+ * AotEmit translates every proto of a parsed module into a C function with
+ * the same contract as the baseline JIT , see jit.h. The function works on
+ * the CallThread stack directly , each pc is a case of a switch so it can be
+ * entered at any instruction boundary. Number arithmetic , comparison ,
+ * branches , loads , moves and for loops over loop() are translated into
+ * inline C , everything else is executed by the interpreter one instruction
+ * at a time through JitStep , so the generated code uses exactly the same
+ * runtime helpers as the interpreter. Calls and returns leave the function
+ * and are performed by the interpreter.
+ *
+ * The generated translation unit only depends on this header , it is built
+ * by the system C compiler and linked with the runtime. It defines a
+ * struct AotModule which embeds the source of the module , AotLoad attaches
+ * the compiled functions to the protos of a module parsed from the same
+ * source and the interpreter runs them whenever the frame of such a proto
+ * is entered. A proto whose bytecode does not match what has been compiled
+ * simply stays interpreted */
+
+struct Runtime;
+struct ObjModule;
+
+/* Compiled proto , it returns the pc where the interpreter should continue
+ * or -1 if an error happened */
+typedef int (*AotEntry)( struct JitState* , int pc );
+
+struct AotFunc {
+  uint32_t checksum; /* AotChecksum of the proto it is compiled from */
+  AotEntry entry;
+};
+
+struct AotModule {
+  const char* path;   /* source path of the module */
+  const char* source; /* source code of the module */
+  size_t size;        /* number of protos */
+  const struct AotFunc* func_arr;
+};
+
+/* Checksum of the bytecode and number table of a proto */
+uint32_t AotChecksum( const struct ObjProto* );
+
+/* Write a C translation unit for a module which defines a struct AotModule
+ * named symbol */
+int AotEmit( struct ObjModule* , const char* symbol , FILE* output );
+
+/* Attach compiled functions to protos of a module. Returns -1 and leaves the
+ * module interpreted when it is not the module that has been compiled */
+int AotLoad( struct ObjModule* , const struct AotModule* );
+
+/* Parse the source embedded in an AotModule , load the compiled functions
+ * and execute it like RunString */
+int AotExecute( struct Sparrow* , const struct AotModule* , struct ObjMap* env ,
+    Value* ret , struct CStr* err );
+
+/* Run the compiled proto of current frame from current frame's pc , see
+ * JitRun */
+int AotRun( struct Runtime* , struct ObjProto* );
+
+/* ==================================================
+ * Used by generated code
+ * =================================================*/
+
+/* Execute instruction PC in the interpreter and dispatch to the pc it
+ * leaves , the generated function body is a switch inside of a for loop */
+#define AOT_STEP(PC) \
+  { \
+    st->top = top; \
+    if((pc = JitStep(st,(PC))) < 0) return -1; \
+    base = st->base; \
+    top = st->top; \
+    limit = st->limit; \
+    continue; \
+  }
+
+/* Leave to interpreter at PC */
+#define AOT_EXIT(PC) \
+  { \
+    st->top = top; \
+    return (PC); \
+  }
+
+/* Integer modulo of the interpreter , returns -1 for the cases interpreter
+ * reports or traps on , ie zero divisor and INT_MIN % -1 */
+static SPARROW_INLINE int AotMod( double l , double r , Value* out ) {
+  int li , ri;
+  if(ToInt(l,&li) || ToInt(r,&ri) || ri == 0 || ri == -1) return -1;
+  Vset_number(out,li % ri);
+  return 0;
+}
+
+/* BC_FORLOOP over loop() , returns -1 for other iterators */
+static SPARROW_INLINE int AotForLoop( Value* itr ) {
+  struct ObjLoopIterator* litr;
+  if(!Vis_loop_iterator(itr)) return -1;
+  litr = Vget_loop_iterator(itr);
+  litr->index += litr->step; /* move */
+  return litr->index < litr->end;
+}
+
+/* BC_IDREFK over loop() , the key goes to the slot above the iterator */
+static SPARROW_INLINE int AotIdrefK( Value* itr ) {
+  if(!Vis_loop_iterator(itr)) return -1;
+  Vset_number(itr+1,Vget_loop_iterator(itr)->index);
+  return 0;
+}
+
+#endif /* SPARROW_AOT */
+
+#endif /* AOT_H_ */
@@ -18,6 +18,13 @@ static const char* IFUNCTABLE[] = {
   NULL
 };
 
+static const char* BCNAMETABLE[] = {
+#define __(A,B,C) B,
+  BYTECODE(__)
+#undef __
+  NULL
+};
+
 static const char* IATTRTABLE[] = {
 #define __(A,B) B,
   INTRINSIC_ATTRIBUTE(__)
@@ -25,6 +32,11 @@ static const char* IATTRTABLE[] = {
   NULL
 };
 
+const char* BytecodeGetName( enum Bytecode bc ) {
+  assert( bc < SIZE_OF_BYTECODE );
+  return BCNAMETABLE[bc];
+}
+
 enum Bytecode IFuncGetBytecode( const char* name ) {
   size_t i;
   for( i = 0 ; i < SIZE_OF_IFUNC ; ++i ) {
@@ -63,129 +75,70 @@ const char* IAttrGetName( enum IntrinsicAttribute iattr ) {
   }
 }
 
-static void patchA( enum Bytecode op , uint32_t A ,
-    uint8_t* location ) {
-  uint32_t c1,c2,c3;
+static void patch( struct CodeBuffer* cb , size_t pos ,
+    enum Bytecode op , uint32_t A , size_t line , size_t ccnt ) {
   assert(op >= 0 && op < SIZE_OF_BYTECODE);
   assert(A < MAX_ARG_VALUE);
-  c1 = (uint8_t)(A & 0xff);
-  c2 = (uint8_t)((A & 0xff00)>>8);
-  c3 = (uint8_t)((A & 0xff0000)>>16);
-  location[0] = (uint8_t)op;
-  location[1] = c1;
-  location[2] = c2;
-  location[3] = c3;
-}
-
-static void patchOP( enum Bytecode op , uint8_t* location ) {
-  assert(op >= 0 && op < SIZE_OF_BYTECODE);
-  *location = op;
+  cb->buf[pos] = BCINS(op,A);
+  cb->dbg_arr[pos].line = line;
+  cb->dbg_arr[pos].ccnt = ccnt;
 }
 
-static void encodeA( struct CodeBuffer* cb ,
-    enum Bytecode op , uint32_t A ) {
-  patchA(op,A,cb->pos+cb->buf);
-  cb->pos += 4;
-}
-
-static void encodeOP( struct CodeBuffer* cb ,
-    enum Bytecode op ) {
-  patchOP(op,cb->buf+cb->pos);
-  cb->pos++;
+/* Append an instruction , return its index */
+static size_t emit( struct CodeBuffer* cb ,
+    enum Bytecode op , uint32_t A , size_t line , size_t ccnt ) {
+  if(cb->pos == cb->cap) {
+    /* Cannot use MemGrow since it has a capacity limitation */
+    size_t ncap = cb->cap == 0 ? CODE_BUFFER_INITIAL_SIZE : 2 * cb->cap;
+    cb->buf = realloc(cb->buf,ncap*sizeof(uint32_t));
+    cb->dbg_arr = realloc(cb->dbg_arr,ncap*sizeof(struct InstrDebugInfo));
+    cb->cap = ncap;
+  }
+  patch(cb,cb->pos,op,A,line,ccnt);
+  return cb->pos++;
 }
 
 void CodeBufferInit( struct CodeBuffer* cb ) {
-  cb->buf = malloc(CODE_BUFFER_INITIAL_SIZE);
+  cb->buf = malloc(CODE_BUFFER_INITIAL_SIZE*sizeof(uint32_t));
+  cb->dbg_arr = malloc(CODE_BUFFER_INITIAL_SIZE*
+      sizeof(struct InstrDebugInfo));
   cb->cap = CODE_BUFFER_INITIAL_SIZE;
   cb->pos = 0;
-  cb->dbg_arr = NULL;
-  cb->dbg_size= 0;
-  cb->dbg_cap = 0;
-  cb->ins_size = 0;
 }
 
 void CodeBufferDestroy( struct CodeBuffer* cb ) {
   free(cb->buf);
   free(cb->dbg_arr);
   cb->buf = NULL;
-  cb->cap = cb->pos = 0;
   cb->dbg_arr = NULL;
-  cb->dbg_size = cb->dbg_cap = 0;
-  cb->ins_size = 0;
+  cb->cap = cb->pos = 0;
 }
 
 struct Label CodeBufferPutOP( struct CodeBuffer* cb ) {
   struct Label ret;
-  struct InstrDebugInfo dbg = {0,0};
-  if(cb->pos == cb->cap) {
-    /* Add more spaces */
-    MemGrow((void**)&(cb->buf),&(cb->cap),1);
-  }
-  encodeOP(cb,BC_OP);
-  /* Add debug entry for this instructions */
-  DynArrPush(cb,dbg,dbg);
-  ++cb->ins_size;
-  assert(cb->ins_size == cb->dbg_size);
-  ret.dbg_pos = cb->dbg_size -1;
-  ret.code_pos= cb->pos-1;
+  ret.pos = emit(cb,BC_OP,0,0,0);
   return ret;
 }
 
 struct Label CodeBufferPutA( struct CodeBuffer* cb ) {
-  int i;
-  struct InstrDebugInfo dbg = {0,0};
   struct Label ret;
-  for( i = 0 ; i < 2 ; ++i ) {
-    if(cb->pos +4 > cb->cap) {
-      MemGrow((void**)&(cb->buf),&(cb->cap),1);
-    } else break;
-  }
-  assert(cb->pos+4 <= cb->cap);
-  encodeA(cb,BC_A,0);
-  DynArrPush(cb,dbg,dbg);
-  ++cb->ins_size;
-  assert(cb->ins_size == cb->dbg_size);
-  ret.dbg_pos = cb->dbg_size - 1;
-  ret.code_pos = cb->pos - 4;
+  ret.pos = emit(cb,BC_A,0,0,0);
   return ret;
 }
 
 int CodeBufferEmitA( struct CodeBuffer* cb ,
     enum Bytecode op, uint32_t A,
     size_t line, size_t ccnt ) {
-  int i;
-  struct InstrDebugInfo dbg;
-  for( i = 0 ; i < 2 ; ++i ) {
-    if(cb->pos + 4 > cb->cap) {
-      MemGrow((void**)&(cb->buf),&(cb->cap),1);
-    }
-  }
-  assert(cb->pos+4 <= cb->cap);
-  assert(A < MAX_ARG_VALUE);
   assert(DEBUG_TABLE[op]);
-  encodeA(cb,op,A);
-  dbg.line = line;
-  dbg.ccnt = ccnt;
-  DynArrPush(cb,dbg,dbg);
-  ++cb->ins_size;
-  assert(cb->ins_size == cb->dbg_size);
+  emit(cb,op,A,line,ccnt);
   return 0;
 }
 
 int CodeBufferEmitOP( struct CodeBuffer* cb ,
     enum Bytecode op ,
     size_t line , size_t ccnt ) {
-  struct InstrDebugInfo dbg;
-  if(cb->pos == cb->cap) {
-    MemGrow((void**)&(cb->buf),&(cb->cap),1);
-  }
   assert(!DEBUG_TABLE[op]);
-  encodeOP(cb,op);
-  dbg.line = line;
-  dbg.ccnt = ccnt;
-  DynArrPush(cb,dbg,dbg);
-  ++cb->ins_size;
-  assert(cb->ins_size == cb->dbg_size);
+  emit(cb,op,0,line,ccnt);
   return 0;
 }
 
@@ -193,54 +146,94 @@ void CodeBufferPatchOP( struct CodeBuffer* cb,
     struct Label l,
     enum Bytecode op,
     size_t line, size_t ccnt ) {
-  assert(l.code_pos < cb->pos);
-  assert(cb->buf[l.code_pos] == BC_OP);
-  patchOP(op,cb->buf + l.code_pos);
-  cb->dbg_arr[l.dbg_pos].line = line;
-  cb->dbg_arr[l.dbg_pos].ccnt = ccnt;
+  assert(l.pos < cb->pos);
+  assert(CodeBufferDecodeOP(cb,l.pos) == BC_OP);
+  assert(!DEBUG_TABLE[op]);
+  patch(cb,l.pos,op,0,line,ccnt);
 }
 
 void CodeBufferPatchA( struct CodeBuffer* cb,
     struct Label l,
     enum Bytecode op, uint32_t A,
     size_t line, size_t ccnt ) {
-  assert(l.code_pos < cb->pos);
-  assert(cb->buf[l.code_pos] == BC_A);
+  assert(l.pos < cb->pos);
+  assert(CodeBufferDecodeOP(cb,l.pos) == BC_A);
+  assert(DEBUG_TABLE[op]);
+  patch(cb,l.pos,op,A,line,ccnt);
+}
+
+void CodeBufferRepatchA( struct CodeBuffer* cb,
+    struct Label l,
+    enum Bytecode op, uint32_t A ) {
+  assert(l.pos < cb->pos);
+  assert(DEBUG_TABLE[CodeBufferDecodeOP(cb,l.pos)]);
+  assert(DEBUG_TABLE[op]);
   assert(A < MAX_ARG_VALUE);
-  patchA(op,A,cb->buf + l.code_pos);
-  cb->dbg_arr[l.dbg_pos].line = line;
-  cb->dbg_arr[l.dbg_pos].ccnt = ccnt;
+  cb->buf[l.pos] = BCINS(op,A);
+}
+
+static enum Bytecode fuse( enum Bytecode first , enum Bytecode second ) {
+#define __(A,B,C) if(first == B && second == C) return A;
+  SUPERINSTRUCTION(__)
+#undef __
+  return SIZE_OF_BYTECODE;
+}
+
+void CodeBufferFuse( struct CodeBuffer* cb ) {
+  size_t pos;
+  for( pos = 0 ; pos + 1 < cb->pos ; ++pos ) {
+    enum Bytecode op = fuse(CodeBufferDecodeOP(cb,pos),
+                            CodeBufferDecodeOP(cb,pos+1));
+    if(op != SIZE_OF_BYTECODE) {
+      cb->buf[pos] = BCINS(op,CodeBufferDecodeArg(cb,pos));
+      ++pos; /* the second one is taken */
+    }
+  }
 }
 
 void CodeBufferDump( const struct CodeBuffer* cb,
     FILE* output , const char* prefix ) {
-  size_t pos = 0;
-  size_t nins= 0;
+  size_t pos;
   if(prefix)
     fprintf(output,"Code buffer dump(%s):\n",prefix);
   else
     fprintf(output,"Code buffer dump\n");
   fprintf(output,"Instruction count: %zu\n"
                  "Code buffer size : %zu\n",
-                 cb->ins_size,cb->pos);
-  while(pos < cb->pos){
-    uint8_t op = cb->buf[pos];
+                 cb->pos,cb->pos*sizeof(uint32_t));
+  for( pos = 0 ; pos < cb->pos ; ++pos ) {
+    int op = CodeBufferDecodeOP(cb,pos);
+    uint32_t opr = CodeBufferDecodeArg(cb,pos);
+
+    /* register instructions , show each operand */
+    if((op >= BC_ADDLL && op <= BC_RMULLN) ||
+       (op >= BC_ADDLLNN && op <= BC_RDIVLLNN) ||
+       (op >= BC_LTLNJF && op <= BC_NELLJF)) {
+      if((op >= BC_RADDLL && op <= BC_RMULLN) ||
+         (op >= BC_RADDLLNN && op <= BC_RDIVLLNN)) {
+        fprintf(output,"%zu. %zu    %10s(%u,%u,%u) @(%zu,%zu)\n",
+            pos+1,pos,BCNAMETABLE[op],BCREG3_A(opr),BCREG3_B(opr),
+            BCREG3_C(opr),cb->dbg_arr[pos].line,cb->dbg_arr[pos].ccnt);
+      } else {
+        fprintf(output,"%zu. %zu    %10s(%u,%u) @(%zu,%zu)\n",
+            pos+1,pos,BCNAMETABLE[op],BCREG2_B(opr),BCREG2_C(opr),
+            cb->dbg_arr[pos].line,cb->dbg_arr[pos].ccnt);
+      }
+      continue;
+    }
 
 #define __(A,B,C) \
     case A: \
       if(C == 1) { \
-        uint32_t opr = CodeBufferDecodeArg(cb,pos+1); \
-        fprintf(output,"%zu. %zu(4)    %10s(%d) @(%zu,%zu)\n",nins+1,pos,B,opr, \
-            cb->dbg_arr[nins].line , \
-            cb->dbg_arr[nins].ccnt); \
-        pos += 4; \
+        fprintf(output,"%zu. %zu    %10s(%d) @(%zu,%zu)\n",pos+1,pos,B,opr, \
+            cb->dbg_arr[pos].line , \
+            cb->dbg_arr[pos].ccnt); \
       }  else { \
-        fprintf(output,"%zu. %zu(1)    %10s @(%zu,%zu)\n",nins+1,pos,B,\
-            cb->dbg_arr[nins].line , \
-            cb->dbg_arr[nins].ccnt); \
-        pos += 1; \
+        fprintf(output,"%zu. %zu    %10s @(%zu,%zu)\n",pos+1,pos,B,\
+            cb->dbg_arr[pos].line , \
+            cb->dbg_arr[pos].ccnt); \
       } \
-      ++nins; break;
+      break;
 
     switch(op) {
       BYTECODE(__)
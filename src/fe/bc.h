@@ -7,23 +7,46 @@
 #include "../util.h"
 
 /* Bytecode
- * We have a *none-fixed* length bytecode configuration. Each bytecode
- * occupies one single bytes and optionally it could have a 3 bytes
- * arguments
+ * Each instruction is a 32 bits word , the opcode is in the lowest byte and
+ * the optional argument takes the other 3 bytes. So the interpreter fetches
+ * and decodes an instruction with one aligned load , and a code position
+ * ( pc , jump target , label ) is an instruction index
  *
- *     +====+
- *     | OP |
- *     +====+====================+
- *     | OP |  3 bytes arg       |
+ *     +====================+====+
+ *     |  3 bytes arg       | OP |
  *     +=========================+
  *
  * N number literal
  * S string literal
  * V variable
+ * L local variable slot , ie a register of current frame
+ *
+ * Register instructions address local variable slots directly instead of
+ * going through the stack , they pack their operands into the 3 bytes
+ * argument , see BCREG2 and BCREG3. The ones prefixed with R store the
+ * result into register A , others push the result onto the stack
  *
  */
 
 #define MAX_ARG_VALUE 0x00ffffff
+
+#define BCINS(OP,A) ((uint32_t)(OP) | ((uint32_t)(A) << 8))
+#define BCINS_OP(I) ((I) & 0xff)
+#define BCINS_A(I) ((I) >> 8)
+
+/* Operands of register instructions. Push form holds 2 operands of 12 bits
+ * and store form holds 3 operands of 8 bits , with destination at top */
+#define BCREG2_MAX 0xfff
+#define BCREG2(B,C) (((uint32_t)(B)<<12)|(uint32_t)(C))
+#define BCREG2_B(A) ((A)>>12)
+#define BCREG2_C(A) ((A)&0xfff)
+
+#define BCREG3_MAX 0xff
+#define BCREG3(A,B,C) \
+  (((uint32_t)(A)<<16)|((uint32_t)(B)<<8)|(uint32_t)(C))
+#define BCREG3_A(A) ((A)>>16)
+#define BCREG3_B(A) (((A)>>8)&0xff)
+#define BCREG3_C(A) ((A)&0xff)
 #define BCARG_NULL 0
 #define BCARG_TRUE 1
 #define BCARG_FALSE 2
@@ -151,6 +174,40 @@ extern struct CStr VARG;
   __(BC_NEVNULL,"nevnull",0) \
   __(BC_NENULLV,"nenullv",0) \
   __(BC_NEVV,"nevv",0) \
+  /* Register , push R(B) op R(C) */ \
+  __(BC_ADDLL,"addll",1) \
+  __(BC_SUBLL,"subll",1) \
+  __(BC_MULLL,"mulll",1) \
+  __(BC_DIVLL,"divll",1) \
+  __(BC_MODLL,"modll",1) \
+  __(BC_POWLL,"powll",1) \
+  __(BC_LTLL,"ltll",1) \
+  __(BC_LELL,"lell",1) \
+  __(BC_GTLL,"gtll",1) \
+  __(BC_GELL,"gell",1) \
+  __(BC_EQLL,"eqll",1) \
+  __(BC_NELL,"nell",1) \
+  /* Register , push R(B) op N(C) */ \
+  __(BC_ADDLN,"addln",1) \
+  __(BC_SUBLN,"subln",1) \
+  __(BC_MULLN,"mulln",1) \
+  __(BC_LTLN,"ltln",1) \
+  __(BC_LELN,"leln",1) \
+  __(BC_GTLN,"gtln",1) \
+  __(BC_GELN,"geln",1) \
+  __(BC_EQLN,"eqln",1) \
+  __(BC_NELN,"neln",1) \
+  /* Register , R(A) = R(B) op R(C) */ \
+  __(BC_RADDLL,"raddll",1) \
+  __(BC_RSUBLL,"rsubll",1) \
+  __(BC_RMULLL,"rmulll",1) \
+  __(BC_RDIVLL,"rdivll",1) \
+  __(BC_RMODLL,"rmodll",1) \
+  __(BC_RPOWLL,"rpowll",1) \
+  /* Register , R(A) = R(B) op N(C) */ \
+  __(BC_RADDLN,"raddln",1) \
+  __(BC_RSUBLN,"rsubln",1) \
+  __(BC_RMULLN,"rmulln",1) \
   /* Jump */ \
   __(BC_JMP,"jmp",1) \
   __(BC_JT,"jt",1) \
@@ -177,6 +234,8 @@ extern struct CStr VARG;
   __(BC_NEWM3,"newm3",0) \
   __(BC_NEWM4,"newm4",0) \
   __(BC_NEWM,"newm",1) \
+  __(BC_NEWL0S,"newl0s",1) \
+  __(BC_NEWM0S,"newm0s",1) \
   /* Attributes/Index Get */ \
   __(BC_AGETS,"agets",1) \
   __(BC_AGETN,"agetn",1) \
@@ -199,6 +258,53 @@ extern struct CStr VARG;
   __(BC_IDREFKV,"idrefkv",0) \
   __(BC_FORPREP,"forprep",1) \
   __(BC_FORLOOP,"forloop",1) \
+  /* Numeric for loop over loop() and range() , the iterator is 3 hidden \
+   * number slots ( index , end , step ) on stack top. BC_FORPREPR counts \
+   * the elements of range() and keeps its start and step below them , \
+   * see parse_for */ \
+  __(BC_FORPREPN,"forprepn",1) \
+  __(BC_FORPREPR,"forprepr",1) \
+  __(BC_FORLOOPN,"forloopn",1) \
+  /* Quickened , never emitted by parser. A generic instruction rewrites \
+   * itself into its NN variant after observing number operands */ \
+  __(BC_ADDNN,"addnn",0) \
+  __(BC_SUBNN,"subnn",0) \
+  __(BC_MULNN,"mulnn",0) \
+  __(BC_DIVNN,"divnn",0) \
+  __(BC_LTNN,"ltnn",0) \
+  __(BC_LENN,"lenn",0) \
+  __(BC_GTNN,"gtnn",0) \
+  __(BC_GENN,"genn",0) \
+  __(BC_ADDLLNN,"addllnn",1) \
+  __(BC_SUBLLNN,"subllnn",1) \
+  __(BC_MULLLNN,"mulllnn",1) \
+  __(BC_DIVLLNN,"divllnn",1) \
+  __(BC_LTLLNN,"ltllnn",1) \
+  __(BC_LELLNN,"lellnn",1) \
+  __(BC_GTLLNN,"gtllnn",1) \
+  __(BC_GELLNN,"gellnn",1) \
+  __(BC_RADDLLNN,"raddllnn",1) \
+  __(BC_RSUBLLNN,"rsubllnn",1) \
+  __(BC_RMULLLNN,"rmulllnn",1) \
+  __(BC_RDIVLLNN,"rdivllnn",1) \
+  /* Superinstructions , never emitted by parser directly. See \
+   * CodeBufferFuse and SUPERINSTRUCTION */ \
+  __(BC_POPFORLOOP,"pop_forloop",1) \
+  __(BC_POPFORLOOPN,"pop_forloopn",1) \
+  __(BC_LOADVLOADV,"loadv_loadv",1) \
+  __(BC_LOADVAGETS,"loadv_agets",1) \
+  __(BC_LTLNJF,"ltln_jf",1) \
+  __(BC_LELNJF,"leln_jf",1) \
+  __(BC_GTLNJF,"gtln_jf",1) \
+  __(BC_GELNJF,"geln_jf",1) \
+  __(BC_EQLNJF,"eqln_jf",1) \
+  __(BC_NELNJF,"neln_jf",1) \
+  __(BC_LTLLJF,"ltll_jf",1) \
+  __(BC_LELLJF,"lell_jf",1) \
+  __(BC_GTLLJF,"gtll_jf",1) \
+  __(BC_GELLJF,"gell_jf",1) \
+  __(BC_EQLLJF,"eqll_jf",1) \
+  __(BC_NELLJF,"nell_jf",1) \
   /* Stack pop */ \
   __(BC_POP,"pop",1) \
   /* Return */ \
@@ -230,7 +336,7 @@ extern struct CStr VARG;
   __(BC_LOADN3,"loadn3",0) \
   __(BC_LOADN4,"loadn4",0) \
   __(BC_LOADN5,"loadn5",0) \
-  /* JIT tag */ \
+  /* Hotness tags of loop header and function entry */ \
   __(BC_LOOP,"loop",1) \
   __(BC_CLOSURE,"closure",1) \
   /* Debug */ \
@@ -238,6 +344,30 @@ extern struct CStr VARG;
   __(BC_A,"<A>",1) \
   __(BC_NOP,"nop",0)
 
+/* Superinstruction table , ( fused , first , second ). The fused opcode
+ * replaces the first instruction of a pair and keeps its operand , while
+ * the second instruction is left as is. So the fused instruction executes
+ * both words with one dispatch , and jumping to the second one still works
+ * since it is an ordinary instruction. Pairs are picked from the dispatch
+ * profile of benchmark/ and sparrow-test/ , see make profile */
+#define SUPERINSTRUCTION(__) \
+  __(BC_POPFORLOOP,BC_POP,BC_FORLOOP) \
+  __(BC_POPFORLOOPN,BC_POP,BC_FORLOOPN) \
+  __(BC_LOADVLOADV,BC_LOADV,BC_LOADV) \
+  __(BC_LOADVAGETS,BC_LOADV,BC_AGETS) \
+  __(BC_LTLNJF,BC_LTLN,BC_JF) \
+  __(BC_LELNJF,BC_LELN,BC_JF) \
+  __(BC_GTLNJF,BC_GTLN,BC_JF) \
+  __(BC_GELNJF,BC_GELN,BC_JF) \
+  __(BC_EQLNJF,BC_EQLN,BC_JF) \
+  __(BC_NELNJF,BC_NELN,BC_JF) \
+  __(BC_LTLLJF,BC_LTLL,BC_JF) \
+  __(BC_LELLJF,BC_LELL,BC_JF) \
+  __(BC_GTLLJF,BC_GTLL,BC_JF) \
+  __(BC_GELLJF,BC_GELL,BC_JF) \
+  __(BC_EQLLJF,BC_EQLL,BC_JF) \
+  __(BC_NELLJF,BC_NELL,BC_JF)
+
 /* Intrinsic function table */
 #define INTRINSIC_FUNCTION(__) \
   __(TYPEOF,TypeOf,"typeof") \
@@ -300,6 +430,8 @@ enum Bytecode {
 #undef __
 };
 
+const char* BytecodeGetName( enum Bytecode );
+
 enum Bytecode IFuncGetBytecode( const char* name );
 const char* IFuncGetName( enum IntrinsicFunction );
 
@@ -313,49 +445,33 @@ struct InstrDebugInfo {
 };
 
 struct CodeBuffer {
-  /* Debug information */
+  /* Instruction buffer and debug information , dbg_arr[i] is the debug
+   * information of instruction buf[i] and both have cap entries */
   struct InstrDebugInfo* dbg_arr;
-  size_t dbg_size;
-  size_t dbg_cap;
-  /* Instruction buffer */
-  uint8_t* buf;
+  uint32_t* buf;
   size_t cap;
-  size_t pos;
-
-  size_t ins_size; /* Instruction size */
+  size_t pos; /* Instruction size */
 };
 
+/* Instruction index */
 struct Label {
-  size_t code_pos;
-  size_t dbg_pos;
+  size_t pos;
 };
 
 void CodeBufferInit( struct CodeBuffer* );
 void CodeBufferDestroy( struct CodeBuffer* );
 
-static SPARROW_INLINE
-void CodeBufferGetState( struct CodeBuffer* cb,
-    size_t* ins_pos,
-    size_t* dbg_pos,
-    size_t* ins_size) {
-  if(ins_pos) *ins_pos = cb->pos;
-  if(dbg_pos) *dbg_pos = cb->dbg_size;
-  if(ins_size)*ins_size= cb->ins_size;
-}
-
 #define CodeBufferPos(CB) ((CB)->pos)
 
 static SPARROW_INLINE
 struct Label CodeBufferGetLabel( struct CodeBuffer* cb ) {
-  struct Label ret = { cb->pos , cb->dbg_size };
+  struct Label ret = { cb->pos };
   return ret;
 }
 
 static SPARROW_INLINE
 void CodeBufferSetToLabel( struct CodeBuffer* cb , struct Label l ) {
-  cb->pos = l.code_pos;
-  cb->dbg_size = l.dbg_pos;
-  cb->ins_size = l.dbg_pos;
+  cb->pos = l.pos;
 }
 
 struct Label CodeBufferPutA( struct CodeBuffer* );
@@ -375,19 +491,40 @@ void CodeBufferPatchA ( struct CodeBuffer* ,
     struct Label l,
     enum Bytecode op , uint32_t A ,
     size_t line, size_t ccnt );
+/* Rewrite an already emitted A type instruction */
+void CodeBufferRepatchA( struct CodeBuffer* ,
+    struct Label l,
+    enum Bytecode op , uint32_t A );
+
+/* Peephole pass over a finished code buffer , rewrites instruction pairs
+ * listed in SUPERINSTRUCTION into their fused opcode */
+void CodeBufferFuse( struct CodeBuffer* );
+
+/* First instruction of a superinstruction , SIZE_OF_BYTECODE if op is not
+ * a superinstruction */
+static SPARROW_INLINE
+enum Bytecode BytecodeUnfuse( enum Bytecode op ) {
+  switch(op) {
+#define __(A,B,C) case A: return B;
+    SUPERINSTRUCTION(__)
+#undef __
+    default: return SIZE_OF_BYTECODE;
+  }
+}
 
 /* helper function for debugging */
 void CodeBufferDump( const struct CodeBuffer* cb ,
     FILE* output , const char* prefix );
 
-/* helper decoder for A type instructions */
+/* helper decoder for the instruction at index pos */
+static SPARROW_INLINE
+enum Bytecode CodeBufferDecodeOP( const struct CodeBuffer* b , size_t pos ) {
+  return (enum Bytecode)BCINS_OP(b->buf[pos]);
+}
+
 static SPARROW_INLINE
 uint32_t CodeBufferDecodeArg( const struct CodeBuffer* b , size_t pos ) {
-  int p = (int)pos;
-  uint8_t b1 = b->buf[p];
-  uint8_t b2 = b->buf[p+1];
-  uint8_t b3 = b->buf[p+2];
-  return b1 + (b2 << 8) + (b3 << 16);
+  return BCINS_A(b->buf[pos]);
 }
 
 #endif /* BC_H_ */
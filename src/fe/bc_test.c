@@ -51,18 +51,16 @@ static void test_bc_basic() {
       }
       i = 0;
       do {
-        uint8_t op = cb.buf[pos];
+        uint8_t op = CodeBufferDecodeOP(&cb,pos);
         assert(op == i);
         if(ARG_COUNT[op]) {
-          assert( res[i].operand == CodeBufferDecodeArg(&cb,pos+1) );
-          assert( res[i].line == cb.dbg_arr[i].line );
-          assert( res[i].ccnt == cb.dbg_arr[i].ccnt );
-          pos += 4;
+          assert( res[i].operand == CodeBufferDecodeArg(&cb,pos) );
         } else {
-          assert( res[i].line == cb.dbg_arr[i].line );
-          assert( res[i].ccnt == cb.dbg_arr[i].ccnt );
-          pos += 1;
+          assert( CodeBufferDecodeArg(&cb,pos) == 0 );
         }
+        assert( res[i].line == cb.dbg_arr[pos].line );
+        assert( res[i].ccnt == cb.dbg_arr[pos].ccnt );
+        ++pos;
         ++i;
       } while(pos < cb.pos);
     }
@@ -97,7 +97,7 @@ void Builtin_Range( struct Runtime* rt , Value* ret , int* fail ) {
     for( ; istart < iend ; istart += istep ) {
       Value ele;
       Vset_number(&ele,istart);
-      ObjListPush(list,ele);
+      ObjListPush(RTSparrow(rt),list,ele);
     }
     Vset_list(ret,list);
     *fail = 0;
@@ -286,7 +286,9 @@ static int list_push( struct Sparrow* sth ,
   l = Vget_list(&arg);
 
   for( i = 1 ; i < narg ; ++i ) {
-    ObjListPush(l,RuntimeGetArg(runtime,i));
+    Value v = RuntimeGetArg(runtime,i);
+    ObjListPush(sth,l,v);
+    GCBarrier(sth,l,v);
   }
   Vset_number(ret,narg-1);
   return 0;
@@ -297,12 +299,18 @@ static int list_extend( struct Sparrow* sth ,
     Value* ret ) {
   struct Runtime* runtime = sth->runtime;
   Value a1,a2;
+  struct ObjList* l;
+  size_t i;
   assert(Vis_udata(&obj));
   if(RuntimeCheckArg(runtime,"extend",2,ARG_LIST,ARG_LIST))
     return -1;
   a1 = RuntimeGetArg(runtime,0);
   a2 = RuntimeGetArg(runtime,1);
-  ObjListExtend(Vget_list(&a1),Vget_list(&a2));
+  l = Vget_list(&a2);
+  ObjListExtend(sth,Vget_list(&a1),l);
+  for( i = 0 ; i < l->size ; ++i ) {
+    GCBarrier(sth,Vget_list(&a1),l->arr[i]);
+  }
   Vset_null(ret);
   return 0;
 }
@@ -325,7 +333,7 @@ static int list_resize( struct Sparrow* sth ,
   }
 
   /* ignore negative size value */
-  if(size >0) ObjListResize(Vget_list(&a1),size);
+  if(size >0) ObjListResize(sth,Vget_list(&a1),size);
   Vset_number(ret,(double)size);
   return 0;
 }
@@ -335,11 +343,14 @@ static int list_pop( struct Sparrow* sth ,
     Value* ret ) {
   struct Runtime* runtime = sth->runtime;
   Value arg;
+  struct ObjList* l;
   assert(Vis_udata(&obj));
 
   if(RuntimeCheckArg(runtime,"pop",1,ARG_LIST)) return -1;
   arg = RuntimeGetArg(runtime,0);
-  ObjListPop(Vget_list(&arg));
+  l = Vget_list(&arg);
+  if(l->size) GCPreBarrier(sth,ObjListLast(l));
+  ObjListPop(l);
   Vset_null(ret);
   return 0;
 }
@@ -371,10 +382,18 @@ static int list_empty( struct Sparrow* sth,
 static int list_clear( struct Sparrow* sth , Value obj, Value* ret ) {
   struct Runtime* runtime = sth->runtime;
   Value arg;
+  struct ObjList* l;
   assert(Vis_udata(&obj));
   if(RuntimeCheckArg(runtime,"clear",1,ARG_LIST)) return -1;
   arg = RuntimeGetArg(runtime,0);
-  ObjListClear(Vget_list(&arg));
+  l = Vget_list(&arg);
+  if(SP_UNLIKELY(SparrowGCMarking(sth))) {
+    size_t i;
+    for( i = 0 ; i < l->size ; ++i ) {
+      GCPreBarrier(sth,l->arr[i]);
+    }
+  }
+  ObjListClear(l);
   Vset_null(ret);
   return 0;
 }
@@ -522,6 +541,7 @@ struct ObjUdata* GCreateStringUdata( struct Sparrow* sparrow ) {
 static int map_pop( struct Sparrow* sparrow , Value obj , Value* ret ) {
   struct Runtime* runtime = sparrow->runtime;
   Value a1,a2;
+  Value old;
   struct ObjMap* m;
   assert(Vis_udata(&obj));
   if(RuntimeCheckArg(runtime,"pop",2,ARG_MAP,ARG_STRING))
@@ -529,7 +549,12 @@ static int map_pop( struct Sparrow* sparrow , Value obj , Value* ret ) {
   a1 = RuntimeGetArg(runtime,0);
   a2 = RuntimeGetArg(runtime,1);
   m = Vget_map(&a1);
-  Vset_boolean(ret,ObjMapRemove(m,Vget_str(&a2),NULL)==0);
+  if(ObjMapRemove(sparrow,m,Vget_str(&a2),&old)==0) {
+    GCPreBarrier(sparrow,old);
+    Vset_true(ret);
+  } else {
+    Vset_false(ret);
+  }
   return 0;
 }
 
@@ -551,7 +576,8 @@ static int map_extend( struct Sparrow* sparrow , Value obj , Value* ret ) {
     Value key;
     Value val;
     oitr.deref(sparrow,&oitr,&key,&val);
-    ObjMapPut(src,Vget_str(&key),val);
+    ObjMapPut(sparrow,src,Vget_str(&key),val);
+    GCBarrier(sparrow,src,val);
     oitr.move(sparrow,&oitr);
   }
   Vset_map(ret,src);
@@ -603,10 +629,21 @@ static int map_exist( struct Sparrow* sparrow , Value obj , Value* ret ) {
 static int map_clear( struct Sparrow* sparrow , Value obj , Value* ret ) {
   struct Runtime* runtime = sparrow->runtime;
   Value a1;
+  struct ObjMap* m;
   assert(Vis_udata(&obj));
   if(RuntimeCheckArg(runtime,"clear",1,ARG_MAP)) return -1;
   a1 = RuntimeGetArg(runtime,0);
-  ObjMapClear(Vget_map(&a1));
+  m = Vget_map(&a1);
+  if(SP_UNLIKELY(SparrowGCMarking(sparrow))) {
+    /* shade all the values and hold the heap lock while the entries are
+     * wiped out , see gc.h */
+    ObjMapPreBarrier(sparrow,m);
+    GCLockHeap(sparrow);
+    ObjMapClear(m);
+    GCUnlockHeap(sparrow);
+  } else {
+    ObjMapClear(m);
+  }
   Vset_null(ret);
   return 0;
 }
@@ -711,7 +748,7 @@ static struct ObjUdata* gvar_general_create( struct Sparrow* sparrow ,
     struct ObjMethod* method = ObjNewMethodNoGC(sparrow,methods[i].ptr,
         self,methods[i].name);
     Vset_method(&v,method);
-    ObjMapPut(pri->attr,methods[i].name,v);
+    ObjMapPut(sparrow,pri->attr,methods[i].name,v);
   }
 
   udata->mops = NewMetaOps();
@@ -756,6 +793,42 @@ static int gc_attr_hook( struct Sparrow* sparrow , struct ObjUdata* udata,
   } else if(ObjStrCmpStr(key,"adjust_threshold") ==0) {
     Vset_number(ret,sparrow->gc_adjust_threshold);
     return 0;
+  } else if(ObjStrCmpStr(key,"young_sz") ==0) {
+    Vset_number(ret,sparrow->gc_young_sz);
+    return 0;
+  } else if(ObjStrCmpStr(key,"minor_generation") ==0) {
+    Vset_number(ret,sparrow->gc_minor_generation);
+    return 0;
+  } else if(ObjStrCmpStr(key,"promoted") ==0) {
+    Vset_number(ret,sparrow->gc_promoted);
+    return 0;
+  } else if(ObjStrCmpStr(key,"remember_size") ==0) {
+    Vset_number(ret,sparrow->gc_remember_size);
+    return 0;
+  } else if(ObjStrCmpStr(key,"bytes") ==0) {
+    Vset_number(ret,sparrow->gc_bytes);
+    return 0;
+  } else if(ObjStrCmpStr(key,"freed") ==0) {
+    Vset_number(ret,sparrow->gc_freed);
+    return 0;
+  } else if(ObjStrCmpStr(key,"page_size") ==0) {
+    Vset_number(ret,sparrow->gc_page_size);
+    return 0;
+  } else if(ObjStrCmpStr(key,"string_size") ==0) {
+    Vset_number(ret,sparrow->str_size);
+    return 0;
+  } else if(ObjStrCmpStr(key,"string_cap") ==0) {
+    Vset_number(ret,sparrow->str_cap);
+    return 0;
+  } else if(ObjStrCmpStr(key,"budget") ==0) {
+    Vset_number(ret,sparrow->gc_budget);
+    return 0;
+  } else if(ObjStrCmpStr(key,"phase") ==0) {
+    Vset_number(ret,sparrow->gc_phase);
+    return 0;
+  } else if(ObjStrCmpStr(key,"concurrent") ==0) {
+    Vset_boolean(ret,sparrow->gc_concurrent);
+    return 0;
   } else {
     return -1;
   }
@@ -779,6 +852,71 @@ static int gc_try( struct Sparrow* sparrow , Value obj , Value* ret ) {
   return 0;
 }
 
+/* Helpers for gc.stat , nothing is rooted while the result is built so
+ * only NoGC version of allocation can be used */
+static void stat_put( struct Sparrow* sparrow , struct ObjMap* map ,
+    const char* key , Value v ) {
+  ObjMapPut(sparrow,map,ObjNewStrNoGC(sparrow,key,strlen(key)),v);
+}
+
+static void stat_put_number( struct Sparrow* sparrow , struct ObjMap* map ,
+    const char* key , double n ) {
+  Value v;
+  Vset_number(&v,n);
+  stat_put(sparrow,map,key,v);
+}
+
+static void stat_put_hist( struct Sparrow* sparrow , struct ObjMap* map ,
+    const char* key , const size_t* hist ) {
+  struct ObjList* l = ObjNewListNoGC(sparrow,SPARROW_GC_HISTOGRAM_SIZE);
+  Value v;
+  size_t i;
+  for( i = 0 ; i < SPARROW_GC_HISTOGRAM_SIZE ; ++i ) {
+    Vset_number(&v,hist[i]);
+    ObjListPush(sparrow,l,v);
+  }
+  Vset_list(&v,l);
+  stat_put(sparrow,map,key,v);
+}
+
+/* Per type object count and bytes , pause time histograms and latest
+ * collections , see struct GCStat */
+static void stat_heap( struct Sparrow* sparrow , struct ObjMap* map ) {
+  const struct GCStat* stat = GCGetStat(sparrow);
+  const struct GCPause* p;
+  struct ObjMap* types = ObjNewMapNoGC(sparrow,16);
+  struct ObjList* history = ObjNewListNoGC(sparrow,SPARROW_GC_HISTORY_SIZE);
+  Value v;
+  size_t i;
+  for( i = 0 ; i < SIZE_OF_VALUE_TYPE ; ++i ) {
+    struct ObjMap* t = ObjNewMapNoGC(sparrow,2);
+    stat_put_number(sparrow,t,"count",stat->type_sz[i]);
+    stat_put_number(sparrow,t,"bytes",stat->type_bytes[i]);
+    Vset_map(&v,t);
+    stat_put(sparrow,types,GCTypeGetString(i),v);
+  }
+  Vset_map(&v,types);
+  stat_put(sparrow,map,"types",v);
+
+  stat_put_hist(sparrow,map,"minor_mark_hist",stat->mark_hist[GC_MINOR]);
+  stat_put_hist(sparrow,map,"minor_sweep_hist",stat->sweep_hist[GC_MINOR]);
+  stat_put_hist(sparrow,map,"major_mark_hist",stat->mark_hist[GC_MAJOR]);
+  stat_put_hist(sparrow,map,"major_sweep_hist",stat->sweep_hist[GC_MAJOR]);
+
+  /* latest collection goes first */
+  for( i = 0 ; (p = GCGetHistory(sparrow,i)) != NULL ; ++i ) {
+    struct ObjMap* t = ObjNewMapNoGC(sparrow,4);
+    Vset_boolean(&v,p->major);
+    stat_put(sparrow,t,"major",v);
+    stat_put_number(sparrow,t,"mark",p->mark);
+    stat_put_number(sparrow,t,"sweep",p->sweep);
+    Vset_map(&v,t);
+    ObjListPush(sparrow,history,v);
+  }
+  Vset_list(&v,history);
+  stat_put(sparrow,map,"history",v);
+}
+
 static int gc_stat( struct Sparrow* sparrow , Value obj , Value* ret ) {
   struct Runtime* runtime = sparrow->runtime;
   struct ObjMap* map = ObjNewMap(sparrow,16);
@@ -788,12 +926,14 @@ static int gc_stat( struct Sparrow* sparrow , Value obj , Value* ret ) {
 #define ADD(X) \
   do { \
     Vset_number(&v,sparrow->gc_##X); \
-    ObjMapPut(map,ObjNewStrNoGC(sparrow,#X,STRING_SIZE(#X)),v); \
+    ObjMapPut(sparrow,map,ObjNewStrNoGC(sparrow,#X,STRING_SIZE(#X)),v); \
   } while(0)
 
   ADD(generation);
   ADD(prevsz);
   ADD(sz);
+  ADD(bytes);
+  ADD(freed);
   ADD(active);
   ADD(inactive);
   ADD(ratio);
@@ -802,8 +942,27 @@ static int gc_stat( struct Sparrow* sparrow , Value obj , Value* ret ) {
   ADD(penalty_ratio);
   ADD(ps_threshold);
   ADD(penalty_times);
+  ADD(young_sz);
+  ADD(nursery_size);
+  ADD(promote_age);
+  ADD(minor_generation);
+  ADD(promoted);
+  ADD(remember_size);
+  ADD(budget);
+  ADD(phase);
+  ADD(page_size);
+  ADD(concurrent);
 
 #undef ADD /* ADD */
+
+  /* string pool */
+  Vset_number(&v,sparrow->str_size);
+  ObjMapPut(sparrow,map,ObjNewStrNoGC(sparrow,"string_size",
+        STRING_SIZE("string_size")),v);
+  Vset_number(&v,sparrow->str_cap);
+  ObjMapPut(sparrow,map,ObjNewStrNoGC(sparrow,"string_cap",
+        STRING_SIZE("string_cap")),v);
+  stat_heap(sparrow,map);
   Vset_map(ret,map);
   return 0;
 }
@@ -814,6 +973,8 @@ static int gc_config( struct Sparrow* sparrow , Value obj , Value* ret ) {
   Value v_ratio;
   Value v_threshold;
   Value v_penalty_ratio;
+  Value v_budget;
+  Value v_concurrent;
   Value arg;
   size_t threshold= 0;
   float ratio = 0.0f;
@@ -842,13 +1003,49 @@ static int gc_config( struct Sparrow* sparrow , Value obj , Value* ret ) {
     }
   }
 
+  /* Budget of incremental GC step , 0 turns incremental GC off */
+  if(ObjMapFindStr(sparrow,m,"budget",&v_budget)==0) {
+    if(Vis_number(&v_budget)) {
+      double n = Vget_number(&v_budget);
+      if(n>=0 && n < SPARROW_SIZE_MAX) sparrow->gc_budget = (size_t)n;
+    }
+  }
+
+  /* Only takes effect when concurrent GC is compiled in , and from the
+   * next major GC */
+  if(ObjMapFindStr(sparrow,m,"concurrent",&v_concurrent)==0) {
+    if(Vis_boolean(&v_concurrent)) {
+#ifdef SPARROW_GC_CONCURRENT
+      sparrow->gc_concurrent = Vis_true(&v_concurrent);
+#endif /* SPARROW_GC_CONCURRENT */
+    }
+  }
+
   SparrowGCConfig(sparrow,threshold,ratio,penalty_ratio);
   Vset_null(ret);
   return 0;
 }
 
+/* Write a heap snapshot into the file , return false if it fails */
+static int gc_dump( struct Sparrow* sparrow , Value obj , Value* ret ) {
+  struct Runtime* runtime = sparrow->runtime;
+  Value arg;
+  FILE* file;
+  int ok = 0;
+  assert(Vis_udata(&obj));
+  if(RuntimeCheckArg(runtime,"dump",1,ARG_STRING)) return -1;
+  arg = RuntimeGetArg(runtime,0);
+  file = fopen(Vget_str(&arg)->str,"wb");
+  if(file) {
+    ok = GCDumpHeap(sparrow,file) == 0;
+    ok = (fclose(file) == 0) && ok;
+  }
+  Vset_boolean(ret,ok);
+  return 0;
+}
+
 struct ObjUdata* GCreateGCUdata( struct Sparrow* sparrow ) {
-  struct cmethod_ptr methods[4];
+  struct cmethod_ptr methods[5];
 #define STRING_LEN(X) (X), STRING_SIZE((X))
 
   methods[0].ptr = gc_try;
@@ -859,7 +1056,9 @@ struct ObjUdata* GCreateGCUdata( struct Sparrow* sparrow ) {
   methods[2].name = ObjNewStrNoGC(sparrow,STRING_LEN("stat"));
   methods[3].ptr = gc_config;
   methods[3].name = ObjNewStrNoGC(sparrow,STRING_LEN("config"));
+  methods[4].ptr = gc_dump;
+  methods[4].name = ObjNewStrNoGC(sparrow,STRING_LEN("dump"));
 
 #undef STRING_LEN /* STRING_LEN */
-  return gvar_general_create(sparrow,"gc",gc_attr_hook,methods,4);
+  return gvar_general_create(sparrow,"gc",gc_attr_hook,methods,5);
 }
@@ -3,12 +3,25 @@
 #include "list.h"
 #include "map.h"
 #include "vm.h"
+#include "jit.h"
+#include <time.h>
 
-static void destroy_proto( struct ObjProto* cls ) {
+static void destroy_proto( struct Sparrow* sth , struct ObjProto* cls ) {
+#ifdef SPARROW_JIT
+  JitFree(sth,cls);
+#else
+  (void)sth;
+#endif /* SPARROW_JIT */
   CodeBufferDestroy(&(cls->code_buf));
   free(cls->num_arr);
   free(cls->str_arr);
   free(cls->uv_arr);
+  free(cls->scratch_arr);
+  free(cls->ic_arr);
+  free(cls->cell_arr);
+  free(cls->dcode);
+  free(cls->fb_arr);
+  free(cls->fb_idx);
   CStrDestroy(&(cls->proto));
   cls->num_arr = NULL;
   cls->num_size = cls->num_cap = 0;
@@ -16,29 +29,309 @@ static void destroy_proto( struct ObjProto* cls ) {
   cls->str_size = cls->str_cap = 0;
   cls->uv_arr = NULL;
   cls->uv_size = cls->uv_cap = 0;
+  cls->scratch_arr = NULL;
+  cls->scratch_size = cls->scratch_cap = 0;
+  cls->ic_arr = NULL;
+  cls->ic_size = cls->ic_cap = 0;
+  cls->cell_arr = NULL;
+  cls->cell_size = cls->cell_cap = 0;
+  cls->dcode = NULL;
+  cls->fb_arr = NULL;
+  cls->fb_size = 0;
+  cls->fb_idx = NULL;
+}
+
+/* Slab allocator.
+ *
+ * Small objects are allocated from pages of fixed size. Each page only
+ * holds objects of one size class so a slot can be reused by any object
+ * that falls into the same class. Pages are aligned to their size , so
+ * the page header can be found from an object pointer by masking. A page
+ * hands out slots from its free list first and then from its bump pointer.
+ * Only pages that still have free slot are linked into gc_page , a full
+ * page is unlinked and gets linked back once a slot is freed. Every page
+ * is also linked into gc_page_all which is what the sweeper walks.
+ *
+ * The GC states that are visited by sweeping are kept in bitmaps inside
+ * of the page header instead of the objects , one bit for every
+ * GC_SIZE_CLASS_STEP bytes of the page. alloc tells which slots hold an
+ * object , old tells which of them are in the old generation and mark is
+ * the mark bit. Sweeping a page is then a few bitwise operations per 64
+ * slots and only the objects that die or survive a minor GC are touched.
+ *
+ * Objects larger than the biggest class go to malloc directly , they are
+ * prefixed with struct GCLarge which holds their mark bit and links them
+ * into the list of their generation */
+#define PAGE_BITS (SPARROW_GC_PAGE_SIZE/GC_SIZE_CLASS_STEP)
+#define PAGE_WORDS ((PAGE_BITS+63)/64)
+
+struct GCPage {
+  struct GCPage* prev;
+  struct GCPage* next;
+  struct GCPage* link; /* Next page in gc_page_all */
+  void* free;          /* Freed slots list , linked by the first word */
+  char* bump;          /* Start of slots never used */
+  char* end;
+  size_t slot;         /* Slot size in bytes */
+  size_t used;         /* Number of slots in use */
+  size_t young;        /* Number of young objects */
+  int cls;
+  int linked;          /* Whether page is inside of gc_page list */
+  uint64_t alloc[PAGE_WORDS];
+  uint64_t old[PAGE_WORDS];
+  GCBits mark[PAGE_WORDS];
+};
+
+struct GCLarge {
+  struct GCLarge* next;
+  size_t size;         /* Bytes including this header */
+  GCBits mark;
+};
+
+#define PAGE_HEADER_SIZE \
+  ((sizeof(struct GCPage)+GC_SIZE_CLASS_STEP-1)&~(GC_SIZE_CLASS_STEP-1))
+
+#define obj2page(OBJ) \
+  ((struct GCPage*)((uintptr_t)(OBJ) & ~((uintptr_t)SPARROW_GC_PAGE_SIZE-1)))
+
+#define obj2large(OBJ) ((struct GCLarge*)(OBJ) - 1)
+
+/* Bit of a slot inside of the page bitmaps */
+#define page_bit(PAGE,OBJ) \
+  ((size_t)((char*)(OBJ) - (char*)(PAGE)) / GC_SIZE_CLASS_STEP)
+
+#define page_object(PAGE,BIT) \
+  ((struct GCRef*)((char*)(PAGE) + (BIT) * GC_SIZE_CLASS_STEP))
+
+/* Number of bitmap words that cover the slots handed out so far */
+#define page_words(PAGE) \
+  ((page_bit(PAGE,(PAGE)->bump) + 63) / 64)
+
+#define bit_word(BIT) ((BIT) >> 6)
+#define bit_mask(BIT) ((uint64_t)1 << ((BIT) & 63))
+
+/* Mark bitmap words. The marker thread sets them while the interpreter
+ * peeks at them , see gc.h. Relaxed order is enough , the heap lock orders
+ * everything else the two threads share */
+#ifdef SPARROW_GC_CONCURRENT
+#define bits_get(W) atomic_load_explicit(&(W),memory_order_relaxed)
+#define bits_set(W,M) atomic_fetch_or_explicit(&(W),(M),memory_order_relaxed)
+#define bits_clear(W,M) \
+  atomic_fetch_and_explicit(&(W),~(M),memory_order_relaxed)
+#define bits_reset(W) atomic_store_explicit(&(W),0,memory_order_relaxed)
+#else
+#define bits_get(W) (W)
+#define bits_set(W,M) ((W) |= (M))
+#define bits_clear(W,M) ((W) &= ~(M))
+#define bits_reset(W) ((W) = 0)
+#endif /* SPARROW_GC_CONCURRENT */
+
+static void page_link( struct Sparrow* sparrow , struct GCPage* page ) {
+  page->prev = NULL;
+  page->next = sparrow->gc_page[page->cls];
+  if(page->next) page->next->prev = page;
+  sparrow->gc_page[page->cls] = page;
+  page->linked = 1;
+}
+
+static void page_unlink( struct Sparrow* sparrow , struct GCPage* page ) {
+  if(page->prev) page->prev->next = page->next;
+  else sparrow->gc_page[page->cls] = page->next;
+  if(page->next) page->next->prev = page->prev;
+  page->prev = page->next = NULL;
+  page->linked = 0;
+}
+
+static struct GCPage* page_new( struct Sparrow* sparrow , int cls ) {
+  struct GCPage* page = aligned_alloc(SPARROW_GC_PAGE_SIZE,
+      SPARROW_GC_PAGE_SIZE);
+  size_t i;
+  if(!page) {
+    fprintf(stderr,"Out of memory when allocating GC page!");
+    abort();
+  }
+  page->free = NULL;
+  page->bump = (char*)page + PAGE_HEADER_SIZE;
+  page->end = (char*)page + SPARROW_GC_PAGE_SIZE;
+  page->slot = (size_t)(cls+1)*GC_SIZE_CLASS_STEP;
+  page->used = 0;
+  page->young = 0;
+  page->cls = cls;
+  for( i = 0 ; i < PAGE_WORDS ; ++i ) {
+    page->alloc[i] = 0;
+    page->old[i] = 0;
+    bits_reset(page->mark[i]);
+  }
+  page_link(sparrow,page);
+  page->link = sparrow->gc_page_all;
+  sparrow->gc_page_all = page;
+  ++sparrow->gc_page_size;
+  return page;
+}
+
+/* An empty page is released by the sweeper , unless it is the only page
+ * of its class left. This avoids allocating and releasing pages again and
+ * again when a class hovers around a page boundary */
+static SPARROW_INLINE
+int page_empty( struct GCPage* page ) {
+  return page->used == 0 && (page->prev || page->next);
+}
+
+/* The caller unlinks the page from gc_page_all */
+static void page_release( struct Sparrow* sparrow , struct GCPage* page ) {
+  page_unlink(sparrow,page);
+  free(page);
+  --sparrow->gc_page_size;
+}
+
+void* GCAlloc( struct Sparrow* sparrow , size_t size ) {
+  struct GCRef* ref;
+  struct GCLarge* large;
+#ifndef SPARROW_GC_NO_SLAB
+  if(SP_LIKELY(size <= GC_SIZE_CLASS_STEP*GC_SIZE_CLASS_SIZE)) {
+    int cls = (int)((size+GC_SIZE_CLASS_STEP-1)/GC_SIZE_CLASS_STEP) - 1;
+    struct GCPage* page = sparrow->gc_page[cls];
+    if(SP_UNLIKELY(!page)) page = page_new(sparrow,cls);
+    if(page->free) {
+      ref = page->free;
+      page->free = *(void**)ref;
+    } else {
+      ref = (struct GCRef*)page->bump;
+      page->bump += page->slot;
+    }
+    ++page->used;
+    if(!page->free && page->bump + page->slot > page->end)
+      page_unlink(sparrow,page);
+    ref->gc_kind = GC_KIND_SLAB;
+    sparrow->gc_bytes += page->slot;
+    return ref;
+  }
+#endif /* SPARROW_GC_NO_SLAB */
+  size += sizeof(struct GCLarge);
+  large = malloc(size);
+  large->size = size;
+  bits_reset(large->mark);
+  ref = (struct GCRef*)(large + 1);
+  ref->gc_kind = GC_KIND_LARGE;
+  sparrow->gc_bytes += size;
+  return ref;
+}
+
+/* Mark bit of an object , the global environment is the only static
+ * object and its mark bit lives in Sparrow */
+static SPARROW_INLINE
+GCBits* mark_word( struct Sparrow* sparrow , struct GCRef* ref ,
+    uint64_t* mask ) {
+  if(SP_LIKELY(ref->gc_kind == GC_KIND_SLAB)) {
+    struct GCPage* page = obj2page(ref);
+    size_t bit = page_bit(page,ref);
+    *mask = bit_mask(bit);
+    return page->mark + bit_word(bit);
+  }
+  *mask = 1;
+  return ref->gc_kind == GC_KIND_LARGE ? &(obj2large(ref)->mark) :
+    &(sparrow->gc_env_mark);
+}
+
+static SPARROW_INLINE
+int is_marked( struct Sparrow* sparrow , struct GCRef* ref ) {
+  uint64_t mask;
+  GCBits* w = mark_word(sparrow,ref,&mask);
+  return (bits_get(*w) & mask) != 0;
+}
+
+static SPARROW_INLINE
+void set_mark( struct Sparrow* sparrow , struct GCRef* ref ) {
+  uint64_t mask;
+  GCBits* w = mark_word(sparrow,ref,&mask);
+  bits_set(*w,mask);
+}
+
+static SPARROW_INLINE
+void clear_mark( struct Sparrow* sparrow , struct GCRef* ref ) {
+  uint64_t mask;
+  GCBits* w = mark_word(sparrow,ref,&mask);
+  bits_clear(*w,mask);
+}
+
+int GCIsMarked( struct Sparrow* sparrow , struct GCRef* ref ) {
+  return is_marked(sparrow,ref);
+}
+
+void GCAddObject( struct Sparrow* sparrow , struct GCRef* ref , int old ) {
+  ref->gc_old = old;
+  ref->gc_remember = 0;
+  ref->gc_age = 0;
+  if(ref->gc_kind == GC_KIND_SLAB) {
+    struct GCPage* page = obj2page(ref);
+    size_t bit = page_bit(page,ref);
+    page->alloc[bit_word(bit)] |= bit_mask(bit);
+    if(old) page->old[bit_word(bit)] |= bit_mask(bit);
+    else ++page->young;
+  } else {
+    struct GCLarge* large = obj2large(ref);
+    struct GCLarge** list = old ? &(sparrow->gc_large_old) :
+      &(sparrow->gc_large_young);
+    large->next = *list;
+    *list = large;
+  }
+  if(old || SparrowGCMarking(sparrow)) set_mark(sparrow,ref);
+  ++sparrow->gc_sz;
+}
+
+size_t GCObjectSize( struct GCRef* ref ) {
+  switch(ref->gc_kind) {
+    case GC_KIND_SLAB: return obj2page(ref)->slot;
+    case GC_KIND_LARGE: return obj2large(ref)->size;
+    default: return 0;
+  }
+}
+
+/* A large object must have been unlinked from its list , and a page that
+ * becomes empty is left to the sweeper , see page_release */
+void GCFree( struct Sparrow* sparrow , struct GCRef* ref ) {
+  struct GCPage* page;
+  size_t bit;
+  --sparrow->gc_stat.type_sz[ref->gtype];
+  sparrow->gc_stat.type_bytes[ref->gtype] -= GCObjectSize(ref);
+  if(ref->gc_kind == GC_KIND_LARGE) {
+    struct GCLarge* large = obj2large(ref);
+    sparrow->gc_bytes -= large->size;
+    free(large);
+    return;
+  }
+  page = obj2page(ref);
+  bit = page_bit(page,ref);
+  page->alloc[bit_word(bit)] &= ~bit_mask(bit);
+  page->old[bit_word(bit)] &= ~bit_mask(bit);
+  bits_clear(page->mark[bit_word(bit)],bit_mask(bit));
+  if(!ref->gc_old) --page->young;
+  sparrow->gc_bytes -= page->slot;
+  *(void**)ref = page->free;
+  page->free = ref;
+  --page->used;
+  if(!page->linked) page_link(sparrow,page);
 }
 
 /* Real routine that *deletes* resource based on GC object's type */
 void GCFinalizeObj( struct Sparrow* sth, struct GCRef* obj ) {
-  UNUSE_ARG(sth);
   switch(obj->gtype) {
-    case VALUE_STRING:
-      free(obj);
-      break;
     case VALUE_LIST:
-      ObjListDestroy(gc2obj(obj,struct ObjList));
-      free(obj);
+      {
+        struct ObjList* list = gc2obj(obj,struct ObjList);
+        sth->gc_bytes -= list->cap * sizeof(Value);
+        ObjListDestroy(list);
+      }
       break;
     case VALUE_MAP:
-      ObjMapDestroy(gc2obj(obj,struct ObjMap));
-      free(obj);
+      {
+        struct ObjMap* map = gc2obj(obj,struct ObjMap);
+        sth->gc_bytes -= ObjMapBytes(map);
+        ObjMapDestroy(map);
+      }
       break;
     case VALUE_PROTO:
-      destroy_proto(gc2obj(obj,struct ObjProto));
-      free(obj);
-      break;
-    case VALUE_METHOD:
-      free(obj);
+      destroy_proto(sth,gc2obj(obj,struct ObjProto));
       break;
     case VALUE_UDATA:
       {
@@ -46,44 +339,152 @@ void GCFinalizeObj( struct Sparrow* sth, struct GCRef* obj ) {
         CStrDestroy(&(udata->name));
         if(udata->destroy) udata->destroy(udata->udata);
         free(udata->mops);
-        free(obj);
       }
       break;
     case VALUE_ITERATOR:
       {
         struct ObjIterator* itr = gc2obj(obj,struct ObjIterator);
         if(itr->destroy) itr->destroy(itr->u.ptr);
-        free(obj);
       }
       break;
     case VALUE_MODULE:
       ObjDestroyModule(gc2obj(obj,struct ObjModule));
-      free(obj);
       break;
+    case VALUE_STRING:
+    case VALUE_METHOD:
     case VALUE_COMPONENT:
-      free(obj);
-      break;
     case VALUE_CLOSURE:
-      free(obj);
-      break;
     case VALUE_LOOP:
-      free(obj);
-      break;
     case VALUE_LOOP_ITERATOR:
-      free(obj);
       break;
     default:
       assert(!"unreachable!");
       break;
   }
+  GCFree(sth,obj);
+}
+
+/* Call fn on every object of the heap , fn may free the object */
+static void heap_foreach( struct Sparrow* sparrow ,
+    void (*fn)( struct Sparrow* , struct GCRef* ) ) {
+  struct GCPage* page;
+  struct GCLarge* large;
+  struct GCLarge* next;
+  size_t w;
+  for( page = sparrow->gc_page_all ; page ; page = page->link ) {
+    const size_t words = page_words(page);
+    for( w = 0 ; w < words ; ++w ) {
+      uint64_t alloc = page->alloc[w];
+      while(alloc) {
+        struct GCRef* ref = page_object(page,w * 64 + SP_CTZ64(alloc));
+        alloc &= alloc - 1;
+        fn(sparrow,ref);
+      }
+    }
+  }
+  for( large = sparrow->gc_large_young ; large ; large = next ) {
+    next = large->next;
+    fn(sparrow,(struct GCRef*)(large + 1));
+  }
+  for( large = sparrow->gc_large_old ; large ; large = next ) {
+    next = large->next;
+    fn(sparrow,(struct GCRef*)(large + 1));
+  }
 }
 
-/* Mark phase */
-#define gcstate(OBJ) ((OBJ)->gc.gc_state)
-#define gcmarked(OBJ) (gcstate(OBJ) == GC_MARKED)
+void GCDestroyHeap( struct Sparrow* sparrow ) {
+  struct GCPage* page = sparrow->gc_page_all;
+  heap_foreach(sparrow,GCFinalizeObj);
+  while(page) {
+    struct GCPage* next = page->link;
+    assert(page->used == 0);
+    free(page);
+    page = next;
+  }
+  memset(sparrow->gc_page,0,sizeof(sparrow->gc_page));
+  sparrow->gc_page_all = NULL;
+  sparrow->gc_page_size = 0;
+  sparrow->gc_large_young = NULL;
+  sparrow->gc_large_old = NULL;
+  sparrow->gc_sz = 0;
+  sparrow->gc_young_sz = 0;
+}
+
+/* Mark phase.
+ *
+ * We use tri-color marking. A white object is unmarked , a gray object is
+ * marked but still sits inside of the gray stack waiting for its children
+ * to be scanned and a black object is marked and scanned. The GCMarkXXX
+ * routines only shade an object gray , the real work is done when the gray
+ * stack is drained which can be done in several steps for incremental GC.
+ *
+ * Old objects stay marked between major GCs , a major GC clears all the
+ * mark bitmaps when it starts and a minor GC clears the mark bits of the
+ * survivors of nursery. The Sparrow of current collection is cached here
+ * since the mark routines don't know which Sparrow they work on , it is
+ * only valid during a collection , see gc_enter */
+static struct Sparrow* gc_sparrow = NULL;
+
+#define gcmarked(OBJ) is_marked(gc_sparrow,obj2gc(OBJ))
 #define gcunmarked(OBJ) (!gcmarked(OBJ))
-#define gcsetmark(OBJ) (gcstate(OBJ) = GC_MARKED)
-#define gcsetunmark(OBJ) (gcstate(OBJ) = GC_UNMARKED)
+#define gcsetmark(OBJ) set_mark(gc_sparrow,obj2gc(OBJ))
+
+static SPARROW_INLINE
+void gc_enter( struct Sparrow* sparrow ) {
+  gc_sparrow = sparrow;
+}
+
+static void gray_grow( struct Sparrow* sparrow ) {
+  /* Cannot use DynArrPush since MemGrow has a capacity limitation */
+  size_t ncap = sparrow->gc_gray_cap == 0 ? 64 : 2 * sparrow->gc_gray_cap;
+  sparrow->gc_gray_arr = realloc(sparrow->gc_gray_arr,
+      ncap*sizeof(struct GCRef*));
+  sparrow->gc_gray_cap = ncap;
+}
+
+static SPARROW_INLINE
+void gray_push( struct GCRef* ref ) {
+  struct Sparrow* sparrow = gc_sparrow;
+  if(SP_UNLIKELY(sparrow->gc_gray_size == sparrow->gc_gray_cap))
+    gray_grow(sparrow);
+  sparrow->gc_gray_arr[sparrow->gc_gray_size++] = ref;
+}
+
+/* Heap snapshot , see GCDumpHeap. While dumping , the mark routines don't
+ * mark anything but report each reference to the snapshot , so it sees
+ * exactly what a major GC sees , including references reported by the
+ * mark function of user data. gc_dump_from is the object being scanned ,
+ * NULL means a root of kind gc_dump_root */
+static FILE* gc_dump = NULL;
+static struct GCRef* gc_dump_from = NULL;
+static int gc_dump_root = 0;
+
+#define gcdumping() SP_UNLIKELY(gc_dump != NULL)
+
+static void dump_u64( uint64_t v ) {
+  fwrite(&v,sizeof(v),1,gc_dump);
+}
+
+static void dump_ref( const void* obj ) {
+  if(gc_dump_from) {
+    fputc(GC_DUMP_EDGE,gc_dump);
+    dump_u64((uintptr_t)gc_dump_from);
+  } else {
+    fputc(GC_DUMP_ROOT,gc_dump);
+    fputc(gc_dump_root,gc_dump);
+  }
+  dump_u64((uintptr_t)obj);
+}
+
+#define gcshade(OBJ) \
+  do { \
+    if(gcdumping()) { \
+      dump_ref(OBJ); \
+    } else if(gcunmarked(OBJ)) { \
+      gcsetmark(OBJ); \
+      gray_push(obj2gc(OBJ)); \
+    } \
+  } while(0)
 
 static void mark_mops( struct MetaOps* mops ) {
 #define __(A,B,C) GCMark(mops->hook_##B);
@@ -92,131 +493,646 @@ static void mark_mops( struct MetaOps* mops ) {
 }
 
 SPARROW_INLINE void GCMarkString( struct ObjStr* str ) {
-  if(gcunmarked(str)) {
+  if(gcdumping()) {
+    dump_ref(str);
+  } else if(gcunmarked(str)) {
     gcsetmark(str);
   }
 }
 
+/* Empty container has nothing to scan , so it is turned into black
+ * directly. It saves another trip to the object when draining the gray
+ * stack , which is a cache miss for the large amount of small objects */
 void GCMarkList( struct ObjList* list ) {
-  if(gcunmarked(list)) {
-    size_t i;
+  if(list->size == 0 && !gcdumping()) {
     gcsetmark(list);
-    for( i = 0 ; i < list->size ; ++i ) {
-      GCMark(list->arr[i]);
-    }
+  } else {
+    gcshade(list);
   }
 }
 
 void GCMarkMap( struct ObjMap* map ) {
-  if(gcunmarked(map)) {
-    size_t i;
+  if(map->size == 0 && map->mops == NULL && !gcdumping()) {
     gcsetmark(map);
-    for( i = 0 ; i < map->cap ; ++i ) {
-      struct ObjMapEntry* e = map->entry + i;
-      if(!e->used || e->del) continue;
-      GCMark(e->value);
-      GCMarkString( e->key );
-    }
-    if(map->mops) mark_mops(map->mops);
+  } else {
+    gcshade(map);
   }
 }
 
 void GCMarkMethod( struct ObjMethod* method ) {
-  if(gcunmarked(method)) {
-    method->gc.gc_state = GC_MARKED;
-    GCMark( method->object );
-    GCMarkString(method->name);
-  }
+  gcshade(method);
 }
 
 void GCMarkUdata( struct ObjUdata* udata ) {
-  if(gcunmarked(udata)) {
-    if(udata->mark) udata->mark(udata);
-    udata->gc.gc_state = GC_MARKED;
-    if(udata->mops) mark_mops(udata->mops);
-  }
+  gcshade(udata);
 }
 
 void GCMarkIter( struct ObjIterator* itr ) {
-  if(gcunmarked(itr)) {
-    gcsetmark(itr);
-    GCMark(itr->obj);
-  }
+  gcshade(itr);
 }
 
 void GCMarkProto( struct ObjProto* proto ) {
-  if(gcunmarked(proto)) {
-    size_t i;
-    gcsetmark(proto);
-    for(i = 0 ; i < proto->str_size ; ++i) {
-      GCMarkString(proto->str_arr[i]);
+  gcshade(proto);
+}
+
+void GCMarkClosure( struct ObjClosure* closure ) {
+  gcshade(closure);
+}
+
+void GCMarkModule( struct ObjModule* module ) {
+  gcshade(module);
+}
+
+void GCMarkComponent(
+    struct ObjComponent* component ) {
+  gcshade(component);
+}
+
+/* Only containers go through the gray stack. Leaf objects are turned
+ * into black directly , and an object that is already marked is skipped
+ * before looking at its type */
+void GCMark( Value v ) {
+  struct GCRef* ref;
+  if(!Vis_gcobject(&v)) return;
+  ref = Vget_gcobject(&v);
+  if(gcdumping()) {
+    dump_ref(ref);
+    return;
+  }
+  if(is_marked(gc_sparrow,ref)) return;
+  switch(ref->gtype) {
+    case VALUE_STRING:
+    case VALUE_LOOP:
+      set_mark(gc_sparrow,ref);
+      break;
+    case VALUE_LOOP_ITERATOR:
+      set_mark(gc_sparrow,ref);
+      gcsetmark(gc2obj(ref,struct ObjLoopIterator)->loop);
+      break;
+    case VALUE_LIST:
+      GCMarkList(gc2obj(ref,struct ObjList));
+      break;
+    case VALUE_MAP:
+      GCMarkMap(gc2obj(ref,struct ObjMap));
+      break;
+    default:
+      set_mark(gc_sparrow,ref);
+      gray_push(ref);
+      break;
+  }
+}
+
+/* Shape tree.
+ *
+ * Shapes are not GC objects , but a shape keeps raw pointers to its keys ,
+ * and maps , inline caches and feedback keep raw pointers to shapes. Major
+ * GC stamps the shape of each live record map and the shapes cached or
+ * recorded by each live proto with the epoch of the cycle , and marks their
+ * keys. A map , an inline cache or a feedback slot that starts using a
+ * shape during marking stamps it by GCMarkShape. Once marking is done , the
+ * ancestors of a stamped shape are stamped as well and the subtrees without
+ * any stamped shape are freed. The root is never freed. Minor GC and heap
+ * dump don't stamp shapes */
+#define shape_epoch(SP) ((SP)->gc_generation + 1)
+
+#define shape_marking(SP) \
+  ((SP)->gc_phase == GC_PHASE_MARK && !gcdumping())
+
+static SPARROW_INLINE
+void mark_shape( struct Sparrow* sparrow , struct Shape* shape ) {
+  size_t i;
+  if(shape->mark == shape_epoch(sparrow)) return;
+  shape->mark = shape_epoch(sparrow);
+  for( i = 0 ; i < shape->size ; ++i ) GCMarkString(shape->keys[i]);
+}
+
+void GCMarkShape( struct Sparrow* sparrow , struct Shape* shape ) {
+  assert(sparrow->gc_phase == GC_PHASE_MARK);
+  gc_enter(sparrow);
+  mark_shape(sparrow,shape);
+}
+
+/* Shapes cached by inline caches and recorded by feedback of a proto. They
+ * are compared by pointer and a proto holds a bounded number of them */
+static void mark_proto_shape( struct Sparrow* sparrow ,
+    struct ObjProto* proto ) {
+  size_t i;
+  uint32_t j;
+  for( i = 0 ; i < proto->ic_size ; ++i ) {
+    const struct InlineCache* ic = proto->ic_arr + i;
+    if(ic->size == IC_MEGAMORPHIC) continue;
+    for( j = 0 ; j < ic->size ; ++j ) {
+      if(ic->shape[j]) mark_shape(sparrow,(struct Shape*)ic->shape[j]);
+    }
+  }
+  for( i = 0 ; i < proto->fb_size ; ++i ) {
+    const struct FeedbackSlot* slot = proto->fb_arr + i;
+    if((slot->kind != FEEDBACK_ATTR && slot->kind != FEEDBACK_INDEX) ||
+       slot->target_size == FEEDBACK_MEGAMORPHIC) continue;
+    for( j = 0 ; j < slot->target_size ; ++j ) {
+      mark_shape(sparrow,(struct Shape*)slot->target[j]);
     }
-    GCMarkModule(proto->module);
   }
 }
 
-void GCMarkClosure( struct ObjClosure* closure ) {
-  if(gcunmarked(closure)) {
-    size_t i;
-    const size_t usize = closure->proto->uv_size;
-    gcsetmark(closure);
-    GCMarkProto(closure->proto);
-    for( i = 0 ; i < usize ; ++i ) {
-      GCMark(closure->upval[i]);
+/* Stamp the ancestors of stamped shapes , return 1 if SHAPE is stamped */
+static int mark_shape_path( size_t epoch , struct Shape* shape ) {
+  struct Shape* c;
+  int marked = shape->mark == epoch;
+  for( c = shape->child ; c ; c = c->sibling ) {
+    if(mark_shape_path(epoch,c)) marked = 1;
+  }
+  if(marked) shape->mark = epoch;
+  return marked;
+}
+
+/* Free the transitions that are not stamped , return number of shapes
+ * freed */
+static size_t prune_shape( size_t epoch , struct Shape* shape ) {
+  struct Shape** prev = &(shape->child);
+  struct Shape* c;
+  size_t n = 0;
+  while((c = *prev)) {
+    if(c->mark == epoch) {
+      n += prune_shape(epoch,c);
+      prev = &(c->sibling);
+    } else {
+      *prev = c->sibling;
+      n += ShapeDestroy(c);
     }
   }
+  return n;
 }
 
-void GCMarkModule( struct ObjModule* module ) {
-  if(gcunmarked(module)) {
-    size_t i;
-    gcsetmark(module);
-    for( i = 0 ; i < module->cls_size ; ++i ) {
-      GCMarkProto(module->cls_arr[i]);
+/* Children of a container are prefetched this many slots ahead of the
+ * one being marked , GCMark has to read each child's header */
+#define PREFETCH_DISTANCE 8
+
+static SPARROW_INLINE void prefetch_value( Value v ) {
+  if(Vis_gcobject(&v)) SP_PREFETCH(Vget_gcobject(&v));
+}
+
+/* Scan a gray object's children and turn it into black */
+static void scan_object( struct GCRef* ref ) {
+  size_t i;
+  switch(ref->gtype) {
+    case VALUE_LIST:
+      {
+        struct ObjList* list = gc2obj(ref,struct ObjList);
+        for( i = 0 ; i < list->size ; ++i ) {
+          if(i + PREFETCH_DISTANCE < list->size)
+            prefetch_value(list->arr[i+PREFETCH_DISTANCE]);
+          GCMark(list->arr[i]);
+        }
+      }
+      break;
+    case VALUE_MAP:
+      {
+        struct ObjMap* map = gc2obj(ref,struct ObjMap);
+        if(map->shape) {
+          /* record , keys are kept alive by the map */
+          if(shape_marking(gc_sparrow)) mark_shape(gc_sparrow,map->shape);
+          for( i = 0 ; i < map->size ; ++i ) {
+            GCMark(map->slot[i]);
+            GCMarkString(map->shape->keys[i]);
+          }
+        } else {
+          for( i = 0 ; i < map->cap ; ++i ) {
+            struct ObjMapEntry* e = map->entry + i;
+            if(i + PREFETCH_DISTANCE < map->cap) {
+              struct ObjMapEntry* n = e + PREFETCH_DISTANCE;
+              if(n->used && !n->del) {
+                prefetch_value(n->value);
+                SP_PREFETCH(n->key);
+              }
+            }
+            if(!e->used || e->del) continue;
+            GCMark(e->value);
+            GCMarkString( e->key );
+          }
+        }
+        if(map->mops) mark_mops(map->mops);
+      }
+      break;
+    case VALUE_METHOD:
+      {
+        struct ObjMethod* method = gc2obj(ref,struct ObjMethod);
+        GCMark( method->object );
+        GCMarkString(method->name);
+      }
+      break;
+    case VALUE_UDATA:
+      {
+        struct ObjUdata* udata = gc2obj(ref,struct ObjUdata);
+        if(udata->mark) udata->mark(udata);
+        if(udata->mops) mark_mops(udata->mops);
+      }
+      break;
+    case VALUE_ITERATOR:
+      GCMark(gc2obj(ref,struct ObjIterator)->obj);
+      break;
+    case VALUE_PROTO:
+      {
+        struct ObjProto* proto = gc2obj(ref,struct ObjProto);
+        for(i = 0 ; i < proto->str_size ; ++i) {
+          GCMarkString(proto->str_arr[i]);
+        }
+        for(i = 0 ; i < proto->scratch_size ; ++i) {
+          GCMark(proto->scratch_arr[i].obj);
+        }
+        if(shape_marking(gc_sparrow)) mark_proto_shape(gc_sparrow,proto);
+        GCMarkModule(proto->module);
+      }
+      break;
+    case VALUE_CLOSURE:
+      {
+        struct ObjClosure* closure = gc2obj(ref,struct ObjClosure);
+        const size_t usize = closure->proto->uv_size;
+        GCMarkProto(closure->proto);
+        for( i = 0 ; i < usize ; ++i ) {
+          GCMark(closure->upval[i]);
+        }
+      }
+      break;
+    case VALUE_MODULE:
+      {
+        struct ObjModule* module = gc2obj(ref,struct ObjModule);
+        for( i = 0 ; i < module->cls_size ; ++i ) {
+          GCMarkProto(module->cls_arr[i]);
+        }
+      }
+      break;
+    case VALUE_COMPONENT:
+      {
+        struct ObjComponent* component = gc2obj(ref,struct ObjComponent);
+        GCMarkMap(component->env);
+        GCMarkModule(component->module);
+      }
+      break;
+    default:
+      assert(!"unreachable!");
+      break;
+  }
+}
+
+/* Drain the gray stack. At most budget objects will be scanned , pass
+ * SIZE_MAX to drain it completely. Return 1 if gray stack is empty */
+static int propagate( struct Sparrow* sparrow , size_t budget ) {
+  while(sparrow->gc_gray_size && budget) {
+    struct GCRef* ref = sparrow->gc_gray_arr[--sparrow->gc_gray_size];
+    /* the next gray object is scanned right after this one */
+    if(sparrow->gc_gray_size)
+      SP_PREFETCH(sparrow->gc_gray_arr[sparrow->gc_gray_size-1]);
+    scan_object(ref);
+    --budget;
+  }
+  return sparrow->gc_gray_size == 0;
+}
+
+/* Concurrent marking.
+ *
+ * The marker thread is created by the first concurrent major GC and lives
+ * until the Sparrow is destroyed. It sleeps on gc_cond and drains the gray
+ * stack while gc_marking is true , holding the heap lock while it scans
+ * SPARROW_GC_CONCURRENT_STEP objects at a time. The gray stack and the
+ * remembered set are only touched with the heap lock held. Mark bits live
+ * in atomic bitmap words , since the interpreter sets the mark of new
+ * objects and tests marks in barriers without the lock. Between
+ * steps it hands the lock over if the interpreter is waiting for it , a
+ * plain mutex is not fair and the marker thread would just grab it again.
+ *
+ * Once the gray stack is empty , the interpreter does the final remark
+ * from GCTry : it clears gc_marking , drains whatever has been shaded by
+ * barrier since then and swaps the nursery. Swapping the old generation
+ * is left to the interpreter as well , finalizing touches the allocator ,
+ * the string pool and user data , none of them are thread safe */
+#ifdef SPARROW_GC_CONCURRENT
+#include <sched.h>
+
+static void* marker_main( void* arg ) {
+  struct Sparrow* sparrow = (struct Sparrow*)arg;
+  pthread_mutex_lock(&(sparrow->gc_lock));
+  while(!sparrow->gc_thread_quit) {
+    if(!SparrowGCMarking(sparrow) || sparrow->gc_gray_size == 0) {
+      atomic_store_explicit(&(sparrow->gc_thread_idle),1,
+          memory_order_release);
+      pthread_cond_wait(&(sparrow->gc_cond),&(sparrow->gc_lock));
+      continue;
+    }
+    atomic_store_explicit(&(sparrow->gc_thread_idle),0,memory_order_release);
+    propagate(sparrow,SPARROW_GC_CONCURRENT_STEP);
+    if(atomic_load_explicit(&(sparrow->gc_lock_request),
+          memory_order_acquire)) {
+      pthread_mutex_unlock(&(sparrow->gc_lock));
+      while(atomic_load_explicit(&(sparrow->gc_lock_request),
+            memory_order_acquire))
+        sched_yield();
+      pthread_mutex_lock(&(sparrow->gc_lock));
     }
   }
+  pthread_mutex_unlock(&(sparrow->gc_lock));
+  return NULL;
 }
 
-void GCMarkComponent(
-    struct ObjComponent* component ) {
-  if(gcunmarked(component)) {
-    gcsetmark(component);
-    GCMarkMap(component->env);
-    GCMarkModule(component->module);
+static int marker_start( struct Sparrow* sparrow ) {
+  if(sparrow->gc_thread_start) return 0;
+  sparrow->gc_thread_quit = 0;
+  atomic_store_explicit(&(sparrow->gc_thread_idle),1,memory_order_relaxed);
+  atomic_store_explicit(&(sparrow->gc_lock_request),0,memory_order_relaxed);
+  if(pthread_mutex_init(&(sparrow->gc_lock),NULL)) return -1;
+  if(pthread_cond_init(&(sparrow->gc_cond),NULL)) {
+    pthread_mutex_destroy(&(sparrow->gc_lock));
+    return -1;
   }
+  if(pthread_create(&(sparrow->gc_thread),NULL,marker_main,sparrow)) {
+    pthread_cond_destroy(&(sparrow->gc_cond));
+    pthread_mutex_destroy(&(sparrow->gc_lock));
+    return -1;
+  }
+  sparrow->gc_thread_start = 1;
+  return 0;
 }
 
-void GCMark( Value v ) {
-  if(Vis_str(&v)) {
-    GCMarkString(Vget_str(&v));
-  } else if(Vis_map(&v)) {
-    GCMarkMap(Vget_map(&v));
-  } else if(Vis_list(&v)) {
-    GCMarkList(Vget_list(&v));
-  } else if(Vis_proto(&v)) {
-    GCMarkProto(Vget_proto(&v));
-  } else if(Vis_closure(&v)) {
-    GCMarkClosure(Vget_closure(&v));
-  } else if(Vis_method(&v)) {
-    GCMarkMethod(Vget_method(&v));
-  } else if(Vis_udata(&v)) {
-    GCMarkUdata(Vget_udata(&v));
-  } else if(Vis_iterator(&v)) {
-    GCMarkIter(Vget_iterator(&v));
-  } else if(Vis_module(&v)) {
-    GCMarkModule(Vget_module(&v));
-  } else if(Vis_loop(&v)) {
-    struct ObjLoop* loop = Vget_loop(&v);
-    if(gcunmarked(loop)) {
-      gcsetmark(loop);
+/* Whether the marker thread has drained the gray stack , the interpreter
+ * calls it at every allocation so it only peeks at gc_thread_idle before
+ * taking the lock */
+static int marker_done( struct Sparrow* sparrow ) {
+  int ret;
+  if(!atomic_load_explicit(&(sparrow->gc_thread_idle),memory_order_acquire))
+    return 0;
+  GCLockHeap(sparrow);
+  ret = atomic_load_explicit(&(sparrow->gc_thread_idle),
+      memory_order_relaxed) && sparrow->gc_gray_size == 0;
+  GCUnlockHeap(sparrow);
+  return ret;
+}
+
+void GCLockHeap( struct Sparrow* sparrow ) {
+  atomic_fetch_add_explicit(&(sparrow->gc_lock_request),1,
+      memory_order_acq_rel);
+  pthread_mutex_lock(&(sparrow->gc_lock));
+  atomic_fetch_sub_explicit(&(sparrow->gc_lock_request),1,
+      memory_order_release);
+}
+
+void GCUnlockHeap( struct Sparrow* sparrow ) {
+  pthread_mutex_unlock(&(sparrow->gc_lock));
+}
+
+void GCStopMarker( struct Sparrow* sparrow ) {
+  if(!sparrow->gc_thread_start) return;
+  pthread_mutex_lock(&(sparrow->gc_lock));
+  atomic_store_explicit(&(sparrow->gc_marking),0,memory_order_release);
+  sparrow->gc_thread_quit = 1;
+  pthread_cond_signal(&(sparrow->gc_cond));
+  pthread_mutex_unlock(&(sparrow->gc_lock));
+  pthread_join(sparrow->gc_thread,NULL);
+  pthread_cond_destroy(&(sparrow->gc_cond));
+  pthread_mutex_destroy(&(sparrow->gc_lock));
+  sparrow->gc_thread_start = 0;
+}
+
+#else
+
+void GCLockHeap( struct Sparrow* sparrow ) {
+  UNUSE_ARG(sparrow);
+}
+
+void GCUnlockHeap( struct Sparrow* sparrow ) {
+  UNUSE_ARG(sparrow);
+}
+
+void GCStopMarker( struct Sparrow* sparrow ) {
+  UNUSE_ARG(sparrow);
+}
+
+#endif /* SPARROW_GC_CONCURRENT */
+
+/* Called by write barrier when incremental marking is in progress */
+void GCShade( struct Sparrow* sparrow , struct GCRef* ref ) {
+  Value v;
+  const int lock = SparrowGCMarking(sparrow);
+  if(lock) GCLockHeap(sparrow);
+  gc_enter(sparrow);
+  _Vset_ptr(&v,ref,ref->gtype);
+  GCMark(v);
+#ifdef SPARROW_GC_CONCURRENT
+  if(lock && sparrow->gc_gray_size &&
+     atomic_load_explicit(&(sparrow->gc_thread_idle),memory_order_relaxed))
+    pthread_cond_signal(&(sparrow->gc_cond));
+#endif /* SPARROW_GC_CONCURRENT */
+  if(lock) GCUnlockHeap(sparrow);
+}
+
+/* Remembered set.
+ *
+ * Instead of remembering the old container that has been written , we
+ * remember the young object that is stored into it. Since we never move
+ * objects , keeping the young object alive is all we need and a minor GC
+ * only needs to treat them as extra roots. This makes minor GC's cost
+ * depend on the young objects instead of the size of an old container ,
+ * ie a huge list keeps getting new elements. The price is that a young
+ * object stays alive until it gets promoted or a major GC kicks in even
+ * if the old container doesn't hold it anymore */
+
+#define young_value(V) (Vis_gcobject(&(V)) && !Vget_gcobject(&(V))->gc_old)
+
+static SPARROW_INLINE
+void remember_value( struct Sparrow* sparrow , Value v ) {
+  if(young_value(v)) {
+    struct GCRef* ref = Vget_gcobject(&v);
+    if(!ref->gc_remember) GCRemember(sparrow,ref);
+  }
+}
+
+static SPARROW_INLINE
+void remember_object( struct Sparrow* sparrow , void* obj ) {
+  struct GCRef* ref = obj2gc(obj);
+  if(!ref->gc_old && !ref->gc_remember) GCRemember(sparrow,ref);
+}
+
+static void remember_mops( struct Sparrow* sparrow , struct MetaOps* mops ) {
+#define __(A,B,C) remember_value(sparrow,mops->hook_##B);
+  METAOPS_LIST(__)
+#undef __ /* __ */
+}
+
+/* A just promoted object may still hold references to young objects ,
+ * they must be remembered since no write barrier is triggered for them */
+static void remember_children( struct Sparrow* sparrow ,
+    struct GCRef* ref ) {
+  size_t i;
+  switch(ref->gtype) {
+    case VALUE_LIST:
+      {
+        struct ObjList* list = gc2obj(ref,struct ObjList);
+        for( i = 0 ; i < list->size ; ++i ) {
+          remember_value(sparrow,list->arr[i]);
+        }
+      }
+      break;
+    case VALUE_MAP:
+      {
+        struct ObjMap* map = gc2obj(ref,struct ObjMap);
+        if(map->shape) {
+          for( i = 0 ; i < map->size ; ++i ) {
+            remember_value(sparrow,map->slot[i]);
+          }
+        } else {
+          for( i = 0 ; i < map->cap ; ++i ) {
+            struct ObjMapEntry* e = map->entry + i;
+            if(!e->used || e->del) continue;
+            remember_value(sparrow,e->value);
+          }
+        }
+        if(map->mops) remember_mops(sparrow,map->mops);
+      }
+      break;
+    case VALUE_PROTO:
+      {
+        struct ObjProto* proto = gc2obj(ref,struct ObjProto);
+        remember_object(sparrow,proto->module);
+        for( i = 0 ; i < proto->scratch_size ; ++i ) {
+          remember_value(sparrow,proto->scratch_arr[i].obj);
+        }
+      }
+      break;
+    case VALUE_CLOSURE:
+      {
+        struct ObjClosure* closure = gc2obj(ref,struct ObjClosure);
+        remember_object(sparrow,closure->proto);
+        for( i = 0 ; i < closure->proto->uv_size ; ++i ) {
+          remember_value(sparrow,closure->upval[i]);
+        }
+      }
+      break;
+    case VALUE_MODULE:
+      {
+        struct ObjModule* module = gc2obj(ref,struct ObjModule);
+        for( i = 0 ; i < module->cls_size ; ++i ) {
+          remember_object(sparrow,module->cls_arr[i]);
+        }
+      }
+      break;
+    case VALUE_COMPONENT:
+      {
+        struct ObjComponent* component = gc2obj(ref,struct ObjComponent);
+        remember_object(sparrow,component->env);
+        remember_object(sparrow,component->module);
+      }
+      break;
+    case VALUE_METHOD:
+      remember_value(sparrow,gc2obj(ref,struct ObjMethod)->object);
+      break;
+    case VALUE_ITERATOR:
+      remember_value(sparrow,gc2obj(ref,struct ObjIterator)->obj);
+      break;
+    case VALUE_LOOP_ITERATOR:
+      remember_object(sparrow,gc2obj(ref,struct ObjLoopIterator)->loop);
+      break;
+    default:
+      break;
+  }
+}
+
+void GCRemember( struct Sparrow* sparrow , struct GCRef* ref ) {
+  const int lock = SparrowGCMarking(sparrow);
+  assert(!ref->gc_old);
+  if(lock) GCLockHeap(sparrow);
+  assert(!ref->gc_remember);
+  ref->gc_remember = 1;
+  /* Cannot use DynArrPush since MemGrow has a capacity limitation */
+  if(sparrow->gc_remember_size == sparrow->gc_remember_cap) {
+    size_t ncap = sparrow->gc_remember_cap == 0 ? 64 :
+      2 * sparrow->gc_remember_cap;
+    sparrow->gc_remember_arr = realloc(sparrow->gc_remember_arr,
+        ncap*sizeof(struct GCRef*));
+    sparrow->gc_remember_cap = ncap;
+  }
+  sparrow->gc_remember_arr[sparrow->gc_remember_size++] = ref;
+  if(lock) GCUnlockHeap(sparrow);
+}
+
+/* Remove objects that has been promoted from the remembered set. Must be
+ * called after swapping */
+static void retain_remember( struct Sparrow* sparrow ) {
+  size_t i;
+  size_t j = 0;
+  for( i = 0 ; i < sparrow->gc_remember_size ; ++i ) {
+    struct GCRef* ref = sparrow->gc_remember_arr[i];
+    if(!ref->gc_old) {
+      sparrow->gc_remember_arr[j++] = ref;
+    } else {
+      ref->gc_remember = 0;
     }
-  } else if(Vis_loop_iterator(&v)) {
-    struct ObjLoopIterator* itr = Vget_loop_iterator(&v);
-    if(gcunmarked(itr)) {
-      gcsetmark(itr);
-      gcsetmark(itr->loop);
+  }
+  sparrow->gc_remember_size = j;
+}
+
+/* Remove dead objects from the remembered set. Only needed by major GC
+ * since minor GC uses the remembered set as root. Must be called before
+ * swapping */
+static void drop_dead_remember( struct Sparrow* sparrow ) {
+  size_t i;
+  size_t j = 0;
+  for( i = 0 ; i < sparrow->gc_remember_size ; ++i ) {
+    struct GCRef* ref = sparrow->gc_remember_arr[i];
+    if(is_marked(sparrow,ref)) {
+      sparrow->gc_remember_arr[j++] = ref;
+    } else {
+      ref->gc_remember = 0;
     }
   }
+  sparrow->gc_remember_size = j;
+}
+
+/* Feedback targets.
+ *
+ * A call site records the protos it has called as raw pointers , they are
+ * weak references since recording a callee must not keep it alive. Once
+ * marking is done , the protos that have a feedback vector are visited : a
+ * dead one leaves the list , and the dead callees are dropped from the slots
+ * of a live one before the swap frees them. Between major GCs every old
+ * object is marked , so the mark bit tells liveness in a minor GC as well.
+ * Shapes seen by attribute and index sites are kept by the proto instead ,
+ * see scan_object */
+void GCTrackFeedback( struct Sparrow* sparrow , struct ObjProto* proto ) {
+  if(sparrow->gc_feedback_size == sparrow->gc_feedback_cap) {
+    size_t ncap = sparrow->gc_feedback_cap == 0 ? 16 :
+      2 * sparrow->gc_feedback_cap;
+    sparrow->gc_feedback_arr = realloc(sparrow->gc_feedback_arr,
+        ncap*sizeof(struct ObjProto*));
+    sparrow->gc_feedback_cap = ncap;
+  }
+  sparrow->gc_feedback_arr[sparrow->gc_feedback_size++] = proto;
+}
+
+static void clear_feedback_slot( struct Sparrow* sparrow ,
+    struct FeedbackSlot* slot ) {
+  uint32_t i;
+  uint32_t j = 0;
+  if(slot->target_size == FEEDBACK_MEGAMORPHIC) return;
+  for( i = 0 ; i < slot->target_size ; ++i ) {
+    struct ObjProto* callee = (struct ObjProto*)slot->target[i];
+    if(is_marked(sparrow,&(callee->gc))) slot->target[j++] = callee;
+  }
+  slot->target_size = j;
+}
+
+static void clear_feedback( struct Sparrow* sparrow ) {
+  size_t i;
+  size_t j = 0;
+  for( i = 0 ; i < sparrow->gc_feedback_size ; ++i ) {
+    struct ObjProto* proto = sparrow->gc_feedback_arr[i];
+    size_t k;
+    if(!is_marked(sparrow,&(proto->gc))) continue;
+    for( k = 0 ; k < proto->fb_size ; ++k ) {
+      if(proto->fb_arr[k].kind == FEEDBACK_CALL)
+        clear_feedback_slot(sparrow,proto->fb_arr + k);
+    }
+    sparrow->gc_feedback_arr[j++] = proto;
+  }
+  sparrow->gc_feedback_size = j;
 }
 
 /* Swap phase */
@@ -226,7 +1142,7 @@ void GCMark( Value v ) {
  * should not be collected by GC cycle but they should involve in
  * the mark cycle since the map/table may hold other object can be
  * GC collected. Afterwards, since they don't participate in swap
- * cycle for finalize, then their gc_state flag remains marked all
+ * cycle for finalize, then their mark bit remains set all
  * the time. We need this routine to flip them back.
  *
  * We only need to flip gc flag of those container objects, for
@@ -235,52 +1151,191 @@ void GCMark( Value v ) {
 
 static SPARROW_INLINE
 void swap_sparrow( struct Sparrow* sparrow ) {
-  gcsetunmark(&(sparrow->global_env.env));
+  bits_reset(sparrow->gc_env_mark);
 }
 
-static void swap( struct Sparrow* sparrow ,
+/* A survivor of nursery grows older and gets promoted into the old
+ * generation once it is old enough , promoted objects stay marked. User
+ * data is never promoted since its mark function is opaque to us and we
+ * cannot tell whether it holds young objects. Return 1 if promoted */
+static int survive( struct Sparrow* sparrow , struct GCRef* ref ) {
+  if(ref->gc_age < GC_MAX_AGE) ++ref->gc_age;
+  if(ref->gtype != VALUE_UDATA && ref->gc_age >= sparrow->gc_promote_age) {
+    ref->gc_old = 1;
+    remember_children(sparrow,ref);
+    return 1;
+  }
+  clear_mark(sparrow,ref);
+  return 0;
+}
+
+/* Swap the nursery. Only pages that hold young objects are visited , the
+ * young objects of a page are its allocated slots that are not old */
+static void swap_young( struct Sparrow* sparrow ,
     int64_t* active, int64_t* inactive ) {
-  struct GCRef* ref = sparrow->gc_start;
-  struct GCRef** prev = &(sparrow->gc_start);
+  struct GCPage** prev = &(sparrow->gc_page_all);
+  struct GCPage* page;
+  struct GCLarge** lprev = &(sparrow->gc_large_young);
+  struct GCLarge* large;
   int64_t a = 0;
   int64_t i = 0;
-  while(ref) {
-    if(ref->gc_state == GC_MARKED) {
-      ref->gc_state = GC_UNMARKED;
-      prev = &(ref->next);
-      ref = ref->next;
+  size_t promoted = 0;
+  while((page = *prev)) {
+    size_t w;
+    const size_t words = page->young ? page_words(page) : 0;
+    for( w = 0 ; w < words ; ++w ) {
+      const uint64_t young = page->alloc[w] & ~page->old[w];
+      uint64_t live = young & bits_get(page->mark[w]);
+      uint64_t dead = young & ~live;
+      while(live) {
+        size_t bit = w * 64 + SP_CTZ64(live);
+        struct GCRef* ref = page_object(page,bit);
+        live &= live - 1;
+        if(survive(sparrow,ref)) {
+          page->old[w] |= bit_mask(bit);
+          --page->young;
+          ++promoted;
+        }
+        ++a;
+      }
+      while(dead) {
+        struct GCRef* ref = page_object(page,w * 64 + SP_CTZ64(dead));
+        dead &= dead - 1;
+        GCFinalizeObj(sparrow,ref);
+        ++i;
+      }
+    }
+    if(page_empty(page)) {
+      *prev = page->link;
+      page_release(sparrow,page);
+    } else {
+      prev = &(page->link);
+    }
+  }
+  while((large = *lprev)) {
+    struct GCRef* ref = (struct GCRef*)(large + 1);
+    if(bits_get(large->mark)) {
+      if(survive(sparrow,ref)) {
+        *lprev = large->next;
+        large->next = sparrow->gc_large_old;
+        sparrow->gc_large_old = large;
+        ++promoted;
+      } else {
+        lprev = &(large->next);
+      }
       ++a;
     } else {
-      assert(ref->gc_state == GC_UNMARKED);
-      *prev = ref->next;
+      *lprev = large->next;
       GCFinalizeObj(sparrow,ref);
-      ref = *prev;
       ++i;
     }
   }
-  *prev = NULL;
   sparrow->gc_sz -= i;
-  swap_sparrow(sparrow);
+  sparrow->gc_young_sz -= i + promoted;
+  sparrow->gc_promoted = promoted;
   if(active) *active = a;
   if(inactive) *inactive = i;
 }
 
-void GCForce( struct Sparrow* sparrow ) {
-  double pr;
+/* Swap the old generation , it can be done in several steps since
+ * nothing else removes object from old generation. The pages are swept
+ * first and then the large objects. New pages and large objects are only
+ * inserted at the head of their list , objects in them are either young
+ * or marked , so the cursor is always valid. A page is swept at once and
+ * counts as many objects as it holds. At most budget objects will be
+ * visited , return 1 if the whole old generation has been swapped */
+static int swap_old( struct Sparrow* sparrow , size_t budget ) {
+  struct GCPage** prev = sparrow->gc_sweep;
+  struct GCLarge** lprev = sparrow->gc_sweep_large;
+  struct GCPage* page;
+  struct GCLarge* large;
+  size_t bytes = sparrow->gc_bytes;
+  int64_t a = 0;
+  int64_t i = 0;
+  while(prev && budget) {
+    size_t w;
+    size_t words;
+    if(!(page = *prev)) {
+      prev = NULL;
+      break;
+    }
+    words = page_words(page);
+    for( w = 0 ; w < words ; ++w ) {
+      const uint64_t old = page->alloc[w] & page->old[w];
+      const uint64_t live = old & bits_get(page->mark[w]);
+      uint64_t dead = old & ~live;
+      a += SP_POPCOUNT64(live);
+      while(dead) {
+        struct GCRef* ref = page_object(page,w * 64 + SP_CTZ64(dead));
+        dead &= dead - 1;
+        GCFinalizeObj(sparrow,ref);
+        ++i;
+      }
+    }
+    budget = budget > page->used ? budget - page->used : 0;
+    if(page_empty(page)) {
+      *prev = page->link;
+      page_release(sparrow,page);
+    } else {
+      prev = &(page->link);
+    }
+  }
+  while(!prev && budget && (large = *lprev)) {
+    if(bits_get(large->mark)) {
+      lprev = &(large->next);
+      ++a;
+    } else {
+      *lprev = large->next;
+      GCFinalizeObj(sparrow,(struct GCRef*)(large + 1));
+      ++i;
+    }
+    --budget;
+  }
+  sparrow->gc_sweep = prev;
+  sparrow->gc_sweep_large = lprev;
+  sparrow->gc_sz -= i;
+  sparrow->gc_active += a;
+  sparrow->gc_inactive += i;
+  sparrow->gc_freed += bytes - sparrow->gc_bytes;
+  return !prev && *lprev == NULL;
+}
+
+/* Old objects stay marked between major GCs. A major GC unmarks all the
+ * objects when it starts , which only clears the mark bitmaps of pages
+ * and walks the large objects */
+static void clear_mark_all( struct Sparrow* sparrow ) {
+  struct GCPage* page;
+  struct GCLarge* large;
+  size_t w;
+  for( page = sparrow->gc_page_all ; page ; page = page->link ) {
+    const size_t words = page_words(page);
+    for( w = 0 ; w < words ; ++w ) bits_reset(page->mark[w]);
+  }
+  for( large = sparrow->gc_large_young ; large ; large = large->next )
+    bits_reset(large->mark);
+  for( large = sparrow->gc_large_old ; large ; large = large->next )
+    bits_reset(large->mark);
+  bits_reset(sparrow->gc_env_mark);
+}
+
+static void mark_root( struct Sparrow* sparrow , int major ) {
   size_t i;
-  int64_t active = 0;
-  int64_t inactive = 0;
-  sparrow->gc_prevsz = sparrow->gc_sz;
-  sparrow->gc_ps_threshold =
-    sparrow->gc_prevsz * sparrow->gc_ratio;
 
-  /* mark string pool */
-  for( i = 0 ; i < sparrow->str_cap ; ++i ) {
-    if(sparrow->str_arr[i])
-      GCMarkString(sparrow->str_arr[i]);
+  /* mark intrinsic names. The string pool is weak so they are not kept
+   * alive by it. Strings are always old , so minor GC can skip them */
+  if(major) {
+    gc_dump_root = GC_ROOT_NAME;
+#define __(A,B,C) GCMarkString(IFUNC_NAME(sparrow,B));
+    INTRINSIC_FUNCTION(__)
+#undef __ /* __ */
+
+#define __(A,B) GCMarkString(IATTR_NAME(sparrow,A));
+    INTRINSIC_ATTRIBUTE(__)
+#undef __ /* __ */
   }
 
   /* mark the global environment */
+  gc_dump_root = GC_ROOT_GLOBAL;
   GCMarkMap(&(sparrow->global_env.env));
 
   /* mark the runtime virtual machine.
@@ -292,10 +1347,12 @@ void GCForce( struct Sparrow* sparrow ) {
     do {
       struct CallThread* csparrow = runtime->cur_thread;
       /* mark the stack */
+      gc_dump_root = GC_ROOT_STACK;
       for( i = 0 ; i < csparrow->stack_size ; ++i ) {
         GCMark(csparrow->stack[i]);
       }
       /* mark all active function call */
+      gc_dump_root = GC_ROOT_FRAME;
       for( i = 0 ; i < csparrow->frame_size ; ++i ) {
         struct CallFrame* cframe = csparrow->frame+i;
         if(cframe->closure) {
@@ -303,20 +1360,169 @@ void GCForce( struct Sparrow* sparrow ) {
           GCMark(cframe->callable);
         }
       }
+      gc_dump_root = GC_ROOT_COMPONENT;
       GCMarkComponent(csparrow->component);
       runtime = runtime->prev;
     } while(runtime);
   }
+}
 
-  /* swap the memory away and free them */
-  swap(sparrow,&active,&inactive);
+/* Statistics , see struct GCStat in object.h */
+static SPARROW_INLINE
+double gc_clock() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int hist_bucket( double usec ) {
+  size_t n = (size_t)usec;
+  int i = 0;
+  while(n > 1 && i < SPARROW_GC_HISTOGRAM_SIZE-1) {
+    n >>= 1;
+    ++i;
+  }
+  return i;
+}
+
+static void record_collection( struct Sparrow* sparrow , int kind ,
+    double mark , double sweep ) {
+  struct GCStat* stat = &(sparrow->gc_stat);
+  struct GCPause* p = stat->history +
+    stat->history_size % SPARROW_GC_HISTORY_SIZE;
+  ++stat->mark_hist[kind][hist_bucket(mark)];
+  ++stat->sweep_hist[kind][hist_bucket(sweep)];
+  p->major = (kind == GC_MAJOR);
+  p->mark = mark;
+  p->sweep = sweep;
+  ++stat->history_size;
+}
 
+const struct GCStat* GCGetStat( struct Sparrow* sparrow ) {
+  return &(sparrow->gc_stat);
+}
+
+const struct GCPause* GCGetHistory( struct Sparrow* sparrow , size_t idx ) {
+  const struct GCStat* stat = &(sparrow->gc_stat);
+  if(idx >= stat->history_size || idx >= SPARROW_GC_HISTORY_SIZE)
+    return NULL;
+  return stat->history +
+    (stat->history_size - 1 - idx) % SPARROW_GC_HISTORY_SIZE;
+}
+
+void GCMinor( struct Sparrow* sparrow ) {
+  size_t i;
+  double start = gc_clock();
+  double mark;
+  assert(sparrow->gc_phase == GC_PHASE_IDLE);
+  gc_enter(sparrow);
+  mark_root(sparrow,0);
+
+  /* mark everything referenced by old generation */
+  for( i = 0 ; i < sparrow->gc_remember_size ; ++i ) {
+    Value v;
+    struct GCRef* ref = sparrow->gc_remember_arr[i];
+    _Vset_ptr(&v,ref,ref->gtype);
+    GCMark(v);
+  }
+  propagate(sparrow,SIZE_MAX);
+  mark = gc_clock();
+
+  clear_feedback(sparrow);
+  swap_young(sparrow,NULL,NULL);
+  swap_sparrow(sparrow);
+  retain_remember(sparrow);
+  sparrow->gc_minor_generation++;
+  record_collection(sparrow,GC_MINOR,mark-start,gc_clock()-mark);
+}
+
+/* Major GC.
+ *
+ * It is split into 3 parts , major_start shades all the roots , then the
+ * gray stack is drained either in one go or in several steps. Once the
+ * gray stack is empty , major_finish_mark rescans the roots since stack
+ * and frames are modified without write barrier , and then swaps the
+ * nursery. Lastly the old generation is swapped by swap_old , again in
+ * one go or several steps. During an incremental major GC , write barrier
+ * keeps the tri-color invariant and no minor GC happens */
+static void major_start( struct Sparrow* sparrow ) {
+  double start = gc_clock();
+  sparrow->gc_prevsz = sparrow->gc_bytes;
+  sparrow->gc_ps_threshold =
+    sparrow->gc_prevsz * sparrow->gc_ratio;
+  clear_mark_all(sparrow);
+  gc_enter(sparrow);
+  mark_root(sparrow,1);
+  sparrow->gc_phase = GC_PHASE_MARK;
+#ifdef SPARROW_GC_CONCURRENT
+  /* roots are shaded , hand the gray stack over to the marker thread */
+  if(sparrow->gc_concurrent && sparrow->runtime) {
+    if(marker_start(sparrow)) {
+      sparrow->gc_concurrent = 0; /* fallback to incremental GC */
+    } else {
+      GCLockHeap(sparrow);
+      atomic_store_explicit(&(sparrow->gc_marking),1,memory_order_release);
+      pthread_cond_signal(&(sparrow->gc_cond));
+      GCUnlockHeap(sparrow);
+    }
+  }
+#endif /* SPARROW_GC_CONCURRENT */
+  sparrow->gc_stat.current.mark = gc_clock() - start;
+  sparrow->gc_stat.current.sweep = 0;
+}
+
+static void major_finish_mark( struct Sparrow* sparrow , double start ) {
+  int64_t active = 0;
+  int64_t inactive = 0;
+  size_t bytes;
+  double mark;
+#ifdef SPARROW_GC_CONCURRENT
+  if(SparrowGCMarking(sparrow)) {
+    /* final remark. Once gc_marking is cleared , marker thread never
+     * touches the heap again. Everything reachable at the start of this
+     * cycle has been shaded by the pre-barrier , so the roots don't need
+     * to be rescanned */
+    GCLockHeap(sparrow);
+    atomic_store_explicit(&(sparrow->gc_marking),0,memory_order_release);
+    GCUnlockHeap(sparrow);
+  } else
+#endif /* SPARROW_GC_CONCURRENT */
+  {
+    /* all new strings are marked , no need to rescan intrinsic names */
+    mark_root(sparrow,0);
+  }
+  propagate(sparrow,SIZE_MAX);
+  mark = gc_clock();
+  sparrow->gc_stat.current.mark += mark - start;
+  mark_shape_path(shape_epoch(sparrow),sparrow->shape_root);
+  sparrow->shape_size -= prune_shape(shape_epoch(sparrow),sparrow->shape_root);
+  ObjStrPoolSweep(sparrow);
+  drop_dead_remember(sparrow);
+  clear_feedback(sparrow);
+  bytes = sparrow->gc_bytes;
+  swap_young(sparrow,&active,&inactive);
+  sparrow->gc_freed = bytes - sparrow->gc_bytes;
+  swap_sparrow(sparrow);
+  retain_remember(sparrow);
   sparrow->gc_active = active;
   sparrow->gc_inactive = inactive;
+  sparrow->gc_sweep = &(sparrow->gc_page_all);
+  sparrow->gc_sweep_large = &(sparrow->gc_large_old);
+  sparrow->gc_phase = GC_PHASE_SWEEP;
+  sparrow->gc_stat.current.sweep += gc_clock() - mark;
+}
+
+static void major_finish( struct Sparrow* sparrow ) {
+  double pr;
+  sparrow->gc_phase = GC_PHASE_IDLE;
+  sparrow->gc_sweep = NULL;
+  sparrow->gc_sweep_large = NULL;
   sparrow->gc_generation++;
+  record_collection(sparrow,GC_MAJOR,sparrow->gc_stat.current.mark,
+      sparrow->gc_stat.current.sweep);
 
   /* update adjust threshold */
-  pr = sparrow->gc_inactive / sparrow->gc_prevsz;
+  pr = SparrowGCFreedRatio(sparrow);
   if(pr < sparrow->gc_penalty_ratio) {
     ++sparrow->gc_penalty_times;
 
@@ -329,19 +1535,152 @@ void GCForce( struct Sparrow* sparrow ) {
   }
 }
 
+/* Perform one step of an incremental major GC */
+static void major_step( struct Sparrow* sparrow , size_t budget ) {
+  double start = gc_clock();
+  int done;
+  /* marker thread reads them , they are set by major_start already */
+  if(!SparrowGCMarking(sparrow)) gc_enter(sparrow);
+  switch(sparrow->gc_phase) {
+    case GC_PHASE_MARK:
+      if(SparrowGCMarking(sparrow) || propagate(sparrow,budget))
+        major_finish_mark(sparrow,start);
+      else
+        sparrow->gc_stat.current.mark += gc_clock() - start;
+      break;
+    case GC_PHASE_SWEEP:
+      done = swap_old(sparrow,budget);
+      sparrow->gc_stat.current.sweep += gc_clock() - start;
+      if(done) major_finish(sparrow);
+      break;
+    default:
+      assert(!"unreachable!");
+      break;
+  }
+}
+
+void GCForce( struct Sparrow* sparrow ) {
+  /* finish the pending incremental GC , if we have one */
+  if(sparrow->gc_phase == GC_PHASE_IDLE) major_start(sparrow);
+  while(sparrow->gc_phase != GC_PHASE_IDLE) {
+    major_step(sparrow,SIZE_MAX);
+  }
+}
+
+/* Heap snapshot. Every object is written as a node followed by the edges
+ * reported by scan_object , the size of a node includes the memory owned
+ * by it , ie the backing array of a list */
+static size_t dump_size( struct GCRef* ref ) {
+  size_t sz = GCObjectSize(ref);
+  switch(ref->gtype) {
+    case VALUE_LIST:
+      sz += gc2obj(ref,struct ObjList)->cap * sizeof(Value);
+      break;
+    case VALUE_MAP:
+      sz += ObjMapBytes(gc2obj(ref,struct ObjMap));
+      break;
+    case VALUE_PROTO:
+      {
+        struct ObjProto* proto = gc2obj(ref,struct ObjProto);
+        sz += proto->code_buf.cap * (sizeof(uint32_t) +
+          sizeof(struct InstrDebugInfo)) + proto->num_cap * sizeof(double) +
+          proto->str_cap * sizeof(struct ObjStr*) + proto->uv_cap *
+          sizeof(struct UpValueIndex) + proto->scratch_cap *
+          sizeof(struct ScratchSlot) + proto->ic_cap *
+          sizeof(struct InlineCache) + proto->cell_cap *
+          sizeof(struct GlobalCell);
+      }
+      break;
+    case VALUE_MODULE:
+      sz += gc2obj(ref,struct ObjModule)->cls_cap * sizeof(struct ObjProto*);
+      break;
+    default:
+      break;
+  }
+  return sz;
+}
+
+static void dump_object( struct Sparrow* sparrow , struct GCRef* ref ) {
+  UNUSE_ARG(sparrow);
+  fputc(GC_DUMP_NODE,gc_dump);
+  dump_u64((uintptr_t)ref);
+  fputc(ref->gtype,gc_dump);
+  dump_u64(dump_size(ref));
+  gc_dump_from = ref;
+  switch(ref->gtype) {
+    case VALUE_STRING:
+    case VALUE_LOOP:
+      break;
+    case VALUE_LOOP_ITERATOR:
+      dump_ref(gc2obj(ref,struct ObjLoopIterator)->loop);
+      break;
+    default:
+      scan_object(ref);
+      break;
+  }
+  gc_dump_from = NULL;
+}
+
+int GCDumpHeap( struct Sparrow* sparrow , FILE* output ) {
+  int i;
+  /* the heap must be quiescent , finish the pending major GC */
+  while(sparrow->gc_phase != GC_PHASE_IDLE) {
+    major_step(sparrow,SIZE_MAX);
+  }
+  gc_enter(sparrow);
+  gc_dump = output;
+  fwrite(GC_DUMP_MAGIC,1,sizeof(GC_DUMP_MAGIC)-1,output);
+  for( i = 0 ; i < SIZE_OF_VALUE_TYPE ; ++i ) {
+    const char* name = GCTypeGetString(i);
+    fputc(GC_DUMP_TYPE,output);
+    fputc(i,output);
+    fputc((int)strlen(name),output);
+    fputs(name,output);
+  }
+  /* global environment is embedded in the Sparrow object */
+  dump_object(sparrow,obj2gc(&(sparrow->global_env.env)));
+  heap_foreach(sparrow,dump_object);
+  mark_root(sparrow,1);
+  fputc(GC_DUMP_END,output);
+  gc_dump = NULL;
+  return ferror(output) ? -1 : 0;
+}
+
 /* This is actually the core of our GC */
 static SPARROW_INLINE
 int trigger_gc( struct Sparrow* sparrow ) {
   if(sparrow->runtime && /* If we don't have a runtime, just don't do GC */
-     sparrow->gc_sz >= sparrow->gc_adjust_threshold &&
-     sparrow->gc_sz >= sparrow->gc_ps_threshold)
+     sparrow->gc_bytes >= sparrow->gc_adjust_threshold &&
+     sparrow->gc_bytes >= sparrow->gc_ps_threshold)
     return 1;
   return 0;
 }
 
+static SPARROW_INLINE
+int trigger_minor_gc( struct Sparrow* sparrow ) {
+  return sparrow->runtime &&
+         sparrow->gc_young_sz >= sparrow->gc_nursery_size;
+}
+
 int GCTry( struct Sparrow* sparrow ) {
-  if(trigger_gc(sparrow)) {
-    GCForce(sparrow);
+  if(sparrow->gc_phase != GC_PHASE_IDLE) {
+    /* incremental major GC is in progress */
+    if(!sparrow->runtime) return -1;
+#ifdef SPARROW_GC_CONCURRENT
+    /* marker thread is still working , don't wait for it */
+    if(SparrowGCMarking(sparrow) && !marker_done(sparrow)) return -1;
+#endif /* SPARROW_GC_CONCURRENT */
+    major_step(sparrow,sparrow->gc_budget ? sparrow->gc_budget : SIZE_MAX);
+    return 0;
+  } else if(trigger_gc(sparrow)) {
+    if(sparrow->gc_budget || sparrow->gc_concurrent) {
+      major_start(sparrow);
+    } else {
+      GCForce(sparrow);
+    }
+    return 0;
+  } else if(trigger_minor_gc(sparrow)) {
+    GCMinor(sparrow);
     return 0;
   } else {
     return -1;
@@ -9,7 +9,54 @@
  * GC try means a GC is kicked in but end up without collecting anything.
  * We have a penalty system to avoid such GC trigger and also we have other
  * mechanism to avoid GC trigger becomes too lazy which means GC never tries
- * to kicks in at anytime */
+ * to kicks in at anytime.
+ *
+ * Major GC is triggered by the bytes held by GC objects , which includes
+ * the object itself and the backing storage of list and map. Any code that
+ * grows the backing storage must account it in gc_bytes , see list.h.
+ *
+ * The GC is generational. New objects are allocated in nursery and a minor
+ * GC only marks and swaps young objects. Old objects are skipped entirely ,
+ * the young objects referenced by old objects are recorded inside of the
+ * remembered set and serve as root for minor GC. Any code that stores a
+ * reference into an *existed* container must call GCBarrier , otherwise a
+ * minor GC can free an object that is still alive.
+ *
+ * Major GC can be incremental when gc_budget is not zero. Marking and
+ * swapping are done in steps from allocation points , each step visits
+ * at most gc_budget objects. The write barrier shades the value stored
+ * into a marked container so a black object never points to a white one
+ *
+ * When concurrent GC is compiled in , the gray stack of a major GC is
+ * drained by a marker thread while the interpreter keeps running. It uses
+ * a snapshot-at-the-beginning barrier instead : the value that is about
+ * to be overwritten or removed from a container is shaded , see
+ * GCPreBarrier , and objects created during marking are born black. So
+ * everything reachable when marking starts is kept and the final remark
+ * pause doesn't need to rescan the stack. The marker thread holds the
+ * heap lock while scanning , any code that changes the layout of a
+ * container ( grow , rehash , clear ) must hold it as well , see list.h */
+
+/* Allocate memory for a GC object of size bytes. Small objects come from
+ * the slab pages of their size class , see gc.c */
+void* GCAlloc( struct Sparrow* , size_t size );
+
+/* Put an object returned by GCAlloc into the heap , gtype must be set.
+ * It goes to the nursery unless old is true. Old objects are born marked
+ * and so are objects created during concurrent marking */
+void GCAddObject( struct Sparrow* , struct GCRef* , int old );
+
+/* Release memory returned by GCAlloc */
+void GCFree( struct Sparrow* , struct GCRef* );
+
+/* Bytes of memory used by a GC object , not including backing storage */
+size_t GCObjectSize( struct GCRef* );
+
+/* Whether an object is marked , see struct GCPage in gc.c */
+int GCIsMarked( struct Sparrow* , struct GCRef* );
+
+/* Finalize every object and release all the memory of the heap */
+void GCDestroyHeap( struct Sparrow* );
 
 /* helper function to *finalize* an GC manged object. Do not use it if you
  * don't know what it is */
@@ -21,9 +68,97 @@ void GCFinalizeObj( struct Sparrow* , struct GCRef* );
 int GCTry( struct Sparrow* );
 
 /* Same as try but just force it to trigger anyway. So it will always return
- * a positive number */
+ * a positive number. This is a major GC which collects both generations */
 void GCForce( struct Sparrow* );
 
+/* Collect nursery only */
+void GCMinor( struct Sparrow* );
+
+/* Put a young object into the remembered set, used by write barrier */
+void GCRemember( struct Sparrow* , struct GCRef* );
+
+/* Register a proto that just got its feedback vector , GC drops the dead
+ * callees from it */
+void GCTrackFeedback( struct Sparrow* , struct ObjProto* );
+
+/* Keep a shape and its keys through the major GC in progress. Called when a
+ * map , an inline cache or a feedback slot starts using it during marking ,
+ * with the heap lock held if SparrowGCMarking */
+void GCMarkShape( struct Sparrow* , struct Shape* );
+
+/* Shade a white object into gray, used by write barrier */
+void GCShade( struct Sparrow* , struct GCRef* );
+
+/* Heap lock , only needed while SparrowGCMarking is true */
+void GCLockHeap( struct Sparrow* );
+void GCUnlockHeap( struct Sparrow* );
+
+/* Stop the marker thread , if we have one */
+void GCStopMarker( struct Sparrow* );
+
+/* Heap statistics , see struct GCStat in object.h */
+const struct GCStat* GCGetStat( struct Sparrow* );
+
+/* Pause time of the latest collections , 0 is the last one. Return NULL if
+ * less than IDX+1 collections are kept */
+const struct GCPause* GCGetHistory( struct Sparrow* , size_t idx );
+
+/* Heap snapshot for offline memory analysis , see src/tool/heap_analyze.c.
+ * The pending major GC is finished first , then every object is written
+ * to the file in a binary stream of native endian records , starting with
+ * GC_DUMP_MAGIC :
+ *  'T' u8 type , u8 len , name  : name of an object type
+ *  'N' u64 id , u8 type , u64 size : an object , size includes backing store
+ *  'E' u64 from , u64 to : a reference , it follows the node it belongs to
+ *  'R' u8 kind , u64 to : a root , see GC_ROOT_*
+ *  'Z' : end of the snapshot
+ * References are the ones seen by a major GC. No GC object is allocated
+ * while dumping. Return -1 if it fails to write */
+#define GC_DUMP_MAGIC "SPHEAP1\n"
+
+enum {
+  GC_DUMP_TYPE = 'T',
+  GC_DUMP_NODE = 'N',
+  GC_DUMP_EDGE = 'E',
+  GC_DUMP_ROOT = 'R',
+  GC_DUMP_END = 'Z'
+};
+
+enum {
+  GC_ROOT_NAME,     /* intrinsic names */
+  GC_ROOT_GLOBAL,   /* global environment */
+  GC_ROOT_STACK,    /* runtime stack */
+  GC_ROOT_FRAME,    /* closure of an active call frame */
+  GC_ROOT_COMPONENT /* component of a runtime */
+};
+
+int GCDumpHeap( struct Sparrow* , FILE* );
+
+/* Write barrier. Call it when value V is stored into container OBJ */
+static SPARROW_INLINE
+void GCBarrier( struct Sparrow* sparrow , void* obj , Value v ) {
+  if(Vis_gcobject(&v)) {
+    struct GCRef* container = obj2gc(obj);
+    struct GCRef* ref = Vget_gcobject(&v);
+    if(SP_UNLIKELY(container->gc_old) && !ref->gc_old && !ref->gc_remember)
+      GCRemember(sparrow,ref);
+    if(SP_UNLIKELY(sparrow->gc_phase == GC_PHASE_MARK) &&
+       !SparrowGCMarking(sparrow) &&
+       GCIsMarked(sparrow,container) && !GCIsMarked(sparrow,ref))
+      GCShade(sparrow,ref);
+  }
+}
+
+/* Snapshot-at-the-beginning barrier for concurrent marking. Call it with
+ * the value that is about to be overwritten or removed from a container ,
+ * before the heap lock is taken */
+static SPARROW_INLINE
+void GCPreBarrier( struct Sparrow* sparrow , Value old ) {
+  if(SP_UNLIKELY(SparrowGCMarking(sparrow)) && Vis_gcobject(&old) &&
+     !GCIsMarked(sparrow,Vget_gcobject(&old)))
+    GCShade(sparrow,Vget_gcobject(&old));
+}
+
 /* Mark routine used for user to do customize cooperative GC in user data */
 void GCMark ( Value value );
 void GCMarkString( struct ObjStr* );
@@ -0,0 +1,1552 @@
+#include "jit.h"
+
+#ifdef SPARROW_JIT
+#include "vm.h"
+#include "bc.h"
+#include "opt.h"
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/* Native code is entered with the JitState and the native address of the
+ * instruction to start with , it returns the pc where the interpreter should
+ * continue or -1 on error */
+typedef int (*JitEntry)( struct JitState* , const void* );
+
+/* x86-64 registers */
+enum {
+  RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+  R8 , R9 , R10, R11, R12, R13, R14, R15
+};
+
+/* Pinned registers of native code , all of them are callee saved */
+#define REG_NUMBER RBX /* VALUE_NUMBER , anything not below is not a number */
+#define REG_STATE R12  /* struct JitState* */
+#define REG_BASE R13   /* base of current frame */
+#define REG_TOP R14    /* next free slot of stack */
+#define REG_LIMIT R15  /* end of stack */
+
+/* Condition code */
+enum {
+  CC_B = 0x2, CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5, CC_BE = 0x6,
+  CC_A = 0x7, CC_S = 0x8 , CC_P = 0xa, CC_NP = 0xb, CC_L = 0xc, CC_GE = 0xd
+};
+
+/* Operation of arithmetic and comparison templates */
+enum {
+  JIT_ADD, JIT_SUB, JIT_MUL, JIT_DIV,
+  JIT_LT , JIT_LE , JIT_GT , JIT_GE , JIT_EQ, JIT_NE
+};
+
+/* Operand of arithmetic and comparison templates , a stack slot relative to
+ * REG_TOP , a register slot relative to REG_BASE or a number constant */
+enum {
+  OPERAND_STACK,
+  OPERAND_REG,
+  OPERAND_NUM
+};
+
+struct Operand {
+  int kind;
+  int32_t disp;
+  uint64_t bits;
+  int nonzero; /* zero goes to slow path , ie divide by zero error */
+};
+
+/* Where the result goes */
+enum {
+  DEST_PUSH,    /* push onto stack */
+  DEST_REPLACE, /* replace stack top */
+  DEST_POP,     /* pop 2 operands and push */
+  DEST_REG      /* register slot */
+};
+
+/* Relative jump waiting for its target to be emitted */
+enum {
+  FIX_LABEL, /* native entry of an instruction */
+  FIX_STUB,  /* slow path */
+  FIX_STEP,  /* shared routine calling JitStep */
+  FIX_LOOP,  /* shared routine calling jit_loop_enter */
+  FIX_EXIT   /* shared routine returning to interpreter */
+};
+
+struct Fixup {
+  uint32_t pos;    /* position of rel32 field */
+  uint32_t target;
+  int kind;
+};
+
+/* Slow path of an instruction , it steps the instruction in interpreter and
+ * jumps to the native entry of the pc interpreter leaves */
+struct Stub {
+  uint32_t pc;
+  uint32_t next;
+  int32_t target;
+};
+
+struct Assembler {
+  uint8_t* code_arr;
+  size_t code_size;
+  size_t code_cap;
+  struct Fixup* fix_arr;
+  size_t fix_size;
+  size_t fix_cap;
+  struct Stub* stub_arr;
+  size_t stub_size;
+  size_t stub_cap;
+  uint32_t* label; /* native offset of each instruction */
+  uint32_t* stub_label;
+  uint32_t step;
+  uint32_t loop;
+  uint32_t exit;
+  /* instruction being compiled */
+  struct Stub cur;
+  int cur_stub;
+  /* tier 2 state of BC_LOOP , see emit_loop */
+  struct JitLoop* loop_arr;
+  size_t loop_size;
+};
+
+/* Exit of a loop region */
+struct JitExit {
+  uint32_t pc;    /* baseline code continues at */
+  uint32_t depth; /* stack depth at pc */
+  int deopt;      /* a guard failed , otherwise the loop is done */
+};
+
+/* Status of a loop in tier 2 */
+enum {
+  LOOP_COLD,     /* not compiled yet */
+  LOOP_COMPILED,
+  LOOP_FAILED    /* stays in baseline code */
+};
+
+struct JitLoop {
+  int64_t hotness;          /* counted down by BC_LOOP template */
+  struct ObjProto* proto;
+  uint32_t pc;              /* pc of BC_LOOP */
+  int status;
+  void* code;               /* region , see JitRegion */
+  size_t size;
+  struct JitExit* exit_arr;
+  size_t exit_size;
+  size_t exit_cap;
+  uint32_t* guard_arr;      /* slots that must be numbers on entry */
+  size_t guard_size;
+  size_t guard_cap;
+  uint32_t depth;           /* stack depth at BC_LOOP */
+  uint32_t max_depth;       /* stack depth the region writes up to */
+  size_t deopt;             /* failed guards so far */
+};
+
+static const void* jit_loop_enter( struct JitState* , struct JitLoop* );
+
+static SPARROW_INLINE
+void emit8( struct Assembler* as , uint8_t byte ) {
+  if(SP_UNLIKELY(as->code_size == as->code_cap)) {
+    MemGrow((void**)&(as->code_arr),&(as->code_cap),1);
+  }
+  as->code_arr[as->code_size++] = byte;
+}
+
+static void emit32( struct Assembler* as , uint32_t v ) {
+  emit8(as,(uint8_t)v);
+  emit8(as,(uint8_t)(v>>8));
+  emit8(as,(uint8_t)(v>>16));
+  emit8(as,(uint8_t)(v>>24));
+}
+
+static void emit64( struct Assembler* as , uint64_t v ) {
+  emit32(as,(uint32_t)v);
+  emit32(as,(uint32_t)(v>>32));
+}
+
+static void patch32( struct Assembler* as , size_t pos , uint32_t v ) {
+  as->code_arr[pos] = (uint8_t)v;
+  as->code_arr[pos+1] = (uint8_t)(v>>8);
+  as->code_arr[pos+2] = (uint8_t)(v>>16);
+  as->code_arr[pos+3] = (uint8_t)(v>>24);
+}
+
+static void emit_rex( struct Assembler* as , int w , int reg , int rm ) {
+  uint8_t rex = (uint8_t)(0x40 | (w<<3) | ((reg>>3)<<2) | (rm>>3));
+  if(rex != 0x40) emit8(as,rex);
+}
+
+/* OPC reg , [base+disp32] , w is 1 for 64 bits registers */
+static void emit_mem( struct Assembler* as , int w , uint8_t opc , int reg ,
+    int base , int32_t disp ) {
+  emit_rex(as,w,reg,base);
+  emit8(as,opc);
+  emit8(as,(uint8_t)(0x80 | ((reg&7)<<3) | (base&7)));
+  if((base&7) == RSP) emit8(as,0x24); /* SIB , base only */
+  emit32(as,(uint32_t)disp);
+}
+
+#define emit_load(AS,DST,BASE,DISP) emit_mem(AS,1,0x8b,DST,BASE,DISP)
+#define emit_lea(AS,DST,BASE,DISP) emit_mem(AS,1,0x8d,DST,BASE,DISP)
+#define emit_store(AS,BASE,DISP,SRC) emit_mem(AS,1,0x89,SRC,BASE,DISP)
+
+/* OPC rm , reg , w is 1 for 64 bits registers */
+static void emit_rr( struct Assembler* as , int w , uint8_t opc , int reg ,
+    int rm ) {
+  emit_rex(as,w,reg,rm);
+  emit8(as,opc);
+  emit8(as,(uint8_t)(0xc0 | ((reg&7)<<3) | (rm&7)));
+}
+
+#define emit_mov(AS,DST,SRC) emit_rr(AS,1,0x89,SRC,DST)
+#define emit_cmp(AS,L,R) emit_rr(AS,1,0x39,R,L)
+#define emit_add(AS,DST,SRC) emit_rr(AS,1,0x01,SRC,DST)
+#define emit_sub(AS,DST,SRC) emit_rr(AS,1,0x29,SRC,DST)
+
+static void emit_mov_imm64( struct Assembler* as , int reg , uint64_t imm ) {
+  emit_rex(as,1,0,reg);
+  emit8(as,(uint8_t)(0xb8 | (reg&7)));
+  emit64(as,imm);
+}
+
+static void emit_mov_imm32( struct Assembler* as , int reg , uint32_t imm ) {
+  emit_rex(as,0,0,reg);
+  emit8(as,(uint8_t)(0xb8 | (reg&7)));
+  emit32(as,imm);
+}
+
+/* add/sub reg , imm32 */
+static void emit_addi( struct Assembler* as , int reg , int32_t imm ) {
+  emit_rex(as,1,0,reg);
+  emit8(as,0x81);
+  if(imm >= 0) {
+    emit8(as,(uint8_t)(0xc0 | (reg&7)));
+    emit32(as,(uint32_t)imm);
+  } else {
+    emit8(as,(uint8_t)(0xe8 | (reg&7)));
+    emit32(as,(uint32_t)(-imm));
+  }
+}
+
+static void emit_push( struct Assembler* as , int reg ) {
+  if(reg >= R8) emit8(as,0x41);
+  emit8(as,(uint8_t)(0x50 | (reg&7)));
+}
+
+static void emit_pop( struct Assembler* as , int reg ) {
+  if(reg >= R8) emit8(as,0x41);
+  emit8(as,(uint8_t)(0x58 | (reg&7)));
+}
+
+/* movq xmm , gpr and movq gpr , xmm , only for RAX/RCX and XMM0/XMM1 */
+static void emit_movq_xr( struct Assembler* as , int xmm , int reg ) {
+  emit8(as,0x66); emit8(as,0x48); emit8(as,0x0f); emit8(as,0x6e);
+  emit8(as,(uint8_t)(0xc0 | (xmm<<3) | reg));
+}
+
+static void emit_movq_rx( struct Assembler* as , int reg , int xmm ) {
+  emit8(as,0x66); emit8(as,0x48); emit8(as,0x0f); emit8(as,0x7e);
+  emit8(as,(uint8_t)(0xc0 | (xmm<<3) | reg));
+}
+
+/* addsd/subsd/mulsd/divsd xmm0 , xmm1 */
+static void emit_sd( struct Assembler* as , int jop ) {
+  static const uint8_t opc[] = { 0x58, 0x5c, 0x59, 0x5e };
+  emit8(as,0xf2); emit8(as,0x0f); emit8(as,opc[jop]);
+  emit8(as,0xc1);
+}
+
+/* ucomisd xmm(l) , xmm(r) */
+static void emit_ucomisd( struct Assembler* as , int l , int r ) {
+  emit8(as,0x66); emit8(as,0x0f); emit8(as,0x2e);
+  emit8(as,(uint8_t)(0xc0 | (l<<3) | r));
+}
+
+/* setcc al/cl */
+static void emit_setcc( struct Assembler* as , int cc , int reg ) {
+  emit8(as,0x0f); emit8(as,(uint8_t)(0x90 | cc));
+  emit8(as,(uint8_t)(0xc0 | reg));
+}
+
+static void emit_fixup( struct Assembler* as , int kind , uint32_t target ) {
+  struct Fixup fix;
+  fix.pos = (uint32_t)as->code_size;
+  fix.target = target;
+  fix.kind = kind;
+  DynArrPush(as,fix,fix);
+  emit32(as,0);
+}
+
+/* jmp/jcc rel32 , cc is -1 for jmp */
+static void emit_jump( struct Assembler* as , int cc , int kind ,
+    uint32_t target ) {
+  if(cc < 0) {
+    emit8(as,0xe9);
+  } else {
+    emit8(as,0x0f);
+    emit8(as,(uint8_t)(0x80 | cc));
+  }
+  emit_fixup(as,kind,target);
+}
+
+/* Forward jcc inside of a template , patched by emit_bind */
+static size_t emit_jump_forward( struct Assembler* as , int cc ) {
+  emit8(as,0x0f);
+  emit8(as,(uint8_t)(0x80 | cc));
+  emit32(as,0);
+  return as->code_size - 4;
+}
+
+static void emit_bind( struct Assembler* as , size_t pos ) {
+  patch32(as,pos,(uint32_t)(as->code_size - (pos+4)));
+}
+
+/* Slow path of current instruction , created on demand */
+static uint32_t stub( struct Assembler* as ) {
+  if(as->cur_stub < 0) {
+    as->cur_stub = (int)as->stub_size;
+    DynArrPush(as,stub,as->cur);
+  }
+  return (uint32_t)as->cur_stub;
+}
+
+/* Jump to the native entry of the pc returned by JitStep */
+static void emit_successor( struct Assembler* as , const struct Stub* s ,
+    int fallthrough ) {
+  if(s->target >= 0) {
+    emit8(as,0x3d); emit32(as,(uint32_t)s->target); /* cmp eax , imm32 */
+    emit_jump(as,CC_E,FIX_LABEL,(uint32_t)s->target);
+  }
+  emit8(as,0x3d); emit32(as,s->next);
+  if(fallthrough) {
+    emit_jump(as,CC_NE,FIX_EXIT,0);
+  } else {
+    emit_jump(as,CC_E,FIX_LABEL,s->next);
+    emit_jump(as,-1,FIX_EXIT,0);
+  }
+}
+
+/* Execute an instruction in interpreter */
+static void emit_step( struct Assembler* as , const struct Stub* s ,
+    int fallthrough ) {
+  emit_mov_imm32(as,RSI,s->pc);
+  emit8(as,0xe8); /* call rel32 */
+  emit_fixup(as,FIX_STEP,0);
+  emit8(as,0x85); emit8(as,0xc0); /* test eax , eax */
+  emit_jump(as,CC_S,FIX_EXIT,0);
+  emit_successor(as,s,fallthrough);
+}
+
+static void emit_exit( struct Assembler* as , uint32_t pc ) {
+  emit_mov_imm32(as,RAX,pc);
+  emit_jump(as,-1,FIX_EXIT,0);
+}
+
+/* Stack needs one more slot */
+static void emit_capacity( struct Assembler* as ) {
+  emit_cmp(as,REG_TOP,REG_LIMIT);
+  emit_jump(as,CC_AE,FIX_STUB,stub(as));
+}
+
+static struct Operand operand_stack( int idx ) {
+  struct Operand ret;
+  ret.kind = OPERAND_STACK;
+  ret.disp = -8 * (idx+1);
+  ret.bits = 0;
+  ret.nonzero = 0;
+  return ret;
+}
+
+static struct Operand operand_reg( uint32_t idx ) {
+  struct Operand ret;
+  ret.kind = OPERAND_REG;
+  ret.disp = (int32_t)(8 * idx);
+  ret.bits = 0;
+  ret.nonzero = 0;
+  return ret;
+}
+
+static struct Operand operand_num( double num ) {
+  struct Operand ret;
+  Value v;
+  Vset_number(&v,num);
+  ret.kind = OPERAND_NUM;
+  ret.disp = 0;
+  ret.bits = v.ipart;
+  ret.nonzero = 0;
+  return ret;
+}
+
+static struct Operand operand_nonzero( struct Operand opd ) {
+  opd.nonzero = 1;
+  return opd;
+}
+
+/* Load a number operand into reg , goes to slow path if it is not */
+static void emit_operand( struct Assembler* as , int reg ,
+    const struct Operand* opd ) {
+  if(opd->kind == OPERAND_NUM) {
+    emit_mov_imm64(as,reg,opd->bits);
+  } else {
+    emit_load(as,reg,opd->kind == OPERAND_STACK ? REG_TOP : REG_BASE,
+        opd->disp);
+    emit_cmp(as,reg,REG_NUMBER);
+    emit_jump(as,CC_AE,FIX_STUB,stub(as));
+  }
+  if(opd->nonzero) {
+    /* both +0 and -0 */
+    if(opd->kind == OPERAND_NUM) {
+      if(!(opd->bits << 1)) emit_jump(as,-1,FIX_STUB,stub(as));
+    } else {
+      emit_mov(as,RDX,reg);
+      emit_add(as,RDX,RDX);
+      emit_jump(as,CC_E,FIX_STUB,stub(as));
+    }
+  }
+}
+
+/* Compare XMM0 with XMM1 , the result is in AL */
+static void emit_cond( struct Assembler* as , int jop ) {
+  switch(jop) {
+    case JIT_LT: emit_ucomisd(as,1,0); emit_setcc(as,CC_A,RAX); break;
+    case JIT_LE: emit_ucomisd(as,1,0); emit_setcc(as,CC_AE,RAX); break;
+    case JIT_GT: emit_ucomisd(as,0,1); emit_setcc(as,CC_A,RAX); break;
+    case JIT_GE: emit_ucomisd(as,0,1); emit_setcc(as,CC_AE,RAX); break;
+    case JIT_EQ:
+      emit_ucomisd(as,0,1);
+      emit_setcc(as,CC_E,RAX);
+      emit_setcc(as,CC_NP,RCX);
+      emit8(as,0x20); emit8(as,0xc8); /* and al , cl */
+      break;
+    default:
+      assert(jop == JIT_NE);
+      emit_ucomisd(as,0,1);
+      emit_setcc(as,CC_NE,RAX);
+      emit_setcc(as,CC_P,RCX);
+      emit8(as,0x08); emit8(as,0xc8); /* or al , cl */
+      break;
+  }
+}
+
+static void emit_operands( struct Assembler* as ,
+    const struct Operand* l , const struct Operand* r ) {
+  emit_operand(as,RAX,l);
+  emit_operand(as,RCX,r);
+  emit_movq_xr(as,0,RAX);
+  emit_movq_xr(as,1,RCX);
+}
+
+static void emit_binary( struct Assembler* as , int jop ,
+    struct Operand l , struct Operand r , int dest , uint32_t dreg ) {
+  if(dest == DEST_PUSH) emit_capacity(as);
+  emit_operands(as,&l,&r);
+  if(jop <= JIT_DIV) {
+    emit_sd(as,jop);
+    emit_movq_rx(as,RAX,0);
+  } else {
+    /* VALUE_FALSE - cond * ( VALUE_FALSE - VALUE_TRUE ) */
+    emit_cond(as,jop);
+    emit8(as,0x0f); emit8(as,0xb6); emit8(as,0xc0); /* movzx eax , al */
+    emit8(as,0x48); emit8(as,0xc1); emit8(as,0xe0); emit8(as,44); /* shl */
+    emit_mov_imm64(as,RCX,VALUE_FALSE);
+    emit_sub(as,RCX,RAX);
+    emit_mov(as,RAX,RCX);
+  }
+  switch(dest) {
+    case DEST_PUSH:
+      emit_store(as,REG_TOP,0,RAX);
+      emit_addi(as,REG_TOP,8);
+      break;
+    case DEST_REPLACE:
+      emit_store(as,REG_TOP,-8,RAX);
+      break;
+    case DEST_POP:
+      emit_store(as,REG_TOP,-16,RAX);
+      emit_addi(as,REG_TOP,-8);
+      break;
+    default:
+      emit_store(as,REG_BASE,(int32_t)(8*dreg),RAX);
+      break;
+  }
+}
+
+/* Compare and BC_JF */
+static void emit_compare_jf( struct Assembler* as , int jop ,
+    struct Operand l , struct Operand r ) {
+  emit_operands(as,&l,&r);
+  emit_cond(as,jop);
+  emit8(as,0x84); emit8(as,0xc0); /* test al , al */
+  emit_jump(as,CC_E,FIX_LABEL,(uint32_t)as->cur.target);
+  emit_jump(as,-1,FIX_LABEL,as->cur.next);
+}
+
+static void emit_push_imm( struct Assembler* as , uint64_t bits ) {
+  emit_capacity(as);
+  emit_mov_imm64(as,RAX,bits);
+  emit_store(as,REG_TOP,0,RAX);
+  emit_addi(as,REG_TOP,8);
+}
+
+static void emit_move_imm( struct Assembler* as , uint32_t idx ,
+    uint64_t bits ) {
+  emit_mov_imm64(as,RAX,bits);
+  emit_store(as,REG_BASE,(int32_t)(8*idx),RAX);
+}
+
+/* Branch on stack top , the jump is taken when it is jv and not taken when it
+ * is fv. Other values are converted to boolean by interpreter */
+static void emit_branch( struct Assembler* as , uint64_t jv , uint64_t fv ,
+    int pop_on_jump , uint32_t target ) {
+  size_t l1;
+  emit_load(as,RAX,REG_TOP,-8);
+  emit_mov_imm64(as,RCX,jv);
+  emit_cmp(as,RAX,RCX);
+  l1 = emit_jump_forward(as,CC_NE);
+  if(pop_on_jump) emit_addi(as,REG_TOP,-8);
+  emit_jump(as,-1,FIX_LABEL,target);
+  emit_bind(as,l1);
+  emit_mov_imm64(as,RCX,fv);
+  emit_cmp(as,RAX,RCX);
+  emit_jump(as,CC_NE,FIX_STUB,stub(as));
+  emit_addi(as,REG_TOP,-8);
+}
+
+/* Loop iterator helpers called by native code. A for loop over loop() runs
+ * natively , the other iterators return -1 and the instruction is stepped */
+static int jit_forloop( Value* itr ) {
+  struct ObjLoopIterator* litr;
+  if(!Vis_loop_iterator(itr)) return -1;
+  litr = Vget_loop_iterator(itr);
+  litr->index += litr->step; /* move */
+  return litr->index < litr->end;
+}
+
+static int jit_idrefk( Value* itr ) {
+  if(!Vis_loop_iterator(itr)) return -1;
+  Vset_number(itr+1,Vget_loop_iterator(itr)->index);
+  return 0;
+}
+
+/* Call a helper with the stack slot at disp of REG_TOP , a negative result
+ * goes to slow path */
+static void emit_helper( struct Assembler* as , int (*helper)( Value* ) ,
+    int32_t disp ) {
+  emit_lea(as,RDI,REG_TOP,disp);
+  emit_mov_imm64(as,RAX,(uint64_t)(uintptr_t)helper);
+  emit8(as,0xff); emit8(as,0xd0); /* call rax */
+  emit8(as,0x85); emit8(as,0xc0); /* test eax , eax */
+  emit_jump(as,CC_S,FIX_STUB,stub(as));
+}
+
+/* BC_FORLOOP , the iterator is popc slots below stack top */
+static void emit_forloop( struct Assembler* as , uint32_t popc ) {
+  emit_helper(as,jit_forloop,-8*(int32_t)(popc+1));
+  if(popc) emit_addi(as,REG_TOP,-(int32_t)(8*popc));
+  emit8(as,0x85); emit8(as,0xc0); /* test eax , eax */
+  emit_jump(as,CC_NE,FIX_LABEL,(uint32_t)as->cur.target);
+  emit_jump(as,-1,FIX_LABEL,as->cur.next);
+}
+
+/* BC_FORLOOPN , the hidden slots are popc slots below stack top. They always
+ * hold numbers so there is no guard */
+static void emit_forloopn( struct Assembler* as , uint32_t popc ) {
+  if(popc) emit_addi(as,REG_TOP,-(int32_t)(8*popc));
+  emit_load(as,RAX,REG_TOP,-24);
+  emit_load(as,RCX,REG_TOP,-8);
+  emit_movq_xr(as,0,RAX);
+  emit_movq_xr(as,1,RCX);
+  emit_sd(as,JIT_ADD);
+  emit_movq_rx(as,RAX,0);
+  emit_store(as,REG_TOP,-24,RAX);
+  emit_load(as,RCX,REG_TOP,-16);
+  emit_movq_xr(as,1,RCX);
+  emit_ucomisd(as,1,0); /* end > index */
+  emit_jump(as,CC_A,FIX_LABEL,(uint32_t)as->cur.target);
+  emit_jump(as,-1,FIX_LABEL,as->cur.next);
+}
+
+/* BC_LOOP counts down the hotness of its loop , a hot loop is entered in
+ * tier 2 and the native entry of the pc where the region exits is jumped
+ * to. Otherwise it goes on with the loop body */
+static void emit_loop( struct Assembler* as , struct ObjProto* proto ) {
+  struct JitLoop* loop = as->loop_arr + as->loop_size++;
+  size_t l1 , l2;
+  memset(loop,0,sizeof(*loop));
+  loop->hotness = SPARROW_JIT_LOOP_THRESHOLD;
+  loop->proto = proto;
+  loop->pc = as->cur.pc;
+  emit_mov_imm64(as,RAX,(uint64_t)(uintptr_t)&(loop->hotness));
+  emit8(as,0x48); emit8(as,0x83); emit8(as,0x28); emit8(as,0x01); /* sub */
+  l1 = emit_jump_forward(as,CC_NE);
+  emit_mov_imm64(as,RSI,(uint64_t)(uintptr_t)loop);
+  emit8(as,0xe8); /* call rel32 */
+  emit_fixup(as,FIX_LOOP,0);
+  emit8(as,0x48); emit8(as,0x85); emit8(as,0xc0); /* test rax , rax */
+  l2 = emit_jump_forward(as,CC_E);
+  emit8(as,0xff); emit8(as,0xe0); /* jmp rax */
+  emit_bind(as,l1);
+  emit_bind(as,l2);
+}
+
+static int32_t jump_target( uint32_t ins ) {
+  switch(BCINS_OP(ins)) {
+    case BC_JMP: case BC_JT: case BC_JF: case BC_BRT: case BC_BRF:
+    case BC_FORPREP: case BC_FORLOOP:
+    case BC_FORPREPN: case BC_FORPREPR: case BC_FORLOOPN:
+      return (int32_t)BCINS_A(ins);
+    default:
+      return -1;
+  }
+}
+
+/* Instructions leave native code , interpreter takes care of them */
+static int is_exit( int op ) {
+  switch(op) {
+    case BC_CALL: case BC_CALL0: case BC_CALL1: case BC_CALL2:
+    case BC_CALL3: case BC_CALL4:
+    case BC_RET: case BC_RETN: case BC_RETS: case BC_RETT: case BC_RETF:
+    case BC_RETN0: case BC_RETN1: case BC_RETNN1: case BC_RETNULL:
+    case BC_OP: case BC_A:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+/* Emit template of an instruction , returns -1 if it has no template */
+static int emit_template( struct Assembler* as , struct ObjProto* proto ,
+    int op , uint32_t opr ) {
+  Value v;
+  const double* num = proto->num_arr;
+
+#define NUM(IDX) operand_num(num[IDX])
+#define STK(IDX) operand_stack(IDX)
+#define REG(IDX) operand_reg(IDX)
+#define NZ(OPD) operand_nonzero(OPD)
+
+  switch(op) {
+    /* NV , VN and VV */
+#define DO(INSTR,JOP) \
+    case BC_##INSTR##NV: \
+      emit_binary(as,JOP,NUM(opr),STK(0),DEST_REPLACE,0); return 0; \
+    case BC_##INSTR##VN: \
+      emit_binary(as,JOP,STK(0),NUM(opr),DEST_REPLACE,0); return 0; \
+    case BC_##INSTR##VV: \
+      emit_binary(as,JOP,STK(1),STK(0),DEST_POP,0); return 0;
+
+    DO(ADD,JIT_ADD)
+    DO(SUB,JIT_SUB)
+    DO(MUL,JIT_MUL)
+    DO(LT,JIT_LT)
+    DO(LE,JIT_LE)
+    DO(GT,JIT_GT)
+    DO(GE,JIT_GE)
+    DO(EQ,JIT_EQ)
+    DO(NE,JIT_NE)
+
+#undef DO /* DO */
+
+    /* interpreter checks the left operand of BC_DIVVN against zero */
+    case BC_DIVNV:
+      emit_binary(as,JIT_DIV,NUM(opr),NZ(STK(0)),DEST_REPLACE,0); return 0;
+    case BC_DIVVN:
+      emit_binary(as,JIT_DIV,NZ(STK(0)),NUM(opr),DEST_REPLACE,0); return 0;
+    case BC_DIVVV: case BC_DIVNN:
+      emit_binary(as,JIT_DIV,STK(1),NZ(STK(0)),DEST_POP,0); return 0;
+
+    /* quickened VV */
+#define DO(INSTR,JOP) \
+    case BC_##INSTR##NN: \
+      emit_binary(as,JOP,STK(1),STK(0),DEST_POP,0); return 0;
+
+    DO(ADD,JIT_ADD)
+    DO(SUB,JIT_SUB)
+    DO(MUL,JIT_MUL)
+    DO(LT,JIT_LT)
+    DO(LE,JIT_LE)
+    DO(GT,JIT_GT)
+    DO(GE,JIT_GE)
+
+#undef DO /* DO */
+
+    /* register instructions , generic ones and quickened ones */
+#define DO(INSTR,JOP,R) \
+    case BC_##INSTR##LL: case BC_##INSTR##LLNN: \
+      emit_binary(as,JOP,REG(BCREG2_B(opr)),R(REG(BCREG2_C(opr))), \
+          DEST_PUSH,0); \
+      return 0; \
+    case BC_R##INSTR##LL: case BC_R##INSTR##LLNN: \
+      emit_binary(as,JOP,REG(BCREG3_B(opr)),R(REG(BCREG3_C(opr))), \
+          DEST_REG,BCREG3_A(opr)); \
+      return 0;
+
+    DO(ADD,JIT_ADD,)
+    DO(SUB,JIT_SUB,)
+    DO(MUL,JIT_MUL,)
+    DO(DIV,JIT_DIV,NZ)
+
+#undef DO /* DO */
+
+#define DO(INSTR,JOP) \
+    case BC_##INSTR##LL: case BC_##INSTR##LLNN: \
+      emit_binary(as,JOP,REG(BCREG2_B(opr)),REG(BCREG2_C(opr)), \
+          DEST_PUSH,0); \
+      return 0;
+
+    DO(LT,JIT_LT)
+    DO(LE,JIT_LE)
+    DO(GT,JIT_GT)
+    DO(GE,JIT_GE)
+
+#undef DO /* DO */
+
+    case BC_EQLL:
+      emit_binary(as,JIT_EQ,REG(BCREG2_B(opr)),REG(BCREG2_C(opr)),
+          DEST_PUSH,0);
+      return 0;
+    case BC_NELL:
+      emit_binary(as,JIT_NE,REG(BCREG2_B(opr)),REG(BCREG2_C(opr)),
+          DEST_PUSH,0);
+      return 0;
+
+#define DO(INSTR,JOP) \
+    case BC_##INSTR##LN: \
+      emit_binary(as,JOP,REG(BCREG2_B(opr)),NUM(BCREG2_C(opr)), \
+          DEST_PUSH,0); \
+      return 0;
+
+    DO(ADD,JIT_ADD)
+    DO(SUB,JIT_SUB)
+    DO(MUL,JIT_MUL)
+    DO(LT,JIT_LT)
+    DO(LE,JIT_LE)
+    DO(GT,JIT_GT)
+    DO(GE,JIT_GE)
+    DO(EQ,JIT_EQ)
+    DO(NE,JIT_NE)
+
+#undef DO /* DO */
+
+#define DO(INSTR,JOP) \
+    case BC_R##INSTR##LN: \
+      emit_binary(as,JOP,REG(BCREG3_B(opr)),NUM(BCREG3_C(opr)), \
+          DEST_REG,BCREG3_A(opr)); \
+      return 0;
+
+    DO(ADD,JIT_ADD)
+    DO(SUB,JIT_SUB)
+    DO(MUL,JIT_MUL)
+
+#undef DO /* DO */
+
+    /* compare and BC_JF */
+#define DO(INSTR,JOP) \
+    case BC_##INSTR##LNJF: \
+      emit_compare_jf(as,JOP,REG(BCREG2_B(opr)),NUM(BCREG2_C(opr))); \
+      return 0; \
+    case BC_##INSTR##LLJF: \
+      emit_compare_jf(as,JOP,REG(BCREG2_B(opr)),REG(BCREG2_C(opr))); \
+      return 0;
+
+    DO(LT,JIT_LT)
+    DO(LE,JIT_LE)
+    DO(GT,JIT_GT)
+    DO(GE,JIT_GE)
+    DO(EQ,JIT_EQ)
+    DO(NE,JIT_NE)
+
+#undef DO /* DO */
+
+    /* loads */
+    case BC_LOADN:
+      emit_push_imm(as,NUM(opr).bits); return 0;
+    case BC_LOADN0: emit_push_imm(as,operand_num(0).bits); return 0;
+    case BC_LOADN1: emit_push_imm(as,operand_num(1).bits); return 0;
+    case BC_LOADN2: emit_push_imm(as,operand_num(2).bits); return 0;
+    case BC_LOADN3: emit_push_imm(as,operand_num(3).bits); return 0;
+    case BC_LOADN4: emit_push_imm(as,operand_num(4).bits); return 0;
+    case BC_LOADN5: emit_push_imm(as,operand_num(5).bits); return 0;
+    case BC_LOADNN1: emit_push_imm(as,operand_num(-1).bits); return 0;
+    case BC_LOADNN2: emit_push_imm(as,operand_num(-2).bits); return 0;
+    case BC_LOADNN3: emit_push_imm(as,operand_num(-3).bits); return 0;
+    case BC_LOADNN4: emit_push_imm(as,operand_num(-4).bits); return 0;
+    case BC_LOADNN5: emit_push_imm(as,operand_num(-5).bits); return 0;
+    case BC_LOADS:
+      Vset_str(&v,proto->str_arr[opr]);
+      emit_push_imm(as,v.ipart);
+      return 0;
+    case BC_LOADNULL: emit_push_imm(as,VALUE_NULL); return 0;
+    case BC_LOADTRUE: emit_push_imm(as,VALUE_TRUE); return 0;
+    case BC_LOADFALSE: emit_push_imm(as,VALUE_FALSE); return 0;
+    case BC_LOADV:
+      emit_capacity(as);
+      emit_load(as,RAX,REG_BASE,(int32_t)(8*opr));
+      emit_store(as,REG_TOP,0,RAX);
+      emit_addi(as,REG_TOP,8);
+      return 0;
+
+    /* moves */
+    case BC_MOVE:
+      emit_load(as,RAX,REG_TOP,-8);
+      emit_store(as,REG_BASE,(int32_t)(8*opr),RAX);
+      emit_addi(as,REG_TOP,-8);
+      return 0;
+    case BC_MOVETRUE: emit_move_imm(as,opr,VALUE_TRUE); return 0;
+    case BC_MOVEFALSE: emit_move_imm(as,opr,VALUE_FALSE); return 0;
+    case BC_MOVENULL: emit_move_imm(as,opr,VALUE_NULL); return 0;
+    case BC_MOVEN0: emit_move_imm(as,opr,operand_num(0).bits); return 0;
+    case BC_MOVEN1: emit_move_imm(as,opr,operand_num(1).bits); return 0;
+    case BC_MOVEN2: emit_move_imm(as,opr,operand_num(2).bits); return 0;
+    case BC_MOVEN3: emit_move_imm(as,opr,operand_num(3).bits); return 0;
+    case BC_MOVEN4: emit_move_imm(as,opr,operand_num(4).bits); return 0;
+    case BC_MOVEN5: emit_move_imm(as,opr,operand_num(5).bits); return 0;
+    case BC_MOVENN1: emit_move_imm(as,opr,operand_num(-1).bits); return 0;
+    case BC_MOVENN2: emit_move_imm(as,opr,operand_num(-2).bits); return 0;
+    case BC_MOVENN3: emit_move_imm(as,opr,operand_num(-3).bits); return 0;
+    case BC_MOVENN4: emit_move_imm(as,opr,operand_num(-4).bits); return 0;
+    case BC_MOVENN5: emit_move_imm(as,opr,operand_num(-5).bits); return 0;
+
+    case BC_POP:
+      if(opr) emit_addi(as,REG_TOP,-(int32_t)(8*opr));
+      return 0;
+    /* function hotness is only meaningful to the interpreter */
+    case BC_NOP: case BC_CLOSURE:
+      return 0;
+    case BC_LOOP:
+      emit_loop(as,proto);
+      return 0;
+
+    /* for loop over loop() */
+    case BC_IDREFK:
+      emit_capacity(as);
+      emit_helper(as,jit_idrefk,-8);
+      emit_addi(as,REG_TOP,8);
+      return 0;
+    case BC_FORLOOP:
+      emit_forloop(as,0);
+      return 0;
+    case BC_POPFORLOOP:
+      emit_forloop(as,opr);
+      return 0;
+
+    /* numeric for loop , its prolog is stepped */
+    case BC_FORLOOPN:
+      emit_forloopn(as,0);
+      return 0;
+    case BC_POPFORLOOPN:
+      emit_forloopn(as,opr);
+      return 0;
+
+    /* jumps */
+    case BC_JMP:
+      emit_jump(as,-1,FIX_LABEL,opr);
+      return 0;
+    case BC_JT:
+      emit_branch(as,VALUE_TRUE,VALUE_FALSE,1,opr);
+      return 0;
+    case BC_JF:
+      emit_branch(as,VALUE_FALSE,VALUE_TRUE,1,opr);
+      return 0;
+    case BC_BRT:
+      emit_branch(as,VALUE_TRUE,VALUE_FALSE,0,opr);
+      return 0;
+    case BC_BRF:
+      emit_branch(as,VALUE_FALSE,VALUE_TRUE,0,opr);
+      return 0;
+
+    default:
+      return -1;
+  }
+
+#undef NZ /* NZ */
+#undef REG /* REG */
+#undef STK /* STK */
+#undef NUM /* NUM */
+}
+
+static void assembler_destroy( struct Assembler* as ) {
+  free(as->code_arr);
+  free(as->fix_arr);
+  free(as->stub_arr);
+  free(as->stub_label);
+}
+
+/* Shared routine calling fn( JitState , RSI ) , REG_TOP is synced before and
+ * all pinned registers are reloaded after */
+static uint32_t emit_routine( struct Assembler* as , uint64_t fn ) {
+  uint32_t pos = (uint32_t)as->code_size;
+  emit_addi(as,RSP,-8);
+  emit_store(as,REG_STATE,offsetof(struct JitState,top),REG_TOP);
+  emit_mov(as,RDI,REG_STATE);
+  emit_mov_imm64(as,RAX,fn);
+  emit8(as,0xff); emit8(as,0xd0); /* call rax */
+  emit_load(as,REG_BASE,REG_STATE,offsetof(struct JitState,base));
+  emit_load(as,REG_TOP,REG_STATE,offsetof(struct JitState,top));
+  emit_load(as,REG_LIMIT,REG_STATE,offsetof(struct JitState,limit));
+  emit_addi(as,RSP,8);
+  emit8(as,0xc3); /* ret */
+  return pos;
+}
+
+static void link_fixups( struct Assembler* as ) {
+  size_t i;
+  for( i = 0 ; i < as->fix_size ; ++i ) {
+    const struct Fixup* fix = as->fix_arr + i;
+    uint32_t target;
+    switch(fix->kind) {
+      case FIX_LABEL: target = as->label[fix->target]; break;
+      case FIX_STUB: target = as->stub_label[fix->target]; break;
+      case FIX_STEP: target = as->step; break;
+      case FIX_LOOP: target = as->loop; break;
+      default: target = as->exit; break;
+    }
+    patch32(as,fix->pos,target - (fix->pos+4));
+  }
+}
+
+static void compile( struct Assembler* as , struct ObjProto* proto ) {
+  const uint32_t* code = proto->code_buf.buf;
+  uint32_t n = (uint32_t)proto->code_buf.pos;
+  uint32_t i;
+
+  /* prologue */
+  emit_push(as,RBX);
+  emit_push(as,RBP);
+  emit_push(as,R12);
+  emit_push(as,R13);
+  emit_push(as,R14);
+  emit_push(as,R15);
+  emit_addi(as,RSP,-8); /* align stack to 16 bytes */
+  emit_mov(as,REG_STATE,RDI);
+  emit_load(as,REG_BASE,REG_STATE,offsetof(struct JitState,base));
+  emit_load(as,REG_TOP,REG_STATE,offsetof(struct JitState,top));
+  emit_load(as,REG_LIMIT,REG_STATE,offsetof(struct JitState,limit));
+  emit_mov_imm64(as,REG_NUMBER,VALUE_NUMBER);
+  emit8(as,0xff); emit8(as,0xe6); /* jmp rsi */
+
+  for( i = 0 ; i < n ; ++i ) {
+    int op = BCINS_OP(code[i]);
+    int first = BytecodeUnfuse(op);
+    as->label[i] = (uint32_t)as->code_size;
+    as->cur.pc = i;
+    as->cur_stub = -1;
+    if(first != SIZE_OF_BYTECODE && i+1 < n) {
+      /* interpreter executes both instructions of a superinstruction , the
+       * ones without template are stepped as a whole. BC_LOADVLOADV is just
+       * compiled as its first BC_LOADV */
+      as->cur.next = i+2;
+      as->cur.target = jump_target(code[i+1]);
+      if(op == BC_LOADVLOADV) op = first;
+    } else {
+      as->cur.next = i+1;
+      as->cur.target = jump_target(code[i]);
+    }
+
+    if(is_exit(op)) {
+      emit_exit(as,i);
+    } else if(emit_template(as,proto,op,BCINS_A(code[i]))) {
+      emit_step(as,&(as->cur),as->cur.next == i+1);
+    }
+  }
+  as->label[n] = (uint32_t)as->code_size;
+  emit_exit(as,n);
+
+  /* slow paths */
+  as->stub_label = malloc(sizeof(uint32_t)*(as->stub_size+1));
+  for( i = 0 ; i < as->stub_size ; ++i ) {
+    as->stub_label[i] = (uint32_t)as->code_size;
+    emit_step(as,as->stub_arr+i,0);
+  }
+
+  as->step = emit_routine(as,(uint64_t)(uintptr_t)&JitStep);
+  as->loop = emit_routine(as,(uint64_t)(uintptr_t)&jit_loop_enter);
+
+  /* epilogue , EAX holds the pc */
+  as->exit = (uint32_t)as->code_size;
+  emit_store(as,REG_STATE,offsetof(struct JitState,top),REG_TOP);
+  emit_addi(as,RSP,8);
+  emit_pop(as,R15);
+  emit_pop(as,R14);
+  emit_pop(as,R13);
+  emit_pop(as,R12);
+  emit_pop(as,RBP);
+  emit_pop(as,RBX);
+  emit8(as,0xc3);
+
+  link_fixups(as);
+}
+
+/* Copy code into executable memory , returns NULL if the code cache is full */
+static void* install( struct Sparrow* sparrow , const struct Assembler* as ,
+    size_t* size ) {
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  void* mem;
+  *size = (as->code_size + page - 1) & ~(page-1);
+  if(sparrow->jit_size + *size > SPARROW_JIT_CACHE_SIZE) return NULL;
+  mem = mmap(NULL,*size,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+  if(mem == MAP_FAILED) return NULL;
+  memcpy(mem,as->code_arr,as->code_size);
+  if(mprotect(mem,*size,PROT_READ|PROT_EXEC)) {
+    munmap(mem,*size);
+    return NULL;
+  }
+  sparrow->jit_size += *size;
+  return mem;
+}
+
+int JitCompile( struct Sparrow* sparrow , struct ObjProto* proto ) {
+  struct Assembler as;
+  size_t size , i , nloop = 0;
+  void* mem;
+
+  if(proto->code_buf.pos == 0) return -1;
+  memset(&as,0,sizeof(as));
+  for( i = 0 ; i < proto->code_buf.pos ; ++i ) {
+    if(BCINS_OP(proto->code_buf.buf[i]) == BC_LOOP) ++nloop;
+  }
+  as.label = malloc(sizeof(uint32_t)*(proto->code_buf.pos+1));
+  as.loop_arr = malloc(sizeof(struct JitLoop)*(nloop+1));
+  compile(&as,proto);
+
+  if(!(mem = install(sparrow,&as,&size))) {
+    free(as.label);
+    free(as.loop_arr);
+    assembler_destroy(&as);
+    return -1;
+  }
+  proto->jit = malloc(sizeof(struct JitCode));
+  proto->jit->code = mem;
+  proto->jit->size = size;
+  proto->jit->map = as.label;
+  proto->jit->loop_arr = as.loop_arr;
+  proto->jit->loop_size = as.loop_size;
+  assembler_destroy(&as);
+  return 0;
+}
+
+int JitRun( struct Runtime* rt , struct ObjProto* proto ) {
+  struct CallThread* thread = RTCallThread(rt);
+  struct CallFrame* frame = RTCurFrame(rt);
+  struct JitState st;
+  JitEntry entry = (JitEntry)(proto->jit->code);
+  int pc;
+
+  st.rt = rt;
+  st.base = thread->stack + frame->base_ptr;
+  st.top = thread->stack + thread->stack_size;
+  st.limit = thread->stack + thread->stack_cap;
+  pc = entry(&st,(const uint8_t*)(proto->jit->code) +
+      proto->jit->map[frame->pc]);
+  if(pc < 0) return -1;
+
+  /* the stack and frames may be reallocated by JitStep */
+  thread->stack_size = (size_t)(st.top - thread->stack);
+  RTCurFrame(rt)->pc = (size_t)pc;
+  return 0;
+}
+
+/* ==================================================
+ * Tier 2 , loop regions
+ * =================================================*/
+
+/* A region is called with base of current frame and the hidden slots of
+ * its loop , it returns the index of the exit it takes */
+typedef int (*JitRegion)( Value* , Value* );
+
+/* Pinned registers of a region , all of them are callee saved. REG_BASE is
+ * the same as baseline code. The hidden slots hold int values , so index ,
+ * end and step are kept as 64 bits integers which never overflow */
+#define REG_SLOT R14  /* hidden slots , index , end and step */
+#define REG_INDEX R15
+#define REG_END RBX
+#define REG_STEP RBP
+
+/* XMM0 to XMM13 are allocated to values , XMM14 and XMM15 are scratch */
+#define REGION_XMM 14
+#define XMM_SCRATCH 14
+#define XMM_TEMP 15
+
+/* Spill slots are on native stack */
+#define SPILL_DISP(LOC) ((int32_t)(8*((LOC)-OPT_SPILL)))
+
+/* SSE instruction PFX 0f OPC reg , rm on registers , w is 1 when one of them
+ * is a 64 bits general purpose register */
+static void emit_sse( struct Assembler* as , uint8_t pfx , int w ,
+    uint8_t opc , int reg , int rm ) {
+  emit8(as,pfx);
+  emit_rex(as,w,reg,rm);
+  emit8(as,0x0f);
+  emit8(as,opc);
+  emit8(as,(uint8_t)(0xc0 | ((reg&7)<<3) | (rm&7)));
+}
+
+/* SSE instruction PFX 0f OPC reg , [base+disp32] */
+static void emit_sse_mem( struct Assembler* as , uint8_t pfx , uint8_t opc ,
+    int reg , int base , int32_t disp ) {
+  emit8(as,pfx);
+  emit_rex(as,0,reg,base);
+  emit8(as,0x0f);
+  emit8(as,opc);
+  emit8(as,(uint8_t)(0x80 | ((reg&7)<<3) | (base&7)));
+  if((base&7) == RSP) emit8(as,0x24); /* SIB , base only */
+  emit32(as,(uint32_t)disp);
+}
+
+/* SSE instruction with a value location , XMM register or spill slot */
+static void emit_sse_loc( struct Assembler* as , uint8_t pfx , uint8_t opc ,
+    int reg , int loc ) {
+  if(loc >= OPT_SPILL)
+    emit_sse_mem(as,pfx,opc,reg,RSP,SPILL_DISP(loc));
+  else
+    emit_sse(as,pfx,0,opc,reg,loc);
+}
+
+#define emit_xorpd(AS,X) emit_sse(AS,0x66,0,0x57,X,X)
+#define emit_movq_to_xmm(AS,X,R) emit_sse(AS,0x66,1,0x6e,X,R)
+#define emit_movq_from_xmm(AS,R,X) emit_sse(AS,0x66,1,0x7e,X,R)
+
+/* Move between value locations */
+static void emit_xmove( struct Assembler* as , int dst , int src ) {
+  if(dst == src) return;
+  if(dst < OPT_SPILL) {
+    if(src < OPT_SPILL)
+      emit_sse(as,0x66,0,0x28,dst,src); /* movapd */
+    else
+      emit_sse_mem(as,0xf2,0x10,dst,RSP,SPILL_DISP(src)); /* movsd */
+  } else if(src < OPT_SPILL) {
+    emit_sse_mem(as,0xf2,0x11,src,RSP,SPILL_DISP(dst));
+  } else {
+    emit_load(as,RAX,RSP,SPILL_DISP(src));
+    emit_store(as,RSP,SPILL_DISP(dst),RAX);
+  }
+}
+
+static int loc( const struct OptFunc* f , int v ) {
+  assert(f->ins_arr[v].loc >= 0);
+  return f->ins_arr[v].loc;
+}
+
+/* Slow path of a region is the deoptimization of a guard , pc of the stub
+ * is the snapshot */
+static uint32_t guard_stub( struct Assembler* as , int snap ) {
+  struct Stub s;
+  s.pc = (uint32_t)snap;
+  s.next = 0;
+  s.target = -1;
+  DynArrPush(as,stub,s);
+  return (uint32_t)(as->stub_size - 1);
+}
+
+/* Deoptimize when a value is +0 or -0 */
+static void emit_zero_guard( struct Assembler* as , const struct OptFunc* f ,
+    int v , uint32_t stub ) {
+  const struct OptIns* ins = f->ins_arr + v;
+  if(ins->op == OPT_CONST) {
+    if(ins->num == 0) emit_jump(as,-1,FIX_STUB,stub);
+    return;
+  }
+  if(loc(f,v) >= OPT_SPILL)
+    emit_load(as,RAX,RSP,SPILL_DISP(ins->loc));
+  else
+    emit_movq_from_xmm(as,RAX,ins->loc);
+  emit_add(as,RAX,RAX);
+  emit_jump(as,CC_E,FIX_STUB,stub);
+}
+
+/* Modulo of truncated operands like interpreter , any operand interpreter
+ * would complain about deoptimizes */
+static void emit_mod( struct Assembler* as , const struct OptFunc* f ,
+    const struct OptIns* ins , int reg ) {
+  uint32_t stub = guard_stub(as,ins->snap);
+  size_t l1;
+  emit_zero_guard(as,f,ins->b,stub);
+  emit_sse_loc(as,0xf2,0x2c,RAX,loc(f,ins->a)); /* cvttsd2si eax */
+  emit8(as,0x3d); emit32(as,0x80000000); /* cmp eax , INT_MIN */
+  emit_jump(as,CC_E,FIX_STUB,stub);
+  emit_sse_loc(as,0xf2,0x2c,RCX,loc(f,ins->b)); /* cvttsd2si ecx */
+  emit8(as,0x81); emit8(as,0xf9); emit32(as,0x80000000); /* cmp ecx */
+  emit_jump(as,CC_E,FIX_STUB,stub);
+  emit8(as,0x85); emit8(as,0xc9); /* test ecx , ecx */
+  emit_jump(as,CC_E,FIX_STUB,stub);
+  emit8(as,0x31); emit8(as,0xd2); /* xor edx , edx */
+  emit8(as,0x83); emit8(as,0xf9); emit8(as,0xff); /* cmp ecx , -1 */
+  l1 = emit_jump_forward(as,CC_E);
+  emit8(as,0x99); /* cdq */
+  emit8(as,0xf7); emit8(as,0xf9); /* idiv ecx */
+  emit_bind(as,l1);
+  emit_xorpd(as,reg);
+  emit_sse(as,0xf2,0,0x2a,reg,RDX); /* cvtsi2sd */
+}
+
+static void emit_ins( struct Assembler* as , const struct OptFunc* f ,
+    int v ) {
+  const struct OptIns* ins = f->ins_arr + v;
+  int dst = ins->loc;
+  /* result goes to XMM_TEMP when it is spilled */
+  int reg = dst < OPT_SPILL ? dst : XMM_TEMP;
+  uint8_t opc;
+  Value val;
+
+  switch(ins->op) {
+    case OPT_PHI: case OPT_CMP:
+      return;
+    case OPT_CONST:
+      Vset_number(&val,ins->num);
+      if(val.ipart == 0) {
+        emit_xorpd(as,reg);
+      } else {
+        emit_mov_imm64(as,RAX,val.ipart);
+        emit_movq_to_xmm(as,reg,RAX);
+      }
+      break;
+    case OPT_PARAM:
+      emit_sse_mem(as,0xf2,0x10,reg,REG_BASE,(int32_t)(8*ins->slot));
+      break;
+    case OPT_INDEX:
+      emit_xorpd(as,reg);
+      emit_sse(as,0xf2,1,0x2a,reg,REG_INDEX); /* cvtsi2sd */
+      break;
+    case OPT_NEG:
+      emit_xmove(as,reg,loc(f,ins->a));
+      emit_mov_imm64(as,RAX,(uint64_t)1<<63);
+      emit_movq_to_xmm(as,XMM_SCRATCH,RAX);
+      emit_sse(as,0x66,0,0x57,reg,XMM_SCRATCH); /* xorpd */
+      break;
+    case OPT_MOD:
+      emit_mod(as,f,ins,reg);
+      break;
+    default:
+      switch(ins->op) {
+        case OPT_ADD: opc = 0x58; break;
+        case OPT_SUB: opc = 0x5c; break;
+        case OPT_MUL: opc = 0x59; break;
+        default:
+          assert(ins->op == OPT_DIV);
+          emit_zero_guard(as,f,ins->cc ? ins->b : ins->a,
+              guard_stub(as,ins->snap));
+          opc = 0x5e;
+          break;
+      }
+      if(reg == loc(f,ins->b) && reg != loc(f,ins->a)) {
+        if(ins->op == OPT_ADD || ins->op == OPT_MUL) {
+          emit_sse_loc(as,0xf2,opc,reg,loc(f,ins->a));
+        } else {
+          emit_xmove(as,XMM_SCRATCH,loc(f,ins->a));
+          emit_sse_loc(as,0xf2,opc,XMM_SCRATCH,loc(f,ins->b));
+          emit_xmove(as,reg,XMM_SCRATCH);
+        }
+      } else {
+        emit_xmove(as,reg,loc(f,ins->a));
+        emit_sse_loc(as,0xf2,opc,reg,loc(f,ins->b));
+      }
+      break;
+  }
+  emit_xmove(as,dst,reg);
+}
+
+struct Move {
+  int dst;
+  int src;
+};
+
+/* Moves of phis when going from block to its successor , move can be NULL
+ * to count them */
+static size_t edge_moves( const struct OptFunc* f , int from , int to ,
+    struct Move* move ) {
+  const struct OptBlock* blk = f->block_arr + to;
+  size_t p , i , n = 0;
+  for( p = 0 ; blk->pred_arr[p] != from ; ++p )
+    ;
+  for( i = 0 ; i < blk->ins_size ; ++i ) {
+    const struct OptIns* ins = f->ins_arr + blk->ins_arr[i];
+    int src;
+    if(ins->op != OPT_PHI) continue;
+    src = loc(f,f->phi_arr[ins->phi+p]);
+    if(src == ins->loc) continue;
+    if(move) {
+      move[n].dst = ins->loc;
+      move[n].src = src;
+    }
+    ++n;
+  }
+  return n;
+}
+
+/* Go from block to its successor , phis of the successor are assigned as a
+ * parallel move and a cycle is broken with XMM_TEMP */
+static void emit_edge( struct Assembler* as , const struct OptFunc* f ,
+    int from , int to , int fallthrough ) {
+  struct Move* move = malloc(sizeof(struct Move)*
+      (f->block_arr[to].ins_size+1));
+  size_t n = edge_moves(f,from,to,move) , i , k;
+  while(n) {
+    /* a move whose destination is not read by others */
+    for( i = 0 ; i < n ; ++i ) {
+      for( k = 0 ; k < n && move[k].src != move[i].dst ; ++k )
+        ;
+      if(k == n) break;
+    }
+    if(i == n) {
+      i = 0;
+      emit_xmove(as,XMM_TEMP,move[0].dst);
+      for( k = 0 ; k < n ; ++k ) {
+        if(move[k].src == move[0].dst) move[k].src = XMM_TEMP;
+      }
+    }
+    emit_xmove(as,move[i].dst,move[i].src);
+    move[i] = move[--n];
+  }
+  free(move);
+  if(!fallthrough || to != from+1) emit_jump(as,-1,FIX_LABEL,(uint32_t)to);
+}
+
+/* OPT_BR , the false edge is jumped to directly when it has no moves */
+static void emit_br( struct Assembler* as , const struct OptFunc* f ,
+    int block ) {
+  const struct OptBlock* blk = f->block_arr + block;
+  const struct OptIns* cmp = f->ins_arr + blk->cmp;
+  int direct = edge_moves(f,block,blk->succ[1],NULL) == 0;
+  int l = loc(f,cmp->a) , r = loc(f,cmp->b) , cc , t;
+  size_t fpos[2] , tpos = 0;
+  int nf = 0 , k;
+
+  /* ucomisd l , r and the condition to go to false edge */
+  switch(cmp->cc) {
+    case OPT_LT: t = l; l = r; r = t; cc = CC_BE; break;
+    case OPT_LE: t = l; l = r; r = t; cc = CC_B; break;
+    case OPT_GT: cc = CC_BE; break;
+    case OPT_GE: cc = CC_B; break;
+    case OPT_EQ: cc = CC_NE; break;
+    default: assert(cmp->cc == OPT_NE); cc = CC_E; break;
+  }
+  if(l >= OPT_SPILL) {
+    emit_xmove(as,XMM_TEMP,l);
+    l = XMM_TEMP;
+  }
+  emit_sse_loc(as,0x66,0x2e,l,r); /* ucomisd */
+
+  /* unordered is false except for OPT_NE */
+  if(cmp->cc == OPT_NE) tpos = emit_jump_forward(as,CC_P);
+  for( k = 0 ; k < (cmp->cc == OPT_EQ ? 2 : 1) ; ++k ) {
+    int c = k ? CC_P : cc;
+    if(direct)
+      emit_jump(as,c,FIX_LABEL,(uint32_t)blk->succ[1]);
+    else
+      fpos[nf++] = emit_jump_forward(as,c);
+  }
+  if(cmp->cc == OPT_NE) emit_bind(as,tpos);
+  emit_edge(as,f,block,blk->succ[0],direct);
+  if(!direct) {
+    for( k = 0 ; k < nf ; ++k ) emit_bind(as,fpos[k]);
+    emit_edge(as,f,block,blk->succ[1],1);
+  }
+}
+
+/* Write snapshot back to the frame and leave the region with the index of
+ * a new exit */
+static void emit_leave( struct Assembler* as , const struct OptFunc* f ,
+    struct JitLoop* loop , int snap , int deopt ) {
+  const struct OptSnap* s = f->snap_arr + snap;
+  struct JitExit e;
+  uint32_t i;
+  for( i = 0 ; i < s->depth ; ++i ) {
+    int v = f->slot_arr[s->slot+i];
+    if(v < 0) continue;
+    if(loc(f,v) >= OPT_SPILL) {
+      emit_load(as,RAX,RSP,SPILL_DISP(loc(f,v)));
+      emit_store(as,REG_BASE,(int32_t)(8*i),RAX);
+    } else {
+      emit_sse_mem(as,0xf2,0x11,loc(f,v),REG_BASE,(int32_t)(8*i));
+    }
+  }
+  emit_sse(as,0xf2,1,0x2a,XMM_SCRATCH,REG_INDEX); /* cvtsi2sd */
+  emit_sse_mem(as,0xf2,0x11,XMM_SCRATCH,REG_SLOT,0);
+  emit_mov_imm32(as,RAX,(uint32_t)loop->exit_size);
+  emit_jump(as,-1,FIX_EXIT,0);
+  e.pc = s->pc;
+  e.depth = s->depth;
+  e.deopt = deopt;
+  DynArrPush(loop,exit,e);
+}
+
+/* Load a hidden slot into a general purpose register */
+static void emit_slot_int( struct Assembler* as , int reg , int32_t disp ) {
+  emit_sse_mem(as,0xf2,0x10,XMM_SCRATCH,REG_SLOT,disp); /* movsd */
+  emit_sse(as,0xf2,1,0x2c,reg,XMM_SCRATCH); /* cvttsd2si */
+}
+
+static void compile_region( struct Assembler* as , const struct OptFunc* f ,
+    struct JitLoop* loop ) {
+  int32_t frame = 8*f->spill_size;
+  size_t i , j;
+
+  /* prologue */
+  emit_push(as,RBX);
+  emit_push(as,RBP);
+  emit_push(as,R13);
+  emit_push(as,R14);
+  emit_push(as,R15);
+  if(frame) emit_addi(as,RSP,-frame);
+  emit_mov(as,REG_BASE,RDI);
+  emit_mov(as,REG_SLOT,RSI);
+  emit_slot_int(as,REG_INDEX,0);
+  emit_slot_int(as,REG_END,8);
+  emit_slot_int(as,REG_STEP,16);
+
+  /* blocks are laid out in order , the preheader falls through to header */
+  for( i = 0 ; i < f->block_size ; ++i ) {
+    const struct OptBlock* blk = f->block_arr + i;
+    as->label[i] = (uint32_t)as->code_size;
+    if(i > 0 && blk->pred_size == 0) continue;
+    for( j = 0 ; j < blk->ins_size ; ++j ) emit_ins(as,f,blk->ins_arr[j]);
+    switch(blk->term) {
+      case OPT_JMP:
+        emit_edge(as,f,(int)i,blk->succ[0],1);
+        break;
+      case OPT_BR:
+        emit_br(as,f,(int)i);
+        break;
+      case OPT_LOOPEND:
+        emit_add(as,REG_INDEX,REG_STEP);
+        emit_cmp(as,REG_INDEX,REG_END);
+        emit_jump(as,CC_GE,FIX_LABEL,(uint32_t)blk->succ[1]);
+        emit_edge(as,f,(int)i,1,0);
+        break;
+      default:
+        emit_leave(as,f,loop,blk->snap,0);
+        break;
+    }
+  }
+
+  /* deoptimization */
+  as->stub_label = malloc(sizeof(uint32_t)*(as->stub_size+1));
+  for( i = 0 ; i < as->stub_size ; ++i ) {
+    as->stub_label[i] = (uint32_t)as->code_size;
+    emit_leave(as,f,loop,(int)as->stub_arr[i].pc,1);
+  }
+
+  /* epilogue , EAX holds the exit */
+  as->exit = (uint32_t)as->code_size;
+  if(frame) emit_addi(as,RSP,frame);
+  emit_pop(as,R15);
+  emit_pop(as,R14);
+  emit_pop(as,R13);
+  emit_pop(as,RBP);
+  emit_pop(as,RBX);
+  emit8(as,0xc3);
+  link_fixups(as);
+}
+
+static void loop_release( struct Sparrow* sparrow , struct JitLoop* loop ) {
+  if(loop->code) {
+    munmap(loop->code,loop->size);
+    sparrow->jit_size -= loop->size;
+    loop->code = NULL;
+  }
+  free(loop->exit_arr);
+  free(loop->guard_arr);
+  loop->exit_arr = NULL;
+  loop->exit_size = loop->exit_cap = 0;
+  loop->guard_arr = NULL;
+  loop->guard_size = loop->guard_cap = 0;
+}
+
+/* Compile a loop into a region. The type feedback is current frame , a slot
+ * the region reads as number must hold one now and is guarded on entry */
+static int compile_loop( struct Sparrow* sparrow , struct JitLoop* loop ,
+    const Value* base , uint32_t depth ) {
+  struct OptFunc f;
+  struct Assembler as;
+  size_t i;
+  int ret = -1;
+
+  if(OptBuild(&f,loop->proto,loop->pc,depth)) return -1;
+  OptRun(&f,REGION_XMM);
+  for( i = 0 ; i < f.ins_size ; ++i ) {
+    const struct OptIns* ins = f.ins_arr + i;
+    if(ins->op == OPT_PARAM && ins->guard && !ins->dead) {
+      if(!Vis_number(base+ins->slot)) goto done;
+      DynArrPush(loop,guard,ins->slot);
+    }
+  }
+
+  memset(&as,0,sizeof(as));
+  as.label = malloc(sizeof(uint32_t)*f.block_size);
+  compile_region(&as,&f,loop);
+  if((loop->code = install(sparrow,&as,&(loop->size)))) {
+    loop->depth = depth;
+    loop->max_depth = f.max_depth;
+    ret = 0;
+  }
+  free(as.label);
+  assembler_destroy(&as);
+
+done:
+  OptDestroy(&f);
+  return ret;
+}
+
+/* Called by BC_LOOP template once its loop is hot , returns native entry of
+ * the pc where the region exits or NULL to go on in baseline code */
+static const void* jit_loop_enter( struct JitState* st ,
+    struct JitLoop* loop ) {
+  struct Sparrow* sparrow = RTSparrow(st->rt);
+  const struct JitCode* jit = loop->proto->jit;
+  Value* base = st->base;
+  uint32_t depth = (uint32_t)(st->top - base);
+  const struct JitExit* e;
+  uint32_t pc;
+  size_t i;
+
+  if(loop->status == LOOP_COLD) {
+    if(depth < 3 || compile_loop(sparrow,loop,base,depth)) {
+      loop_release(sparrow,loop);
+      loop->status = LOOP_FAILED;
+    } else {
+      loop->status = LOOP_COMPILED;
+    }
+  }
+  if(loop->status == LOOP_FAILED) {
+    loop->hotness = INT64_MAX;
+    return NULL;
+  }
+
+  /* entry guards , otherwise try later */
+  if(depth != loop->depth || base + loop->max_depth > st->limit)
+    goto cold;
+  for( i = 0 ; i < loop->guard_size ; ++i ) {
+    if(!Vis_number(base+loop->guard_arr[i])) goto cold;
+  }
+
+  e = loop->exit_arr +
+    ((JitRegion)loop->code)(base,base+depth-3);
+  st->top = base + e->depth;
+  pc = e->pc;
+  if(e->deopt && ++loop->deopt == SPARROW_JIT_DEOPT_LIMIT) {
+    loop_release(sparrow,loop);
+    loop->status = LOOP_FAILED;
+    loop->hotness = INT64_MAX;
+  } else {
+    /* enter again next time the loop starts */
+    loop->hotness = 1;
+  }
+  return (const uint8_t*)(jit->code) + jit->map[pc];
+
+cold:
+  loop->hotness = SPARROW_JIT_LOOP_THRESHOLD;
+  return NULL;
+}
+
+void JitFree( struct Sparrow* sparrow , struct ObjProto* proto ) {
+  if(proto->jit) {
+    size_t i;
+    for( i = 0 ; i < proto->jit->loop_size ; ++i )
+      loop_release(sparrow,proto->jit->loop_arr+i);
+    munmap(proto->jit->code,proto->jit->size);
+    sparrow->jit_size -= proto->jit->size;
+    free(proto->jit->loop_arr);
+    free(proto->jit->map);
+    free(proto->jit);
+    proto->jit = NULL;
+  }
+}
+
+#endif /* SPARROW_JIT */
@@ -0,0 +1,80 @@
+#ifndef JIT_H_
+#define JIT_H_
+#include "../conf.h"
+#include "object.h"
+
+struct Runtime;
+
+#ifdef SPARROW_JIT
+
+/* Baseline JIT ( tier 1 ) for x86-64.
+ *
+ * A proto is compiled once the interpreter finds it hot , see BC_LOOP and
+ * BC_CLOSURE in vm.c. Each instruction is translated by a template into
+ * native code , so every pc has a native entry and native code can be
+ * entered at any instruction boundary. The templates only handle the fast
+ * path : number arithmetic , comparison , branch on boolean , for loops over
+ * loop() , loads , moves and stack pops. When a guard fails or an instruction
+ * has no template , the native code asks the interpreter to execute that
+ * single instruction , see JitStep , and continues with the pc the
+ * interpreter leaves.
+ *
+ * The native code works on the CallThread stack and CallFrame directly and it
+ * never creates a frame. A call or a return leaves native code and the
+ * interpreter performs it , the callee is then run natively if it has been
+ * compiled and a return into a compiled proto enters native code again. So
+ * interpreted and compiled functions call each other freely.
+ *
+ * Optimizing JIT ( tier 2 ) for loops. The BC_LOOP template counts the
+ * iterations of its loop , a hot loop whose body only does number arithmetic
+ * is compiled by the optimizer in opt.h into a region of native code and the
+ * baseline code enters the region at the loop header. A region returns to
+ * the baseline code when the loop exits or a guard fails , since the frame
+ * layout is shared the baseline code simply continues at the pc of the exit */
+
+struct JitLoop;
+
+struct JitCode {
+  void* code;    /* executable memory */
+  size_t size;   /* size of the executable memory */
+  uint32_t* map; /* native offset of each instruction */
+  struct JitLoop* loop_arr; /* tier 2 state of each BC_LOOP */
+  size_t loop_size;
+};
+
+/* Compile a proto into native code. Returns -1 if the proto cannot be
+ * compiled , ie the code cache is full , and the proto stays interpreted */
+int JitCompile( struct Sparrow* , struct ObjProto* );
+
+/* Run the compiled proto of current frame from current frame's pc. Native
+ * code returns at an instruction it cannot run , the frame's pc and the
+ * stack are updated accordingly. Returns -1 if an error happened */
+int JitRun( struct Runtime* , struct ObjProto* );
+
+/* Release native code of a proto */
+void JitFree( struct Sparrow* , struct ObjProto* );
+
+#endif /* SPARROW_JIT */
+
+#ifdef SPARROW_NATIVE
+
+/* Registers of native code that are visible to JitStep. Base is the first
+ * slot of current frame and top is the next free slot of the stack , limit
+ * is the end of the stack. JitStep reloads all of them since the stack can
+ * be reallocated by the interpreter */
+struct JitState {
+  struct Runtime* rt;
+  Value* base;
+  Value* top;
+  Value* limit;
+};
+
+/* Execute one instruction at pc of current frame in the interpreter , returns
+ * the pc of next instruction or -1 if an error happened. It is implemented
+ * in vm.c and called by native code of both the JIT and the code
+ * compiled ahead of time , see aot.h */
+int JitStep( struct JitState* , uint32_t pc );
+
+#endif /* SPARROW_NATIVE */
+
+#endif /* JIT_H_ */
@@ -3,11 +3,18 @@
 #include "error.h"
 #include "object.h"
 
-void ObjListAssign( struct ObjList* self , size_t index , Value value ) {
+void ObjListAssign( struct Sparrow* sparrow , struct ObjList* self ,
+    size_t index , Value value ) {
   size_t i;
+  const int lock = SparrowGCMarking(sparrow);
+  if(SP_UNLIKELY(lock)) {
+    if(index < self->size) GCPreBarrier(sparrow,self->arr[index]);
+    GCLockHeap(sparrow);
+  }
   if(index >= self->cap) {
     size_t ncap = index + 1 + ( self->cap - self->size );
     self->arr = realloc(self->arr,ncap*sizeof(Value));
+    sparrow->gc_bytes += (ncap - self->cap)*sizeof(Value);
     self->cap = ncap;
   }
   for( i = self->size ; i < index ; ++i ) {
@@ -15,26 +22,42 @@ void ObjListAssign( struct ObjList* self , size_t index , Value value ) {
   }
   self->arr[index] = value;
   if(index >= self->size) self->size = index + 1;
+  if(SP_UNLIKELY(lock)) GCUnlockHeap(sparrow);
 }
 
-void ObjListExtend( struct ObjList* self , const struct ObjList* that ) {
+void ObjListExtend( struct Sparrow* sparrow , struct ObjList* self ,
+    const struct ObjList* that ) {
   size_t i;
+  const int lock = SparrowGCMarking(sparrow);
+  if(SP_UNLIKELY(lock)) GCLockHeap(sparrow);
   /* reserve enough memory */
   if(self->size + that->size > self->cap) {
     size_t ncap = that->size + self->cap;
     self->arr = realloc(self->arr,ncap*sizeof(Value));
+    sparrow->gc_bytes += (ncap - self->cap)*sizeof(Value);
+    self->cap = ncap;
   }
   for( i = 0 ; i < that->size ; ++i ) {
     self->arr[self->size++] = that->arr[i];
   }
+  if(SP_UNLIKELY(lock)) GCUnlockHeap(sparrow);
 }
 
-void ObjListResize( struct ObjList* self, size_t size ) {
+void ObjListResize( struct Sparrow* sparrow , struct ObjList* self,
+    size_t size ) {
+  const int lock = SparrowGCMarking(sparrow);
+  if(SP_UNLIKELY(lock)) {
+    size_t i;
+    for( i = size ; i < self->size ; ++i ) {
+      GCPreBarrier(sparrow,self->arr[i]);
+    }
+    GCLockHeap(sparrow);
+  }
   if(size < self->size) {
     self->size = size;
   } else if(size <= self->cap) {
     size_t i;
-    for( i = self->size ; i <= size; ++i ) {
+    for( i = self->size ; i < size; ++i ) {
       Vset_null(self->arr+i);
     }
     self->size = size;
@@ -42,12 +65,14 @@ void ObjListResize( struct ObjList* self, size_t size ) {
     size_t i;
     size_t ncap = self->cap - self->size + size;
     self->arr = realloc(self->arr,ncap*sizeof(Value));
+    sparrow->gc_bytes += (ncap - self->cap)*sizeof(Value);
     for( i = self->size ; i < size ; ++i ) {
       Vset_null(self->arr+i);
     }
     self->size = size;
     self->cap = ncap;
   }
+  if(SP_UNLIKELY(lock)) GCUnlockHeap(sparrow);
 }
 
 struct ObjList* ObjListSlice( struct Sparrow* sparrow , struct ObjList* list ,
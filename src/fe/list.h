@@ -1,6 +1,7 @@
 #ifndef LIST_H_
 #define LIST_H_
 #include "object.h"
+#include "gc.h"
 
 static SPARROW_INLINE
 void ObjListInit( struct Sparrow* sparrow , struct ObjList* list ,
@@ -12,6 +13,7 @@ void ObjListInit( struct Sparrow* sparrow , struct ObjList* list ,
     list->arr = malloc(cap*sizeof(Value));
     list->size = 0;
     list->cap = cap;
+    sparrow->gc_bytes += cap*sizeof(Value);
   }
 }
 
@@ -24,20 +26,29 @@ ObjListDestroy( struct ObjList* list ) {
   list->arr = NULL;
 }
 
+/* Functions that grow the list take the Sparrow so the memory of the
+ * backing array is accounted for GC. They also hold the heap lock during
+ * concurrent marking , since the marker thread may be scanning the array
+ * that is going to be reallocated */
 static SPARROW_INLINE void
-ObjListPush( struct ObjList* list, Value val ) {
+ObjListPush( struct Sparrow* sparrow , struct ObjList* list, Value val ) {
+  const int lock = SparrowGCMarking(sparrow);
+  if(SP_UNLIKELY(lock)) GCLockHeap(sparrow);
   if(list->size == list->cap) {
     /* Cannot use MemGrow since it is managed memory */
     size_t ncap = list->cap == 0 ? 2 : 2 * list->cap;
     list->arr = realloc(list->arr,ncap*sizeof(Value));
+    sparrow->gc_bytes += (ncap - list->cap)*sizeof(Value);
     list->cap = ncap;
   }
   list->arr[list->size] = val;
   ++list->size;
+  if(SP_UNLIKELY(lock)) GCUnlockHeap(sparrow);
 }
 
-void ObjListExtend( struct ObjList* , const struct ObjList* );
-void ObjListResize( struct ObjList* , size_t );
+void ObjListExtend( struct Sparrow* , struct ObjList* ,
+    const struct ObjList* );
+void ObjListResize( struct Sparrow* , struct ObjList* , size_t );
 struct ObjList* ObjListSlice( struct Sparrow* , struct ObjList* , size_t ,
     size_t );
 
@@ -54,7 +65,8 @@ ObjListIndex( struct ObjList* list , size_t idx ) {
 
 /* It will automatically extend the array and assign the value if
  * we need to do so */
-void ObjListAssign( struct ObjList* list , size_t idx , Value value );
+void ObjListAssign( struct Sparrow* , struct ObjList* list , size_t idx ,
+    Value value );
 
 #define ObjListLast(L) ObjListIndex(L,(L)->size-1)
 #define ObjListSize(L) ((L)->size)
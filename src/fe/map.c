@@ -1,7 +1,9 @@
 #include "map.h"
+#include "gc.h"
 #include <stdlib.h>
 
-static void insert( struct ObjMap* map , struct ObjStr* key , Value val );
+static struct ObjMapEntry* insert( struct Sparrow* sparrow ,
+    struct ObjMap* map , struct ObjStr* key , Value val );
 
 enum {
   DO_FIND,
@@ -12,10 +14,17 @@ static struct ObjMapEntry* find_entry( struct ObjMap* map ,
     const struct ObjStr* key , int opt ) {
   /* Try to find the main position */
   int fhash = key->hash;
-  int idx = fhash & (map->cap-1);
-  struct ObjMapEntry* entry = map->entry + idx;
+  int idx;
+  struct ObjMapEntry* entry;
   struct ObjMapEntry* prev;
 
+  if(map->cap == 0) {
+    assert(opt == DO_FIND);
+    return NULL;
+  }
+  idx = fhash & (map->cap-1);
+  entry = map->entry + idx;
+
   if(!entry->used) {
     if(opt == DO_INSERT) {
       entry->used = 0;
@@ -60,7 +69,7 @@ static struct ObjMapEntry* find_entry( struct ObjMap* map ,
   }
 }
 
-static void rehash( struct ObjMap* map ) {
+static void rehash( struct Sparrow* sparrow , struct ObjMap* map ) {
   size_t i;
   struct ObjMap temp_map;
   size_t ncap = map->cap == 0 ? 2 : map->cap * 2;
@@ -68,9 +77,11 @@ static void rehash( struct ObjMap* map ) {
   for( i = 0 ; i < map->cap ; ++i ) {
     struct ObjMapEntry* ent = map->entry+i;
     if(ent->used && !ent->del) {
-      insert(&temp_map,ent->key,ent->value);
+      insert(NULL,&temp_map,ent->key,ent->value);
     }
   }
+  if(sparrow)
+    sparrow->gc_bytes += (ncap - map->cap)*sizeof(struct ObjMapEntry);
   free(map->entry); /* free the existed entry */
   map->entry = temp_map.entry;
   map->scnt = temp_map.scnt;
@@ -78,10 +89,11 @@ static void rehash( struct ObjMap* map ) {
   map->cap = temp_map.cap;
 }
 
-static void insert( struct ObjMap* map , struct ObjStr* key , Value val ) {
+static struct ObjMapEntry* insert( struct Sparrow* sparrow ,
+    struct ObjMap* map , struct ObjStr* key , Value val ) {
   struct ObjMapEntry* entry;
   if(map->scnt == map->cap)
-    rehash(map);
+    rehash(sparrow,map);
 
   entry = find_entry(
       map,
@@ -89,16 +101,138 @@ static void insert( struct ObjMap* map , struct ObjStr* key , Value val ) {
       DO_INSERT);
 
   assert(entry);
+  /* overwriting an existed key doesn't change the size */
+  if(!entry->used) {
+    ++map->size;
+    if(!entry->del) ++map->scnt;
+  } else if(entry->del) {
+    ++map->size;
+  }
   entry->key = key;
   entry->value = val;
   entry->del = 0;
   entry->used = 1;
-  ++map->size;
-  ++map->scnt;
+  return entry;
+}
+
+/* ============================================
+ * Record map , see struct Shape
+ * ==========================================*/
+struct Shape* ShapeNewRoot() {
+  struct Shape* root = malloc(sizeof(*root));
+  root->root = root;
+  root->child = NULL;
+  root->sibling = NULL;
+  root->size = 0;
+  root->mark = 0;
+  root->keys = NULL;
+  return root;
+}
+
+size_t ShapeDestroy( struct Shape* shape ) {
+  struct Shape* c = shape->child;
+  size_t n = 1;
+  while(c) {
+    struct Shape* next = c->sibling;
+    n += ShapeDestroy(c);
+    c = next;
+  }
+  free(shape);
+  return n;
+}
+
+/* Shape after adding KEY , NULL if the tree is not allowed to grow */
+static struct Shape* shape_transition( struct Sparrow* sparrow ,
+    struct Shape* shape , struct ObjStr* key ) {
+  struct Shape* c;
+  size_t n = 0;
+  for( c = shape->child ; c ; c = c->sibling , ++n ) {
+    if(c->keys[shape->size] == key) return c;
+  }
+  if(shape->size == SPARROW_SHAPE_MAX_SIZE ||
+     n == SPARROW_SHAPE_MAX_TRANSITION ||
+     sparrow->shape_size == SPARROW_SHAPE_MAX_COUNT)
+    return NULL;
+  c = malloc(sizeof(*c) + (shape->size+1)*sizeof(struct ObjStr*));
+  c->root = shape->root;
+  c->child = NULL;
+  c->sibling = shape->child;
+  c->size = shape->size + 1;
+  c->mark = 0;
+  c->keys = (struct ObjStr**)(c+1);
+  if(shape->size)
+    memcpy(c->keys,shape->keys,shape->size*sizeof(struct ObjStr*));
+  c->keys[shape->size] = key;
+  shape->child = c;
+  ++sparrow->shape_size;
+  return c;
+}
+
+/* Keys are compared by pointer since all the strings are interned */
+static SPARROW_INLINE
+int shape_find( const struct Shape* shape , const struct ObjStr* key ) {
+  size_t i;
+  for( i = 0 ; i < shape->size ; ++i ) {
+    if(shape->keys[i] == key) return (int)i;
+  }
+  return -1;
+}
+
+/* Store the value into a record , return NULL if the map has to become a
+ * dictionary */
+static Value* record_put( struct Sparrow* sparrow , struct ObjMap* map ,
+    struct ObjStr* key , Value val ) {
+  struct Shape* next;
+  int idx = shape_find(map->shape,key);
+  if(idx >= 0) {
+    map->slot[idx] = val;
+    return map->slot + idx;
+  }
+  if(!sparrow || !(next = shape_transition(sparrow,map->shape,key)))
+    return NULL;
+  if(map->size == map->cap) {
+    size_t ncap = map->cap ? map->cap * 2 : 2;
+    map->slot = realloc(map->slot,ncap*sizeof(Value));
+    sparrow->gc_bytes += (ncap - map->cap)*sizeof(Value);
+    map->cap = ncap;
+  }
+  map->slot[map->size] = val;
+  map->shape = next;
+  /* the map may have been scanned already */
+  if(SP_UNLIKELY(sparrow->gc_phase == GC_PHASE_MARK))
+    GCMarkShape(sparrow,next);
+  return map->slot + map->size++;
+}
+
+static void to_dictionary( struct Sparrow* sparrow , struct ObjMap* map ) {
+  struct Shape* shape = map->shape;
+  struct MetaOps* mops = map->mops;
+  Value* slot = map->slot;
+  size_t size = map->size;
+  size_t ocap = map->cap;
+  size_t ncap = 2;
+  size_t i;
+  while(ncap <= size*2) ncap *= 2;
+  ObjMapInit(map,ncap);
+  map->mops = mops;
+  for( i = 0 ; i < size ; ++i ) {
+    insert(NULL,map,shape->keys[i],slot[i]);
+  }
+  if(sparrow) {
+    sparrow->gc_bytes += ncap*sizeof(struct ObjMapEntry);
+    sparrow->gc_bytes -= ocap*sizeof(Value);
+  }
+  free(slot);
 }
 
 void ObjMapClear( struct ObjMap* map ) {
-  memset(map->entry,0,sizeof(struct ObjMapEntry)*map->cap);
+  if(map->shape) {
+    map->shape = map->shape->root;
+    map->size = 0;
+    return;
+  }
+  if(map->scnt) /* untouched entries are already zero */
+    memset(map->entry,0,sizeof(struct ObjMapEntry)*map->cap);
   map->size = 0;
   map->scnt = 0;
 }
@@ -106,25 +240,62 @@ void ObjMapClear( struct ObjMap* map ) {
 void ObjMapDestroy( struct ObjMap* map ) {
   free(map->mops); /* Created on demand */
   free(map->entry);
+  free(map->slot);
   map->entry = NULL;
+  map->slot = NULL;
+  map->shape = NULL;
   map->cap = 0;
   map->size = 0;
   map->scnt = 0;
 }
 
-void ObjMapPut( struct ObjMap* map , struct ObjStr* key ,
-  Value val ) {
-  insert(map,key,val);
+static Value* put( struct Sparrow* sparrow , struct ObjMap* map ,
+    struct ObjStr* key , Value val ) {
+  if(map->shape) {
+    Value* ret = record_put(sparrow,map,key,val);
+    if(ret) return ret;
+    to_dictionary(sparrow,map);
+  }
+  return &(insert(sparrow,map,key,val)->value);
+}
+
+Value* ObjMapPutRef( struct Sparrow* sparrow , struct ObjMap* map ,
+    struct ObjStr* key , Value val ) {
+  Value* ret;
+  if(sparrow && SP_UNLIKELY(SparrowGCMarking(sparrow))) {
+    /* marker thread may be scanning the entries , see gc.h */
+    Value old;
+    if(ObjMapFind(map,key,&old) == 0)
+      GCPreBarrier(sparrow,old);
+    GCLockHeap(sparrow);
+    ret = put(sparrow,map,key,val);
+    GCUnlockHeap(sparrow);
+  } else {
+    ret = put(sparrow,map,key,val);
+  }
+  return ret;
+}
+
+void ObjMapPut( struct Sparrow* sparrow , struct ObjMap* map ,
+    struct ObjStr* key , Value val ) {
+  ObjMapPutRef(sparrow,map,key,val);
+}
+
+Value* ObjMapFindRef( struct ObjMap* map , const struct ObjStr* key ) {
+  if(map->shape) {
+    int idx = shape_find(map->shape,key);
+    return idx < 0 ? NULL : map->slot + idx;
+  } else {
+    struct ObjMapEntry* entry = find_entry(map,key,DO_FIND);
+    return entry ? &(entry->value) : NULL;
+  }
 }
 
 int ObjMapFind( struct ObjMap* map , const struct ObjStr* key ,
     Value* val ) {
-  struct ObjMapEntry* entry = find_entry(
-      map,
-      key,
-      DO_FIND);
-  if(entry) {
-    if(val) *val = entry->value;
+  Value* ref = ObjMapFindRef(map,key);
+  if(ref) {
+    if(val) *val = *ref;
     return 0;
   } else {
     return -1;
@@ -134,21 +305,24 @@ int ObjMapFind( struct ObjMap* map , const struct ObjStr* key ,
 int ObjMapFindStr( struct Sparrow* sparrow , struct ObjMap* map ,
     const char* key , Value* val ) {
   struct ObjStr* k = ObjNewStr(sparrow,key,strlen(key));
-  struct ObjMapEntry* entry = find_entry(
-      map,
-      k,
-      DO_FIND);
-  if(entry) {
-    if(val) *val = entry->value;
-    return 0;
-  } else {
-    return -1;
-  }
+  return ObjMapFind(map,k,val);
 }
 
-int ObjMapRemove( struct ObjMap* map , const struct ObjStr* key ,
-    Value* val ) {
-  struct ObjMapEntry* entry = find_entry(
+int ObjMapRemove( struct Sparrow* sparrow , struct ObjMap* map ,
+    const struct ObjStr* key , Value* val ) {
+  struct ObjMapEntry* entry;
+  if(map->shape) {
+    /* shape has no deletion , the map becomes dictionary */
+    if(shape_find(map->shape,key) < 0) return -1;
+    if(sparrow && SP_UNLIKELY(SparrowGCMarking(sparrow))) {
+      GCLockHeap(sparrow);
+      to_dictionary(sparrow,map);
+      GCUnlockHeap(sparrow);
+    } else {
+      to_dictionary(sparrow,map);
+    }
+  }
+  entry = find_entry(
       map,
       key,
       DO_FIND);
@@ -162,6 +336,20 @@ int ObjMapRemove( struct ObjMap* map , const struct ObjStr* key ,
   }
 }
 
+void ObjMapPreBarrier( struct Sparrow* sparrow , struct ObjMap* map ) {
+  size_t i;
+  if(map->shape) {
+    for( i = 0 ; i < map->size ; ++i ) {
+      GCPreBarrier(sparrow,map->slot[i]);
+    }
+  } else {
+    for( i = 0 ; i < map->cap ; ++i ) {
+      struct ObjMapEntry* e = map->entry + i;
+      if(e->used && !e->del) GCPreBarrier(sparrow,e->value);
+    }
+  }
+}
+
 /* ============================================
  * Map iterators
  * ==========================================*/
@@ -170,7 +358,9 @@ static int map_iter_has_next( struct Sparrow* sth ,
   struct ObjMap* m;
   UNUSE_ARG(sth);
   m = Vget_map(&(itr->obj));
-  if( (size_t)itr->u.index >= m->cap ) {
+  if(m->shape) {
+    return (size_t)itr->u.index < m->size ? 0 : -1;
+  } else if( (size_t)itr->u.index >= m->cap ) {
     return -1;
   } else {
     int c = (int)(m->cap);
@@ -192,6 +382,12 @@ static void map_iter_deref( struct Sparrow* sth ,
   struct ObjMap* m;
   UNUSE_ARG(sth);
   m = Vget_map(&(itr->obj));
+  if(m->shape) {
+    assert((size_t)(itr->u.index) < m->size);
+    if(key) Vset_str(key,m->shape->keys[itr->u.index]);
+    if(value) *value = m->slot[itr->u.index];
+    return;
+  }
   assert((size_t)(itr->u.index) < m->cap);
   assert(m->entry[itr->u.index].used && !m->entry[itr->u.index].del);
   if(key) Vset_str(key,m->entry[itr->u.index].key);
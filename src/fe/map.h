@@ -14,15 +14,64 @@ void ObjMapInit( struct ObjMap* map , size_t capacity ) {
   map->cap = capacity;
   map->size= 0;
   map->scnt = 0;
+  map->shape = NULL;
+  map->slot = NULL;
   map->mops= NULL;
 }
 
-void ObjMapPut( struct ObjMap* , struct ObjStr* key , Value val );
+/* Initialize an empty record map whose shape is ROOT */
+static SPARROW_INLINE
+void ObjMapInitRecord( struct ObjMap* map , struct Shape* root ,
+    size_t capacity ) {
+  assert(root->size == 0);
+  map->entry = NULL;
+  map->slot = capacity ? malloc(capacity*sizeof(Value)) : NULL;
+  map->shape = root;
+  map->cap = capacity;
+  map->size= 0;
+  map->scnt = 0;
+  map->mops= NULL;
+}
+
+/* Bytes of the backing storage */
+static SPARROW_INLINE
+size_t ObjMapBytes( const struct ObjMap* map ) {
+  return map->cap * (map->shape ? sizeof(Value) : sizeof(struct ObjMapEntry));
+}
+
+/* Growing the entry array is accounted for GC , the Sparrow can be NULL
+ * when the map is not managed by any Sparrow */
+void ObjMapPut( struct Sparrow* , struct ObjMap* , struct ObjStr* key ,
+    Value val );
 int ObjMapFind( struct ObjMap* , const struct ObjStr*,Value* );
+
+/* Same as ObjMapPut and ObjMapFind but return where the value is stored ,
+ * it stays valid until a key is added to or removed from the map */
+Value* ObjMapPutRef( struct Sparrow* , struct ObjMap* ,
+    struct ObjStr* key , Value val );
+Value* ObjMapFindRef( struct ObjMap* , const struct ObjStr* );
+
+/* Index of the entry or slot pointed by a reference returned above */
+static SPARROW_INLINE
+uint32_t ObjMapRefIndex( const struct ObjMap* map , const Value* ref ) {
+  if(map->shape) return (uint32_t)(ref - map->slot);
+  return (uint32_t)((const struct ObjMapEntry*)
+      ((const char*)ref - offsetof(struct ObjMapEntry,value)) - map->entry);
+}
+
 int ObjMapFindStr( struct Sparrow* , struct ObjMap* , const char* , Value* );
-int ObjMapRemove( struct ObjMap*, const struct ObjStr* ,Value* );
+int ObjMapRemove( struct Sparrow* , struct ObjMap*, const struct ObjStr* ,
+    Value* );
 void ObjMapClear( struct ObjMap* );
 void ObjMapDestroy( struct ObjMap* );
 void ObjMapIterInit( struct ObjMap* , struct ObjIterator* );
 
+/* Call GCPreBarrier on all the values , used before the map is cleared */
+void ObjMapPreBarrier( struct Sparrow* , struct ObjMap* );
+
+/* Shape tree , see struct Shape. ShapeDestroy frees the subtree and returns
+ * the number of shapes freed */
+struct Shape* ShapeNewRoot();
+size_t ShapeDestroy( struct Shape* root );
+
 #endif /* MAP_H_ */
@@ -27,34 +27,34 @@ static void test_map_basic() {
     {
       Value v;
       Vset_number(&v,1);
-      ObjMapPut(&m,new_str("k1",&k1),v);
+      ObjMapPut(NULL,&m,new_str("k1",&k1),v);
       assert(m.size == 1);
       assert(m.cap == 2);
     }
     {
       Value v;
       Vset_number(&v,2);
-      ObjMapPut(&m,new_str("k2",&k2),v);
+      ObjMapPut(NULL,&m,new_str("k2",&k2),v);
       assert( m.size == 2);
       assert(m.cap == 2);
     }
     {
       Value v;
       Vset_number(&v,3);
-      ObjMapPut(&m,new_str("k3",&k3),v);
+      ObjMapPut(NULL,&m,new_str("k3",&k3),v);
       assert( m.size == 3);
       assert( m.cap >= m.size);
     }
     {
       Value v;
       Vset_number(&v,4);
-      ObjMapPut(&m,new_str("k4",&k4),v);
+      ObjMapPut(NULL,&m,new_str("k4",&k4),v);
       assert(m.size == 4);
     }
     {
       Value v;
       Vset_number(&v,5);
-      ObjMapPut(&m,new_str("k5",&k5),v);
+      ObjMapPut(NULL,&m,new_str("k5",&k5),v);
       assert(m.size == 5);
     }
     assert( ObjMapFind(&m , new_str("k1",&k) , &v) == 0);
@@ -103,14 +103,14 @@ static void test_map_basic() {
     struct ObjStr k1,k2;
     ObjMapInit(&m,2);
     Vset_number(&v,10);
-    ObjMapPut(&m,new_str("Key2",&k1),v);
+    ObjMapPut(NULL,&m,new_str("Key2",&k1),v);
     assert( ObjMapFind(&m,&k1,&v) == 0);
     assert(Vget_number(&v) == 10);
     Vset_number(&v,1);
-    ObjMapPut(&m,new_str("Key2",&k2),v);
+    ObjMapPut(NULL,&m,new_str("Key2",&k2),v);
     assert( ObjMapFind(&m,&k2,&v) == 0);
     assert(Vget_number(&v) == 1);
-    assert(m.size == 2);
+    assert(m.size == 1);
     ObjMapDestroy(&m);
   }
   {
@@ -119,12 +119,12 @@ static void test_map_basic() {
     struct ObjStr k1,k2;
     ObjMapInit(&m,2);
     Vset_number(&v,10);
-    ObjMapPut(&m,new_str("Key",&k1),v);
+    ObjMapPut(NULL,&m,new_str("Key",&k1),v);
     assert( ObjMapFind(&m,&k1,&v) == 0);
     assert( Vget_number(&v) == 10);
     assert( m.size == 1 );
     // Delete this entry
-    assert( ObjMapRemove(&m,new_str("Key",&k2),&v) == 0);
+    assert( ObjMapRemove(NULL,&m,new_str("Key",&k2),&v) == 0);
     assert( m.size == 0);
     assert( ObjMapFind(&m,&k2,&v) != 0 );
     ObjMapDestroy(&m);
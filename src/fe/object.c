@@ -58,29 +58,70 @@ int ConstAddString( struct ObjProto* oc , struct ObjStr* str ) {
   return (int)(oc->str_size-1);
 }
 
+int ProtoAddScratch( struct ObjProto* oc ) {
+  struct ScratchSlot slot;
+  Vset_null(&(slot.obj));
+  slot.thread = NULL;
+  slot.frame = 0;
+  DynArrPush(oc,scratch,slot);
+  return (int)(oc->scratch_size-1);
+}
+
+int ProtoAddIC( struct ObjProto* oc , int key ) {
+  struct InlineCache ic;
+  ic.key = (uint32_t)key;
+  ic.size = 0;
+  DynArrPush(oc,ic,ic);
+  return (int)(oc->ic_size-1);
+}
+
+int ProtoAddCell( struct ObjProto* oc , int key ) {
+  struct GlobalCell cell;
+  cell.key = (uint32_t)key;
+  cell.version = 0;
+  cell.env = NULL;
+  cell.ref = NULL;
+  DynArrPush(oc,cell,cell);
+  return (int)(oc->cell_size-1);
+}
+
 /* String is *not* pooling in our implementation */
 #define add_gcobject(TH,OBJ,TYPE) \
   do { \
-    (OBJ)->gc.gc_state = GC_UNMARKED; \
-    (OBJ)->gc.next = (TH)->gc_start; \
-    (TH)->gc_start = (struct GCRef*)(OBJ); \
-    (TH)->gc_sz++; \
     (OBJ)->gc.gtype = (TYPE); \
+    GCAddObject(TH,&((OBJ)->gc),0); \
+    (TH)->gc_stat.type_sz[(TYPE)]++; \
+    (TH)->gc_stat.type_bytes[(TYPE)] += GCObjectSize((struct GCRef*)(OBJ)); \
+    (TH)->gc_young_sz++; \
   } while(0)
 
-#define init_static_map_gcstate(OBJ,TYPE) \
+/* Strings are rooted by the string pool and never hold any reference , so
+ * it is pointless to keep them in nursery. They are born old and stay
+ * marked like any other old objects */
+#define add_gcobject_old(TH,OBJ,TYPE) \
+  do { \
+    (OBJ)->gc.gtype = (TYPE); \
+    GCAddObject(TH,&((OBJ)->gc),1); \
+    (TH)->gc_stat.type_sz[(TYPE)]++; \
+    (TH)->gc_stat.type_bytes[(TYPE)] += GCObjectSize((struct GCRef*)(OBJ)); \
+  } while(0)
+
+#define init_static_map_gcstate(TH,OBJ,TYPE) \
   do { \
     /* Must be unmarked though map is static, but its entry */ \
     /* can be GC collected so mark phase still needs to work */ \
-    (OBJ)->gc.gc_state = GC_UNMARKED; \
-    (OBJ)->gc.next = NULL; \
+    (TH)->gc_env_mark = 0; \
+    (OBJ)->gc.gc_kind = GC_KIND_STATIC; \
+    (OBJ)->gc.gc_old = 0; \
+    (OBJ)->gc.gc_remember = 0; \
+    (OBJ)->gc.gc_age = 0; \
     (OBJ)->gc.gtype = (TYPE); \
     (OBJ)->mops = NULL; \
   } while(0)
 
 struct ObjMethod* ObjNewMethodNoGC( struct Sparrow* sth , CMethod method ,
     Value object , struct ObjStr* name ) {
-  struct ObjMethod* ret = malloc(sizeof(*ret));
+  struct ObjMethod* ret = GCAlloc(sth,sizeof(*ret));
   add_gcobject(sth,ret,VALUE_METHOD);
   ret->name = name;
   ret->method = method;
@@ -96,7 +137,7 @@ struct ObjMethod* ObjNewMethod( struct Sparrow* sth , CMethod method ,
 
 struct ObjList* ObjNewListNoGC( struct Sparrow* sth ,
     size_t cap ) {
-  struct ObjList* ret = malloc(sizeof(*ret));
+  struct ObjList* ret = GCAlloc(sth,sizeof(*ret));
   add_gcobject(sth,ret,VALUE_LIST);
   ObjListInit(sth,ret,cap);
   return ret;
@@ -110,9 +151,10 @@ struct ObjList* ObjNewList( struct Sparrow* sth ,
 
 struct ObjMap* ObjNewMapNoGC( struct Sparrow* sth ,
     size_t cap ) {
-  struct ObjMap* ret = malloc(sizeof(*ret));
+  struct ObjMap* ret = GCAlloc(sth,sizeof(*ret));
   add_gcobject(sth,ret,VALUE_MAP);
-  ObjMapInit(ret,cap);
+  ObjMapInitRecord(ret,sth->shape_root,cap);
+  sth->gc_bytes += ObjMapBytes(ret);
   return ret;
 }
 
@@ -128,7 +170,7 @@ struct ObjUdata* ObjNewUdataNoGC( struct Sparrow* sth ,
     UdataGCMarkFunction mark_func,
     CDataDestroyFunction destroy_func,
     UdataCall call_func ) {
-  struct ObjUdata* ret = malloc(sizeof(*ret));
+  struct ObjUdata* ret = GCAlloc(sth,sizeof(*ret));
   add_gcobject(sth,ret,VALUE_UDATA);
   ret->name = CStrDup(name);
   ret->udata= udata;
@@ -151,7 +193,7 @@ struct ObjUdata* ObjNewUdata( struct Sparrow* sth ,
 
 struct ObjProto* ObjNewProtoNoGC( struct Sparrow* sth ,
     struct ObjModule* mod ) {
-  struct ObjProto* ret = malloc(sizeof(*ret));
+  struct ObjProto* ret = GCAlloc(sth,sizeof(*ret));
   add_gcobject(sth,ret,VALUE_PROTO);
   CodeBufferInit(&(ret->code_buf));
   ret->num_arr = NULL;
@@ -160,6 +202,19 @@ struct ObjProto* ObjNewProtoNoGC( struct Sparrow* sth ,
   ret->str_size = ret->str_cap = 0;
   ret->uv_arr = NULL;
   ret->uv_cap = ret->uv_size = 0;
+  ret->scratch_arr = NULL;
+  ret->scratch_size = ret->scratch_cap = 0;
+  ret->ic_arr = NULL;
+  ret->ic_size = ret->ic_cap = 0;
+  ret->cell_arr = NULL;
+  ret->cell_size = ret->cell_cap = 0;
+  ret->jit = NULL;
+  ret->aot = NULL;
+  ret->dcode = NULL;
+  ret->hotness = 0;
+  ret->fb_arr = NULL;
+  ret->fb_size = 0;
+  ret->fb_idx = NULL;
   ret->narg = 0;
   ret->proto = CStrEmpty();
   ret->start = 0;
@@ -178,9 +233,8 @@ struct ObjProto* ObjNewProto( struct Sparrow* sth ,
 
 struct ObjClosure* ObjNewClosureNoGC( struct Sparrow* sth ,
     struct ObjProto* proto ) {
-  struct ObjClosure* cls = malloc(
+  struct ObjClosure* cls = GCAlloc(sth,
       sizeof(*cls)+sizeof(Value)*proto->uv_size);
-  UNUSE_ARG(sth);
   cls->proto = proto;
   cls->upval = (Value*)((char*)cls + sizeof(struct ObjClosure));
   add_gcobject(sth,cls,VALUE_CLOSURE);
@@ -194,7 +248,7 @@ struct ObjClosure* ObjNewClosure( struct Sparrow* sth ,
 }
 
 struct ObjIterator* ObjNewIteratorNoGC( struct Sparrow* sth ) {
-  struct ObjIterator* ret= malloc(sizeof(*ret));
+  struct ObjIterator* ret= GCAlloc(sth,sizeof(*ret));
   add_gcobject(sth,ret,VALUE_ITERATOR);
   ret->has_next = NULL;
   ret->deref = NULL;
@@ -224,7 +278,7 @@ struct ObjModule* ObjNewModuleNoGC( struct Sparrow* sth ,
   /* add a module */
   struct ObjModule* mod;
   assert( ObjFindModule(sth,fpath) == NULL );
-  mod =  malloc(sizeof(*mod));
+  mod = GCAlloc(sth,sizeof(*mod));
   mod->cls_arr = NULL;
   mod->cls_cap = mod->cls_size = 0;
   mod->source = CStrDup(source);
@@ -285,10 +339,116 @@ void ObjDumpModule( struct ObjModule* mod ,
   }
 }
 
+static const char* feedback_kind_str( uint32_t kind ) {
+  switch(kind) {
+    case FEEDBACK_ARITH: return "arith";
+    case FEEDBACK_COMPARE: return "compare";
+    case FEEDBACK_ATTR: return "attribute";
+    case FEEDBACK_INDEX: return "index";
+    default: assert(kind == FEEDBACK_CALL); return "call";
+  }
+}
+
+static const char* feedback_type_str( int bit ) {
+  if(bit < SIZE_OF_VALUE_TYPE) return GCTypeGetString(bit);
+  switch(1U<<bit) {
+    case FEEDBACK_NUMBER: return "number";
+    case FEEDBACK_BOOLEAN: return "boolean";
+    default: assert((1U<<bit) == FEEDBACK_NULL); return "null";
+  }
+}
+
+/* Number of types in a type set */
+static int feedback_type_count( uint32_t type ) {
+  int cnt = 0;
+  for( ; type ; type &= type - 1 ) ++cnt;
+  return cnt;
+}
+
+static void feedback_type_dump( FILE* file , const char* name ,
+    uint32_t type ) {
+  int i;
+  const char* sep = ":";
+  if(!type) return;
+  fprintf(file," %s",name);
+  for( i = 0 ; i < SIZE_OF_VALUE_TYPE + 3 ; ++i ) {
+    if(type & (1U<<i)) {
+      fprintf(file,"%s%s",sep,feedback_type_str(i));
+      sep = "|";
+    }
+  }
+}
+
+/* A site is polymorphic if it sees more than one target , or more than one
+ * type of an operand when it has no target */
+static const char* feedback_status( const struct FeedbackSlot* slot ) {
+  int cnt;
+  if(slot->target_size == FEEDBACK_MEGAMORPHIC) return "megamorphic";
+  cnt = (int)slot->target_size;
+  if(!cnt) {
+    int l = feedback_type_count(slot->type[0]);
+    int r = feedback_type_count(slot->type[1]);
+    cnt = l > r ? l : r;
+  }
+  return cnt > 1 ? "polymorphic" : "monomorphic";
+}
+
+/* A shape is shown by its number of keys. A callee is shown by its
+ * prototype if it is a proto of the module. GC drops the dead targets , see
+ * GCTrackFeedback */
+static void feedback_target_dump( FILE* file , struct ObjModule* mod ,
+    const struct FeedbackSlot* slot ) {
+  size_t i , j;
+  if(slot->target_size == FEEDBACK_MEGAMORPHIC) return;
+  for( i = 0 ; i < slot->target_size ; ++i ) {
+    if(slot->kind == FEEDBACK_CALL) {
+      const char* name = "<proto of other module>";
+      for( j = 0 ; j < mod->cls_size ; ++j ) {
+        if(mod->cls_arr[j] == slot->target[i]) {
+          name = mod->cls_arr[j]->proto.str;
+          break;
+        }
+      }
+      fprintf(file," proto:%s",name);
+    } else {
+      const struct Shape* shape = slot->target[i];
+      fprintf(file," shape:%zu keys",shape->size);
+    }
+  }
+}
+
+void ObjDumpFeedback( struct ObjModule* mod , FILE* file ) {
+  size_t i;
+  fprintf(file,"Source path:%s!\n",mod->source_path.str);
+  for( i = 0 ; i < mod->cls_size ; ++i ) {
+    struct ObjProto* cls = mod->cls_arr[i];
+    size_t j;
+    fprintf(file,"%zu. Proto prototype:%s\n",i+1,cls->proto.str);
+    if(!cls->fb_idx) {
+      fprintf(file,"No feedback , proto is not warm\n");
+      continue;
+    }
+    for( j = 0 ; j < cls->fb_size ; ++j ) {
+      const struct FeedbackSlot* slot = cls->fb_arr + j;
+      if(!slot->count) continue;
+      fprintf(file,"%u. %s(%s) count:%u %s",slot->pc,
+          BytecodeGetName(CodeBufferDecodeOP(&(cls->code_buf),slot->pc)),
+          feedback_kind_str(slot->kind),
+          slot->count,
+          feedback_status(slot));
+      feedback_type_dump(file,
+          slot->kind == FEEDBACK_CALL ? "callee" : "left",slot->type[0]);
+      feedback_type_dump(file,"right",slot->type[1]);
+      feedback_target_dump(file,mod,slot);
+      fprintf(file,"\n");
+    }
+  }
+}
+
 struct ObjComponent* ObjNewComponentNoGC( struct Sparrow* sth,
     struct ObjModule* module , struct ObjMap* env ) {
   struct ObjComponent* component;
-  component = malloc(sizeof(*component));
+  component = GCAlloc(sth,sizeof(*component));
   component->env = env;
   component->module = module;
   add_gcobject(sth,component,VALUE_COMPONENT);
@@ -305,7 +465,7 @@ struct ObjComponent* ObjNewComponent( struct Sparrow* sth,
 struct ObjLoop* ObjNewLoopNoGC( struct Sparrow* sth,
     int start, int end, int step ) {
   struct ObjLoop* loop;
-  loop = malloc(sizeof(*loop));
+  loop = GCAlloc(sth,sizeof(*loop));
   loop->start = start;
   loop->end = end;
   loop->step = step;
@@ -321,7 +481,7 @@ struct ObjLoop* ObjNewLoop( struct Sparrow* sth,
 
 struct ObjLoopIterator* ObjNewLoopIteratorNoGC( struct Sparrow* sth,
     struct ObjLoop* loop ) {
-  struct ObjLoopIterator* iterator = malloc(sizeof(*iterator));
+  struct ObjLoopIterator* iterator = GCAlloc(sth,sizeof(*iterator));
   iterator->end = loop->end;
   iterator->step= loop->step;
   iterator->loop= loop;
@@ -392,19 +552,19 @@ static void list_print( struct Sparrow* sth, struct StrBuf* buf ,
 
 static void map_print( struct Sparrow* sth, struct StrBuf* buf ,
     struct ObjMap* map ) {
-  size_t i;
   size_t cnt = 0;
-  Value k;
+  Value k , v;
+  struct ObjIterator itr;
   StrBufAppendStrLen(buf,"{",1);
-  for( i = 0 ; i < map->cap ; ++i ) {
-    struct ObjMapEntry* e = map->entry+i;
-    if(!e->used || e->del) continue;
-    Vset_str(&k,e->key);
+  ObjMapIterInit(map,&itr);
+  while(itr.has_next(sth,&itr) == 0) {
+    itr.deref(sth,&itr,&k,&v);
     ValuePrint(sth,buf,k);
     StrBufAppendStrLen(buf,":",1);
-    ValuePrint(sth,buf,e->value);
+    ValuePrint(sth,buf,v);
     ++cnt;
     if(cnt != map->size) StrBufAppendStrLen(buf,",",1);
+    itr.move(sth,&itr);
   }
   StrBufAppendStrLen(buf,"}",1);
 }
@@ -539,7 +699,7 @@ static struct ObjUdata* create_ifunc_udata( struct Sparrow* sparrow ,
 /* global env initialization */
 static void global_env_init( struct Sparrow* sparrow ,
     struct GlobalEnv* genv ) {
-  init_static_map_gcstate(&(genv->env),VALUE_MAP);
+  init_static_map_gcstate(sparrow,&(genv->env),VALUE_MAP);
   ObjMapInit(&genv->env,NextPowerOf2Size(SIZE_OF_IFUNC+4));
 
 #define ADD(NAME,FUNC) \
@@ -548,7 +708,7 @@ static void global_env_init( struct Sparrow* sparrow ,
     struct ObjUdata* udata = FUNC(sparrow); \
     Value v; \
     Vset_udata(&v,udata); \
-    ObjMapPut(&(genv->env),name,v); \
+    ObjMapPut(sparrow,&(genv->env),name,v); \
   } while(0)
 
   ADD(list,GCreateListUdata);
@@ -566,7 +726,7 @@ static void global_env_init( struct Sparrow* sparrow ,
     Value v; \
     genv->icall[IFUNC_##A] = Builtin_##B; \
     Vset_udata(&v,create_ifunc_udata(sparrow,Builtin_##B,"function::" C)); \
-    ObjMapPut(&(genv->env),name,v); \
+    ObjMapPut(sparrow,&(genv->env),name,v); \
   } while(0);
 
   INTRINSIC_FUNCTION(__)
@@ -576,37 +736,65 @@ static void global_env_init( struct Sparrow* sparrow ,
 
 /* only used here for SparrowDestroy */
 void SparrowDestroy( struct Sparrow* sth ) {
-  struct GCRef* start , *temp;
-  size_t i;
-#ifndef NDEBUG
-  i = 0;
-#endif
-
-  start = sth->gc_start;
-  while( start ) {
-    temp = start->next;
-    GCFinalizeObj(sth,start);
-    start = temp;
-#ifndef NDEBUG
-    ++i;
-#endif /* NDEBUG */
-  }
-  assert( i == sth->gc_sz );
+  GCStopMarker(sth);
+  GCDestroyHeap(sth);
+  free(sth->gc_remember_arr);
+  sth->gc_remember_arr = NULL;
+  sth->gc_remember_size = sth->gc_remember_cap = 0;
+  free(sth->gc_gray_arr);
+  sth->gc_gray_arr = NULL;
+  sth->gc_gray_size = sth->gc_gray_cap = 0;
+  free(sth->gc_feedback_arr);
+  sth->gc_feedback_arr = NULL;
+  sth->gc_feedback_size = sth->gc_feedback_cap = 0;
   free(sth->str_arr);
   sth->str_arr = NULL;
   sth->str_size = sth->str_cap = 0;
   ListInit(sth,mod);
 
   ObjMapDestroy(&(sth->global_env.env));
+  ShapeDestroy(sth->shape_root);
+  sth->shape_root = NULL;
+  sth->shape_size = 0;
 }
 
 void SparrowInit( struct Sparrow* sth ) {
   sth->runtime = NULL;
   sth->max_funccall = SPARROW_DEFAULT_FUNCCALL_SIZE;
   sth->max_stacksize= SPARROW_DEFAULT_STACK_SIZE;
-  sth->gc_start = NULL;
   sth->gc_prevsz = 0;
+  sth->gc_freed = 0;
   sth->gc_sz = 0;
+  sth->gc_bytes = 0;
+  sth->gc_young_sz = 0;
+  sth->gc_env_mark = 0;
+  sth->gc_remember_arr = NULL;
+  sth->gc_remember_size = 0;
+  sth->gc_remember_cap = 0;
+  sth->gc_gray_arr = NULL;
+  sth->gc_gray_size = 0;
+  sth->gc_gray_cap = 0;
+  sth->gc_feedback_arr = NULL;
+  sth->gc_feedback_size = 0;
+  sth->gc_feedback_cap = 0;
+  sth->gc_phase = GC_PHASE_IDLE;
+  sth->gc_budget = SPARROW_DEFAULT_GC_BUDGET;
+  sth->gc_sweep = NULL;
+  sth->gc_sweep_large = NULL;
+  sth->gc_concurrent = SPARROW_DEFAULT_GC_CONCURRENT;
+#ifdef SPARROW_GC_CONCURRENT
+  atomic_init(&(sth->gc_marking),0);
+  atomic_init(&(sth->gc_thread_idle),1);
+  atomic_init(&(sth->gc_lock_request),0);
+  sth->gc_thread_start = 0;
+#else
+  sth->gc_marking = 0;
+#endif /* SPARROW_GC_CONCURRENT */
+  memset(sth->gc_page,0,sizeof(sth->gc_page));
+  sth->gc_page_all = NULL;
+  sth->gc_large_young = NULL;
+  sth->gc_large_old = NULL;
+  sth->gc_page_size = 0;
   sth->gc_active = 0;
   sth->gc_inactive = 0;
   sth->gc_generation = 0;
@@ -616,15 +804,24 @@ void SparrowInit( struct Sparrow* sth ) {
   sth->gc_penalty_ratio = SPARROW_DEFAULT_GC_PENALTY_RATIO;
   sth->gc_adjust_threshold = sth->gc_threshold;
   sth->gc_penalty_times = 0;
+  sth->gc_nursery_size = SPARROW_DEFAULT_GC_NURSERY_SIZE;
+  sth->gc_promote_age = SPARROW_DEFAULT_GC_PROMOTE_AGE;
+  sth->gc_minor_generation = 0;
+  sth->gc_promoted = 0;
+  memset(&(sth->gc_stat),0,sizeof(sth->gc_stat));
   sth->str_arr = calloc(sizeof(struct ObjStr*),STRING_POOL_SIZE);
   sth->str_cap = STRING_POOL_SIZE;
   sth->str_size = 0;
+  sth->shape_root = ShapeNewRoot();
+  sth->shape_size = 1;
+  sth->global_version = 1;
+  sth->jit_size = 0;
   ListInit(sth,mod);
 
   /* Initialize global builtin function name lists */
 #define __(A,B,C) \
   do { \
-    sth->BuiltinFuncName_##B = ObjNewStr(sth,C,STRING_SIZE(C)); \
+    sth->BuiltinFuncName_##B = ObjNewStrNoGC(sth,C,STRING_SIZE(C)); \
   } while(0);
 
   INTRINSIC_FUNCTION(__)
@@ -634,7 +831,7 @@ void SparrowInit( struct Sparrow* sth ) {
   /* Initialize intrinsic attribute name lists */
 #define __(A,B) \
     do { \
-      sth->IAttrName_##A = ObjNewStr(sth,B,STRING_SIZE(B)); \
+      sth->IAttrName_##A = ObjNewStrNoGC(sth,B,STRING_SIZE(B)); \
     } while(0);
 
   INTRINSIC_ATTRIBUTE(__)
@@ -664,50 +861,55 @@ struct ObjStr* IAttrGetObjStr( struct Sparrow* sparrow,
 /* ========================================
  * String pool implementation
  * ======================================*/
+/* Rebuild the string pool with capacity NCAP , empty slots are skipped */
+static void objstr_rehash( struct Sparrow* sth , size_t ncap ) {
+  struct ObjStr** new_entry = calloc(sizeof(struct ObjStr*),ncap);
+  size_t i;
+  int idx;
+  for( i = 0 ; i < sth ->str_cap ; ++i ) {
+    struct ObjStr* s;
+    struct ObjStr** e;
+
+    s = sth->str_arr[i];
+    if(!s) continue;
+    idx = s->hash & (ncap-1);
+    e = new_entry + idx;
+
+    if(!*e) {
+      *e = s;
+      s->more = 0;
+      s->next = 0;
+    } else {
+      /* find where we should chain */
+      struct ObjStr** n;
+      uint32_t h = s->hash;
+      while((*e)->more) {
+        e = new_entry + (*e)->next;
+      }
+      n = e;
+      /* probing for an empty slot */
+      do {
+        e = new_entry + ((++h) & (ncap-1));
+      } while(*e);
+      *e = s;
+      s->more = 0;
+      s->next = 0;
+      (*n)->more = 1;
+      (*n)->next = (e - new_entry);
+    }
+  }
+  free(sth->str_arr);
+  sth->str_arr = new_entry;
+  sth->str_cap = ncap;
+}
+
 static void objstr_insert( struct Sparrow* sth ,
     struct ObjStr* str,
     struct ObjStr* hint ) {
   int idx;
   struct ObjStr** slot;
   if( sth->str_size == sth->str_cap ) {
-    /* do a rehashing */
-    size_t ncap = sth->str_cap * 2;
-    struct ObjStr** new_entry = calloc(sizeof(struct ObjStr*),ncap);
-    size_t i;
-    for( i = 0 ; i < sth ->str_cap ; ++i ) {
-      struct ObjStr* s;
-      struct ObjStr** e;
-
-      s = sth->str_arr[i];
-      idx = s->hash & (ncap-1);
-      e = new_entry + idx;
-
-      if(!*e) {
-        *e = s;
-        s->more = 0;
-        s->next = 0;
-      } else {
-        /* find where we should chain */
-        struct ObjStr** n;
-        uint32_t h = s->hash;
-        while((*e)->more) {
-          e = new_entry + (*e)->next;
-        }
-        n = e;
-        /* probing for an empty slot */
-        do {
-          e = new_entry + ((++h) & (ncap-1));
-        } while(*e);
-        *e = s;
-        s->more = 0;
-        s->next = 0;
-        (*n)->more = 1;
-        (*n)->next = (e - new_entry);
-      }
-    }
-    free(sth->str_arr);
-    sth->str_arr = new_entry;
-    sth->str_cap = ncap;
+    objstr_rehash(sth,sth->str_cap*2);
     hint = NULL; /* invalidate HINT */
   }
   /* real insertion */
@@ -753,9 +955,16 @@ struct ObjStr* ObjNewStrNoGC( struct Sparrow* sth ,
       break;
     }
   }
-  if(slot) return slot;
-  else {
-    struct ObjStr* new_str = malloc(sizeof(*new_str)+len+1);
+  if(slot) {
+    /* The pool is weak , a string that is not marked yet may be found
+     * during an incremental major GC. It is alive again and must be
+     * marked , otherwise it gets swept while the caller is using it */
+    if(SP_UNLIKELY(sth->gc_phase == GC_PHASE_MARK) &&
+       !GCIsMarked(sth,&(slot->gc)))
+      GCShade(sth,&(slot->gc));
+    return slot;
+  } else {
+    struct ObjStr* new_str = GCAlloc(sth,sizeof(*new_str)+len+1);
     new_str->str = ((char*)new_str+sizeof(*new_str));
     new_str->len = len;
     new_str->hash = hash;
@@ -770,11 +979,31 @@ struct ObjStr* ObjNewStrNoGC( struct Sparrow* sth ,
     ((char*)new_str->str)[len] = 0;
 
     objstr_insert(sth,new_str,hint);
-    add_gcobject(sth,new_str,VALUE_STRING);
+    add_gcobject_old(sth,new_str,VALUE_STRING);
     return new_str;
   }
 }
 
+void ObjStrPoolSweep( struct Sparrow* sth ) {
+  size_t i;
+  size_t live = 0;
+  size_t ncap;
+  for( i = 0 ; i < sth->str_cap ; ++i ) {
+    struct ObjStr* s = sth->str_arr[i];
+    if(!s) continue;
+    if(!GCIsMarked(sth,&(s->gc))) sth->str_arr[i] = NULL;
+    else ++live;
+  }
+  if(live == sth->str_size) return;
+
+  /* removing a string breaks the collision chain that goes through it ,
+   * so the pool is always rebuilt. Shrink it when it becomes sparse */
+  ncap = sth->str_cap;
+  while(ncap > STRING_POOL_SIZE && live < ncap/4) ncap /= 2;
+  sth->str_size = live;
+  objstr_rehash(sth,ncap);
+}
+
 struct ObjStr* ObjNewStr( struct Sparrow* sth ,
     const char* str, size_t len ) {
   GCTry(sth);
@@ -870,6 +1099,24 @@ const char* ValueGetTypeString( Value v ) {
   }
 }
 
+const char* GCTypeGetString( int type ) {
+  switch(type) {
+    case VALUE_LIST: return "list";
+    case VALUE_MAP: return "map";
+    case VALUE_PROTO: return "proto";
+    case VALUE_CLOSURE: return "closure";
+    case VALUE_METHOD: return "method";
+    case VALUE_UDATA: return "udata";
+    case VALUE_STRING: return "string";
+    case VALUE_ITERATOR: return "iterator";
+    case VALUE_MODULE: return "module";
+    case VALUE_COMPONENT: return "component";
+    case VALUE_LOOP: return "loop";
+    case VALUE_LOOP_ITERATOR: return "loop_iterator";
+    default: assert(!"unreachable!"); return NULL;
+  }
+}
+
 double ValueToNumber( struct Runtime* rt , Value obj ,
     int* fail ) {
   double ret = 0;
@@ -8,19 +8,39 @@
 #include "../util.h"
 #include "bc.h"
 
+#ifdef SPARROW_GC_CONCURRENT
+#include <pthread.h>
+#include <stdatomic.h>
+#endif /* SPARROW_GC_CONCURRENT */
+
 struct Sparrow;
 struct ObjModule;
 struct Runtime;
 struct ObjIterator;
 struct ObjUdata;
+struct JitCode;
+struct DecodedIns;
 
 /* Garbage collector header for each value.
- * The gc header is just a pointer to next.
- * Currently we just use a stop the world GC, in the future if we want
- * to fancy stuff , the pointer can be overlapped with 2 bits states */
+ * The gc header only holds the type and the generation of an object , mark
+ * bits live in side bitmaps , see gc.c. We use a generational GC. Object is
+ * born in nursery and gets promoted into the old generation after it
+ * survives several collections. Old objects stay *marked* between major
+ * GCs , so a minor GC naturally stops at them while marking */
+
+/* Where the memory of a GC object comes from , see GCAlloc */
+enum {
+  GC_KIND_SLAB = 0, /* slot of a slab page */
+  GC_KIND_LARGE,    /* malloc , prefixed with a header */
+  GC_KIND_STATIC    /* embedded in Sparrow , never freed */
+};
+
+/* Phase of major GC , only incremental major GC can be observed in phase
+ * other than GC_PHASE_IDLE */
 enum {
-  GC_UNMARKED = 0,
-  GC_MARKED
+  GC_PHASE_IDLE = 0,
+  GC_PHASE_MARK,
+  GC_PHASE_SWEEP
 };
 
 /* Threshold for whether a string is large or not */
@@ -45,13 +65,33 @@ uint32_t HashString( const char* str , size_t len ) {
     return LargeStringHash(str,len);
 }
 
-/* This is obviously not cache-friendly GC header */
 struct GCRef {
-  struct GCRef* next;
-  uint32_t gc_state : 4;
-  uint32_t gtype : 28;
+  uint8_t gtype;
+  uint8_t gc_kind;     /* GC_KIND_XXX */
+  uint8_t gc_old;      /* Whether object is in old generation */
+  uint8_t gc_remember; /* Whether object is in remembered set */
+  uint8_t gc_age;      /* Number of collections survived */
 };
 
+/* Largest value gc_age can hold */
+#define GC_MAX_AGE UINT8_MAX
+
+/* Word of mark bitmaps. The marker thread sets mark bits while interpreter
+ * allocates and runs barriers , so it is an atomic word when concurrent GC
+ * is compiled in */
+#ifdef SPARROW_GC_CONCURRENT
+typedef _Atomic uint64_t GCBits;
+#else
+typedef uint64_t GCBits;
+#endif /* SPARROW_GC_CONCURRENT */
+
+/* Size classes of slab allocator , see GCAlloc in gc.c. Object larger than
+ * GC_SIZE_CLASS_STEP * GC_SIZE_CLASS_SIZE goes to malloc directly */
+#define GC_SIZE_CLASS_STEP 16
+#define GC_SIZE_CLASS_SIZE 16
+struct GCPage;
+struct GCLarge;
+
 /* Put this as the first element in each structure to
  * allow us to do correct pointer casting */
 #define DEFINE_GCOBJECT struct GCRef gc
@@ -86,7 +126,8 @@ enum {
   VALUE_COMPONENT,
   VALUE_LOOP,/* specialized loop objects for VM to execut the common loop
               * faster */
-  VALUE_LOOP_ITERATOR
+  VALUE_LOOP_ITERATOR,
+  SIZE_OF_VALUE_TYPE
 };
 
 typedef union _Value {
@@ -215,12 +256,33 @@ struct ObjMapEntry {
   uint32_t used: 1;
 };
 
+/* Shape of a record map. Record maps created by the same code add their
+ * keys in the same order , so they share a path of a transition tree whose
+ * node is the list of keys so far. A record only keeps a dense array of
+ * values , value i belongs to keys[i]. Shapes are owned by the Sparrow ,
+ * major GC keeps the shapes used by live maps and inline caches along with
+ * their keys and prunes the rest of the tree , see gc.c */
+struct Shape {
+  struct Shape* root;    /* Empty shape of the tree */
+  struct Shape* child;   /* First transition */
+  struct Shape* sibling; /* Next transition of the parent */
+  size_t size;           /* Number of keys */
+  size_t mark;           /* Epoch of the last major GC that kept it */
+  struct ObjStr** keys;
+};
+
+/* A map is either a record which has a shape and a slot array , or a
+ * dictionary which has a hash table. Maps created by ObjNewMap start as
+ * record and become dictionary when a key is removed or there're too many
+ * keys or shapes , see map.c */
 struct ObjMap {
   DEFINE_GCOBJECT; /* GC object */
   size_t scnt; /* slot count */
   size_t size;
-  size_t cap;
-  struct ObjMapEntry* entry; /* hash entry */
+  size_t cap;  /* capacity of entry or slot */
+  struct ObjMapEntry* entry; /* hash entry , NULL for record */
+  struct Shape* shape; /* shape of record , NULL for dictionary */
+  Value* slot; /* values of record */
   struct MetaOps* mops; /* meta Operations */
 };
 
@@ -269,6 +331,77 @@ struct UpValueIndex {
   uint32_t state: 1;
 };
 
+/* Scratch object of an empty list/map literal that never escapes its
+ * local variable , see BC_NEWL0S and BC_NEWM0S */
+struct ScratchSlot {
+  Value obj; /* Cached object , null if not created yet */
+  const void* thread; /* CallThread of the frame that owns the object */
+  size_t frame; /* Index of the frame that owns the object */
+};
+
+/* Inline cache of a BC_AGETS/BC_ASETS instruction. It remembers where the
+ * key lives in each map layout seen by the instruction. For a record map
+ * the layout is its shape and the index is the slot of the key. Dictionary
+ * maps built by the same code put a key at the same entry , so for them the
+ * shape is NULL and a map whose entry at the index holds the key is a hit.
+ * Once more than SPARROW_IC_SIZE layouts are seen the instruction is
+ * megamorphic and always does the full lookup */
+#define IC_MEGAMORPHIC ((uint32_t)-1)
+
+struct InlineCache {
+  uint32_t key;  /* index of the attribute name in string table */
+  uint32_t size; /* number of cached layouts or IC_MEGAMORPHIC */
+  const struct Shape* shape[SPARROW_IC_SIZE];
+  uint32_t idx[SPARROW_IC_SIZE];
+};
+
+/* Type feedback of an arithmetic , comparison , attribute , index or call
+ * instruction. The vector of a proto is allocated once it gets warm , see
+ * SPARROW_FEEDBACK_THRESHOLD , and a slot is only updated by the slow paths
+ * of vm_main : a generic instruction , a failed guard of a quickened one ,
+ * an inline cache miss , and index and call instructions which have no fast
+ * path there. So a slot tells why its site is slow.
+ *
+ * type[0] and type[1] are the types seen as left and right operand , object
+ * and key of an index , object and value of an attribute set , and callee
+ * of a call. A type is VALUE_* of a GC object as a bit , or one of the
+ * FEEDBACK_NUMBER/BOOLEAN/NULL bits. target is the map shapes seen by an
+ * attribute or index site and the callee protos of a call site */
+#define FEEDBACK_NUMBER (1U<<SIZE_OF_VALUE_TYPE)
+#define FEEDBACK_BOOLEAN (FEEDBACK_NUMBER<<1)
+#define FEEDBACK_NULL (FEEDBACK_BOOLEAN<<1)
+#define FEEDBACK_MEGAMORPHIC ((uint32_t)-1)
+#define FEEDBACK_NONE ((uint32_t)-1) /* instruction isn't a site */
+
+enum {
+  FEEDBACK_ARITH,
+  FEEDBACK_COMPARE,
+  FEEDBACK_ATTR,
+  FEEDBACK_INDEX,
+  FEEDBACK_CALL
+};
+
+struct FeedbackSlot {
+  uint32_t pc;    /* index of the instruction */
+  uint32_t kind;  /* FEEDBACK_ARITH ... FEEDBACK_CALL */
+  uint32_t count; /* times the slow path is taken */
+  uint32_t type[2];
+  uint32_t target_size; /* number of targets or FEEDBACK_MEGAMORPHIC */
+  const void* target[SPARROW_FEEDBACK_SIZE];
+};
+
+/* Global variable cell of a BC_GGET/BC_GSET* instruction. It points to
+ * the value of the global inside of the component env or the GlobalEnv ,
+ * so a read or write is a single load or store. A cell is valid while
+ * version equals Sparrow's global_version , which is bumped whenever an
+ * env may have new names or moved storage , see SparrowGlobalChanged */
+struct GlobalCell {
+  uint32_t key;   /* index of the name in string table */
+  size_t version; /* 0 means not resolved */
+  const struct ObjMap* env; /* component env it is resolved for */
+  Value* ref;
+};
+
 /* Represented a compiled closure */
 struct ObjProto {
   DEFINE_GCOBJECT; /* GC object */
@@ -285,6 +418,28 @@ struct ObjProto {
   struct UpValueIndex* uv_arr;
   size_t uv_cap;
   size_t uv_size;
+  /* Scratch object table */
+  struct ScratchSlot* scratch_arr;
+  size_t scratch_size;
+  size_t scratch_cap;
+  /* Inline cache table */
+  struct InlineCache* ic_arr;
+  size_t ic_size;
+  size_t ic_cap;
+  /* Global variable cell table */
+  struct GlobalCell* cell_arr;
+  size_t cell_size;
+  size_t cell_cap;
+  /* Native code , see jit.h */
+  struct JitCode* jit;
+  const struct AotFunc* aot; /* compiled ahead of time , see aot.h */
+  /* Pre-decoded code of a direct threading interpreter , see vm.c */
+  struct DecodedIns* dcode;
+  size_t hotness; /* Entries plus loop iterations of the function */
+  /* Type feedback , NULL until the proto is warm , see vm.c */
+  struct FeedbackSlot* fb_arr;
+  size_t fb_size;
+  uint32_t* fb_idx; /* slot of each instruction or FEEDBACK_NONE */
   /* Closure index */
   struct ObjModule* module;
   int cls_idx;
@@ -356,6 +511,11 @@ struct ObjStr* ObjNewStr( struct Sparrow* , const char* , size_t len );
 struct ObjStr* ObjNewStrFromChar( struct Sparrow* , char  );
 struct ObjStr* ObjNewStrFromCharNoGC( struct Sparrow* , char  );
 
+/* The string pool doesn't keep strings alive. This function removes the
+ * strings that are not marked from the pool , it must be called by major
+ * GC after marking and before any string is swept */
+void ObjStrPoolSweep( struct Sparrow* );
+
 struct ObjList* ObjNewListNoGC( struct Sparrow* , size_t cap );
 struct ObjList* ObjNewList( struct Sparrow* , size_t cap );
 
@@ -424,10 +584,17 @@ void ObjDestroyModule( struct ObjModule* mod ) {
 /* Debug purpose */
 void ObjDumpModule( struct ObjModule* , FILE* , const char* );
 
+/* Dump the type feedback of the module's protos , only the sites whose slow
+ * path was taken are listed */
+void ObjDumpFeedback( struct ObjModule* , FILE* );
+
 
 /* Used in parser */
 int ConstAddNumber( struct ObjProto* oc , double num );
 int ConstAddString( struct ObjProto* oc , struct ObjStr* );
+int ProtoAddScratch( struct ObjProto* oc );
+int ProtoAddIC( struct ObjProto* oc , int key );
+int ProtoAddCell( struct ObjProto* oc , int key );
 
 /* Intrinsic function call prototype , must match prototype defined in
  * builtin.h/c file */
@@ -441,51 +608,147 @@ struct GlobalEnv {
 };
 
 /* Sparrow */
+/* Heap statistics. They are always on , the counters are updated when an
+ * object is created or freed and the clock is only read at the boundary of
+ * each GC phase. Time is in microseconds and only counts the time spent by
+ * the interpreter thread , the concurrent marker thread is not included */
+enum {
+  GC_MINOR = 0,
+  GC_MAJOR,
+  SIZE_OF_GC_KIND
+};
+
+struct GCPause {
+  int major;    /* Whether it is a major GC */
+  double mark;  /* Time spent on marking */
+  double sweep; /* Time spent on swapping */
+};
+
+struct GCStat {
+  size_t type_sz[SIZE_OF_VALUE_TYPE]; /* Live objects of each type */
+  size_t type_bytes[SIZE_OF_VALUE_TYPE]; /* Bytes held by objects of each
+                                          * type , backing storage of list
+                                          * and map is not included */
+  /* log2 histograms of mark and swap time of each collection , indexed
+   * by GC_MINOR/GC_MAJOR. Bucket 0 also counts anything less than 1 and
+   * the last bucket counts anything longer */
+  size_t mark_hist[SIZE_OF_GC_KIND][SPARROW_GC_HISTOGRAM_SIZE];
+  size_t sweep_hist[SIZE_OF_GC_KIND][SPARROW_GC_HISTOGRAM_SIZE];
+  /* Ring buffer of latest collections */
+  struct GCPause history[SPARROW_GC_HISTORY_SIZE];
+  size_t history_size; /* Collections recorded so far */
+  struct GCPause current; /* Major GC in progress */
+};
+
 struct Sparrow {
   struct Runtime* runtime; /* If non null means running */
   size_t max_stacksize;    /* Maximum allowed stack size */
   size_t max_funccall;     /* Maximum allowed function call */
 
-  struct GCRef* gc_start; /* Start of managed objects */
-  size_t gc_sz; /* Size of the GC objects list */
+  size_t gc_sz; /* Size of all the GC objects */
+  size_t gc_bytes; /* Memory held by GC objects including their backing
+                    * storage , this is what triggers major GC */
+  size_t gc_young_sz; /* Size of the young GC objects */
+  GCBits gc_env_mark; /* Mark bit of global_env.env */
+
+  /* Remembered set. Old objects that may hold reference to young objects.
+   * It is maintained by write barrier , see GCBarrier in gc.h */
+  struct GCRef** gc_remember_arr;
+  size_t gc_remember_size;
+  size_t gc_remember_cap;
+
+  /* Gray stack for marking */
+  struct GCRef** gc_gray_arr;
+  size_t gc_gray_size;
+  size_t gc_gray_cap;
+
+  /* Protos that have a feedback vector , see GCTrackFeedback */
+  struct ObjProto** gc_feedback_arr;
+  size_t gc_feedback_size;
+  size_t gc_feedback_cap;
+
+  /* Incremental major GC */
+  int gc_phase;            /* Current phase of major GC */
+  size_t gc_budget;        /* Objects visited per GC step , 0 means STW */
+  struct GCPage** gc_sweep; /* Cursor of swapping old generation */
+  struct GCLarge** gc_sweep_large;
+
+  /* Concurrent major GC , see gc.c. gc_marking is only set by interpreter
+   * thread and is true while the marker thread may be scanning the heap */
+  int gc_concurrent;       /* Whether major GC marks on the marker thread */
+#ifdef SPARROW_GC_CONCURRENT
+  atomic_int gc_marking;
+  pthread_t gc_thread;
+  pthread_mutex_t gc_lock; /* Heap lock , held by marker while scanning */
+  pthread_cond_t gc_cond;
+  int gc_thread_start;     /* Whether marker thread has been created */
+  int gc_thread_quit;
+  atomic_int gc_thread_idle;  /* Marker thread runs out of gray objects */
+  atomic_int gc_lock_request; /* Interpreter is waiting for gc_lock */
+#else
+  int gc_marking;
+#endif /* SPARROW_GC_CONCURRENT */
+
+  /* Slab allocator. Pages that still have free slot of each size class ,
+   * all the pages and objects that are too large for any size class */
+  struct GCPage* gc_page[GC_SIZE_CLASS_SIZE];
+  struct GCPage* gc_page_all;
+  size_t gc_page_size;     /* Number of pages allocated */
+  struct GCLarge* gc_large_young;
+  struct GCLarge* gc_large_old;
 
   /* GC tune parameters */
   size_t gc_active;   /* Last round of GC's active count */
   size_t gc_inactive; /* Last round of GC's inactive count */
-  size_t gc_prevsz;   /* Previous GC size */
+  size_t gc_prevsz;   /* Previous GC size in bytes */
+  size_t gc_freed;    /* Last round of GC's freed bytes */
   size_t gc_generation; /* Generation count of GC */
-  size_t gc_threshold ; /* Threshold of GC */
+  size_t gc_threshold ; /* Threshold of GC in bytes */
   double gc_ratio ;     /* GC triggering ratio */
   size_t gc_ps_threshold;  /* Cached value for gc_ratio * gc_prevsz */
-  double gc_penalty_ratio; /* GC penalty ratio, when gc_inactive/gc_prevsz
+  double gc_penalty_ratio; /* GC penalty ratio, when gc_freed/gc_prevsz
                             * is less than this value, a penalty will trigger
                             * which avoid too much frequent GC collection. */
   size_t gc_adjust_threshold;/* threshold after applied penalty if we have
                               * so. This is also a cached value so should update
                               * it accordinly */
   size_t gc_penalty_times;
+  size_t gc_nursery_size; /* Young objects count that triggers minor GC */
+  size_t gc_promote_age;  /* Collections needed to get promoted */
+  size_t gc_minor_generation; /* Minor GC count */
+  size_t gc_promoted;     /* Last round of GC's promoted count */
+  struct GCStat gc_stat;
 
   /* Parsed file module */
   struct ObjModule mod_list;
 
-  /* Global string pool */
+  /* Global string pool , it is weak , see ObjStrPoolSweep */
   struct ObjStr** str_arr;
   size_t str_size;
   size_t str_cap;
 
+  /* Shape tree of record maps */
+  struct Shape* shape_root;
+  size_t shape_size;
+
+  /* Version of the layout of global envs , see struct GlobalCell */
+  size_t global_version;
+
+  /* Bytes of executable memory held by native code */
+  size_t jit_size;
+
   /* Global envrionment */
   struct GlobalEnv global_env;
 
   /* Resource that is global */
   /* All the intrinsic function(builtin)'s name in static ObjStr
-   * structure. They don't participate in GC at all. A little bit
-   * optimization from traditionall large root sets */
+   * structure. They are marked as root by major GC */
 #define __(A,B,C) struct ObjStr* BuiltinFuncName_##B;
   INTRINSIC_FUNCTION(__)
 #undef __ /* __ */
 
   /* All the intrinsic attribute's name in static ObjStr
-   * structure. They don't participate in GC at all. */
+   * structure. They are marked as root by major GC */
 #define __(A,C) struct ObjStr* IAttrName_##A;
   INTRINSIC_ATTRIBUTE(__)
 #undef __ /* __ */
@@ -494,6 +757,30 @@ struct Sparrow {
 #define IFUNC_NAME(SP,NAME) (((SP)->BuiltinFuncName_##NAME))
 #define IATTR_NAME(SP,NAME) ((SP)->IAttrName_##NAME)
 
+/* Whether the marker thread may be scanning the heap. It is constant 0 when
+ * concurrent GC is not compiled in so the checks are gone */
+#ifdef SPARROW_GC_CONCURRENT
+#define SparrowGCMarking(SP) \
+  atomic_load_explicit(&((SP)->gc_marking),memory_order_acquire)
+#else
+#define SparrowGCMarking(SP) 0
+#endif /* SPARROW_GC_CONCURRENT */
+
+/* Must be called when an env map is changed by anything other than BC_GSET ,
+ * it drops all the resolved global variable cells */
+static SPARROW_INLINE
+void SparrowGlobalChanged( struct Sparrow* sparrow ) {
+  ++sparrow->global_version;
+}
+
+/* Ratio of memory reclaimed by last major GC */
+static SPARROW_INLINE
+double SparrowGCFreedRatio( struct Sparrow* sparrow ) {
+  if(sparrow->gc_prevsz == 0 || sparrow->gc_freed >= sparrow->gc_prevsz)
+    return 1.0;
+  return (double)sparrow->gc_freed / sparrow->gc_prevsz;
+}
+
 /* Function for configuring GC trigger formula */
 static SPARROW_INLINE
 void SparrowGCConfig( struct Sparrow* sparrow, size_t threshold ,
@@ -515,7 +802,7 @@ void SparrowGCConfig( struct Sparrow* sparrow, size_t threshold ,
       (int64_t)(sparrow->gc_adjust_threshold) + diff;
 
     if(penalty_ratio) {
-      double pr = sparrow->gc_inactive/sparrow->gc_prevsz;
+      double pr = SparrowGCFreedRatio(sparrow);
       assert(pr<=1.0f);
       if(pr <penalty_ratio) {
         sparrow->gc_adjust_threshold =
@@ -523,7 +810,7 @@ void SparrowGCConfig( struct Sparrow* sparrow, size_t threshold ,
       }
     }
   } else if(penalty_ratio) {
-    double pr = sparrow->gc_inactive/sparrow->gc_prevsz;
+    double pr = SparrowGCFreedRatio(sparrow);
     assert(pr<=1.0f);
     if(pr <penalty_ratio) {
       sparrow->gc_adjust_threshold =
@@ -543,6 +830,9 @@ struct ObjStr* IAttrGetObjStr( struct Sparrow* , enum IntrinsicAttribute );
 
 const char* ValueGetTypeString( Value );
 
+/* Name of a VALUE_XXX type stored in GC header */
+const char* GCTypeGetString( int type );
+
 #define obj2gc(X) ((struct GCRef*)(X))
 #define gc2obj(X,T) ((T*)(X))
 
@@ -558,7 +848,9 @@ static SPARROW_INLINE
 void _Vset_ptr( Value* value , void* ptr , int type ) {
   _check_ptr(ptr);
   value->ptr = ((intptr_t)(ptr)) | VALUE_GCOBJECT;
-  _set_gctype(ptr,type);
+  /* GC objects get their type when created , only write it for the ones
+   * that are not. The header word may be written by the marker thread */
+  if(_get_gctype(ptr) != (uint32_t)type) _set_gctype(ptr,type);
 }
 
 /* type test */
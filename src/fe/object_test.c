@@ -147,6 +147,21 @@ void cls_init( struct ObjProto* cls ) {
   cls->uv_arr = NULL;
   cls->uv_cap = 0;
   cls->uv_size= 0;
+  cls->scratch_arr = NULL;
+  cls->scratch_size = 0;
+  cls->scratch_cap = 0;
+  cls->ic_arr = NULL;
+  cls->ic_size = 0;
+  cls->ic_cap = 0;
+  cls->cell_arr = NULL;
+  cls->cell_size = 0;
+  cls->cell_cap = 0;
+  cls->jit = NULL;
+  cls->dcode = NULL;
+  cls->hotness = 0;
+  cls->fb_arr = NULL;
+  cls->fb_size = 0;
+  cls->fb_idx = NULL;
 }
 
 static void test_const_table() {
@@ -181,16 +196,8 @@ static void test_const_table() {
       str = ObjNewStrNoGC(&sth,buf,strlen(buf));
       assert(ConstAddString(&cls,str) == i);
     }
-    /* We should have a chain of GC object which are all string */
-    {
-      struct GCRef* start = sth.gc_start;
-      size_t i = 0 ;
-      while(start) {
-        ++i;
-        start = start->next;
-      }
-      assert( i == 100 + gc_sz );
-    }
+    /* We should have 100 more GC objects which are all string */
+    assert( sth.gc_sz == 100 + gc_sz );
   }
   SparrowDestroy(&sth);
   free(cls.num_arr);
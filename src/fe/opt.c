@@ -0,0 +1,1085 @@
+#include "opt.h"
+
+#ifdef SPARROW_JIT
+#include "bc.h"
+#include <string.h>
+
+/* Loops with more instructions than this stay in baseline code */
+#define OPT_MAX_SIZE 1024
+
+/* Slot values of the builder besides instruction index */
+#define SLOT_UNCHANGED -1 /* the value when region is entered */
+#define SLOT_ITERATOR -2  /* end or step of the loop */
+#define SLOT_INDEX -3     /* index of the loop */
+
+struct Builder {
+  struct OptFunc* func;
+  struct ObjProto* proto;
+  const uint32_t* code;
+  uint32_t loop;   /* pc of BC_LOOP */
+  uint32_t exit;   /* pc of loop exit */
+  int* leader;     /* block of each pc starts one , -1 otherwise */
+  int* param;      /* OPT_PARAM of each slot , -1 if not created */
+  int* state;      /* slot values at end of each block */
+  uint32_t* state_depth;
+  size_t width;    /* max slots */
+  int* val;        /* slot values */
+  uint32_t depth;
+  int block;       /* block being translated */
+};
+
+/* Decode the instruction at pc , superinstructions are taken apart since
+ * the second instruction is still in the code buffer */
+static int decode( const uint32_t* code , uint32_t pc , uint32_t* opr ) {
+  int op = BCINS_OP(code[pc]);
+  int first = BytecodeUnfuse((enum Bytecode)op);
+  *opr = BCINS_A(code[pc]);
+  return first == SIZE_OF_BYTECODE ? op : first;
+}
+
+static int new_block( struct OptFunc* f , uint32_t pc , int term ) {
+  struct OptBlock blk;
+  memset(&blk,0,sizeof(blk));
+  blk.pc = pc;
+  blk.term = term;
+  blk.cmp = -1;
+  blk.succ[0] = blk.succ[1] = -1;
+  blk.snap = -1;
+  blk.idom = -1;
+  DynArrPush(f,block,blk);
+  return (int)(f->block_size - 1);
+}
+
+static void add_edge( struct OptFunc* f , int from , int to ) {
+  DynArrPush(f->block_arr+to,pred,from);
+}
+
+static int new_ins( struct OptFunc* f , int block , int op , int a , int b ) {
+  struct OptIns ins;
+  int idx = (int)f->ins_size;
+  memset(&ins,0,sizeof(ins));
+  ins.op = op;
+  ins.a = a;
+  ins.b = b;
+  ins.phi = -1;
+  ins.snap = -1;
+  ins.block = block;
+  ins.loc = -1;
+  DynArrPush(f,ins,ins);
+  DynArrPush(f->block_arr+block,ins,idx);
+  return idx;
+}
+
+static int new_const( struct OptFunc* f , int block , double num ) {
+  int idx = new_ins(f,block,OPT_CONST,-1,-1);
+  f->ins_arr[idx].num = num;
+  return idx;
+}
+
+static int new_phi( struct OptFunc* f , int block ) {
+  int idx = new_ins(f,block,OPT_PHI,-1,-1);
+  size_t i;
+  f->ins_arr[idx].phi = (int)f->phi_size;
+  for( i = 0 ; i < f->block_arr[block].pred_size ; ++i ) {
+    int arg = -1;
+    DynArrPush(f,phi,arg);
+  }
+  return idx;
+}
+
+/* Value of a slot when region is entered , all of them are loaded in the
+ * preheader */
+static int param( struct Builder* b , uint32_t slot ) {
+  if(b->param[slot] < 0) {
+    int idx = new_ins(b->func,0,OPT_PARAM,-1,-1);
+    b->func->ins_arr[idx].slot = slot;
+    b->param[slot] = idx;
+  }
+  return b->param[slot];
+}
+
+static int is_cmp( struct OptFunc* f , int v ) {
+  return v >= 0 && f->ins_arr[v].op == OPT_CMP;
+}
+
+/* Number value of a slot , -2 if it has no one */
+static int get_slot( struct Builder* b , uint32_t slot ) {
+  int v;
+  if(slot >= b->depth) return -2;
+  v = b->val[slot];
+  if(v == SLOT_UNCHANGED) return param(b,slot);
+  if(v == SLOT_INDEX) return new_ins(b->func,b->block,OPT_INDEX,-1,-1);
+  if(v == SLOT_ITERATOR || is_cmp(b->func,v)) return -2;
+  return v;
+}
+
+static int push( struct Builder* b , int v ) {
+  if(v < 0 || b->depth == b->width) return -1;
+  b->val[b->depth++] = v;
+  if(b->depth > b->func->max_depth) b->func->max_depth = b->depth;
+  return 0;
+}
+
+static int set_slot( struct Builder* b , uint32_t slot , int v ) {
+  if(v < 0 || is_cmp(b->func,v) || slot >= b->depth ||
+     b->val[slot] == SLOT_ITERATOR || b->val[slot] == SLOT_INDEX)
+    return -1;
+  b->val[slot] = v;
+  return 0;
+}
+
+/* Snapshot of current state at pc */
+static int snapshot( struct Builder* b , uint32_t pc ) {
+  struct OptFunc* f = b->func;
+  struct OptSnap snap;
+  uint32_t i;
+  snap.pc = pc;
+  snap.depth = b->depth;
+  snap.slot = (int)f->slot_size;
+  for( i = 0 ; i < b->depth ; ++i ) {
+    int v = b->val[i];
+    if(is_cmp(f,v)) return -1;
+    if(v < 0) v = -1;
+    DynArrPush(f,slot,v);
+  }
+  DynArrPush(f,snap,snap);
+  return (int)(f->snap_size - 1);
+}
+
+static int arith( struct Builder* b , int block , uint32_t pc , int op ,
+    int l , int r , int guard ) {
+  int idx , snap = -1;
+  if(l < 0 || r < 0) return -1;
+  if(op == OPT_DIV || op == OPT_MOD) {
+    if((snap = snapshot(b,pc)) < 0) return -1;
+  }
+  idx = new_ins(b->func,block,op,l,r);
+  b->func->ins_arr[idx].cc = guard;
+  b->func->ins_arr[idx].snap = snap;
+  return idx;
+}
+
+static int compare( struct Builder* b , int block , int cc , int l , int r ) {
+  int idx;
+  if(l < 0 || r < 0) return -1;
+  idx = new_ins(b->func,block,OPT_CMP,l,r);
+  b->func->ins_arr[idx].cc = cc;
+  return idx;
+}
+
+/* Stack slot at top - k */
+#define STK(K) (b->depth > (K) ? get_slot(b,b->depth-1-(K)) : -2)
+#define NUM(IDX) new_const(f,block,b->proto->num_arr[IDX])
+
+/* Replace operands on top of stack with result */
+static int replace( struct Builder* b , uint32_t n , int v ) {
+  if(v < 0) return -1;
+  b->depth -= n;
+  return push(b,v);
+}
+
+/* Translate one instruction , returns -1 if it is not supported */
+static int translate( struct Builder* b , int block , uint32_t pc ,
+    int op , uint32_t opr ) {
+  struct OptFunc* f = b->func;
+  int v;
+
+  switch(op) {
+    case BC_LOOP: case BC_NOP: case BC_JMP:
+      return 0;
+    case BC_FORLOOPN:
+      return b->depth == f->depth ? 0 : -1;
+
+    case BC_LOADN: return push(b,NUM(opr));
+    case BC_LOADN0: return push(b,new_const(f,block,0));
+    case BC_LOADN1: return push(b,new_const(f,block,1));
+    case BC_LOADN2: return push(b,new_const(f,block,2));
+    case BC_LOADN3: return push(b,new_const(f,block,3));
+    case BC_LOADN4: return push(b,new_const(f,block,4));
+    case BC_LOADN5: return push(b,new_const(f,block,5));
+    case BC_LOADNN1: return push(b,new_const(f,block,-1));
+    case BC_LOADNN2: return push(b,new_const(f,block,-2));
+    case BC_LOADNN3: return push(b,new_const(f,block,-3));
+    case BC_LOADNN4: return push(b,new_const(f,block,-4));
+    case BC_LOADNN5: return push(b,new_const(f,block,-5));
+    case BC_LOADV: return push(b,get_slot(b,opr));
+
+    case BC_MOVE:
+      if(b->depth <= f->depth || (v = STK(0)) < 0) return -1;
+      --b->depth;
+      return opr < b->depth ? set_slot(b,opr,v) : 0;
+    case BC_MOVEN0: return set_slot(b,opr,new_const(f,block,0));
+    case BC_MOVEN1: return set_slot(b,opr,new_const(f,block,1));
+    case BC_MOVEN2: return set_slot(b,opr,new_const(f,block,2));
+    case BC_MOVEN3: return set_slot(b,opr,new_const(f,block,3));
+    case BC_MOVEN4: return set_slot(b,opr,new_const(f,block,4));
+    case BC_MOVEN5: return set_slot(b,opr,new_const(f,block,5));
+    case BC_MOVENN1: return set_slot(b,opr,new_const(f,block,-1));
+    case BC_MOVENN2: return set_slot(b,opr,new_const(f,block,-2));
+    case BC_MOVENN3: return set_slot(b,opr,new_const(f,block,-3));
+    case BC_MOVENN4: return set_slot(b,opr,new_const(f,block,-4));
+    case BC_MOVENN5: return set_slot(b,opr,new_const(f,block,-5));
+    case BC_POP:
+      if(b->depth < f->depth + opr) return -1;
+      b->depth -= opr;
+      return 0;
+
+    case BC_NEG:
+      if((v = STK(0)) < 0) return -1;
+      return replace(b,1,new_ins(f,block,OPT_NEG,v,-1));
+
+    /* arithmetic , the guarded operand of division follows interpreter ,
+     * which checks the left operand of BC_DIVVN */
+#define DO(INSTR,OP,NVG,VNG) \
+    case BC_##INSTR##NV: \
+      return replace(b,1,arith(b,block,pc,OP,NUM(opr),STK(0),NVG)); \
+    case BC_##INSTR##VN: \
+      return replace(b,1,arith(b,block,pc,OP,STK(0),NUM(opr),VNG)); \
+    case BC_##INSTR##VV: \
+      return replace(b,2,arith(b,block,pc,OP,STK(1),STK(0),1)); \
+    case BC_##INSTR##LL: \
+      return push(b,arith(b,block,pc,OP,get_slot(b,BCREG2_B(opr)), \
+            get_slot(b,BCREG2_C(opr)),1)); \
+    case BC_R##INSTR##LL: \
+      return set_slot(b,BCREG3_A(opr),arith(b,block,pc,OP, \
+            get_slot(b,BCREG3_B(opr)),get_slot(b,BCREG3_C(opr)),1));
+
+    DO(ADD,OPT_ADD,1,1)
+    DO(SUB,OPT_SUB,1,1)
+    DO(MUL,OPT_MUL,1,1)
+    DO(DIV,OPT_DIV,1,0)
+    DO(MOD,OPT_MOD,1,1)
+
+#undef DO /* DO */
+
+#define DO(INSTR,OP) \
+    case BC_##INSTR##NN: \
+      return replace(b,2,arith(b,block,pc,OP,STK(1),STK(0),1)); \
+    case BC_##INSTR##LLNN: \
+      return push(b,arith(b,block,pc,OP,get_slot(b,BCREG2_B(opr)), \
+            get_slot(b,BCREG2_C(opr)),1)); \
+    case BC_R##INSTR##LLNN: \
+      return set_slot(b,BCREG3_A(opr),arith(b,block,pc,OP, \
+            get_slot(b,BCREG3_B(opr)),get_slot(b,BCREG3_C(opr)),1));
+
+    DO(ADD,OPT_ADD)
+    DO(SUB,OPT_SUB)
+    DO(MUL,OPT_MUL)
+    DO(DIV,OPT_DIV)
+
+#undef DO /* DO */
+
+#define DO(INSTR,OP) \
+    case BC_##INSTR##LN: \
+      return push(b,arith(b,block,pc,OP,get_slot(b,BCREG2_B(opr)), \
+            NUM(BCREG2_C(opr)),1)); \
+    case BC_R##INSTR##LN: \
+      return set_slot(b,BCREG3_A(opr),arith(b,block,pc,OP, \
+            get_slot(b,BCREG3_B(opr)),NUM(BCREG3_C(opr)),1));
+
+    DO(ADD,OPT_ADD)
+    DO(SUB,OPT_SUB)
+    DO(MUL,OPT_MUL)
+
+#undef DO /* DO */
+
+    /* comparisons , the result is only consumed by BC_JF and BC_JT */
+#define DO(INSTR,CC) \
+    case BC_##INSTR##NV: \
+      return replace(b,1,compare(b,block,CC,NUM(opr),STK(0))); \
+    case BC_##INSTR##VN: \
+      return replace(b,1,compare(b,block,CC,STK(0),NUM(opr))); \
+    case BC_##INSTR##VV: \
+      return replace(b,2,compare(b,block,CC,STK(1),STK(0))); \
+    case BC_##INSTR##LL: \
+      return push(b,compare(b,block,CC,get_slot(b,BCREG2_B(opr)), \
+            get_slot(b,BCREG2_C(opr)))); \
+    case BC_##INSTR##LN: \
+      return push(b,compare(b,block,CC,get_slot(b,BCREG2_B(opr)), \
+            NUM(BCREG2_C(opr))));
+
+    DO(LT,OPT_LT)
+    DO(LE,OPT_LE)
+    DO(GT,OPT_GT)
+    DO(GE,OPT_GE)
+    DO(EQ,OPT_EQ)
+    DO(NE,OPT_NE)
+
+#undef DO /* DO */
+
+#define DO(INSTR,CC) \
+    case BC_##INSTR##NN: \
+      return replace(b,2,compare(b,block,CC,STK(1),STK(0))); \
+    case BC_##INSTR##LLNN: \
+      return push(b,compare(b,block,CC,get_slot(b,BCREG2_B(opr)), \
+            get_slot(b,BCREG2_C(opr))));
+
+    DO(LT,OPT_LT)
+    DO(LE,OPT_LE)
+    DO(GT,OPT_GT)
+    DO(GE,OPT_GE)
+
+#undef DO /* DO */
+
+    case BC_JF: case BC_JT:
+      if(b->depth <= f->depth) return -1;
+      v = b->val[--b->depth];
+      if(!is_cmp(f,v)) return -1;
+      f->block_arr[block].cmp = v;
+      return 0;
+
+    default:
+      return -1;
+  }
+}
+
+#undef NUM /* NUM */
+#undef STK /* STK */
+
+static int is_jump( int op ) {
+  return op == BC_JMP || op == BC_JF || op == BC_JT || op == BC_FORLOOPN;
+}
+
+/* Find out blocks of the loop body. Only forward jumps inside of the body ,
+ * jumps to the loop exit and BC_FORLOOPN back to BC_LOOP are allowed */
+static int scan( struct Builder* b ) {
+  uint32_t pc;
+  b->leader[0] = 1;
+  for( pc = b->loop+1 ; pc < b->exit ; ++pc ) {
+    uint32_t opr;
+    int op = decode(b->code,pc,&opr);
+    if(!is_jump(op)) continue;
+    if(op == BC_FORLOOPN) {
+      if(opr != b->loop) return -1;
+    } else {
+      if(opr <= pc || opr > b->exit) return -1;
+      if(opr < b->exit) b->leader[opr-b->loop] = 0;
+    }
+    if(pc+1 < b->exit) b->leader[pc+1-b->loop] = 0;
+  }
+  for( pc = b->loop+1 ; pc < b->exit ; ++pc ) {
+    if(b->leader[pc-b->loop] == 0)
+      b->leader[pc-b->loop] = new_block(b->func,pc,OPT_JMP);
+  }
+  return 0;
+}
+
+static int target( struct Builder* b , uint32_t pc ) {
+  if(pc == b->exit) return new_block(b->func,pc,OPT_EXIT);
+  return b->leader[pc-b->loop];
+}
+
+static uint32_t block_end( struct Builder* b , int block ) {
+  uint32_t pc = b->func->block_arr[block].pc + 1;
+  while(pc < b->exit && b->leader[pc-b->loop] < 0) ++pc;
+  return pc;
+}
+
+/* Successors of each block of the loop body */
+static void link( struct Builder* b , int nblock ) {
+  struct OptFunc* f = b->func;
+  int i;
+  f->block_arr[0].succ[0] = 1;
+  add_edge(f,0,1);
+  for( i = 1 ; i < nblock ; ++i ) {
+    uint32_t end = block_end(b,i);
+    uint32_t opr;
+    int op = decode(b->code,end-1,&opr);
+    int s0 , s1 = -1 , term = OPT_JMP;
+    switch(op) {
+      case BC_JMP: s0 = target(b,opr); break;
+      case BC_JF: term = OPT_BR; s0 = target(b,end); s1 = target(b,opr); break;
+      case BC_JT: term = OPT_BR; s0 = target(b,opr); s1 = target(b,end); break;
+      case BC_FORLOOPN: term = OPT_LOOPEND; s0 = 1; s1 = target(b,end); break;
+      default: s0 = target(b,end); break;
+    }
+    f->block_arr[i].term = term;
+    f->block_arr[i].succ[0] = s0;
+    f->block_arr[i].succ[1] = s1;
+    add_edge(f,i,s0);
+    if(s1 >= 0) add_edge(f,i,s1);
+  }
+}
+
+/* Entry state of a block , header has a phi for every slot below the
+ * hidden slots of the loop and a merge point has phis for slots that
+ * differ */
+static int enter_block( struct Builder* b , int block ) {
+  struct OptFunc* f = b->func;
+  const struct OptBlock* blk = f->block_arr + block;
+  uint32_t i;
+  size_t k;
+  if(block == 1) {
+    b->depth = f->depth;
+    for( i = 0 ; i + 3 < f->depth ; ++i ) {
+      int phi = new_phi(f,1);
+      f->phi_arr[f->ins_arr[phi].phi] = param(b,i);
+      b->val[i] = phi;
+    }
+    b->val[f->depth-3] = SLOT_INDEX;
+    b->val[f->depth-2] = SLOT_ITERATOR;
+    b->val[f->depth-1] = SLOT_ITERATOR;
+    return 0;
+  }
+  b->depth = b->state_depth[blk->pred_arr[0]];
+  for( k = 1 ; k < blk->pred_size ; ++k ) {
+    if(b->state_depth[blk->pred_arr[k]] != b->depth) return -1;
+  }
+  for( i = 0 ; i < b->depth ; ++i ) {
+    int v = b->state[blk->pred_arr[0]*b->width+i];
+    int same = 1;
+    for( k = 1 ; k < blk->pred_size ; ++k ) {
+      if(b->state[blk->pred_arr[k]*b->width+i] != v) same = 0;
+    }
+    if(!same) {
+      int phi = new_phi(f,block);
+      blk = f->block_arr + block;
+      for( k = 0 ; k < blk->pred_size ; ++k ) {
+        int a = b->state[blk->pred_arr[k]*b->width+i];
+        if(a == SLOT_UNCHANGED) a = param(b,i);
+        if(a < 0 || is_cmp(f,a)) return -1;
+        f->phi_arr[f->ins_arr[phi].phi+k] = a;
+      }
+      v = phi;
+    }
+    b->val[i] = v;
+  }
+  return 0;
+}
+
+static void leave_block( struct Builder* b , int block ) {
+  memcpy(b->state+block*b->width,b->val,sizeof(int)*b->depth);
+  b->state_depth[block] = b->depth;
+}
+
+/* Drop unreachable blocks , ie code after a break , from predecessors */
+static void prune( struct OptFunc* f ) {
+  char* reach = calloc(f->block_size,1);
+  size_t i , k;
+  reach[0] = reach[1] = 1;
+  for( i = 2 ; i < f->block_size ; ++i ) {
+    const struct OptBlock* blk = f->block_arr + i;
+    for( k = 0 ; k < blk->pred_size ; ++k ) {
+      if(reach[blk->pred_arr[k]]) reach[i] = 1;
+    }
+  }
+  for( i = 0 ; i < f->block_size ; ++i ) {
+    struct OptBlock* blk = f->block_arr + i;
+    size_t n = 0;
+    if(!reach[i]) {
+      blk->pred_size = 0;
+      blk->succ[0] = blk->succ[1] = -1;
+      continue;
+    }
+    for( k = 0 ; k < blk->pred_size ; ++k ) {
+      if(reach[blk->pred_arr[k]]) blk->pred_arr[n++] = blk->pred_arr[k];
+    }
+    blk->pred_size = n;
+  }
+  free(reach);
+}
+
+int OptBuild( struct OptFunc* f , struct ObjProto* proto , uint32_t pc ,
+    uint32_t depth ) {
+  struct Builder b;
+  int nblock , i , ret = -1;
+  uint32_t exit = BCINS_A(proto->code_buf.buf[pc]);
+  size_t k;
+
+  memset(f,0,sizeof(*f));
+  if(exit <= pc+1 || exit > proto->code_buf.pos ||
+     exit - pc > OPT_MAX_SIZE || depth < 3)
+    return -1;
+
+  memset(&b,0,sizeof(b));
+  b.func = f;
+  b.proto = proto;
+  b.code = proto->code_buf.buf;
+  b.loop = pc;
+  b.exit = exit;
+  b.width = depth + 2*(exit-pc) + 2;
+  b.leader = malloc(sizeof(int)*(exit-pc+1));
+  b.param = malloc(sizeof(int)*b.width);
+  b.val = malloc(sizeof(int)*b.width);
+  for( k = 0 ; k <= exit-pc ; ++k ) b.leader[k] = -1;
+  for( k = 0 ; k < b.width ; ++k ) b.param[k] = -1;
+  f->depth = f->max_depth = depth;
+
+  /* preheader and header */
+  new_block(f,pc,OPT_JMP);
+  new_block(f,pc,OPT_JMP);
+  if(scan(&b)) goto done;
+  nblock = (int)f->block_size;
+  link(&b,nblock);
+  prune(f);
+
+  b.state = malloc(sizeof(int)*b.width*f->block_size);
+  b.state_depth = malloc(sizeof(uint32_t)*f->block_size);
+
+  /* translate the body , every block but the header only has forward
+   * predecessors which are already done */
+  for( i = 1 ; i < nblock ; ++i ) {
+    uint32_t end = block_end(&b,i);
+    uint32_t p;
+    if(f->block_arr[i].pred_size == 0) continue;
+    if(enter_block(&b,i)) goto done;
+    b.block = i;
+    for( p = f->block_arr[i].pc ; p < end ; ++p ) {
+      uint32_t opr;
+      int op = decode(b.code,p,&opr);
+      if(translate(&b,i,p,op,opr)) goto done;
+    }
+    if(f->block_arr[i].term == OPT_BR && f->block_arr[i].cmp < 0) goto done;
+    leave_block(&b,i);
+  }
+
+  /* loop exits */
+  for( i = nblock ; i < (int)f->block_size ; ++i ) {
+    int pred;
+    if(f->block_arr[i].pred_size == 0) continue;
+    pred = f->block_arr[i].pred_arr[0];
+    b.depth = b.state_depth[pred];
+    memcpy(b.val,b.state+pred*b.width,sizeof(int)*b.depth);
+    if((f->block_arr[i].snap = snapshot(&b,exit)) < 0) goto done;
+  }
+
+  /* back edges of header phis */
+  for( k = 1 ; k < f->block_arr[1].pred_size ; ++k ) {
+    int pred = f->block_arr[1].pred_arr[k];
+    uint32_t s;
+    if(b.state_depth[pred] != depth) goto done;
+    for( s = 0 ; s + 3 < depth ; ++s ) {
+      int phi = f->block_arr[1].ins_arr[s];
+      int a = b.state[pred*b.width+s];
+      if(a == SLOT_UNCHANGED) a = param(&b,s);
+      if(a < 0 || is_cmp(f,a)) goto done;
+      f->phi_arr[f->ins_arr[phi].phi+k] = a;
+    }
+  }
+  ret = 0;
+
+done:
+  free(b.leader);
+  free(b.param);
+  free(b.val);
+  free(b.state);
+  free(b.state_depth);
+  if(ret) OptDestroy(f);
+  return ret;
+}
+
+/* ==================================================
+ * Optimization
+ * =================================================*/
+
+struct Optimizer {
+  struct OptFunc* func;
+  int* repl;   /* replacement of each instruction */
+  int* avail;  /* available expressions of value numbering */
+  size_t avail_size;
+};
+
+static int resolve( struct Optimizer* o , int v ) {
+  while(v >= 0 && o->repl[v] != v) v = o->repl[v];
+  return v;
+}
+
+static int is_loop_block( const struct OptFunc* f , int block ) {
+  return block > 0 && f->block_arr[block].term != OPT_EXIT;
+}
+
+/* Immediate dominators , blocks are numbered in reverse post order */
+static void dominators( struct OptFunc* f ) {
+  int changed = 1;
+  size_t i , k;
+  f->block_arr[0].idom = 0;
+  for( i = 1 ; i < f->block_size ; ++i ) f->block_arr[i].idom = -1;
+  while(changed) {
+    changed = 0;
+    for( i = 1 ; i < f->block_size ; ++i ) {
+      struct OptBlock* blk = f->block_arr + i;
+      int idom = -1;
+      for( k = 0 ; k < blk->pred_size ; ++k ) {
+        int p = blk->pred_arr[k];
+        if(f->block_arr[p].idom < 0) continue;
+        if(idom < 0) {
+          idom = p;
+        } else {
+          int x = p , y = idom;
+          while(x != y) {
+            while(x > y) x = f->block_arr[x].idom;
+            while(y > x) y = f->block_arr[y].idom;
+          }
+          idom = x;
+        }
+      }
+      if(idom != blk->idom) {
+        blk->idom = idom;
+        changed = 1;
+      }
+    }
+  }
+}
+
+static int is_const( const struct OptFunc* f , int v ) {
+  return f->ins_arr[v].op == OPT_CONST;
+}
+
+/* Fold an instruction with constant operands , guards are only folded when
+ * they pass */
+static void fold( struct OptFunc* f , struct OptIns* ins ) {
+  double l , r , res;
+  switch(ins->op) {
+    case OPT_NEG:
+      if(!is_const(f,ins->a)) return;
+      res = -f->ins_arr[ins->a].num;
+      break;
+    case OPT_ADD: case OPT_SUB: case OPT_MUL: case OPT_DIV: case OPT_MOD:
+      if(!is_const(f,ins->a) || !is_const(f,ins->b)) return;
+      l = f->ins_arr[ins->a].num;
+      r = f->ins_arr[ins->b].num;
+      switch(ins->op) {
+        case OPT_ADD: res = l + r; break;
+        case OPT_SUB: res = l - r; break;
+        case OPT_MUL: res = l * r; break;
+        case OPT_DIV:
+          if((ins->cc ? r : l) == 0) return;
+          res = l / r;
+          break;
+        default:
+          if(r == 0 || !(l > -2147483648.0 && l < 2147483648.0) ||
+             !(r > -2147483648.0 && r < 2147483648.0) ||
+             (int)r == 0 || (int)r == -1)
+            return;
+          res = (int)l % (int)r;
+          break;
+      }
+      break;
+    default:
+      return;
+  }
+  ins->op = OPT_CONST;
+  ins->num = res;
+  ins->a = ins->b = -1;
+  ins->snap = -1;
+}
+
+static int same_value( const struct OptFunc* f , int x , int y ) {
+  const struct OptIns* a = f->ins_arr + x;
+  const struct OptIns* b = f->ins_arr + y;
+  if(a->op != b->op) return 0;
+  if(a->op == OPT_CONST) return memcmp(&a->num,&b->num,sizeof(double)) == 0;
+  return a->a == b->a && a->b == b->b && a->cc == b->cc;
+}
+
+/* A phi whose arguments are the same value besides itself is that value */
+static int trivial_phi( struct Optimizer* o , int idx ) {
+  struct OptFunc* f = o->func;
+  const struct OptIns* ins = f->ins_arr + idx;
+  size_t n = f->block_arr[ins->block].pred_size , k;
+  int same = -1;
+  for( k = 0 ; k < n ; ++k ) {
+    int a = resolve(o,f->phi_arr[ins->phi+k]);
+    if(a == idx || a == same) continue;
+    if(same >= 0) return -1;
+    same = a;
+  }
+  return same;
+}
+
+/* Global value numbering over dominator tree with constant folding */
+static void gvn_block( struct Optimizer* o , int block ) {
+  struct OptFunc* f = o->func;
+  size_t mark = o->avail_size;
+  size_t i , k;
+  for( i = 0 ; i < f->block_arr[block].ins_size ; ++i ) {
+    int idx = f->block_arr[block].ins_arr[i];
+    struct OptIns* ins = f->ins_arr + idx;
+    if(ins->dead) continue;
+    if(ins->op == OPT_PHI) {
+      int same = trivial_phi(o,idx);
+      if(same >= 0) {
+        o->repl[idx] = same;
+        ins->dead = 1;
+      }
+      continue;
+    }
+    ins->a = resolve(o,ins->a);
+    ins->b = resolve(o,ins->b);
+    switch(ins->op) {
+      case OPT_ADD: case OPT_MUL:
+        if(ins->a > ins->b) {
+          int t = ins->a;
+          ins->a = ins->b;
+          ins->b = t;
+        }
+        break;
+      case OPT_CONST: case OPT_SUB: case OPT_NEG: case OPT_DIV: case OPT_MOD:
+        break;
+      default:
+        continue;
+    }
+    fold(f,ins);
+    for( k = 0 ; k < o->avail_size ; ++k ) {
+      if(same_value(f,o->avail[k],idx)) break;
+    }
+    if(k < o->avail_size) {
+      o->repl[idx] = o->avail[k];
+      ins->dead = 1;
+    } else {
+      o->avail[o->avail_size++] = idx;
+    }
+  }
+  for( i = 1 ; i < f->block_size ; ++i ) {
+    if(f->block_arr[i].idom == block && (int)i != block) gvn_block(o,(int)i);
+  }
+  o->avail_size = mark;
+}
+
+/* Hoist loop invariant arithmetic into the preheader */
+static void licm( struct Optimizer* o ) {
+  struct OptFunc* f = o->func;
+  size_t i , j;
+  for( i = 1 ; i < f->block_size ; ++i ) {
+    struct OptBlock* blk = f->block_arr + i;
+    size_t n = 0;
+    if(!is_loop_block(f,(int)i)) continue;
+    for( j = 0 ; j < blk->ins_size ; ++j ) {
+      int idx = blk->ins_arr[j];
+      struct OptIns* ins = f->ins_arr + idx;
+      int hoist = 0;
+      if(!ins->dead) {
+        switch(ins->op) {
+          case OPT_CONST:
+            hoist = 1;
+            break;
+          case OPT_ADD: case OPT_SUB: case OPT_MUL: case OPT_NEG:
+            hoist = f->ins_arr[resolve(o,ins->a)].block == 0 &&
+                    (ins->b < 0 || f->ins_arr[resolve(o,ins->b)].block == 0);
+            break;
+          default:
+            break;
+        }
+      }
+      if(hoist) {
+        ins->block = 0;
+        DynArrPush(f->block_arr,ins,idx);
+        blk = f->block_arr + i;
+      } else {
+        blk->ins_arr[n++] = idx;
+      }
+    }
+    blk->ins_size = n;
+  }
+}
+
+/* Rewrite every reference with its replacement */
+static void rewrite( struct Optimizer* o ) {
+  struct OptFunc* f = o->func;
+  size_t i;
+  for( i = 0 ; i < f->ins_size ; ++i ) {
+    struct OptIns* ins = f->ins_arr + i;
+    ins->a = resolve(o,ins->a);
+    ins->b = resolve(o,ins->b);
+  }
+  for( i = 0 ; i < f->phi_size ; ++i ) f->phi_arr[i] = resolve(o,f->phi_arr[i]);
+  for( i = 0 ; i < f->snap_size ; ++i ) {
+    const struct OptSnap* snap = f->snap_arr + i;
+    uint32_t s;
+    for( s = 0 ; s < snap->depth ; ++s ) {
+      int* v = f->slot_arr + snap->slot + s;
+      *v = resolve(o,*v);
+      /* a slot still holding its entry value needs no write back */
+      if(*v >= 0 && f->ins_arr[*v].op == OPT_PARAM && f->ins_arr[*v].slot == s)
+        *v = -1;
+    }
+  }
+}
+
+static void mark( struct OptFunc* f , char* live , int v ) {
+  const struct OptIns* ins;
+  if(v < 0 || live[v]) return;
+  live[v] = 1;
+  ins = f->ins_arr + v;
+  if(ins->op == OPT_PHI) {
+    size_t k , n = f->block_arr[ins->block].pred_size;
+    for( k = 0 ; k < n ; ++k ) mark(f,live,f->phi_arr[ins->phi+k]);
+  } else {
+    mark(f,live,ins->a);
+    mark(f,live,ins->b);
+  }
+}
+
+static void mark_snap( struct OptFunc* f , char* live , int snap ) {
+  uint32_t s;
+  if(snap < 0) return;
+  for( s = 0 ; s < f->snap_arr[snap].depth ; ++s )
+    mark(f,live,f->slot_arr[f->snap_arr[snap].slot+s]);
+}
+
+/* Dead code elimination , guards , branches and snapshots are roots */
+static void dce( struct OptFunc* f ) {
+  char* live = calloc(f->ins_size,1);
+  size_t i , j;
+  for( i = 0 ; i < f->ins_size ; ++i ) {
+    const struct OptIns* ins = f->ins_arr + i;
+    if(!ins->dead && (ins->op == OPT_DIV || ins->op == OPT_MOD)) {
+      mark(f,live,(int)i);
+      mark_snap(f,live,ins->snap);
+    }
+  }
+  for( i = 0 ; i < f->block_size ; ++i ) {
+    mark(f,live,f->block_arr[i].cmp);
+    mark_snap(f,live,f->block_arr[i].snap);
+  }
+  for( i = 0 ; i < f->block_size ; ++i ) {
+    struct OptBlock* blk = f->block_arr + i;
+    size_t n = 0;
+    for( j = 0 ; j < blk->ins_size ; ++j ) {
+      if(live[blk->ins_arr[j]]) blk->ins_arr[n++] = blk->ins_arr[j];
+    }
+    blk->ins_size = n;
+  }
+  for( i = 0 ; i < f->ins_size ; ++i ) {
+    if(!live[i]) f->ins_arr[i].dead = 1;
+  }
+  free(live);
+}
+
+/* Parameters used as number are guarded when region is entered */
+static void guard_param( struct OptFunc* f , int v ) {
+  struct OptIns* ins;
+  if(v < 0 || (ins = f->ins_arr + v)->guard) return;
+  ins->guard = 1;
+  if(ins->op == OPT_PHI) {
+    size_t k , n = f->block_arr[ins->block].pred_size;
+    for( k = 0 ; k < n ; ++k ) guard_param(f,f->phi_arr[ins->phi+k]);
+  }
+}
+
+static void guard( struct OptFunc* f ) {
+  size_t i;
+  for( i = 0 ; i < f->ins_size ; ++i ) {
+    const struct OptIns* ins = f->ins_arr + i;
+    if(ins->dead) continue;
+    switch(ins->op) {
+      case OPT_ADD: case OPT_SUB: case OPT_MUL: case OPT_NEG: case OPT_DIV:
+      case OPT_MOD: case OPT_CMP:
+        guard_param(f,ins->a);
+        guard_param(f,ins->b);
+        break;
+      default:
+        break;
+    }
+  }
+}
+
+/* ==================================================
+ * Linear scan register allocation
+ * =================================================*/
+
+static void use( struct OptFunc* f , int v , int pos ) {
+  if(v >= 0 && f->ins_arr[v].end < pos) f->ins_arr[v].end = pos;
+}
+
+static void use_snap( struct OptFunc* f , int snap , int pos ) {
+  uint32_t s;
+  if(snap < 0) return;
+  for( s = 0 ; s < f->snap_arr[snap].depth ; ++s )
+    use(f,f->slot_arr[f->snap_arr[snap].slot+s],pos);
+}
+
+/* Values read by a block , phi arguments are read by predecessors */
+static void block_uses( const struct OptFunc* f , int block , char* set ) {
+  const struct OptBlock* blk = f->block_arr + block;
+  size_t i;
+  uint32_t s;
+  for( i = 0 ; i < blk->ins_size ; ++i ) {
+    const struct OptIns* ins = f->ins_arr + blk->ins_arr[i];
+    if(ins->op == OPT_PHI) continue;
+    if(ins->a >= 0) set[ins->a] = 1;
+    if(ins->b >= 0) set[ins->b] = 1;
+    if(ins->snap >= 0) {
+      for( s = 0 ; s < f->snap_arr[ins->snap].depth ; ++s ) {
+        int v = f->slot_arr[f->snap_arr[ins->snap].slot+s];
+        if(v >= 0) set[v] = 1;
+      }
+    }
+  }
+  if(blk->cmp >= 0) set[blk->cmp] = 1;
+  if(blk->snap >= 0) {
+    for( s = 0 ; s < f->snap_arr[blk->snap].depth ; ++s ) {
+      int v = f->slot_arr[f->snap_arr[blk->snap].slot+s];
+      if(v >= 0) set[v] = 1;
+    }
+  }
+}
+
+/* Live intervals , one range from definition to the last position the value
+ * is live at. Blocks are laid out in order so a range covers every block the
+ * value is live in */
+static void intervals( struct OptFunc* f ) {
+  size_t nb = f->block_size , ni = f->ins_size;
+  char* live_in = calloc(nb*ni,1);
+  char* live_out = calloc(nb*ni,1);
+  char* set = malloc(ni);
+  int pos = 0 , changed = 1;
+  size_t i , j , k;
+
+  /* positions */
+  for( i = 0 ; i < nb ; ++i ) {
+    struct OptBlock* blk = f->block_arr + i;
+    blk->start = pos;
+    pos += 2;
+    for( j = 0 ; j < blk->ins_size ; ++j ) {
+      struct OptIns* ins = f->ins_arr + blk->ins_arr[j];
+      if(ins->op == OPT_PHI) {
+        ins->start = ins->end = blk->start;
+      } else {
+        ins->start = ins->end = pos;
+        pos += 2;
+      }
+    }
+    blk->end = pos;
+    pos += 2;
+  }
+
+  /* liveness */
+  while(changed) {
+    changed = 0;
+    for( i = nb ; i-- > 0 ; ) {
+      const struct OptBlock* blk = f->block_arr + i;
+      char* out = live_out + i*ni;
+      char* in = live_in + i*ni;
+      for( k = 0 ; k < 2 ; ++k ) {
+        int s = blk->succ[k];
+        size_t p;
+        if(s < 0) continue;
+        for( j = 0 ; j < ni ; ++j ) out[j] |= live_in[s*ni+j];
+        for( p = 0 ; p < f->block_arr[s].pred_size ; ++p ) {
+          if(f->block_arr[s].pred_arr[p] != (int)i) continue;
+          for( j = 0 ; j < f->block_arr[s].ins_size ; ++j ) {
+            const struct OptIns* phi = f->ins_arr + f->block_arr[s].ins_arr[j];
+            if(phi->op == OPT_PHI) out[f->phi_arr[phi->phi+p]] = 1;
+          }
+        }
+      }
+      memcpy(set,out,ni);
+      for( j = 0 ; j < blk->ins_size ; ++j ) set[blk->ins_arr[j]] = 0;
+      block_uses(f,(int)i,set);
+      for( j = 0 ; j < ni ; ++j ) {
+        if(set[j] && !in[j]) {
+          in[j] = 1;
+          changed = 1;
+        }
+      }
+    }
+  }
+
+  /* ranges */
+  for( i = 0 ; i < nb ; ++i ) {
+    const struct OptBlock* blk = f->block_arr + i;
+    for( j = 0 ; j < ni ; ++j ) {
+      if(live_out[i*ni+j]) use(f,(int)j,blk->end);
+    }
+    for( j = 0 ; j < blk->ins_size ; ++j ) {
+      const struct OptIns* ins = f->ins_arr + blk->ins_arr[j];
+      if(ins->op == OPT_PHI) continue;
+      /* comparison is done by the branch at block end */
+      use(f,ins->a,ins->op == OPT_CMP ? blk->end : ins->start);
+      use(f,ins->b,ins->op == OPT_CMP ? blk->end : ins->start);
+      use_snap(f,ins->snap,ins->start);
+    }
+    use_snap(f,blk->snap,blk->end);
+  }
+
+  free(set);
+  free(live_in);
+  free(live_out);
+}
+
+static void linear_scan( struct OptFunc* f , int nreg ) {
+  int* active = malloc(sizeof(int)*nreg);
+  int nactive = 0;
+  unsigned int used = 0;
+  size_t i , j;
+
+  intervals(f);
+  /* values are visited in order of their start */
+  for( i = 0 ; i < f->block_size ; ++i ) {
+    const struct OptBlock* blk = f->block_arr + i;
+    for( j = 0 ; j < blk->ins_size ; ++j ) {
+      int v = blk->ins_arr[j];
+      struct OptIns* ins = f->ins_arr + v;
+      int k , n , r;
+      if(ins->op == OPT_CMP) continue;
+      /* expire */
+      for( k = 0 , n = 0 ; k < nactive ; ++k ) {
+        if(f->ins_arr[active[k]].end < ins->start)
+          used &= ~(1u << f->ins_arr[active[k]].loc);
+        else
+          active[n++] = active[k];
+      }
+      nactive = n;
+      if(nactive < nreg) {
+        for( r = 0 ; used & (1u << r) ; ++r )
+          ;
+        ins->loc = r;
+        used |= 1u << r;
+        active[nactive++] = v;
+      } else {
+        /* spill the one that lives the longest */
+        int s = 0;
+        for( k = 1 ; k < nactive ; ++k ) {
+          if(f->ins_arr[active[k]].end > f->ins_arr[active[s]].end) s = k;
+        }
+        if(f->ins_arr[active[s]].end > ins->end) {
+          ins->loc = f->ins_arr[active[s]].loc;
+          f->ins_arr[active[s]].loc = OPT_SPILL + f->spill_size++;
+          active[s] = v;
+        } else {
+          ins->loc = OPT_SPILL + f->spill_size++;
+        }
+      }
+    }
+  }
+  free(active);
+}
+
+void OptRun( struct OptFunc* f , int nreg ) {
+  struct Optimizer o;
+  size_t i;
+  o.func = f;
+  o.repl = malloc(sizeof(int)*f->ins_size);
+  o.avail = malloc(sizeof(int)*f->ins_size);
+  o.avail_size = 0;
+  for( i = 0 ; i < f->ins_size ; ++i ) o.repl[i] = (int)i;
+
+  dominators(f);
+  gvn_block(&o,0);
+  licm(&o);
+  gvn_block(&o,0);
+  rewrite(&o);
+  dce(f);
+  guard(f);
+  linear_scan(f,nreg);
+
+  free(o.repl);
+  free(o.avail);
+}
+
+void OptDestroy( struct OptFunc* f ) {
+  size_t i;
+  for( i = 0 ; i < f->block_size ; ++i ) {
+    free(f->block_arr[i].ins_arr);
+    free(f->block_arr[i].pred_arr);
+  }
+  free(f->block_arr);
+  free(f->ins_arr);
+  free(f->phi_arr);
+  free(f->snap_arr);
+  free(f->slot_arr);
+  memset(f,0,sizeof(*f));
+}
+
+#endif /* SPARROW_JIT */
@@ -0,0 +1,140 @@
+#ifndef OPT_H_
+#define OPT_H_
+#include "../conf.h"
+#include "object.h"
+
+#ifdef SPARROW_JIT
+
+/* Optimizing compiler ( tier 2 ) , middle end.
+ *
+ * A hot numeric for loop over loop() or range() whose body only does number
+ * arithmetic is translated from bytecode into SSA IR. The region starts at
+ * the BC_LOOP tag and ends at the loop exit , each stack slot of the frame is
+ * an SSA variable and the index , end and step of the loop , which are the
+ * hidden slots on top of the stack , live in machine registers. Every value of
+ * the IR is a number : slots read by arithmetic are speculated to hold
+ * numbers , which is guarded once when the region is entered , so the body
+ * runs on unboxed doubles without any type check.
+ *
+ * The IR is optimized by constant folding , global value numbering , loop
+ * invariant code motion and dead code elimination , then values are assigned
+ * to XMM registers by a linear scan allocator. Code generation lives in
+ * jit.c.
+ *
+ * Division and modulo guard their operands. When a guard fails or the loop
+ * exits , the snapshot of the guard is written back to the CallFrame's stack
+ * slots and execution continues in the baseline code at the snapshot's pc ,
+ * which shares the interpreter's frame layout. This is the deoptimization.
+ *
+ * Range check elimination and inlining of small closures are not done.
+ * Both need IR values that are not numbers , a list with its length or a
+ * callee , which the IR has no type for. So OptBuild rejects a loop whose
+ * body indexes a list or map , calls anything or creates a closure , and
+ * such a loop stays in baseline code */
+
+/* IR opcodes , the ones after OPT_NEG are guards and have a snapshot */
+enum {
+  OPT_CONST,  /* number constant */
+  OPT_PARAM,  /* stack slot value when region is entered */
+  OPT_PHI,
+  OPT_INDEX,  /* loop index of current iteration */
+  OPT_ADD,
+  OPT_SUB,
+  OPT_MUL,
+  OPT_NEG,
+  OPT_DIV,    /* guard : operand zero is zero */
+  OPT_MOD,    /* guard : operand zero is zero or operands are not int */
+  OPT_CMP     /* comparison , only used by OPT_BR */
+};
+
+/* Block terminators */
+enum {
+  OPT_JMP,     /* jump to succ[0] */
+  OPT_BR,      /* compare cmp , true to succ[0] and false to succ[1] */
+  OPT_LOOPEND, /* move index , next iteration to succ[0] or succ[1] */
+  OPT_EXIT     /* leave region with snapshot */
+};
+
+/* Comparison of OPT_CMP */
+enum {
+  OPT_LT, OPT_LE, OPT_GT, OPT_GE, OPT_EQ, OPT_NE
+};
+
+struct OptIns {
+  int op;
+  int a , b;       /* operands */
+  int cc;          /* OPT_CMP : comparison , OPT_DIV/OPT_MOD : guarded
+                    * operand , 0 is a and 1 is b */
+  double num;      /* OPT_CONST */
+  uint32_t slot;   /* OPT_PARAM */
+  int phi;         /* OPT_PHI : first argument in phi_arr */
+  int snap;        /* guards : snapshot */
+  int block;
+  int dead;
+  int guard;       /* OPT_PARAM : needs to be a number */
+  /* register allocation */
+  int start , end; /* live interval */
+  int loc;         /* XMM register or OPT_SPILL + spill slot */
+};
+
+#define OPT_SPILL 16
+
+/* Interpreter state at a pc , slot i of the frame holds value
+ * slot_arr[slot+i] or is unchanged when it is -1 */
+struct OptSnap {
+  uint32_t pc;
+  uint32_t depth;
+  int slot;
+};
+
+struct OptBlock {
+  uint32_t pc;     /* first pc */
+  int* ins_arr;
+  size_t ins_size;
+  size_t ins_cap;
+  int* pred_arr;
+  size_t pred_size;
+  size_t pred_cap;
+  int term;
+  int cmp;         /* OPT_BR */
+  int succ[2];
+  int snap;        /* OPT_EXIT */
+  int idom;
+  int start , end; /* positions of linear scan */
+};
+
+struct OptFunc {
+  struct OptIns* ins_arr;
+  size_t ins_size;
+  size_t ins_cap;
+  struct OptBlock* block_arr; /* 0 is the preheader and 1 is the header */
+  size_t block_size;
+  size_t block_cap;
+  int* phi_arr;               /* phi arguments , one per predecessor */
+  size_t phi_size;
+  size_t phi_cap;
+  struct OptSnap* snap_arr;
+  size_t snap_size;
+  size_t snap_cap;
+  int* slot_arr;              /* slots of snapshots */
+  size_t slot_size;
+  size_t slot_cap;
+  uint32_t depth;             /* stack depth at BC_LOOP , index , end and
+                               * step on top */
+  uint32_t max_depth;         /* max stack depth of the region */
+  int spill_size;             /* spill slots used by register allocation */
+};
+
+/* Build the IR of the loop at pc of BC_LOOP , depth is the stack depth
+ * there. Returns -1 if the loop cannot be compiled */
+int OptBuild( struct OptFunc* , struct ObjProto* , uint32_t pc ,
+    uint32_t depth );
+
+/* Optimize the IR and allocate nreg XMM registers */
+void OptRun( struct OptFunc* , int nreg );
+
+void OptDestroy( struct OptFunc* );
+
+#endif /* SPARROW_JIT */
+
+#endif /* OPT_H_ */
@@ -87,6 +87,8 @@ static const char* expr_typestr( struct Expr* expr ) {
 struct LocalVar {
   int idx; /* Where the hack this variable is placed */
   struct CStr name; /* Name of the variable */
+  int scratch; /* Whether it is initialized by BC_NEWL0S/BC_NEWM0S */
+  struct Label scratch_pos; /* Position of that instruction */
 };
 
 struct PClosure;
@@ -156,6 +158,12 @@ struct Parser {
 #define cbpatchOP(POS,OP) CodeBufferPatchOP(codebuf(p),POS,OP, \
     p->lex.line,p->lex.ccnt)
 
+/* BC_AGETS/BC_ASETS take an inline cache slot which refers to the name */
+#define cbIC(OP,KEY) cbA(OP,ProtoAddIC(objclosure(p),KEY))
+
+/* BC_GGET/BC_GSET* take a global variable cell which refers to the name */
+#define cbCELL(OP,KEY) cbA(OP,ProtoAddCell(objclosure(p),KEY))
+
 #define is_unaryop(P) TokenIsUnaryOP(LexerToken(&((P)->lex)))
 #define is_factorop(P) TokenIsFactorOP(LexerToken(&((P)->lex)))
 #define is_termop(P) TokenIsTermOP(LexerToken(&((P)->lex)))
@@ -190,6 +198,7 @@ static int def_locvar( struct Parser* p , struct CStr* var , int own ) {
   else
     pc->var_tab[pc->vt_size].name = CStrDupCStr(var);
   pc->var_tab[pc->vt_size].idx = pc->cur_scp->cur_idx;
+  pc->var_tab[pc->vt_size].scratch = 0;
   ++pc->cur_scp->var_size;
   ++pc->cur_scp->cur_idx;
   ++pc->vt_size;
@@ -221,6 +230,53 @@ get_locvar( struct Parser* p , const struct ObjStr* var ) {
   return _get_locvar(cclosure(p),var);
 }
 
+/* Escape analysis.
+ *
+ * An empty list/map literal that initializes a local variable doesn't need
+ * a new object each time the declaration runs , as long as the object never
+ * leaves that variable. Such literal is compiled into BC_NEWL0S/BC_NEWM0S ,
+ * which clears and reuses a scratch object held by the prototype. Since we
+ * are a one pass compiler this is optimistic : any later use of the variable
+ * that may let the object escape ( read as a plain value , which covers
+ * return , store into container or global and passing it to a call , being
+ * called or captured as upvalue ) patches the instruction back to a normal
+ * allocation. Only getting or setting an element of it is safe */
+static void
+escape_locvar( struct PClosure* pc , const struct ObjStr* var ) {
+  size_t i;
+  for( i = 0 ; i < pc->vt_size ; ++i ) {
+    struct LocalVar* lv = pc->var_tab + i;
+    if(lv->scratch && ObjStrCmpCStr(var,&(lv->name))==0) {
+      CodeBufferRepatchA(&(pc->closure->code_buf),lv->scratch_pos,
+          BC_NEWL0S == CodeBufferDecodeOP(&(pc->closure->code_buf),
+            lv->scratch_pos.pos) ?
+          BC_NEWL : BC_NEWM , 0);
+      lv->scratch = 0;
+    }
+  }
+}
+
+/* Called right after the initializer of the last defined local variable
+ * is emitted */
+static void
+try_scratch( struct Parser* p , struct Expr* val ) {
+  struct CodeBuffer* cb = codebuf(p);
+  struct PClosure* pc = cclosure(p);
+  struct LocalVar* lv = pc->var_tab + pc->vt_size - 1;
+  int op , idx;
+  if(val->tag != ELIST && val->tag != EMAP) return;
+  /* The literal must be exactly the last instruction */
+  if(val->cpos.pos + 1 != CodeBufferPos(cb)) return;
+  op = CodeBufferDecodeOP(cb,val->cpos.pos);
+  if(op != BC_NEWL0 && op != BC_NEWM0) return;
+  idx = ProtoAddScratch(objclosure(p));
+  if(idx >= MAX_ARG_VALUE) return;
+  CodeBufferSetToLabel(cb,val->cpos);
+  cbA(op == BC_NEWL0 ? BC_NEWL0S : BC_NEWM0S , idx);
+  lv->scratch = 1;
+  lv->scratch_pos = val->cpos;
+}
+
 static void initialize_pclosure( struct PClosure* pc ,
     struct LexScope* cscp ,
     struct PClosure* prev ,
@@ -315,6 +371,7 @@ resolve_upvar_as_local( struct PClosure* pc , const struct ObjStr* var ) {
   size_t i;
   for( i = 0 ; i< pc->vt_size ; ++i ) {
     if(ObjStrCmpCStr(var,&(pc->var_tab[i].name))==0) {
+      escape_locvar(pc,var); /* captured as upvalue */
       return pc->var_tab[i].idx;
     }
   }
@@ -475,7 +532,7 @@ static int emit_readvar( struct Parser* p , struct Expr* expr ) {
         perr(PERR_TOO_MANY_STRING_LITERALS);
         return -1;
       }
-      cbA(BC_GGET,sidx);
+      cbCELL(BC_GGET,sidx);
     } else {
       expr->tag = EUPVALUE;
       cbA(BC_UGET,idx);
@@ -615,6 +672,91 @@ static int emit_arithcomp( struct Parser* p ,
 }
 #undef _emit
 
+/* Register instructions. When both operands of an arithmetic/comparison
+ * operation are plain local variable reads , or the right one is a number
+ * literal , the LOADV/VV or LOADV/VN sequence is replaced by one register
+ * instruction which reads the local variable slots directly. LPOS and RPOS
+ * are where the code of each operand starts. Return 1 if it is emitted */
+static int local_slot( struct Parser* p , struct Label start , size_t end ) {
+  struct CodeBuffer* cb = codebuf(p);
+  if(end - start.pos != 1 || CodeBufferDecodeOP(cb,start.pos) != BC_LOADV)
+    return -1;
+  return (int)CodeBufferDecodeArg(cb,start.pos);
+}
+
+static int emit_regop( struct Parser* p ,
+    struct Expr* lexpr , struct Expr* rexpr , enum Token tk ,
+    struct Label lpos , struct Label rpos ) {
+  enum Bytecode op = BC_NOP;
+  size_t pos = CodeBufferPos(codebuf(p));
+  int lidx = local_slot(p,lpos,rpos.pos);
+  int ridx;
+  if(lidx < 0 || lidx > BCREG2_MAX) return 0;
+  if(is_convnum(rexpr) && rpos.pos == pos) {
+    switch(tk) {
+      case TK_ADD: op = BC_ADDLN; break;
+      case TK_SUB: op = BC_SUBLN; break;
+      case TK_MUL: op = BC_MULLN; break;
+      case TK_LT : op = BC_LTLN; break;
+      case TK_LE : op = BC_LELN; break;
+      case TK_GT : op = BC_GTLN; break;
+      case TK_GE : op = BC_GELN; break;
+      case TK_EQ : op = BC_EQLN; break;
+      case TK_NE : op = BC_NELN; break;
+      default: return 0;
+    }
+    expr2num(rexpr);
+    ridx = expr_index(p,rexpr);
+  } else {
+    ridx = local_slot(p,rpos,pos);
+    switch(tk) {
+      case TK_ADD: op = BC_ADDLL; break;
+      case TK_SUB: op = BC_SUBLL; break;
+      case TK_MUL: op = BC_MULLL; break;
+      case TK_DIV: op = BC_DIVLL; break;
+      case TK_MOD: op = BC_MODLL; break;
+      case TK_POW: op = BC_POWLL; break;
+      case TK_LT : op = BC_LTLL; break;
+      case TK_LE : op = BC_LELL; break;
+      case TK_GT : op = BC_GTLL; break;
+      case TK_GE : op = BC_GELL; break;
+      case TK_EQ : op = BC_EQLL; break;
+      case TK_NE : op = BC_NELL; break;
+      default: return 0;
+    }
+  }
+  if(ridx < 0 || ridx > BCREG2_MAX) return 0;
+  CodeBufferSetToLabel(codebuf(p),lpos);
+  cbA(op,BCREG2(lidx,ridx));
+  lexpr->tag = EEXPR;
+  return 1;
+}
+
+/* Fold the MOVE of an assignment to local variable IDX into the register
+ * instruction that computes the value , VPOS is where the value starts */
+static int emit_regstore( struct Parser* p , struct Label vpos , int idx ) {
+  struct CodeBuffer* cb = codebuf(p);
+  enum Bytecode op;
+  uint32_t arg;
+  if(CodeBufferPos(cb) - vpos.pos != 1 || idx > BCREG3_MAX) return 0;
+  switch(CodeBufferDecodeOP(cb,vpos.pos)) {
+    case BC_ADDLL: op = BC_RADDLL; break;
+    case BC_SUBLL: op = BC_RSUBLL; break;
+    case BC_MULLL: op = BC_RMULLL; break;
+    case BC_DIVLL: op = BC_RDIVLL; break;
+    case BC_MODLL: op = BC_RMODLL; break;
+    case BC_POWLL: op = BC_RPOWLL; break;
+    case BC_ADDLN: op = BC_RADDLN; break;
+    case BC_SUBLN: op = BC_RSUBLN; break;
+    case BC_MULLN: op = BC_RMULLN; break;
+    default: return 0;
+  }
+  arg = CodeBufferDecodeArg(cb,vpos.pos);
+  if(BCREG2_B(arg) > BCREG3_MAX || BCREG2_C(arg) > BCREG3_MAX) return 0;
+  CodeBufferRepatchA(cb,vpos,op,BCREG3(idx,BCREG2_B(arg),BCREG2_C(arg)));
+  return 1;
+}
+
 /* Constant folding routine , move it to VM module ??? */
 enum {
   FOLD,
@@ -873,18 +1015,22 @@ static int pexpr_unary( struct Parser* p ,struct Expr* expr) {
 #define _DEFINE_PARITH(PREV,CHECKER,NAME) \
   static int pexpr_##NAME( struct Parser* p , struct Expr* expr ) { \
     struct Expr rexpr; \
+    struct Label lpos = CodeBufferGetLabel(codebuf(p)); \
+    struct Label rpos; \
     int ret; \
     enum Token tk; \
     if(PREV(p,expr)) return -1; \
     while(CHECKER(p)) { \
       tk = LexerToken(&(p->lex)); \
       NEXT(); \
+      rpos = CodeBufferGetLabel(codebuf(p)); \
       if(PREV(p,&rexpr)) return -1; \
       ret = tryfold_arithcomp(p,expr,&rexpr,tk); \
       switch(ret) { \
         case FOLD: break; \
         case PERROR: return -1; \
         default: \
+          if(emit_regop(p,expr,&rexpr,tk,lpos,rpos)) break; \
           if(emit_arithcomp(p,expr,&rexpr,tk)) return -1; \
           break; \
       } \
@@ -1141,6 +1287,10 @@ static int _pexpr_pfix( struct Parser* p , struct Expr* lexpr ,
   if(is_pfixexpr(lexpr->tag)) {
     if(is_pfix_tk(p)) {
       if(_pexpr_pfixcomp(p,rexpr)) return -1;
+      /* Calling the local variable or its member escapes it */
+      if(lexpr->tag == ELOCAL && (rexpr->tag == EFUNCCALL ||
+         LexerToken(&(p->lex)) == TK_LPAR))
+        escape_locvar(cclosure(p),lexpr->str);
       while(is_pfix_tk(p)) {
         switch(rexpr->tag) {
           case ENUMBER: cbA(BC_AGETN,rexpr->info); break;
@@ -1148,7 +1298,7 @@ static int _pexpr_pfix( struct Parser* p , struct Expr* lexpr ,
           {
             enum IntrinsicAttribute iattr = IAttrGetIndex(rexpr->str->str);
             if(iattr == SIZE_OF_IATTR) {
-              cbA(BC_AGETS,rexpr->info);
+              cbIC(BC_AGETS,rexpr->info);
             } else {
               cbA(BC_AGETI,iattr); /* intrinsic attribute */
             }
@@ -1171,11 +1321,13 @@ static int pexpr_rpfix( struct Parser* p , struct Expr* expr ) {
   struct Expr rexpr;
   int ret;
   if(pexpr_atom(p,expr)) return -1;
+  if(expr->tag == ELOCAL && !is_pfix_tk(p))
+    escape_locvar(cclosure(p),expr->str); /* read as a plain value */
   ret = _pexpr_pfix(p,expr,&rexpr);
   if(rexpr.tag != EUNDEFINED) {
     switch(rexpr.tag) {
       case ENUMBER: cbA(BC_AGETN,rexpr.info); break;
-      case ESTRING: cbA(BC_AGETS,rexpr.info); break;
+      case ESTRING: cbIC(BC_AGETS,rexpr.info); break;
       case EFUNCCALL: break;
       default: cbOP(BC_AGET); break;
     }
@@ -1187,6 +1339,7 @@ static int
 pexpr_list( struct Parser* p , struct Expr* expr ) {
   assert(LexerToken(&(p->lex)) == TK_LSQR);
   NEXT();
+  expr->cpos = CodeBufferGetLabel(codebuf(p));
   if(LexerToken(&(p->lex)) == TK_RSQR) {
     NEXT();
     cbOP(BC_NEWL0);
@@ -1237,6 +1390,7 @@ static int
 pexpr_map( struct Parser* p , struct Expr* expr ) {
   assert(LexerToken(&(p->lex)) == TK_LBRA);
   NEXT();
+  expr->cpos = CodeBufferGetLabel(codebuf(p));
   if(LexerToken(&(p->lex)) == TK_RBRA) {
     NEXT();
     cbOP(BC_NEWM0);
@@ -1478,6 +1632,38 @@ static void _close_forjump( struct Parser* p ,
   }
 }
 
+/* A for loop over a bare loop() or range() call doesn't need an iterator
+ * object. The call is dropped and its 3 arguments stay on the stack as the
+ * hidden slots of the loop , so the loop allocates nothing and moving it is
+ * an add and a compare on number slots. Returns the intrinsic instruction
+ * of the call , BC_NOP for other targets */
+static enum Bytecode numeric_for( struct Parser* p , const struct Expr* cond ) {
+  struct CodeBuffer* cb = codebuf(p);
+  size_t pos = CodeBufferPos(cb);
+  enum Bytecode op;
+  /* a call is always the last instruction of its expression */
+  if(cond->tag != EFUNCCALL || pos == 0) return BC_NOP;
+  op = CodeBufferDecodeOP(cb,pos-1);
+  if((op != BC_ICALL_LOOP && op != BC_ICALL_RANGE) ||
+     CodeBufferDecodeArg(cb,pos-1) != 3)
+    return BC_NOP;
+  return op;
+}
+
+/* Value of range() element at hidden slot INDEX , start + index * step */
+static void emit_range_value( struct Parser* p , int start , int index ) {
+  int step = start + 1;
+  if(index <= BCREG2_MAX) {
+    cbA(BC_MULLL,BCREG2(index,step));
+  } else {
+    cbA(BC_LOADV,index);
+    cbA(BC_LOADV,step);
+    cbOP(BC_MULVV);
+  }
+  cbA(BC_LOADV,start);
+  cbOP(BC_ADDVV);
+}
+
 static int parse_for( struct Parser* p ) {
   assert( LexerToken(&(p->lex)) == TK_FOR );
   TRY(TK_LPAR); NEXT(); /* Skip ( */
@@ -1487,8 +1673,13 @@ static int parse_for( struct Parser* p ) {
     struct CStr val; /* Loop variant value */
     struct Expr cond;/* Loop variant condition */
     struct Label skip_body;/* Loop header test jump */
+    struct Label loop_tag; /* Loop hotness tag */
     size_t loop_hdr; /* Loop header position */
     size_t cont_jmp; /* Continue jump position */
+    enum Bytecode numeric; /* BC_ICALL_LOOP/BC_ICALL_RANGE , see numeric_for */
+    int slot; /* First hidden slot of a numeric loop */
+    int index; /* Index slot of a numeric loop */
+    enum Bytecode op;
     enter_lexscope(p,&scp,1);
     key = StrBufToCStr(&(p->lex.lexeme.str)); /* get the variable name */
     NEXT();
@@ -1507,14 +1698,40 @@ static int parse_for( struct Parser* p ) {
     CONSUME(TK_IN); /* Skip in */
     if(pexpr(p,&cond)) return -1; /* evaluate the target */
     if(tryemit_expr(p,&cond)) return -1;
-    if(def_rndvar(p,"itr") != LOCVAR_NEW) { /* pin iterator to an internal variable */
-      perr(PERR_TOO_MANY_LOCAL_VARIABLES);
-      return -1;
+    slot = cclosure(p)->cur_scp->cur_idx;
+    index = slot;
+    numeric = numeric_for(p,&cond);
+    if(numeric == BC_NOP) {
+      if(def_rndvar(p,"itr") != LOCVAR_NEW) { /* pin iterator to an internal variable */
+        perr(PERR_TOO_MANY_LOCAL_VARIABLES);
+        return -1;
+      }
+    } else {
+      /* drop the call , its arguments become the hidden slots. For loop()
+       * they are index , end and step , range() keeps its start and step
+       * below them and counts elements from 0 , see BC_FORPREPR */
+      struct Label call = { CodeBufferPos(codebuf(p)) - 1 };
+      CodeBufferSetToLabel(codebuf(p),call);
+      if(numeric == BC_ICALL_RANGE) {
+        if(def_rndvar(p,"start") != LOCVAR_NEW ||
+           def_rndvar(p,"step") != LOCVAR_NEW) {
+          perr(PERR_TOO_MANY_LOCAL_VARIABLES);
+          return -1;
+        }
+        index = slot + 2;
+      }
+      if(def_rndvar(p,"index") != LOCVAR_NEW ||
+         def_rndvar(p,"end") != LOCVAR_NEW ||
+         def_rndvar(p,"step") != LOCVAR_NEW) {
+        perr(PERR_TOO_MANY_LOCAL_VARIABLES);
+        return -1;
+      }
     }
     CONSUME(TK_RPAR);
     /* loop prolog */
     skip_body = cbputA(); /* forprep , loop header instruction */
     loop_hdr = CodeBufferPos(codebuf(p)); /* store the loop header */
+    loop_tag = cbputA(); /* loop tag , counted on each iteration */
     {
       struct LexScope inner_scp; /* Loop body scope */
       enter_lexscope(p,&inner_scp,0);
@@ -1529,19 +1746,35 @@ static int parse_for( struct Parser* p ) {
           perr(PERR_TOO_MANY_LOCAL_VARIABLES);
           return -1;
         }
-        cbOP(BC_IDREFKV);
-      } else {
+        if(numeric == BC_NOP) {
+          cbOP(BC_IDREFKV);
+        } else {
+          cbA(BC_LOADV,index);
+          if(numeric == BC_ICALL_LOOP)
+            cbA(BC_LOADV,index);
+          else
+            emit_range_value(p,slot,index);
+        }
+      } else if(numeric == BC_NOP) {
         cbOP(BC_IDREFK);
+      } else {
+        cbA(BC_LOADV,index);
       }
       if(parse_stmtorchunk(p,0)) return -1; /* goto inner body */
       cont_jmp = CodeBufferPos(codebuf(p)); /* Continue statment jump position */
       leave_lexscope(p); /* leave the inner loop body */
-      cbA(BC_FORLOOP,loop_hdr);
+      cbA(numeric == BC_NOP ? BC_FORLOOP : BC_FORLOOPN,loop_hdr);
     }
     /* fix all break/continue statment jump table */
     _close_forjump(p,cont_jmp);
-    /* fix skip_body jump */
-    cbpatchA(skip_body,BC_FORPREP,CodeBufferPos(codebuf(p)));
+    /* fix skip_body jump and the loop tag , both point to the loop exit */
+    switch(numeric) {
+      case BC_ICALL_LOOP: op = BC_FORPREPN; break;
+      case BC_ICALL_RANGE: op = BC_FORPREPR; break;
+      default: op = BC_FORPREP; break;
+    }
+    cbpatchA(skip_body,op,CodeBufferPos(codebuf(p)));
+    cbpatchA(loop_tag,BC_LOOP,CodeBufferPos(codebuf(p)));
     leave_lexscope(p);
     return 0;
   } else {
@@ -1686,6 +1919,9 @@ static int parse_closure( struct Parser* p ) {
   /* parse the freaking proto */
   if(_parse_closureproto(p,objc)) goto fail;
 
+  /* function entry tag , counts the hotness of the function */
+  cbA(BC_CLOSURE,objc->narg);
+
   /* parse the chunk */
   if(parse_chunk(p,0)) goto fail;
 
@@ -1695,6 +1931,7 @@ static int parse_closure( struct Parser* p ) {
    * will know how to recover the stack frame without
    * extra byte codee */
   cbOP(BC_RETNULL);
+  CodeBufferFuse(codebuf(p));
 
   /* Exit the function lexical scope, not leave_scope
    * simply because exit_lexscope won't generate code
@@ -1794,6 +2031,7 @@ static int parse_decl( struct Parser* p ) {
           return -1;
         }
         if(tryemit_expr(p,&val)) return -1;
+        try_scratch(p,&val);
       } else {
         cbOP(BC_LOADNULL); /* load a null serve as default value */
       }
@@ -1847,7 +2085,7 @@ static int parse_assignorfunccall( struct Parser* p ) {
             { /* check whether the attribute is intrinsic attributes */
               enum IntrinsicAttribute iattr = IAttrGetIndex(rexpr.str->str);
               if(iattr == SIZE_OF_IATTR)
-                cbA(BC_ASETS,rexpr.info);
+                cbIC(BC_ASETS,rexpr.info);
               else
                 cbA(BC_ASETI,iattr); /* intrinsic attributes */
             }
@@ -1860,8 +2098,10 @@ static int parse_assignorfunccall( struct Parser* p ) {
     }
   } else {
     struct Expr val;
+    struct Label vpos;
     int idx;
     CONSUME(TK_ASSIGN); /* skip = */
+    vpos = CodeBufferGetLabel(codebuf(p));
     if(pexpr(p,&val)) goto fail;
     if((idx = get_locvar(p,lexpr.str))<0) {
       if((idx = handle_upvar(p,lexpr.str))<0) {
@@ -1872,12 +2112,12 @@ static int parse_assignorfunccall( struct Parser* p ) {
           goto fail;
         }
         switch(val.tag) {
-          case ETRUE: cbA(BC_GSETTRUE,idx); break;
-          case EFALSE:cbA(BC_GSETFALSE,idx); break;
-          case ENULL: cbA(BC_GSETNULL,idx); break;
+          case ETRUE: cbCELL(BC_GSETTRUE,idx); break;
+          case EFALSE:cbCELL(BC_GSETFALSE,idx); break;
+          case ENULL: cbCELL(BC_GSETNULL,idx); break;
           default:
             if(tryemit_expr(p,&val)) goto fail;
-            cbA(BC_GSET,idx);
+            cbCELL(BC_GSET,idx);
             break;
         }
       } else {
@@ -1926,7 +2166,7 @@ static int parse_assignorfunccall( struct Parser* p ) {
         default:
 normal:
           if(tryemit_expr(p,&val)) goto fail;
-          cbA(BC_MOVE,idx);
+          if(!emit_regstore(p,vpos,idx)) cbA(BC_MOVE,idx);
           break;
       }
     }
@@ -1993,6 +2233,7 @@ static int parse_mainchunk( struct Parser* p ) {
   } while(LexerToken(&(p->lex)) != TK_EOF);
   /* lastly generate a *ret* */
   cbOP(BC_RETNULL);
+  CodeBufferFuse(codebuf(p));
   exit_lexscope(p);
   return 0;
 }
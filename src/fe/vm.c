@@ -4,7 +4,12 @@
 #include "bc.h"
 #include "error.h"
 #include "builtin.h"
+#include "gc.h"
+#include "jit.h"
+#include "aot.h"
+#include "vm_asm.h"
 #include <math.h>
+#include <stddef.h>
 
 /* helper macros */
 #define current_frame(THREAD) ((THREAD)->frame+((THREAD)->frame_size-1))
@@ -32,12 +37,16 @@ void pop( struct CallThread* frame , size_t narg ) {
 
 static void exec_error( struct Runtime* , const char* , ... );
 
+static void stack_grow( struct CallThread* thread ) {
+  size_t ncap = 2 * thread->stack_cap;
+  thread->stack = realloc(thread->stack,sizeof(Value)*ncap);
+  thread->stack_cap = ncap;
+}
+
 static SPARROW_INLINE
 int push( struct CallThread* thread ,Value val ) {
-  if(SP_UNLIKELY(thread->stack_size == thread->stack_cap)) {
-    size_t ncap = 2 * thread->stack_cap;
-    thread->stack = realloc(thread->stack,sizeof(Value)*ncap);
-  }
+  if(SP_UNLIKELY(thread->stack_size == thread->stack_cap))
+    stack_grow(thread);
   thread->stack[thread->stack_size++] = val;
   return 0;
 }
@@ -448,12 +457,82 @@ Value vm_newlist( struct Runtime* rt, int narg ) {
   Value ret;
   l = ObjNewList(thread->sparrow,narg);
   for( i = narg-1 ; i >= 0 ; --i ) {
-    ObjListPush(l,top(thread,i));
+    ObjListPush(thread->sparrow,l,top(thread,i));
   }
   Vset_list(&ret,l);
   return ret;
 }
 
+/* Whether the current frame may use the scratch object , see escape
+ * analysis in parser.c. The object is owned by the frame that created it
+ * and is handed over once that frame is gone , so a recursive call never
+ * clears the object its caller is still using */
+static SPARROW_INLINE
+int vm_scratch_owned( struct CallThread* thread , struct ObjProto* proto ,
+    const struct ScratchSlot* slot ) {
+  const struct CallFrame* owner;
+  if(slot->thread == NULL) return 1;
+  if(slot->thread != thread) return 0;
+  if(slot->frame + 1 >= thread->frame_size) return 1;
+  owner = thread->frame + slot->frame;
+  return owner->closure == NULL || owner->closure->proto != proto;
+}
+
+static SPARROW_INLINE
+Value vm_newscratch( struct Runtime* rt , struct ObjProto* proto ,
+    int idx , int type ) {
+  struct CallThread* thread = RTCallThread(rt);
+  struct Sparrow* sparrow = thread->sparrow;
+  struct ScratchSlot* slot = proto->scratch_arr + idx;
+  Value ret;
+  assert(idx < (int)proto->scratch_size);
+  if(!vm_scratch_owned(thread,proto,slot)) goto fresh;
+  if(!Vis_null(&(slot->obj))) {
+    if(type == VALUE_LIST) {
+      struct ObjList* l = Vget_list(&(slot->obj));
+      if(SP_UNLIKELY(SparrowGCMarking(sparrow))) {
+        size_t i;
+        for( i = 0 ; i < l->size ; ++i ) {
+          GCPreBarrier(sparrow,l->arr[i]);
+        }
+      }
+      ObjListClear(l);
+      goto reuse;
+    } else if(Vget_map(&(slot->obj))->mops == NULL) {
+      struct ObjMap* m = Vget_map(&(slot->obj));
+      if(SP_UNLIKELY(SparrowGCMarking(sparrow))) {
+        /* same as map.clear , see gc.h */
+        ObjMapPreBarrier(sparrow,m);
+        GCLockHeap(sparrow);
+        ObjMapClear(m);
+        GCUnlockHeap(sparrow);
+      } else {
+        ObjMapClear(m);
+      }
+      goto reuse;
+    }
+  }
+  if(type == VALUE_LIST)
+    Vset_list(&ret,ObjNewList(sparrow,0));
+  else
+    Vset_map(&ret,ObjNewMap(sparrow,0));
+  GCPreBarrier(sparrow,slot->obj);
+  slot->obj = ret;
+  GCBarrier(sparrow,proto,ret);
+
+reuse:
+  slot->thread = thread;
+  slot->frame = thread->frame_size - 1;
+  return slot->obj;
+
+fresh:
+  if(type == VALUE_LIST)
+    Vset_list(&ret,ObjNewList(sparrow,0));
+  else
+    Vset_map(&ret,ObjNewMap(sparrow,0));
+  return ret;
+}
+
 static SPARROW_INLINE
 Value vm_newmap( struct Runtime* rt , int narg , int* fail ) {
   struct ObjMap* m;
@@ -472,7 +551,7 @@ Value vm_newmap( struct Runtime* rt , int narg , int* fail ) {
           ValueGetTypeString(key));
       return ret;
     }
-    ObjMapPut(m,Vget_str(&key),val);
+    ObjMapPut(thread->sparrow,m,Vget_str(&key),val);
   }
   Vset_map(&ret,m);
   *fail = 0;
@@ -770,7 +849,8 @@ void vm_asetn( struct Runtime* rt,
     int* fail ) {
   if(Vis_list(&object)) {
     struct ObjList* l = Vget_list(&object);
-    ObjListAssign(l,index,value);
+    ObjListAssign(RTSparrow(rt),l,index,value);
+    GCBarrier(RTSparrow(rt),l,value);
     *fail = 0;
   } else if(Vis_map(&object)) {
     struct ObjMap* map = Vget_map(&object);
@@ -839,7 +919,8 @@ void vm_asets( struct Runtime* rt,
           value);
       *fail = r ? 1 : 0;
     } else {
-      ObjMapPut(map,key,value);
+      ObjMapPut(RTSparrow(rt),map,key,value);
+      GCBarrier(RTSparrow(rt),map,value);
       *fail = 0;
     }
   } else if(Vis_udata(&object)) {
@@ -871,6 +952,228 @@ void vm_asets( struct Runtime* rt,
   }
 }
 
+/* Inline caches of BC_AGETS/BC_ASETS , see struct InlineCache. Entries are
+ * compared by pointer since strings are interned */
+static SPARROW_INLINE
+Value* ic_find( const struct InlineCache* ic ,
+    const struct ObjMap* map , const struct ObjStr* key ) {
+  uint32_t i;
+  if(ic->size == IC_MEGAMORPHIC) return NULL;
+  if(map->shape) {
+    for( i = 0 ; i < ic->size ; ++i ) {
+      if(ic->shape[i] == map->shape) return map->slot + ic->idx[i];
+    }
+  } else {
+    for( i = 0 ; i < ic->size ; ++i ) {
+      uint32_t idx = ic->idx[i];
+      if(ic->shape[i] == NULL && idx < map->cap) {
+        struct ObjMapEntry* e = map->entry + idx;
+        if(e->key == key && !e->del) return &(e->value);
+      }
+    }
+  }
+  return NULL;
+}
+
+/* Called on a miss with the value found by full lookup. Major GC scans the
+ * cached shapes of a proto , so the entries are updated with the heap lock
+ * held while marker thread is running and a new shape is kept by
+ * GCMarkShape , see gc.c */
+static SPARROW_INLINE
+void ic_update( struct Sparrow* sparrow , struct InlineCache* ic ,
+    const struct ObjMap* map , const Value* ref ) {
+  uint32_t idx = ObjMapRefIndex(map,ref);
+  uint32_t i;
+  int lock;
+  if(ic->size == IC_MEGAMORPHIC) return;
+  for( i = 0 ; i < ic->size ; ++i ) {
+    if(ic->shape[i] == map->shape && ic->idx[i] == idx) return;
+  }
+  lock = SparrowGCMarking(sparrow);
+  if(SP_UNLIKELY(lock)) GCLockHeap(sparrow);
+  if(ic->size == SPARROW_IC_SIZE) {
+    ic->size = IC_MEGAMORPHIC;
+  } else {
+    if(SP_UNLIKELY(sparrow->gc_phase == GC_PHASE_MARK) && map->shape)
+      GCMarkShape(sparrow,map->shape);
+    ic->shape[ic->size] = map->shape;
+    ic->idx[ic->size++] = idx;
+  }
+  if(SP_UNLIKELY(lock)) GCUnlockHeap(sparrow);
+}
+
+/* Type feedback , see struct FeedbackSlot. The vector is allocated by the
+ * first slow path taken after the proto is warm , with a slot for each
+ * site. A superinstruction is classified by its first instruction , the
+ * second one is a site of its own */
+static int feedback_kind( enum Bytecode op ) {
+  enum Bytecode first = BytecodeUnfuse(op);
+  if(first != SIZE_OF_BYTECODE) op = first;
+  switch(op) {
+    case BC_ADDVV: case BC_SUBVV: case BC_MULVV: case BC_DIVVV:
+    case BC_MODVV: case BC_POWVV:
+    case BC_ADDNN: case BC_SUBNN: case BC_MULNN: case BC_DIVNN:
+    case BC_ADDLL: case BC_SUBLL: case BC_MULLL: case BC_DIVLL:
+    case BC_MODLL: case BC_POWLL:
+    case BC_RADDLL: case BC_RSUBLL: case BC_RMULLL: case BC_RDIVLL:
+    case BC_RMODLL: case BC_RPOWLL:
+    case BC_ADDLLNN: case BC_SUBLLNN: case BC_MULLLNN: case BC_DIVLLNN:
+    case BC_RADDLLNN: case BC_RSUBLLNN: case BC_RMULLLNN: case BC_RDIVLLNN:
+      return FEEDBACK_ARITH;
+    case BC_LTVV: case BC_LEVV: case BC_GTVV: case BC_GEVV:
+    case BC_EQVV: case BC_NEVV:
+    case BC_LTNN: case BC_LENN: case BC_GTNN: case BC_GENN:
+    case BC_LTLL: case BC_LELL: case BC_GTLL: case BC_GELL:
+    case BC_EQLL: case BC_NELL:
+    case BC_LTLLNN: case BC_LELLNN: case BC_GTLLNN: case BC_GELLNN:
+      return FEEDBACK_COMPARE;
+    case BC_AGETS: case BC_ASETS:
+      return FEEDBACK_ATTR;
+    case BC_AGETN: case BC_AGETI: case BC_AGET:
+    case BC_ASETN: case BC_ASETI: case BC_ASET:
+      return FEEDBACK_INDEX;
+    case BC_CALL: case BC_CALL0: case BC_CALL1: case BC_CALL2:
+    case BC_CALL3: case BC_CALL4:
+      return FEEDBACK_CALL;
+    default:
+      return -1;
+  }
+}
+
+static void feedback_new( struct Sparrow* sparrow , struct ObjProto* proto ) {
+  const struct CodeBuffer* cb = &(proto->code_buf);
+  size_t i;
+  size_t size = 0;
+  proto->fb_idx = malloc(sizeof(uint32_t)*cb->pos);
+  for( i = 0 ; i < cb->pos ; ++i ) {
+    if(feedback_kind(CodeBufferDecodeOP(cb,i)) >= 0) {
+      proto->fb_idx[i] = (uint32_t)(size++);
+    } else {
+      proto->fb_idx[i] = FEEDBACK_NONE;
+    }
+  }
+  proto->fb_arr = calloc(size ? size : 1,sizeof(struct FeedbackSlot));
+  proto->fb_size = size;
+  for( i = 0 ; i < cb->pos ; ++i ) {
+    if(proto->fb_idx[i] != FEEDBACK_NONE) {
+      struct FeedbackSlot* slot = proto->fb_arr + proto->fb_idx[i];
+      slot->pc = (uint32_t)i;
+      slot->kind = (uint32_t)feedback_kind(CodeBufferDecodeOP(cb,i));
+    }
+  }
+  GCTrackFeedback(sparrow,proto);
+}
+
+static SPARROW_INLINE uint32_t feedback_type( Value* v ) {
+  if(Vis_number(v)) return FEEDBACK_NUMBER;
+  else if(Vis_boolean(v)) return FEEDBACK_BOOLEAN;
+  else if(Vis_null(v)) return FEEDBACK_NULL;
+  return 1U << Vget_gcobject(v)->gtype;
+}
+
+static void feedback_target( struct FeedbackSlot* slot , const void* target ) {
+  uint32_t i;
+  if(slot->target_size == FEEDBACK_MEGAMORPHIC) return;
+  for( i = 0 ; i < slot->target_size ; ++i ) {
+    if(slot->target[i] == target) return;
+  }
+  if(slot->target_size == SPARROW_FEEDBACK_SIZE) {
+    slot->target_size = FEEDBACK_MEGAMORPHIC;
+  } else {
+    slot->target[slot->target_size++] = target;
+  }
+}
+
+/* Record operands of the site at pc , r is NULL for a call. Major GC scans
+ * the shapes recorded by a proto , so the vector is updated with the heap
+ * lock held while marker thread is running , see gc.c */
+static void vm_feedback( struct Sparrow* sparrow , struct ObjProto* proto ,
+    size_t pc , Value* l , Value* r ) {
+  struct FeedbackSlot* slot;
+  const int lock = SparrowGCMarking(sparrow);
+  if(SP_UNLIKELY(lock)) GCLockHeap(sparrow);
+  if(SP_UNLIKELY(!proto->fb_idx)) feedback_new(sparrow,proto);
+  assert(proto->fb_idx[pc] != FEEDBACK_NONE);
+  slot = proto->fb_arr + proto->fb_idx[pc];
+  ++slot->count;
+  slot->type[0] |= feedback_type(l);
+  if(r) slot->type[1] |= feedback_type(r);
+  switch(slot->kind) {
+    case FEEDBACK_ATTR:
+    case FEEDBACK_INDEX:
+      if(Vis_map(l) && Vget_map(l)->shape) {
+        if(SP_UNLIKELY(sparrow->gc_phase == GC_PHASE_MARK))
+          GCMarkShape(sparrow,Vget_map(l)->shape);
+        feedback_target(slot,Vget_map(l)->shape);
+      }
+      break;
+    case FEEDBACK_CALL:
+      if(Vis_closure(l))
+        feedback_target(slot,Vget_closure(l)->proto);
+      break;
+    default:
+      break;
+  }
+  if(SP_UNLIKELY(lock)) GCUnlockHeap(sparrow);
+}
+
+/* Feedback of current instruction , nothing is recorded before the proto is
+ * warm */
+#define FEEDBACK_AT(SP,PROTO,PC,L,R) \
+  do { \
+    if(SP_UNLIKELY((PROTO)->hotness >= SPARROW_FEEDBACK_THRESHOLD)) \
+      vm_feedback((SP),(PROTO),(PC),(L),(R)); \
+  } while(0)
+
+static SPARROW_INLINE
+Value vm_agets_ic( struct Runtime* rt , struct ObjProto* proto , size_t pc ,
+    Value obj , struct InlineCache* ic , struct ObjStr* key , int* fail ) {
+  if(Vis_map(&obj) && !Vget_map(&obj)->mops) {
+    struct ObjMap* map = Vget_map(&obj);
+    Value* ref = ic_find(ic,map,key);
+    if(SP_UNLIKELY(!ref)) {
+      FEEDBACK_AT(RTSparrow(rt),proto,pc,&obj,NULL);
+      ref = ObjMapFindRef(map,key);
+      if(!ref) {
+        Value ret;
+        Vset_null(&ret);
+        *fail = 1;
+        exec_error(rt,PERR_TYPE_NO_ATTRIBUTE,"map",key->str);
+        return ret;
+      }
+      ic_update(RTSparrow(rt),ic,map,ref);
+    }
+    *fail = 0;
+    return *ref;
+  }
+  FEEDBACK_AT(RTSparrow(rt),proto,pc,&obj,NULL);
+  return vm_agets(rt,obj,key,fail);
+}
+
+static SPARROW_INLINE
+void vm_asets_ic( struct Runtime* rt , struct ObjProto* proto , size_t pc ,
+    Value object , struct InlineCache* ic , struct ObjStr* key ,
+    Value value , int* fail ) {
+  if(Vis_map(&object) && !Vget_map(&object)->mops) {
+    struct Sparrow* sparrow = RTSparrow(rt);
+    struct ObjMap* map = Vget_map(&object);
+    Value* ref = ic_find(ic,map,key);
+    /* concurrent marking needs the barrier and the heap lock */
+    if(SP_LIKELY(ref && !SparrowGCMarking(sparrow))) {
+      *ref = value;
+    } else {
+      if(!ref) FEEDBACK_AT(sparrow,proto,pc,&object,&value);
+      ref = ObjMapPutRef(sparrow,map,key,value);
+      ic_update(sparrow,ic,map,ref);
+    }
+    GCBarrier(sparrow,map,value);
+    *fail = 0;
+  } else {
+    FEEDBACK_AT(RTSparrow(rt),proto,pc,&object,&value);
+    vm_asets(rt,object,key,value,fail);
+  }
+}
+
 static SPARROW_INLINE
 void vm_aset( struct Runtime* rt,
     Value object,
@@ -894,7 +1197,8 @@ void vm_aset( struct Runtime* rt,
       *fail = r ? 1 : 0;
     } else {
       if(Vis_str(&key)) {
-        ObjMapPut(map,Vget_str(&key),value);
+        ObjMapPut(RTSparrow(rt),map,Vget_str(&key),value);
+        GCBarrier(RTSparrow(rt),map,value);
         return;
       } else *fail =1;
     }
@@ -906,7 +1210,8 @@ void vm_aset( struct Runtime* rt,
         exec_error(rt,PERR_SIZE_OVERFLOW,Vget_number(&key));
         *fail = 1;
       } else {
-        ObjListAssign(l,index,value);
+        ObjListAssign(RTSparrow(rt),l,index,value);
+        GCBarrier(RTSparrow(rt),l,value);
       }
     } else {
       exec_error(rt,PERR_ATTRIBUTE_TYPE,"list",ValueGetTypeString(key));
@@ -954,7 +1259,8 @@ void vm_aseti( struct Runtime* rt, Value object , Value value ,
       *fail = r ? 1 : 0;
     } else {
       struct ObjStr* oname = IAttrGetObjStr(RTSparrow(rt),iattr);
-      ObjMapPut(m,oname,value);
+      ObjMapPut(RTSparrow(rt),m,oname,value);
+      GCBarrier(RTSparrow(rt),m,value);
       *fail = 0;
     }
   } else if(Vis_udata(&object)) {
@@ -993,7 +1299,9 @@ static SPARROW_INLINE
 void vm_uset( struct Runtime* rt , int index , Value val ) {
   struct ObjClosure* closure = current_frame(RTCallThread(rt))->closure;
   assert(index < closure->proto->uv_size);
+  GCPreBarrier(RTSparrow(rt),closure->upval[index]);
   closure->upval[index] = val;
+  GCBarrier(RTSparrow(rt),closure,val);
 }
 
 static SPARROW_INLINE
@@ -1134,59 +1442,511 @@ Value vm_forprep( struct Runtime* rt , Value tos , int* invalid , int* fail ) {
   return ret;
 }
 
+/* Move the iterator , returns 1 if the loop body needs to run again */
+static SPARROW_INLINE
+int vm_forloop( struct Sparrow* sparrow , Value tos ) {
+  if(Vis_iterator(&tos)) {
+    struct ObjIterator* itr = Vget_iterator(&tos);
+    itr->move(sparrow,itr);
+    return itr->has_next(sparrow,itr) == 0;
+  } else {
+    struct ObjLoopIterator* litr = Vget_loop_iterator(&tos);
+    litr->index += litr->step; /* move */
+    return litr->index < litr->end;
+  }
+}
+
+/* Arguments of loop() and range() in a numeric for loop , see parse_for.
+ * They are checked and converted to int the way the intrinsic does , when
+ * the intrinsic rejects them it is called on them , so the error is the one
+ * a call reports */
+static int vm_forprep_args( struct Runtime* rt , Value* arg , int range ,
+    int* out , int* fail ) {
+  struct Sparrow* sparrow = RTSparrow(rt);
+  Value name;
+  Value res;
+  *fail = 0;
+  if(Vis_number(arg) && Vis_number(arg+1) && Vis_number(arg+2) &&
+     !ConvNum(Vget_number(arg),out) &&
+     !ConvNum(Vget_number(arg+1),out+1) &&
+     !ConvNum(Vget_number(arg+2),out+2)) {
+    if(!range || (out[1] > out[0] && out[2] > 0) ||
+                 (out[1] < out[0] && out[2] < 0))
+      return 0;
+  }
+  Vset_str(&name,range ? IFUNC_NAME(sparrow,Range) :
+                         IFUNC_NAME(sparrow,Loop));
+  if(add_callframe(rt,3,NULL,name) == 0) {
+    if(range) Builtin_Range(rt,&res,fail); else Builtin_Loop(rt,&res,fail);
+    del_callframe(rt);
+    assert(*fail);
+  }
+  *fail = 1;
+  return -1;
+}
+
+/* BC_FORPREPN , arg is index , end and step. Returns 1 if the loop body
+ * needs to run */
+static int vm_forprepn( struct Runtime* rt , Value* arg , int* fail ) {
+  int v[3];
+  if(vm_forprep_args(rt,arg,0,v,fail)) return 0;
+  Vset_number(arg,v[0]);
+  Vset_number(arg+1,v[1]);
+  Vset_number(arg+2,v[2]);
+  return v[0] < v[1];
+}
+
+/* BC_FORPREPR , arg is start , end and step of range() and becomes start ,
+ * step and index 0. Returns the number of elements , a negative step makes
+ * an empty list */
+static int vm_forprepr( struct Runtime* rt , Value* arg , int* fail ) {
+  int v[3];
+  if(vm_forprep_args(rt,arg,1,v,fail)) return 0;
+  Vset_number(arg,v[0]);
+  Vset_number(arg+1,v[2]);
+  Vset_number(arg+2,0);
+  if(v[2] < 0) return 0;
+  return (int)(((int64_t)v[1] - v[0] + v[2] - 1) / v[2]);
+}
+
 static SPARROW_INLINE
-Value vm_gget( struct Runtime* rt , struct ObjStr* key , int* fail ) {
+Value vm_gget( struct Runtime* rt , struct GlobalCell* cell ,
+    struct ObjStr* key , int* fail ) {
+  struct Sparrow* sparrow = RTSparrow(rt);
+  struct ObjMap* env = RTCallThread(rt)->component->env;
+  Value* ref;
+  if(SP_LIKELY(cell->version == sparrow->global_version && cell->env == env)) {
+    *fail = 0;
+    return *cell->ref;
+  }
   /* Try to find out which global value is in component wide environment */
-  Value ret;
-  if(ObjMapFind(RTCallThread(rt)->component->env,key,&ret)) {
+  if(!(ref = ObjMapFindRef(env,key))) {
     /* Find in global table */
-    if(ObjMapFind(&(global_env(rt).env),key,&ret)) {
+    if(!(ref = ObjMapFindRef(&(global_env(rt).env),key))) {
+      Value ret;
+      Vset_null(&ret);
       *fail = 1;
       exec_error(rt,"Cannot find global variable %s!",key->str);
       return ret;
     }
   }
+  cell->version = sparrow->global_version;
+  cell->env = env;
+  cell->ref = ref;
   *fail = 0;
-  return ret;
+  return *ref;
+}
+
+static SPARROW_INLINE
+void vm_gset( struct Runtime* rt , struct GlobalCell* cell ,
+    struct ObjStr* key , Value value ) {
+  struct Sparrow* sparrow = RTSparrow(rt);
+  struct ObjMap* env = RTCallThread(rt)->component->env;
+  /* cell of a BC_GSET* is only resolved here , so it always refers to the
+   * component env ; concurrent marking needs the heap lock of a put */
+  if(SP_LIKELY(cell->version == sparrow->global_version && cell->env == env &&
+               !SparrowGCMarking(sparrow))) {
+    *cell->ref = value;
+  } else {
+    size_t size = env->size;
+    Value* ref = ObjMapPutRef(sparrow,env,key,value);
+    /* a new name may shadow a cell resolved to the GlobalEnv or move
+     * the storage of the env , so all the cells are dropped */
+    if(env->size != size) SparrowGlobalChanged(sparrow);
+    cell->version = sparrow->global_version;
+    cell->env = env;
+    cell->ref = ref;
+  }
+  GCBarrier(sparrow,env,value);
+}
+
+#ifdef SPARROW_VM_PROFILE
+/* Dispatch profile , every dispatched instruction is counted along with
+ * the sequences of 2 and 3 instructions that end with it. It is used to
+ * pick superinstructions , see VMProfileDump */
+#define VM_PROFILE_TRIPLE_SIZE (1<<16)
+
+struct VMProfileTriple {
+  uint32_t key; /* 0 means empty slot */
+  uint64_t count;
+};
+
+static uint64_t vm_profile_single[SIZE_OF_BYTECODE];
+static uint64_t vm_profile_pair[SIZE_OF_BYTECODE][SIZE_OF_BYTECODE];
+static struct VMProfileTriple vm_profile_triple[VM_PROFILE_TRIPLE_SIZE];
+static int vm_profile_prev[2] = { -1 , -1 };
+
+#define VM_PROFILE_KEY(A,B,C) \
+  ((((uint32_t)(A)<<16)|((uint32_t)(B)<<8)|(uint32_t)(C))+1)
+
+static void vm_profile( int op ) {
+  ++vm_profile_single[op];
+  if(vm_profile_prev[1] >= 0) {
+    ++vm_profile_pair[vm_profile_prev[1]][op];
+    if(vm_profile_prev[0] >= 0) {
+      uint32_t key = VM_PROFILE_KEY(vm_profile_prev[0],vm_profile_prev[1],op);
+      size_t idx = (key * 2654435761U) & (VM_PROFILE_TRIPLE_SIZE-1);
+      size_t i;
+      /* the table is never full in practice , extra sequences are dropped */
+      for( i = 0 ; i < VM_PROFILE_TRIPLE_SIZE ; ++i ) {
+        struct VMProfileTriple* t = vm_profile_triple + idx;
+        if(t->key == key || t->key == 0) {
+          t->key = key;
+          ++t->count;
+          break;
+        }
+        idx = (idx+1) & (VM_PROFILE_TRIPLE_SIZE-1);
+      }
+    }
+  }
+  vm_profile_prev[0] = vm_profile_prev[1];
+  vm_profile_prev[1] = op;
+}
+
+struct VMProfileEntry {
+  uint32_t key;
+  uint64_t count;
+};
+
+static int vm_profile_cmp( const void* l , const void* r ) {
+  const struct VMProfileEntry* le = l;
+  const struct VMProfileEntry* re = r;
+  if(le->count == re->count) return 0;
+  return le->count < re->count ? 1 : -1;
+}
+
+static void vm_profile_print( FILE* output , const char* title ,
+    struct VMProfileEntry* arr , size_t size , size_t top ,
+    uint64_t total , int len ) {
+  size_t i;
+  qsort(arr,size,sizeof(*arr),vm_profile_cmp);
+  fprintf(output,"%s:\n",title);
+  for( i = 0 ; i < size && i < top && arr[i].count ; ++i ) {
+    int k;
+    fprintf(output,"%12" PRIu64 " %6.2f%%  ",arr[i].count,
+        total ? 100.0 * arr[i].count / total : 0.0);
+    for( k = len-1 ; k >= 0 ; --k ) {
+      fprintf(output,"%s%s",
+          BytecodeGetName((arr[i].key >> (8*k)) & 0xff),k ? ";" : "\n");
+    }
+  }
+}
+
+void VMProfileDump( FILE* output , size_t top ) {
+  struct VMProfileEntry* arr;
+  size_t size = SIZE_OF_BYTECODE * SIZE_OF_BYTECODE;
+  size_t cnt , i , j;
+  uint64_t total = 0;
+
+  if(size < VM_PROFILE_TRIPLE_SIZE) size = VM_PROFILE_TRIPLE_SIZE;
+  arr = malloc(sizeof(*arr)*size);
+
+  for( i = 0 ; i < SIZE_OF_BYTECODE ; ++i ) {
+    arr[i].key = (uint32_t)i;
+    arr[i].count = vm_profile_single[i];
+    total += vm_profile_single[i];
+  }
+  fprintf(output,"Dispatch count: %" PRIu64 "\n",total);
+  vm_profile_print(output,"Instruction",arr,SIZE_OF_BYTECODE,top,total,1);
+
+  for( cnt = 0 , i = 0 ; i < SIZE_OF_BYTECODE ; ++i ) {
+    for( j = 0 ; j < SIZE_OF_BYTECODE ; ++j ) {
+      arr[cnt].key = (uint32_t)((i<<8)|j);
+      arr[cnt].count = vm_profile_pair[i][j];
+      ++cnt;
+    }
+  }
+  vm_profile_print(output,"Pair",arr,cnt,top,total,2);
+
+  for( cnt = 0 , i = 0 ; i < VM_PROFILE_TRIPLE_SIZE ; ++i ) {
+    if(vm_profile_triple[i].key) {
+      arr[cnt].key = vm_profile_triple[i].key - 1;
+      arr[cnt].count = vm_profile_triple[i].count;
+      ++cnt;
+    }
+  }
+  vm_profile_print(output,"Triple",arr,cnt,top,total,3);
+  free(arr);
 }
 
+#define PROFILE() vm_profile(op)
+#else
+#define PROFILE() (void)(NULL)
+#endif /* SPARROW_VM_PROFILE */
+
 /* vm_main related macro helpers */
+
+/* Interpreter state cached in local variables of vm_main.
+ *
+ * ip points to the next instruction , sp to the first free slot of the stack ,
+ * base to the first slot of current frame , limit to the end of the stack ,
+ * knum and kstr are the constant tables of current proto. The pc of current
+ * frame and the stack size of the thread are only written back by SAVE , which
+ * happens before calls , returns , anything that may allocate ( and so run the
+ * GC ) or run script code , and on error paths. LOAD picks the state up again
+ * when the frame may have changed , RELOAD when only the stack may have been
+ * grown or the frame array may have been reallocated */
+#ifdef SPARROW_VM_DIRECT_THREADING
+/* Direct threading , each instruction is pre-decoded along with the address
+ * of its handler so a dispatch is a single indirect jump without indexing
+ * the jump table. The decoded code is built on first entry of a proto */
+struct DecodedIns {
+  const void* handler;
+  uint32_t ins;
+};
+
+typedef struct DecodedIns VMCode;
+
+static struct DecodedIns* vm_decode( struct ObjProto* proto ,
+    const void* const* jump_table ) {
+  size_t i;
+  struct DecodedIns* dcode = malloc(sizeof(*dcode)*proto->code_buf.pos);
+  for( i = 0 ; i < proto->code_buf.pos ; ++i ) {
+    dcode[i].handler = jump_table[BCINS_OP(proto->code_buf.buf[i])];
+    dcode[i].ins = proto->code_buf.buf[i];
+  }
+  return dcode;
+}
+
+#define CODE_INS(P) ((P)->ins)
+#define LOAD_CODE() \
+  do { \
+    if(SP_UNLIKELY(!proto->dcode)) proto->dcode = vm_decode(proto,jump_table); \
+    code = proto->dcode; \
+  } while(0)
+#else
+typedef uint32_t VMCode;
+
+#define CODE_INS(P) (*(P))
+#define LOAD_CODE() \
+  do { \
+    code = proto->code_buf.buf; \
+  } while(0)
+#endif /* SPARROW_VM_DIRECT_THREADING */
+
+#define SAVE() \
+  do { \
+    frame->pc = (size_t)(ip - code); \
+    thread->stack_size = (size_t)(sp - thread->stack); \
+  } while(0)
+
+#define RELOAD() \
+  do { \
+    frame = current_frame(thread); \
+    base = thread->stack + frame->base_ptr; \
+    sp = thread->stack + thread->stack_size; \
+    limit = thread->stack + thread->stack_cap; \
+  } while(0)
+
+#define LOAD() \
+  do { \
+    RELOAD(); \
+    closure = frame->closure; \
+    proto = closure->proto; \
+    knum = proto->num_arr; \
+    kstr = proto->str_arr; \
+    LOAD_CODE(); \
+    ip = code + frame->pc; \
+  } while(0)
+
+/* Call a helper which needs the state written back , STMT may use check */
+#define CALLOUT(STMT) \
+  do { \
+    SAVE(); \
+    STMT; \
+    RELOAD(); \
+  } while(0)
+
+/* Stack operations on the cached stack top */
+#define TOP(IDX) (*(sp-1-(IDX)))
+#define LEFT() TOP(1)
+#define RIGHT() TOP(0)
+#define REPLACE(VALUE) (sp[-1] = (VALUE))
+#define POP(NARG) \
+  do { \
+    assert(sp - (NARG) >= thread->stack); \
+    sp -= (NARG); \
+  } while(0)
+#define PUSH(VALUE) \
+  do { \
+    if(SP_UNLIKELY(sp == limit)) { \
+      thread->stack_size = (size_t)(sp - thread->stack); \
+      stack_grow(thread); \
+      RELOAD(); \
+    } \
+    *sp++ = (VALUE); \
+  } while(0)
+
+/* Local variable slot of current frame */
+#define reg(IDX) (base[(IDX)])
+
+#define JUMP(PC) \
+  do { \
+    ip = code + (PC); \
+  } while(0)
+
 #define FATAL(...) \
   do { \
+    SAVE(); \
     exec_error(__VA_ARGS__); \
     goto fail; \
   } while(0)
 
+/* the operand is already fetched along with the opcode by DISPATCH */
 #define DECODE_ARG() \
   do { \
-    opr = CodeBufferDecodeArg(&(proto->code_buf),frame->pc); \
-    frame->pc += 3; \
+    opr = BCINS_A(ins); \
   } while(0)
 
-#define SKIP_ARG() \
+#define check &fail); if(fail) goto fail; (void)(NULL
+
+/* Truth value of a value , only a udata may run script code through its
+ * metaops hook so only then the state is written back */
+#define TRUTHY(OUT,VALUE) \
   do { \
-    frame->pc += 3; \
+    if(SP_LIKELY(!Vis_udata(&(VALUE)))) { \
+      (OUT) = ValueToBoolean(rt,(VALUE)); \
+    } else { \
+      CALLOUT((OUT) = ValueToBoolean(rt,(VALUE))); \
+    } \
   } while(0)
 
-#define check &fail); if(fail) goto fail; (void)(NULL
+/* Move the iterator for BC_FORLOOP , only a general iterator may run script
+ * code , loop() is moved inline */
+#define FORLOOP_MOVE(OUT,VALUE) \
+  do { \
+    if(SP_UNLIKELY(Vis_iterator(&(VALUE)))) { \
+      CALLOUT((OUT) = vm_forloop(sparrow,(VALUE))); \
+    } else { \
+      (OUT) = vm_forloop(sparrow,(VALUE)); \
+    } \
+  } while(0)
+
+/* Move the hidden slots of BC_FORLOOPN , index , end and step on stack top
+ * always hold numbers */
+#define FORLOOPN_MOVE(OUT) \
+  do { \
+    Vset_number(&TOP(2),Vget_number(&TOP(2))+Vget_number(&TOP(0))); \
+    (OUT) = Vget_number(&TOP(2)) < Vget_number(&TOP(1)); \
+  } while(0)
+
+/* Take the second instruction of a superinstruction , see SUPERINSTRUCTION.
+ * It is consumed without a dispatch and its operand is then decoded with
+ * DECODE_ARG as usual */
+#define FETCH_NEXT() \
+  do { \
+    ins = CODE_INS(ip); \
+    ++ip; \
+  } while(0)
+
+/* Quickening. A generic instruction rewrites itself in place into a variant
+ * specialized for the operand types it has just observed , the variant
+ * guards the types and rewrites itself back to the generic one on failure */
+#ifdef SPARROW_VM_DIRECT_THREADING
+#define QUICKEN(OP) \
+  do { \
+    size_t pc = (size_t)(ip - code) - 1; \
+    proto->code_buf.buf[pc] = BCINS(OP,BCINS_A(ins)); \
+    proto->dcode[pc].handler = jump_table[OP]; \
+    proto->dcode[pc].ins = proto->code_buf.buf[pc]; \
+  } while(0)
+#else
+#define QUICKEN(OP) \
+  do { \
+    proto->code_buf.buf[(ip - code) - 1] = BCINS(OP,BCINS_A(ins)); \
+  } while(0)
+#endif /* SPARROW_VM_DIRECT_THREADING */
+
+/* Type feedback of current instruction , only used on slow paths. The site
+ * of a superinstruction is the instruction fetched last */
+#define SITE_PC() ((size_t)(ip - code) - 1)
+#define FEEDBACK(L,R) FEEDBACK_AT(sparrow,proto,SITE_PC(),(L),(R))
+
+#ifdef SPARROW_NATIVE
+/* Run current proto in native code if it has been compiled , either ahead of
+ * time or by the JIT. Native code returns at the instruction it leaves to
+ * interpreter , ie a call , and the interpreter picks it up from there */
+static SPARROW_INLINE
+int vm_has_native( struct ObjProto* proto ) {
+#ifdef SPARROW_AOT
+  if(proto->aot) return 1;
+#endif /* SPARROW_AOT */
+#ifdef SPARROW_JIT
+  if(proto->jit) return 1;
+#endif /* SPARROW_JIT */
+  return 0;
+}
+
+static SPARROW_INLINE
+int vm_native( struct Runtime* rt , struct ObjProto* proto ) {
+#ifdef SPARROW_AOT
+  if(proto->aot) return AotRun(rt,proto);
+#endif /* SPARROW_AOT */
+#ifdef SPARROW_JIT
+  if(proto->jit) return JitRun(rt,proto);
+#endif /* SPARROW_JIT */
+  return 0;
+}
 
-static int vm_main( struct Runtime* rt , Value* ret ) {
+#define NATIVE_ENTER() \
+  do { \
+    if(vm_has_native(proto)) { \
+      SAVE(); \
+      if(vm_native(rt,proto)) goto fail; \
+      LOAD(); \
+    } \
+  } while(0)
+#else
+#define NATIVE_ENTER() (void)(NULL)
+#endif /* SPARROW_NATIVE */
+
+/* Tier up hook , called once when a proto gets hot */
+static void vm_tierup( struct Sparrow* sparrow , struct ObjProto* proto ) {
+#ifdef SPARROW_JIT
+  /* code compiled ahead of time is not compiled again */
+  if(!proto->aot) JitCompile(sparrow,proto);
+#else
+  (void)sparrow;
+  (void)proto;
+#endif /* SPARROW_JIT */
+}
+
+/* Hotness counting at BC_CLOSURE and BC_LOOP. Once current proto has native
+ * code the frame is transferred into it right at the tag , so a long loop
+ * that gets hot in the middle continues natively from its next iteration */
+#define HOT() \
+  do { \
+    if(SP_UNLIKELY(++proto->hotness == SPARROW_JIT_THRESHOLD)) \
+      vm_tierup(sparrow,proto); \
+    NATIVE_ENTER(); \
+  } while(0)
+
+/* When step is not zero , vm_main returns after executing one instruction
+ * with pc of current frame pointing to the next one , see JitStep */
+static int vm_main( struct Runtime* rt , Value* ret , int step ) {
   struct Sparrow* sparrow= RTSparrow(rt);
 
   /* operand registers */
   Value l, r, tos , res;
   int fail;
   uint8_t op;
+  uint32_t ins;
   uint32_t opr;
 
   /* context variables */
   struct CallThread* thread = rt->cur_thread;
-  struct CallFrame* frame = current_frame(thread);
-  struct ObjClosure* closure = frame->closure;
-  struct ObjProto* proto = closure->proto;
-
-  /* sink static analyzer's stupid error */
-  Vset_null(ret);
+  struct CallFrame* frame;
+  struct ObjClosure* closure;
+  struct ObjProto* proto;
+
+  /* cached state , see SAVE and LOAD */
+  const VMCode* code;
+  const VMCode* ip;
+  Value* base;
+  Value* sp;
+  Value* limit;
+  const double* knum;
+  struct ObjStr** kstr;
 
 #ifndef SPARROW_VM_NO_THREADING
   /* when we reach here, it means we will do a threading
@@ -1198,42 +1958,98 @@ static int vm_main( struct Runtime* rt , Value* ret ) {
     NULL
 #undef __
   };
+#ifndef SPARROW_VM_DIRECT_THREADING
+  const void* const* dispatch_table = jump_table;
+#ifdef SPARROW_NATIVE
+  /* every instruction after the first one ends a step */
+  static const void* step_table[] = {
+    [0 ... SIZE_OF_BYTECODE] = &&step_done
+  };
+  if(step) dispatch_table = step_table;
+#endif /* SPARROW_NATIVE */
+#endif /* SPARROW_VM_DIRECT_THREADING */
+#endif /* SPARROW_VM_NO_THREADING */
+
+  LOAD();
+
+  /* sink static analyzer's stupid error */
+  Vset_null(ret);
+
+  /* entry of a module has no BC_CLOSURE tag , it goes native from here */
+  if(!step) NATIVE_ENTER();
+
+#ifndef SPARROW_VM_NO_THREADING
 #define CASE(X) label_##X:
 
-#ifndef SPARROW_VM_INSTRUCTION_CHECK
+#ifdef SPARROW_VM_INSTRUCTION_CHECK
+#define CHECK_OP() verify(op >=0 && op < SIZE_OF_BYTECODE)
+#else
+#define CHECK_OP() (void)(NULL)
+#endif /* SPARROW_VM_INSTRUCTION_CHECK */
+
+#ifdef SPARROW_VM_DIRECT_THREADING
+#ifdef SPARROW_NATIVE
+/* every instruction after the first one ends a step */
+#define CHECK_STEP() if(SP_UNLIKELY(step)) goto step_done
+#else
+#define CHECK_STEP() (void)(NULL)
+#endif /* SPARROW_NATIVE */
+
 #define DISPATCH() \
   do { \
-    op = proto->code_buf.buf[frame->pc++]; \
-    goto *jump_table[op]; \
+    ins = CODE_INS(ip); \
+    op = BCINS_OP(ins); \
+    PROFILE(); \
+    CHECK_OP(); \
+    CHECK_STEP(); \
+    goto *(ip++)->handler; \
   } while(0)
 #else
 #define DISPATCH() \
   do { \
-    op = proto->code_buf.buf[frame->pc++]; \
-    verify(op >=0 && op < SIZE_OF_BYTECODE); \
-    goto *jump_table[op]; \
+    ins = CODE_INS(ip); \
+    ++ip; \
+    op = BCINS_OP(ins); \
+    PROFILE(); \
+    CHECK_OP(); \
+    goto *dispatch_table[op]; \
   } while(0)
-#endif /* SPARROW_VM_INSTRUCTION_CHECK */
-
-  DISPATCH(); /* very first dispatch */
+#endif /* SPARROW_VM_DIRECT_THREADING */
+
+  /* very first dispatch , it always executes the instruction */
+  ins = CODE_INS(ip);
+  ++ip;
+  op = BCINS_OP(ins);
+  PROFILE();
+  CHECK_OP();
+  goto *jump_table[op];
 #else
   /* Now we do a normal for loop switch case dispatch table
    * interpreter. */
 #define CASE(X) case X:
 #define DISPATCH() break
   while(1) {
-    op = proto->code_buf.buf[frame->pc++];
+#ifdef SPARROW_NATIVE
+    if(SP_UNLIKELY(step) && step++ > 1) {
+      SAVE();
+      return 0;
+    }
+#endif /* SPARROW_NATIVE */
+    ins = CODE_INS(ip);
+    ++ip;
+    op = BCINS_OP(ins);
+    PROFILE();
     switch(op) {
 #endif /* SPARROW_VM_NO_THREADING */
 
   CASE(BC_ADDNV) {
     double ln;
     DECODE_ARG();
-    ln = proto->num_arr[opr];
-    r = top(thread,0);
+    ln = knum[opr];
+    r = TOP(0);
     if(Vis_number(&r)) {
       Vset_number(&res,ln + Vget_number(&r));
-      replace(thread,res);
+      REPLACE(res);
     } else {
       FATAL(rt,PERR_TYPE_MISMATCH,"right","number",ValueGetTypeString(r));
     }
@@ -1243,11 +2059,11 @@ static int vm_main( struct Runtime* rt , Value* ret ) {
   CASE(BC_ADDVN) {
     double rn;
     DECODE_ARG();
-    rn = proto->num_arr[opr];
-    l = top(thread,0);
+    rn = knum[opr];
+    l = TOP(0);
     if(Vis_number(&l)) {
       Vset_number(&res,Vget_number(&l)+rn);
-      replace(thread,res);
+      REPLACE(res);
     } else {
       FATAL(rt,PERR_TYPE_MISMATCH,"left","number",ValueGetTypeString(l));
     }
@@ -1255,11 +2071,13 @@ static int vm_main( struct Runtime* rt , Value* ret ) {
   }
 
   CASE(BC_ADDVV) {
-    l = left(thread);
-    r = right(thread);
+    l = LEFT();
+    r = RIGHT();
+    FEEDBACK(&l,&r);
     res = vm_addvv( rt , l , r , check );
-    pop(thread,2);
-    push(thread,res);
+    if(Vis_number(&l) && Vis_number(&r)) QUICKEN(BC_ADDNN);
+    POP(2);
+    PUSH(res);
     DISPATCH();
   }
 
@@ -1267,11 +2085,11 @@ static int vm_main( struct Runtime* rt , Value* ret ) {
     struct ObjStr* lstr;
 
     DECODE_ARG();
-    lstr = proto->str_arr[opr];
-    r = top(thread,0);
+    lstr = kstr[opr];
+    r = TOP(0);
     if(Vis_str(&r)) {
-      Vset_str(&res,ObjStrCat(thread->sparrow,lstr,Vget_str(&r)));
-      replace(thread,res);
+      CALLOUT(Vset_str(&res,ObjStrCat(thread->sparrow,lstr,Vget_str(&r))));
+      REPLACE(res);
     } else {
       FATAL(rt,PERR_TYPE_MISMATCH,"right","string",ValueGetTypeString(r));
     }
@@ -1281,11 +2099,11 @@ static int vm_main( struct Runtime* rt , Value* ret ) {
   CASE(BC_ADDVS) {
     struct ObjStr* rstr;
     DECODE_ARG();
-    rstr = proto->str_arr[opr];
-    l = top(thread,0);
+    rstr = kstr[opr];
+    l = TOP(0);
     if(Vis_str(&l)) {
-      Vset_str(&res,ObjStrCat(thread->sparrow,Vget_str(&l),rstr));
-      replace(thread,res);
+      CALLOUT(Vset_str(&res,ObjStrCat(thread->sparrow,Vget_str(&l),rstr)));
+      REPLACE(res);
     } else {
       FATAL(rt,PERR_TYPE_MISMATCH,"left","string",ValueGetTypeString(l));
     }
@@ -1295,11 +2113,11 @@ static int vm_main( struct Runtime* rt , Value* ret ) {
   CASE(BC_SUBNV) {
     double ln;
     DECODE_ARG();
-    ln = proto->num_arr[opr];
-    r = top(thread,0);
+    ln = knum[opr];
+    r = TOP(0);
     if(Vis_number(&r)) {
       Vset_number(&res,ln-Vget_number(&r));
-      replace(thread,res);
+      REPLACE(res);
     } else {
       FATAL(rt,PERR_TYPE_MISMATCH,"right","number",ValueGetTypeString(r));
     }
@@ -1309,11 +2127,11 @@ static int vm_main( struct Runtime* rt , Value* ret ) {
   CASE(BC_SUBVN) {
     double rn;
     DECODE_ARG();
-    rn = proto->num_arr[opr];
-    l = top(thread,0);
+    rn = knum[opr];
+    l = TOP(0);
     if(Vis_number(&l)) {
       Vset_number(&res,Vget_number(&l)-rn);
-      replace(thread,res);
+      REPLACE(res);
     } else {
       FATAL(rt,PERR_TYPE_MISMATCH,"left","number",ValueGetTypeString(l));
     }
@@ -1321,22 +2139,24 @@ static int vm_main( struct Runtime* rt , Value* ret ) {
   }
 
   CASE(BC_SUBVV) {
-    l = left(thread);
-    r = right(thread);
-    res = vm_subvv(rt,l,r,check);
-    pop(thread,2);
-    push(thread,res);
+    l = LEFT();
+    r = RIGHT();
+    FEEDBACK(&l,&r);
+    CALLOUT(res = vm_subvv(rt,l,r,check));
+    if(Vis_number(&l) && Vis_number(&r)) QUICKEN(BC_SUBNN);
+    POP(2);
+    PUSH(res);
     DISPATCH();
   }
 
   CASE(BC_MULNV) {
     double ln;
     DECODE_ARG();
-    ln = proto->num_arr[opr];
-    r = top(thread,0);
+    ln = knum[opr];
+    r = TOP(0);
     if(Vis_number(&r)) {
       Vset_number(&res,ln*Vget_number(&r));
-      replace(thread,res);
+      REPLACE(res);
     } else {
       FATAL(rt,PERR_TYPE_MISMATCH,"right","number",ValueGetTypeString(r));
     }
@@ -1346,11 +2166,11 @@ static int vm_main( struct Runtime* rt , Value* ret ) {
   CASE(BC_MULVN) {
     double rn;
     DECODE_ARG();
-    rn = proto->num_arr[opr];
-    l = top(thread,0);
+    rn = knum[opr];
+    l = TOP(0);
     if(Vis_number(&l)) {
       Vset_number(&res,rn*Vget_number(&l));
-      replace(thread,res);
+      REPLACE(res);
     } else {
       FATAL(rt,PERR_TYPE_MISMATCH,"left","number",ValueGetTypeString(l));
     }
@@ -1358,26 +2178,28 @@ static int vm_main( struct Runtime* rt , Value* ret ) {
   }
 
   CASE(BC_MULVV) {
-    l = left(thread);
-    r = right(thread);
-    res = vm_mulvv(rt,l,r,check);
-    pop(thread,2);
-    push(thread,res);
+    l = LEFT();
+    r = RIGHT();
+    FEEDBACK(&l,&r);
+    CALLOUT(res = vm_mulvv(rt,l,r,check));
+    if(Vis_number(&l) && Vis_number(&r)) QUICKEN(BC_MULNN);
+    POP(2);
+    PUSH(res);
     DISPATCH();
   }
 
   CASE(BC_DIVNV) {
     double ln;
     DECODE_ARG();
-    ln = proto->num_arr[opr];
-    r = top(thread,0);
+    ln = knum[opr];
+    r = TOP(0);
     if(Vis_number(&r)) {
       double rn = Vget_number(&r);
       if(rn ==0) {
         FATAL(rt,PERR_DIVIDE_ZERO);
       }
       Vset_number(&res,ln/rn);
-      replace(thread,res);
+      REPLACE(res);
     } else {
       FATAL(rt,PERR_TYPE_MISMATCH,"right","number",ValueGetTypeString(r));
     }
@@ -1387,15 +2209,15 @@ static int vm_main( struct Runtime* rt , Value* ret ) {
   CASE(BC_DIVVN) {
     double rn;
     DECODE_ARG();
-    rn = proto->num_arr[opr];
-    l = top(thread,0);
+    rn = knum[opr];
+    l = TOP(0);
     if(Vis_number(&l)) {
       double ln = Vget_number(&l);
       if(ln == 0) {
         FATAL(rt,PERR_DIVIDE_ZERO);
       }
       Vset_number(&res,ln/rn);
-      replace(thread,res);
+      REPLACE(res);
     } else {
       FATAL(rt,PERR_TYPE_MISMATCH,"left","number",ValueGetTypeString(l));
     }
@@ -1403,19 +2225,21 @@ static int vm_main( struct Runtime* rt , Value* ret ) {
   }
 
   CASE(BC_DIVVV) {
-    l = left(thread);
-    r = right(thread);
-    res = vm_divvv(rt,l,r,check);
-    pop(thread,2);
-    push(thread,res);
+    l = LEFT();
+    r = RIGHT();
+    FEEDBACK(&l,&r);
+    CALLOUT(res = vm_divvv(rt,l,r,check));
+    if(Vis_number(&l) && Vis_number(&r)) QUICKEN(BC_DIVNN);
+    POP(2);
+    PUSH(res);
     DISPATCH();
   }
 
   CASE(BC_MODVN) {
     double rn;
     DECODE_ARG();
-    rn = proto->num_arr[opr];
-    l = top(thread,0);
+    rn = knum[opr];
+    l = TOP(0);
     if(Vis_number(&l)) {
       double ln = Vget_number(&l);
       int ri , li;
@@ -1429,7 +2253,7 @@ static int vm_main( struct Runtime* rt , Value* ret ) {
         FATAL(rt,PERR_MOD_OUT_OF_RANGE,"left");
       }
       Vset_number(&res,li % ri);
-      replace(thread,res);
+      REPLACE(res);
     } else {
       FATAL(rt,PERR_TYPE_MISMATCH,"left","number",ValueGetTypeString(l));
     }
@@ -1439,8 +2263,8 @@ static int vm_main( struct Runtime* rt , Value* ret ) {
   CASE(BC_MODNV) {
     double ln;
     DECODE_ARG();
-    ln = proto->num_arr[opr];
-    r = top(thread,0);
+    ln = knum[opr];
+    r = TOP(0);
     if(Vis_number(&r)) {
       double rn = Vget_number(&r);
       int ri , li;
@@ -1454,7 +2278,7 @@ static int vm_main( struct Runtime* rt , Value* ret ) {
         FATAL(rt,PERR_MOD_OUT_OF_RANGE,"left");
       }
       Vset_number(&res,li % ri);
-      replace(thread,res);
+      REPLACE(res);
     } else {
       FATAL(rt,PERR_TYPE_MISMATCH,"left","number",ValueGetTypeString(r));
     }
@@ -1462,22 +2286,23 @@ static int vm_main( struct Runtime* rt , Value* ret ) {
   }
 
   CASE(BC_MODVV) {
-    l = left(thread);
-    r = right(thread);
-    res = vm_modvv(rt,l,r,check);
-    pop(thread,2);
-    push(thread,res);
+    l = LEFT();
+    r = RIGHT();
+    FEEDBACK(&l,&r);
+    CALLOUT(res = vm_modvv(rt,l,r,check));
+    POP(2);
+    PUSH(res);
     DISPATCH();
   }
 
   CASE(BC_POWNV) {
     double ln;
     DECODE_ARG();
-    ln = proto->num_arr[opr];
-    r = top(thread,0);
+    ln = knum[opr];
+    r = TOP(0);
     if(Vis_number(&r)) {
       Vset_number(&res,pow(ln,Vget_number(&r)));
-      replace(thread,res);
+      REPLACE(res);
     } else {
       FATAL(rt,PERR_TYPE_MISMATCH,"right","number",ValueGetTypeString(r));
     }
@@ -1487,11 +2312,11 @@ static int vm_main( struct Runtime* rt , Value* ret ) {
   CASE(BC_POWVN) {
     double rn;
     DECODE_ARG();
-    rn = proto->num_arr[opr];
-    l = top(thread,0);
+    rn = knum[opr];
+    l = TOP(0);
     if(Vis_number(&l)) {
       Vset_number(&res,pow(Vget_number(&l),rn));
-      replace(thread,res);
+      REPLACE(res);
     } else {
       FATAL(rt,PERR_TYPE_MISMATCH,"left","number",ValueGetTypeString(l));
     }
@@ -1499,52 +2324,57 @@ static int vm_main( struct Runtime* rt , Value* ret ) {
   }
 
   CASE(BC_POWVV) {
-    l = left(thread);
-    r = right(thread);
-    res = vm_powvv(rt,l,r,check);
-    pop(thread,2);
-    push(thread,res);
+    l = LEFT();
+    r = RIGHT();
+    FEEDBACK(&l,&r);
+    CALLOUT(res = vm_powvv(rt,l,r,check));
+    POP(2);
+    PUSH(res);
     DISPATCH();
   }
 
   CASE(BC_NEG) {
     double num;
-    tos = top(thread,0);
+    tos = TOP(0);
     num = ValueConvNumber(tos,&fail);
     if(fail) {
       FATAL(rt,PERR_TOS_TYPE_MISMATCH,ValueGetTypeString(tos),"number");
     } else {
       Vset_number(&res,-num);
-      replace(thread,res);
+      REPLACE(res);
     }
     DISPATCH();
   }
 
   CASE(BC_NOT) {
-    tos = top(thread,0);
-    res = vm_not(rt,tos);
-    replace(thread,res);
+    int cond;
+    tos = TOP(0);
+    TRUTHY(cond,tos);
+    Vset_boolean(&res,!cond);
+    REPLACE(res);
     DISPATCH();
   }
 
   CASE(BC_TEST) {
-    tos = top(thread,0);
-    res = vm_test(rt,tos);
-    replace(thread,res);
+    int cond;
+    tos = TOP(0);
+    TRUTHY(cond,tos);
+    Vset_boolean(&res,cond);
+    REPLACE(res);
     DISPATCH();
   }
 
   CASE(BC_LOADN) {
     DECODE_ARG();
-    Vset_number(&res,proto->num_arr[opr]);
-    push(thread,res);
+    Vset_number(&res,knum[opr]);
+    PUSH(res);
     DISPATCH();
   }
 
 #define DO(NUM) \
   CASE(BC_LOADN##NUM) { \
     Vset_number(&res,NUM); \
-    push(thread,res); \
+    PUSH(res); \
     DISPATCH(); \
   }
 
@@ -1571,7 +2401,7 @@ static int vm_main( struct Runtime* rt , Value* ret ) {
 #define DO(NUM) \
   CASE(BC_LOADNN##NUM) { \
     Vset_number(&res,-(NUM)); \
-    push(thread,res); \
+    PUSH(res); \
     DISPATCH(); \
   }
 
@@ -1594,62 +2424,62 @@ static int vm_main( struct Runtime* rt , Value* ret ) {
 
   CASE(BC_LOADS) {
     DECODE_ARG();
-    Vset_str(&res,proto->str_arr[opr]);
-    push(thread,res);
+    Vset_str(&res,kstr[opr]);
+    PUSH(res);
     DISPATCH();
   }
 
   CASE(BC_LOADV) {
     DECODE_ARG();
-    push(thread,thread->stack[frame->base_ptr+opr]);
+    PUSH(reg(opr));
     DISPATCH();
   }
 
   CASE(BC_LOADNULL) {
     Vset_null(&res);
-    push(thread,res);
+    PUSH(res);
     DISPATCH();
   }
 
   CASE(BC_LOADTRUE) {
     Vset_true(&res);
-    push(thread,res);
+    PUSH(res);
     DISPATCH();
   }
 
   CASE(BC_LOADFALSE) {
     Vset_false(&res);
-    push(thread,res);
+    PUSH(res);
     DISPATCH();
-      replace(thread,res);
+      REPLACE(res);
   }
 
   CASE(BC_MOVE) {
-    tos = top(thread,0);
+    tos = TOP(0);
     DECODE_ARG();
-    thread->stack[frame->base_ptr+opr] = tos;
-    pop(thread,1);
+    reg(opr) = tos;
+    POP(1);
     DISPATCH();
   }
 
   CASE(BC_MOVETRUE) {
     DECODE_ARG();
     Vset_true(&res);
-    thread->stack[frame->base_ptr+opr] = res;
+    reg(opr) = res;
     DISPATCH();
   }
 
   CASE(BC_MOVEFALSE) {
     DECODE_ARG();
     Vset_false(&res);
-    thread->stack[frame->base_ptr+opr] = res;
+    reg(opr) = res;
     DISPATCH();
   }
 
   CASE(BC_MOVENULL) {
     DECODE_ARG();
     Vset_null(&res);
-    thread->stack[frame->base_ptr+opr] = res;
+    reg(opr) = res;
     DISPATCH();
   }
 
@@ -1657,7 +2487,7 @@ static int vm_main( struct Runtime* rt , Value* ret ) {
   CASE(BC_MOVEN##NUM) { \
     DECODE_ARG(); \
     Vset_number(&res,NUM); \
-    thread->stack[frame->base_ptr+opr] = res; \
+    reg(opr) = res; \
     DISPATCH(); \
   }
 
@@ -1685,7 +2515,7 @@ static int vm_main( struct Runtime* rt , Value* ret ) {
   CASE(BC_MOVENN##NUM) { \
     DECODE_ARG(); \
     Vset_number(&res,-(NUM)); \
-    thread->stack[frame->base_ptr+opr] = res; \
+    reg(opr) = res; \
     DISPATCH(); \
   }
 
@@ -1709,12 +2539,12 @@ static int vm_main( struct Runtime* rt , Value* ret ) {
   CASE(BC_LTNV) {
     double ln,rn;
     DECODE_ARG();
-    ln = proto->num_arr[opr];
-    r = top(thread,0);
+    ln = knum[opr];
+    r = TOP(0);
     rn = ValueConvNumber(r,&fail);
     if(!fail) {
       Vset_boolean(&res, ln < rn);
-      replace(thread,res);
+      REPLACE(res);
     } else {
       FATAL(rt,PERR_TYPE_MISMATCH,"right","number",ValueGetTypeString(r));
     }
@@ -1724,12 +2554,12 @@ static int vm_main( struct Runtime* rt , Value* ret ) {
   CASE(BC_LTVN) {
     double rn,ln;
     DECODE_ARG();
-    rn = proto->num_arr[opr];
-    l = top(thread,0);
+    rn = knum[opr];
+    l = TOP(0);
     ln = ValueConvNumber(l,&fail);
     if(!fail) {
       Vset_boolean(&res,ln<rn);
-      replace(thread,res);
+      REPLACE(res);
     } else {
       FATAL(rt,PERR_TYPE_MISMATCH,"left","number",ValueGetTypeString(l));
     }
@@ -1739,11 +2569,11 @@ static int vm_main( struct Runtime* rt , Value* ret ) {
   CASE(BC_LTSV) {
     struct ObjStr* ls;
     DECODE_ARG();
-    ls = proto->str_arr[opr];
-    r = top(thread,0);
+    ls = kstr[opr];
+    r = TOP(0);
     if(Vis_str(&r)) {
       Vset_boolean(&res,ObjStrCmp(ls,Vget_str(&r))<0);
-      replace(thread,res);
+      REPLACE(res);
     } else {
       FATAL(rt,PERR_TYPE_MISMATCH,"right","string",ValueGetTypeString(r));
     }
@@ -1753,11 +2583,11 @@ static int vm_main( struct Runtime* rt , Value* ret ) {
   CASE(BC_LTVS) {
     struct ObjStr* rs;
     DECODE_ARG();
-    rs = proto->str_arr[opr];
-    l = top(thread,0);
+    rs = kstr[opr];
+    l = TOP(0);
     if(Vis_str(&l)) {
       Vset_boolean(&res,ObjStrCmp(rs,Vget_str(&l))<0);
-      replace(thread,res);
+      REPLACE(res);
     } else {
       FATAL(rt,PERR_TYPE_MISMATCH,"left","string",ValueGetTypeString(l));
     }
@@ -1765,23 +2595,25 @@ static int vm_main( struct Runtime* rt , Value* ret ) {
   }
 
   CASE(BC_LTVV) {
-    l = left(thread);
-    r = right(thread);
-    res = vm_ltvv(rt,l,r,check);
-    pop(thread,2);
-    push(thread,res);
+    l = LEFT();
+    r = RIGHT();
+    FEEDBACK(&l,&r);
+    CALLOUT(res = vm_ltvv(rt,l,r,check));
+    if(Vis_number(&l) && Vis_number(&r)) QUICKEN(BC_LTNN);
+    POP(2);
+    PUSH(res);
     DISPATCH();
   }
 
   CASE(BC_LENV) {
     double ln,rn;
     DECODE_ARG();
-    ln = proto->num_arr[opr];
-    r = top(thread,0);
+    ln = knum[opr];
+    r = TOP(0);
     rn = ValueConvNumber(r,&fail);
     if(!fail) {
       Vset_boolean(&res,ln <= rn);
-      replace(thread,res);
+      REPLACE(res);
     } else {
       FATAL(rt,PERR_TYPE_MISMATCH,"right","number",ValueGetTypeString(r));
     }
@@ -1791,12 +2623,12 @@ static int vm_main( struct Runtime* rt , Value* ret ) {
   CASE(BC_LEVN) {
     double rn,ln;
     DECODE_ARG();
-    rn = proto->num_arr[opr];
-    l = top(thread,0);
+    rn = knum[opr];
+    l = TOP(0);
     ln = ValueConvNumber(l,&fail);
     if(!fail) {
       Vset_boolean(&res,ln<=rn);
-      replace(thread,res);
+      REPLACE(res);
     } else {
       FATAL(rt,PERR_TYPE_MISMATCH,"left","number",ValueGetTypeString(l));
     }
@@ -1806,11 +2638,11 @@ static int vm_main( struct Runtime* rt , Value* ret ) {
   CASE(BC_LESV) {
     struct ObjStr* lstr;
     DECODE_ARG();
-    lstr = proto->str_arr[opr];
-    r = top(thread,0);
+    lstr = kstr[opr];
+    r = TOP(0);
     if(Vis_str(&r)) {
       Vset_boolean(&res,ObjStrCmp(lstr,Vget_str(&r))<=0);
-      replace(thread,res);
+      REPLACE(res);
     } else {
       FATAL(rt,PERR_TYPE_MISMATCH,"right","string",ValueGetTypeString(r));
     }
@@ -1820,11 +2652,11 @@ static int vm_main( struct Runtime* rt , Value* ret ) {
   CASE(BC_LEVS) {
     struct ObjStr* rstr;
     DECODE_ARG();
-    rstr = proto->str_arr[opr];
-    l = top(thread,0);
+    rstr = kstr[opr];
+    l = TOP(0);
     if(Vis_str(&l)) {
       Vset_boolean(&res,ObjStrCmp(Vget_str(&l),rstr)<=0);
-      replace(thread,res);
+      REPLACE(res);
     } else {
       FATAL(rt,PERR_TYPE_MISMATCH,"left","string",ValueGetTypeString(l));
     }
@@ -1832,23 +2664,25 @@ static int vm_main( struct Runtime* rt , Value* ret ) {
   }
 
   CASE(BC_LEVV) {
-    l = left(thread);
-    r = right(thread);
-    res = vm_levv(rt,l,r,check);
-    pop(thread,2);
-    push(thread,res);
+    l = LEFT();
+    r = RIGHT();
+    FEEDBACK(&l,&r);
+    CALLOUT(res = vm_levv(rt,l,r,check));
+    if(Vis_number(&l) && Vis_number(&r)) QUICKEN(BC_LENN);
+    POP(2);
+    PUSH(res);
     DISPATCH();
   }
 
   CASE(BC_GTNV) {
     double ln,rn;
     DECODE_ARG();
-    ln = proto->num_arr[opr];
-    r = top(thread,0);
+    ln = knum[opr];
+    r = TOP(0);
     rn = ValueConvNumber(r,&fail);
     if(!fail) {
       Vset_boolean(&res,ln > rn);
-      replace(thread,res);
+      REPLACE(res);
     } else {
       FATAL(rt,PERR_TYPE_MISMATCH,"right","number",ValueGetTypeString(r));
     }
@@ -1858,12 +2692,12 @@ static int vm_main( struct Runtime* rt , Value* ret ) {
   CASE(BC_GTVN) {
     double rn,ln;
     DECODE_ARG();
-    rn = proto->num_arr[opr];
-    l = top(thread,0);
+    rn = knum[opr];
+    l = TOP(0);
     ln = ValueConvNumber(l,&fail);
     if(!fail) {
       Vset_boolean(&res,ln  > rn);
-      replace(thread,res);
+      REPLACE(res);
     } else {
       FATAL(rt,PERR_TYPE_MISMATCH,"left","number",ValueGetTypeString(l));
     }
@@ -1873,11 +2707,11 @@ static int vm_main( struct Runtime* rt , Value* ret ) {
   CASE(BC_GTSV) {
     struct ObjStr* lstr;
     DECODE_ARG();
-    lstr = proto->str_arr[opr];
-    r = top(thread,0);
+    lstr = kstr[opr];
+    r = TOP(0);
     if(Vis_str(&r)) {
       Vset_boolean(&res,ObjStrCmp(lstr,Vget_str(&r))>0);
-      replace(thread,res);
+      REPLACE(res);
     } else {
       FATAL(rt,PERR_TYPE_MISMATCH,"right","string",ValueGetTypeString(r));
     }
@@ -1887,11 +2721,11 @@ static int vm_main( struct Runtime* rt , Value* ret ) {
   CASE(BC_GTVS) {
     struct ObjStr* rstr;
     DECODE_ARG();
-    rstr = proto->str_arr[opr];
-    l = top(thread,0);
+    rstr = kstr[opr];
+    l = TOP(0);
     if(Vis_str(&l)) {
       Vset_boolean(&res,ObjStrCmp(Vget_str(&l),rstr)>0);
-      replace(thread,res);
+      REPLACE(res);
     } else {
       FATAL(rt,PERR_TYPE_MISMATCH,"left","string",ValueGetTypeString(r));
     }
@@ -1899,23 +2733,25 @@ static int vm_main( struct Runtime* rt , Value* ret ) {
   }
 
   CASE(BC_GTVV) {
-    l = left(thread);
-    r = right(thread);
-    res = vm_gtvv(rt,l,r,check);
-    pop(thread,2);
-    push(thread,res);
+    l = LEFT();
+    r = RIGHT();
+    FEEDBACK(&l,&r);
+    CALLOUT(res = vm_gtvv(rt,l,r,check));
+    if(Vis_number(&l) && Vis_number(&r)) QUICKEN(BC_GTNN);
+    POP(2);
+    PUSH(res);
     DISPATCH();
   }
 
   CASE(BC_GENV) {
     double ln,rn;
     DECODE_ARG();
-    ln = proto->num_arr[opr];
-    r = top(thread,0);
+    ln = knum[opr];
+    r = TOP(0);
     rn = ValueConvNumber(r,&fail);
     if(!fail) {
       Vset_boolean(&res,ln >= rn);
-      replace(thread,res);
+      REPLACE(res);
     } else {
       FATAL(rt,PERR_TYPE_MISMATCH,"right","number",ValueGetTypeString(r));
     }
@@ -1925,12 +2761,12 @@ static int vm_main( struct Runtime* rt , Value* ret ) {
   CASE(BC_GEVN) {
     double rn,ln;
     DECODE_ARG();
-    rn = proto->num_arr[opr];
-    l = top(thread,0);
+    rn = knum[opr];
+    l = TOP(0);
     ln = ValueConvNumber(l,&fail);
     if(!fail) {
       Vset_boolean(&res,ln >= rn);
-      replace(thread,res);
+      REPLACE(res);
     } else {
       FATAL(rt,PERR_TYPE_MISMATCH,"left","number",ValueGetTypeString(l));
     }
@@ -1940,11 +2776,11 @@ static int vm_main( struct Runtime* rt , Value* ret ) {
   CASE(BC_GESV) {
     struct ObjStr* lstr;
     DECODE_ARG();
-    lstr = proto->str_arr[opr];
-    r = top(thread,0);
+    lstr = kstr[opr];
+    r = TOP(0);
     if(Vis_str(&r)) {
       Vset_boolean(&res,ObjStrCmp(lstr,Vget_str(&r))>=0);
-      replace(thread,res);
+      REPLACE(res);
     } else {
       FATAL(rt,PERR_TYPE_MISMATCH,"right","string",ValueGetTypeString(r));
     }
@@ -1954,11 +2790,11 @@ static int vm_main( struct Runtime* rt , Value* ret ) {
   CASE(BC_GEVS) {
     struct ObjStr* rstr;
     DECODE_ARG();
-    rstr = proto->str_arr[opr];
-    l = top(thread,0);
+    rstr = kstr[opr];
+    l = TOP(0);
     if(Vis_str(&l)) {
       Vset_boolean(&res,ObjStrCmp(Vget_str(&l),rstr)>=0);
-      replace(thread,res);
+      REPLACE(res);
     } else {
       FATAL(rt,PERR_TYPE_MISMATCH,"left","string",ValueGetTypeString(l));
     }
@@ -1966,23 +2802,25 @@ static int vm_main( struct Runtime* rt , Value* ret ) {
   }
 
   CASE(BC_GEVV) {
-    l = left(thread);
-    r = right(thread);
-    res = vm_gevv(rt,l,r,check);
-    pop(thread,2);
-    push(thread,res);
+    l = LEFT();
+    r = RIGHT();
+    FEEDBACK(&l,&r);
+    CALLOUT(res = vm_gevv(rt,l,r,check));
+    if(Vis_number(&l) && Vis_number(&r)) QUICKEN(BC_GENN);
+    POP(2);
+    PUSH(res);
     DISPATCH();
   }
 
   CASE(BC_EQNV) {
     double ln,rn;
     DECODE_ARG();
-    ln = proto->num_arr[opr];
-    r = top(thread,0);
+    ln = knum[opr];
+    r = TOP(0);
     rn = ValueConvNumber(r,&fail);
     if(!fail) {
       Vset_boolean(&res,ln == rn);
-      replace(thread,res);
+      REPLACE(res);
     } else {
       FATAL(rt,PERR_TYPE_MISMATCH,"right","number",ValueGetTypeString(r));
     }
@@ -1992,12 +2830,12 @@ static int vm_main( struct Runtime* rt , Value* ret ) {
   CASE(BC_EQVN) {
     double rn,ln;
     DECODE_ARG();
-    rn = proto->num_arr[opr];
-    l = top(thread,0);
+    rn = knum[opr];
+    l = TOP(0);
     ln = ValueConvNumber(l,&fail);
     if(!fail) {
       Vset_boolean(&res,ln == rn);
-      replace(thread,res);
+      REPLACE(res);
     } else {
       FATAL(rt,PERR_TYPE_MISMATCH,"left","string",ValueGetTypeString(r));
     }
@@ -2007,11 +2845,11 @@ static int vm_main( struct Runtime* rt , Value* ret ) {
   CASE(BC_EQSV) {
     struct ObjStr* lstr;
     DECODE_ARG();
-    lstr = proto->str_arr[opr];
-    r = top(thread,0);
+    lstr = kstr[opr];
+    r = TOP(0);
     if(Vis_str(&r)) {
       Vset_boolean(&res,ObjStrEqual(lstr,Vget_str(&r)));
-      replace(thread,res);
+      REPLACE(res);
     } else {
       FATAL(rt,PERR_TYPE_MISMATCH,"right","string",ValueGetTypeString(r));
     }
@@ -2021,11 +2859,11 @@ static int vm_main( struct Runtime* rt , Value* ret ) {
   CASE(BC_EQVS) {
     struct ObjStr* rstr;
     DECODE_ARG();
-    rstr = proto->str_arr[opr];
-    l = top(thread,0);
+    rstr = kstr[opr];
+    l = TOP(0);
     if(Vis_str(&l)) {
       Vset_boolean(&res,ObjStrEqual(Vget_str(&l),rstr));
-      replace(thread,res);
+      REPLACE(res);
     } else {
       FATAL(rt,PERR_TYPE_MISMATCH,"left","string",ValueGetTypeString(l));
     }
@@ -2033,45 +2871,46 @@ static int vm_main( struct Runtime* rt , Value* ret ) {
   }
 
   CASE(BC_EQVNULL) {
-    l = top(thread,0);
+    l = TOP(0);
     if(Vis_null(&l)) {
       Vset_true(&res);
     } else {
       Vset_false(&res);
     }
-    replace(thread,res);
+    REPLACE(res);
     DISPATCH();
   }
 
   CASE(BC_EQNULLV) {
-    r = top(thread,0);
+    r = TOP(0);
     if(Vis_null(&r)) {
       Vset_true(&res);
     } else {
       Vset_false(&res);
     }
-    replace(thread,res);
+    REPLACE(res);
     DISPATCH();
   }
 
   CASE(BC_EQVV) {
-    l = left(thread);
-    r = right(thread);
-    res = vm_eqvv(rt,l,r,check);
-    pop(thread,2);
-    push(thread,res);
+    l = LEFT();
+    r = RIGHT();
+    FEEDBACK(&l,&r);
+    CALLOUT(res = vm_eqvv(rt,l,r,check));
+    POP(2);
+    PUSH(res);
     DISPATCH();
   }
 
   CASE(BC_NENV) {
     double ln,rn;
     DECODE_ARG();
-    ln = proto->num_arr[opr];
-    r = top(thread,0);
+    ln = knum[opr];
+    r = TOP(0);
     rn = ValueConvNumber(r,&fail);
     if(!fail) {
       Vset_boolean(&res,ln != rn);
-      replace(thread,res);
+      REPLACE(res);
     } else {
       FATAL(rt,PERR_TYPE_MISMATCH,"right","number",ValueGetTypeString(r));
     }
@@ -2081,12 +2920,12 @@ static int vm_main( struct Runtime* rt , Value* ret ) {
   CASE(BC_NEVN) {
     double rn,ln;
     DECODE_ARG();
-    rn = proto->num_arr[opr];
-    l = top(thread,0);
+    rn = knum[opr];
+    l = TOP(0);
     ln = ValueConvNumber(l,&fail);
     if(!fail) {
       Vset_boolean(&res,ln != rn);
-      replace(thread,res);
+      REPLACE(res);
     } else {
       FATAL(rt,PERR_TYPE_MISMATCH,"left","number",ValueGetTypeString(l));
     }
@@ -2096,11 +2935,11 @@ static int vm_main( struct Runtime* rt , Value* ret ) {
   CASE(BC_NESV) {
     struct ObjStr* lstr;
     DECODE_ARG();
-    lstr = proto->str_arr[opr];
-    r = top(thread,0);
+    lstr = kstr[opr];
+    r = TOP(0);
     if(Vis_str(&r)) {
       Vset_boolean(&res,ObjStrCmp(lstr,Vget_str(&r))!=0);
-      replace(thread,res);
+      REPLACE(res);
     } else {
       FATAL(rt,PERR_TYPE_MISMATCH,"right","string",ValueGetTypeString(r));
     }
@@ -2110,11 +2949,11 @@ static int vm_main( struct Runtime* rt , Value* ret ) {
   CASE(BC_NEVS) {
     struct ObjStr* rstr;
     DECODE_ARG();
-    rstr = proto->str_arr[opr];
-    l = top(thread,0);
+    rstr = kstr[opr];
+    l = TOP(0);
     if(Vis_str(&l)) {
       Vset_boolean(&res,ObjStrCmp(Vget_str(&l),rstr)!=0);
-      replace(thread,res);
+      REPLACE(res);
     } else {
       FATAL(rt,PERR_TYPE_MISMATCH,"left","string",ValueGetTypeString(l));
     }
@@ -2122,183 +2961,592 @@ static int vm_main( struct Runtime* rt , Value* ret ) {
   }
 
   CASE(BC_NEVNULL) {
-    l = top(thread,0);
+    l = TOP(0);
     if(Vis_null(&l)) {
       Vset_false(&res);
     } else {
       Vset_true(&res);
     }
-    replace(thread,res);
+    REPLACE(res);
     DISPATCH();
   }
 
   CASE(BC_NENULLV) {
-    r = top(thread,0);
+    r = TOP(0);
     if(Vis_null(&r)) {
       Vset_false(&res);
     } else {
       Vset_true(&res);
     }
-    replace(thread,res);
+    REPLACE(res);
     DISPATCH();
   }
 
   CASE(BC_NEVV) {
-    l = left(thread);
-    r = right(thread);
-    res = vm_nevv(rt,l,r,check);
-    pop(thread,2);
-    push(thread,res);
+    l = LEFT();
+    r = RIGHT();
+    FEEDBACK(&l,&r);
+    CALLOUT(res = vm_nevv(rt,l,r,check));
+    POP(2);
+    PUSH(res);
+    DISPATCH();
+  }
+
+  /* Register instructions , operands are local variable slots of current
+   * frame. They do exactly what the LOADV/VV , LOADV/VN and MOVE sequence
+   * they replace does */
+
+#define DO(INSTR,HELPER,QUICK) \
+  CASE(BC_##INSTR##LL) { \
+    DECODE_ARG(); \
+    l = reg(BCREG2_B(opr)); \
+    r = reg(BCREG2_C(opr)); \
+    FEEDBACK(&l,&r); \
+    CALLOUT(res = HELPER(rt,l,r,check)); \
+    QUICK(INSTR##LL); \
+    PUSH(res); \
+    DISPATCH(); \
+  } \
+  CASE(BC_R##INSTR##LL) { \
+    DECODE_ARG(); \
+    l = reg(BCREG3_B(opr)); \
+    r = reg(BCREG3_C(opr)); \
+    FEEDBACK(&l,&r); \
+    CALLOUT(res = HELPER(rt,l,r,check)); \
+    QUICK(R##INSTR##LL); \
+    reg(BCREG3_A(opr)) = res; \
+    DISPATCH(); \
+  }
+
+#define QUICK(INSTR) \
+  do { \
+    if(Vis_number(&l) && Vis_number(&r)) QUICKEN(BC_##INSTR##NN); \
+  } while(0)
+
+#define NO_QUICK(INSTR) (void)(NULL)
+
+  /* BC_ADDLL , BC_RADDLL */
+  DO(ADD,vm_addvv,QUICK)
+
+  /* BC_SUBLL , BC_RSUBLL */
+  DO(SUB,vm_subvv,QUICK)
+
+  /* BC_MULLL , BC_RMULLL */
+  DO(MUL,vm_mulvv,QUICK)
+
+  /* BC_DIVLL , BC_RDIVLL */
+  DO(DIV,vm_divvv,QUICK)
+
+  /* BC_MODLL , BC_RMODLL */
+  DO(MOD,vm_modvv,NO_QUICK)
+
+  /* BC_POWLL , BC_RPOWLL */
+  DO(POW,vm_powvv,NO_QUICK)
+
+#undef DO /* DO */
+
+#define DO(INSTR,HELPER,QUICK) \
+  CASE(BC_##INSTR##LL) { \
+    DECODE_ARG(); \
+    l = reg(BCREG2_B(opr)); \
+    r = reg(BCREG2_C(opr)); \
+    FEEDBACK(&l,&r); \
+    CALLOUT(res = HELPER(rt,l,r,check)); \
+    QUICK(INSTR##LL); \
+    PUSH(res); \
+    DISPATCH(); \
+  }
+
+  /* BC_LTLL */
+  DO(LT,vm_ltvv,QUICK)
+
+  /* BC_LELL */
+  DO(LE,vm_levv,QUICK)
+
+  /* BC_GTLL */
+  DO(GT,vm_gtvv,QUICK)
+
+  /* BC_GELL */
+  DO(GE,vm_gevv,QUICK)
+
+  /* BC_EQLL */
+  DO(EQ,vm_eqvv,NO_QUICK)
+
+  /* BC_NELL */
+  DO(NE,vm_nevv,NO_QUICK)
+
+#undef DO /* DO */
+#undef NO_QUICK /* NO_QUICK */
+#undef QUICK /* QUICK */
+
+  /* Quickened instructions. The guard only checks operand types , anything
+   * else ( ie divide by zero ) goes to the generic instruction as well */
+#define NN_GUARD() (Vis_number(&l) && Vis_number(&r))
+#define NN_DIV_GUARD() (NN_GUARD() && Vget_number(&r) != 0)
+
+#define NN(OP) Vget_number(&l) OP Vget_number(&r)
+
+#define DO(INSTR,HELPER,GUARD,SET,OP) \
+  CASE(BC_##INSTR##NN) { \
+    l = LEFT(); \
+    r = RIGHT(); \
+    if(SP_LIKELY(GUARD())) { \
+      SET(&res,NN(OP)); \
+    } else { \
+      FEEDBACK(&l,&r); \
+      QUICKEN(BC_##INSTR##VV); \
+      CALLOUT(res = HELPER(rt,l,r,check)); \
+    } \
+    POP(2); \
+    PUSH(res); \
+    DISPATCH(); \
+  } \
+  CASE(BC_##INSTR##LLNN) { \
+    DECODE_ARG(); \
+    l = reg(BCREG2_B(opr)); \
+    r = reg(BCREG2_C(opr)); \
+    if(SP_LIKELY(GUARD())) { \
+      SET(&res,NN(OP)); \
+    } else { \
+      FEEDBACK(&l,&r); \
+      QUICKEN(BC_##INSTR##LL); \
+      CALLOUT(res = HELPER(rt,l,r,check)); \
+    } \
+    PUSH(res); \
+    DISPATCH(); \
+  }
+
+  /* BC_ADDNN , BC_ADDLLNN */
+  DO(ADD,vm_addvv,NN_GUARD,Vset_number,+)
+
+  /* BC_SUBNN , BC_SUBLLNN */
+  DO(SUB,vm_subvv,NN_GUARD,Vset_number,-)
+
+  /* BC_MULNN , BC_MULLLNN */
+  DO(MUL,vm_mulvv,NN_GUARD,Vset_number,*)
+
+  /* BC_DIVNN , BC_DIVLLNN */
+  DO(DIV,vm_divvv,NN_DIV_GUARD,Vset_number,/)
+
+  /* BC_LTNN , BC_LTLLNN */
+  DO(LT,vm_ltvv,NN_GUARD,Vset_boolean,<)
+
+  /* BC_LENN , BC_LELLNN */
+  DO(LE,vm_levv,NN_GUARD,Vset_boolean,<=)
+
+  /* BC_GTNN , BC_GTLLNN */
+  DO(GT,vm_gtvv,NN_GUARD,Vset_boolean,>)
+
+  /* BC_GENN , BC_GELLNN */
+  DO(GE,vm_gevv,NN_GUARD,Vset_boolean,>=)
+
+#undef DO /* DO */
+
+#define DO(INSTR,HELPER,GUARD,OP) \
+  CASE(BC_R##INSTR##LLNN) { \
+    DECODE_ARG(); \
+    l = reg(BCREG3_B(opr)); \
+    r = reg(BCREG3_C(opr)); \
+    if(SP_LIKELY(GUARD())) { \
+      Vset_number(&res,NN(OP)); \
+    } else { \
+      FEEDBACK(&l,&r); \
+      QUICKEN(BC_R##INSTR##LL); \
+      CALLOUT(res = HELPER(rt,l,r,check)); \
+    } \
+    reg(BCREG3_A(opr)) = res; \
+    DISPATCH(); \
+  }
+
+  /* BC_RADDLLNN */
+  DO(ADD,vm_addvv,NN_GUARD,+)
+
+  /* BC_RSUBLLNN */
+  DO(SUB,vm_subvv,NN_GUARD,-)
+
+  /* BC_RMULLLNN */
+  DO(MUL,vm_mulvv,NN_GUARD,*)
+
+  /* BC_RDIVLLNN */
+  DO(DIV,vm_divvv,NN_DIV_GUARD,/)
+
+#undef DO /* DO */
+#undef NN /* NN */
+#undef NN_DIV_GUARD /* NN_DIV_GUARD */
+#undef NN_GUARD /* NN_GUARD */
+
+  /* Left operand must be a number , same as the VN instructions */
+#define DO(INSTR,OP) \
+  CASE(BC_##INSTR##LN) { \
+    DECODE_ARG(); \
+    l = reg(BCREG2_B(opr)); \
+    if(Vis_number(&l)) { \
+      Vset_number(&res,Vget_number(&l) OP knum[BCREG2_C(opr)]); \
+      PUSH(res); \
+    } else { \
+      FATAL(rt,PERR_TYPE_MISMATCH,"left","number",ValueGetTypeString(l)); \
+    } \
+    DISPATCH(); \
+  } \
+  CASE(BC_R##INSTR##LN) { \
+    DECODE_ARG(); \
+    l = reg(BCREG3_B(opr)); \
+    if(Vis_number(&l)) { \
+      Vset_number(&res,Vget_number(&l) OP knum[BCREG3_C(opr)]); \
+      reg(BCREG3_A(opr)) = res; \
+    } else { \
+      FATAL(rt,PERR_TYPE_MISMATCH,"left","number",ValueGetTypeString(l)); \
+    } \
+    DISPATCH(); \
+  }
+
+  /* BC_ADDLN , BC_RADDLN */
+  DO(ADD,+)
+
+  /* BC_SUBLN , BC_RSUBLN */
+  DO(SUB,-)
+
+  /* BC_MULLN , BC_RMULLN */
+  DO(MUL,*)
+
+#undef DO /* DO */
+
+#define DO(INSTR,OP) \
+  CASE(BC_##INSTR##LN) { \
+    double ln; \
+    DECODE_ARG(); \
+    l = reg(BCREG2_B(opr)); \
+    ln = ValueConvNumber(l,&fail); \
+    if(!fail) { \
+      Vset_boolean(&res,ln OP knum[BCREG2_C(opr)]); \
+      PUSH(res); \
+    } else { \
+      FATAL(rt,PERR_TYPE_MISMATCH,"left","number",ValueGetTypeString(l)); \
+    } \
+    DISPATCH(); \
+  }
+
+  /* BC_LTLN */
+  DO(LT,<)
+
+  /* BC_LELN */
+  DO(LE,<=)
+
+  /* BC_GTLN */
+  DO(GT,>)
+
+  /* BC_GELN */
+  DO(GE,>=)
+
+  /* BC_EQLN */
+  DO(EQ,==)
+
+  /* BC_NELN */
+  DO(NE,!=)
+
+#undef DO /* DO */
+
+  /* Superinstructions */
+  CASE(BC_POPFORLOOP) {
+    int cond;
+    DECODE_ARG();
+    POP(opr);
+    FETCH_NEXT(); /* BC_FORLOOP */
+    tos = TOP(0);
+    FORLOOP_MOVE(cond,tos);
+    if(cond) {
+      DECODE_ARG();
+      JUMP(opr);
+    }
+    DISPATCH();
+  }
+
+  CASE(BC_POPFORLOOPN) {
+    int cond;
+    DECODE_ARG();
+    POP(opr);
+    FETCH_NEXT(); /* BC_FORLOOPN */
+    FORLOOPN_MOVE(cond);
+    if(cond) {
+      DECODE_ARG();
+      JUMP(opr);
+    }
+    DISPATCH();
+  }
+
+  CASE(BC_LOADVLOADV) {
+    DECODE_ARG();
+    PUSH(reg(opr));
+    FETCH_NEXT(); /* BC_LOADV */
+    DECODE_ARG();
+    PUSH(reg(opr));
+    DISPATCH();
+  }
+
+  CASE(BC_LOADVAGETS) {
+    struct InlineCache* ic;
+    DECODE_ARG();
+    tos = reg(opr);
+    FETCH_NEXT(); /* BC_AGETS */
+    DECODE_ARG();
+    ic = proto->ic_arr + opr;
+    CALLOUT(res = vm_agets_ic(rt,proto,SITE_PC(),tos,ic,kstr[ic->key],
+          check));
+    PUSH(res);
     DISPATCH();
   }
 
+  /* Compare and BC_JF , the comparison result is never materialized */
+#define JF(COND) \
+  do { \
+    FETCH_NEXT(); /* BC_JF */ \
+    if(!(COND)) { \
+      DECODE_ARG(); \
+      JUMP(opr); \
+    } \
+  } while(0)
+
+#define DO(INSTR,OP) \
+  CASE(BC_##INSTR##LNJF) { \
+    double ln; \
+    int cond; \
+    DECODE_ARG(); \
+    l = reg(BCREG2_B(opr)); \
+    ln = ValueConvNumber(l,&fail); \
+    if(fail) { \
+      FATAL(rt,PERR_TYPE_MISMATCH,"left","number",ValueGetTypeString(l)); \
+    } \
+    cond = ln OP knum[BCREG2_C(opr)]; \
+    JF(cond); \
+    DISPATCH(); \
+  }
+
+  /* BC_LTLNJF */
+  DO(LT,<)
+
+  /* BC_LELNJF */
+  DO(LE,<=)
+
+  /* BC_GTLNJF */
+  DO(GT,>)
+
+  /* BC_GELNJF */
+  DO(GE,>=)
+
+  /* BC_EQLNJF */
+  DO(EQ,==)
+
+  /* BC_NELNJF */
+  DO(NE,!=)
+
+#undef DO /* DO */
+
+#define DO(INSTR,HELPER,OP) \
+  CASE(BC_##INSTR##LLJF) { \
+    int cond; \
+    DECODE_ARG(); \
+    l = reg(BCREG2_B(opr)); \
+    r = reg(BCREG2_C(opr)); \
+    if(SP_LIKELY(Vis_number(&l) && Vis_number(&r))) { \
+      cond = Vget_number(&l) OP Vget_number(&r); \
+    } else { \
+      FEEDBACK(&l,&r); \
+      CALLOUT(res = HELPER(rt,l,r,check)); \
+      TRUTHY(cond,res); \
+    } \
+    JF(cond); \
+    DISPATCH(); \
+  }
+
+  /* BC_LTLLJF */
+  DO(LT,vm_ltvv,<)
+
+  /* BC_LELLJF */
+  DO(LE,vm_levv,<=)
+
+  /* BC_GTLLJF */
+  DO(GT,vm_gtvv,>)
+
+  /* BC_GELLJF */
+  DO(GE,vm_gevv,>=)
+
+  /* BC_EQLLJF */
+  DO(EQ,vm_eqvv,==)
+
+  /* BC_NELLJF */
+  DO(NE,vm_nevv,!=)
+
+#undef DO /* DO */
+#undef JF /* JF */
+
   CASE(BC_JMP) {
     DECODE_ARG();
-    frame->pc = opr;
+    JUMP(opr);
     DISPATCH();
   }
 
   CASE(BC_JT) {
+    int cond;
     DECODE_ARG();
-    tos = top(thread,0);
-    if(ValueToBoolean(rt,tos)) {
-      frame->pc = opr;
+    tos = TOP(0);
+    TRUTHY(cond,tos);
+    if(cond) {
+      JUMP(opr);
     }
-    pop(thread,1);
+    POP(1);
     DISPATCH();
   }
 
   CASE(BC_JF) {
+    int cond;
     DECODE_ARG();
-    tos = top(thread,0);
-    if(!ValueToBoolean(rt,tos)) {
-      frame->pc = opr;
+    tos = TOP(0);
+    TRUTHY(cond,tos);
+    if(!cond) {
+      JUMP(opr);
     }
-    pop(thread,1);
+    POP(1);
     DISPATCH();
   }
 
   CASE(BC_BRT) {
-    tos = top(thread,0);
-    if(ValueToBoolean(rt,tos)) {
+    int cond;
+    tos = TOP(0);
+    TRUTHY(cond,tos);
+    if(cond) {
       /* We replace the TOS value and convert it to boolean
        * this save us a test instruction when do code gen */
       Vset_true(&tos);
-      replace(thread,tos);
+      REPLACE(tos);
       DECODE_ARG();
-      frame->pc = opr;
+      JUMP(opr);
     } else {
-      SKIP_ARG(); /* Skip the argument */
-      pop(thread,1);
+      POP(1);
     }
     DISPATCH();
   }
 
   CASE(BC_BRF) {
-    tos = top(thread,0);
-    if(!ValueToBoolean(rt,tos)) {
+    int cond;
+    tos = TOP(0);
+    TRUTHY(cond,tos);
+    if(!cond) {
       Vset_false(&tos);
-      replace(thread,tos);
+      REPLACE(tos);
       DECODE_ARG();
-      frame->pc = opr;
+      JUMP(opr);
     } else {
-      SKIP_ARG(); /* Skip the argument */
-      pop(thread,1);
+      POP(1);
     }
     DISPATCH();
   }
 
   CASE(BC_NEWL0) {
-    Vset_list(&res,ObjNewList(thread->sparrow,0));
-    push(thread,res);
+    CALLOUT(Vset_list(&res,ObjNewList(thread->sparrow,0)));
+    PUSH(res);
     DISPATCH();
   }
 
   CASE(BC_NEWL1) {
-    res = vm_newlist(rt,1);
-    replace(thread,res);
+    CALLOUT(res = vm_newlist(rt,1));
+    REPLACE(res);
     DISPATCH();
   }
 
   CASE(BC_NEWL2) {
-    res = vm_newlist(rt,2);
-    pop(thread,2);
-    push(thread,res);
+    CALLOUT(res = vm_newlist(rt,2));
+    POP(2);
+    PUSH(res);
     DISPATCH();
   }
 
   CASE(BC_NEWL3) {
-    res = vm_newlist(rt,3);
-    pop(thread,3);
-    push(thread,res);
+    CALLOUT(res = vm_newlist(rt,3));
+    POP(3);
+    PUSH(res);
     DISPATCH();
   }
 
   CASE(BC_NEWL4) {
-    res = vm_newlist(rt,4);
-    pop(thread,4);
-    push(thread,res);
+    CALLOUT(res = vm_newlist(rt,4));
+    POP(4);
+    PUSH(res);
     DISPATCH();
   }
 
   CASE(BC_NEWL) {
     DECODE_ARG();
-    res = vm_newlist(rt,opr);
-    pop(thread,opr);
-    push(thread,res);
+    CALLOUT(res = vm_newlist(rt,opr));
+    POP(opr);
+    PUSH(res);
     DISPATCH();
   }
 
   CASE(BC_NEWM0) {
-    Vset_map(&res,ObjNewMap(thread->sparrow,0));
-    push(thread,res);
+    CALLOUT(Vset_map(&res,ObjNewMap(thread->sparrow,0)));
+    PUSH(res);
     DISPATCH();
   }
 
   CASE(BC_NEWM1) {
-    res = vm_newmap(rt,1,check);
-    pop(thread,2);
-    push(thread,res);
+    CALLOUT(res = vm_newmap(rt,1,check));
+    POP(2);
+    PUSH(res);
     DISPATCH();
   }
 
   CASE(BC_NEWM2) {
-    res = vm_newmap(rt,2,check);
-    pop(thread,4);
-    push(thread,res);
+    CALLOUT(res = vm_newmap(rt,2,check));
+    POP(4);
+    PUSH(res);
     DISPATCH();
   }
 
   CASE(BC_NEWM3) {
-    res = vm_newmap(rt,3,check);
-    pop(thread,6);
-    push(thread,res);
+    CALLOUT(res = vm_newmap(rt,3,check));
+    POP(6);
+    PUSH(res);
     DISPATCH();
   }
 
   CASE(BC_NEWM4) {
-    res = vm_newmap(rt,4,check);
-    pop(thread,8);
-    push(thread,res);
+    CALLOUT(res = vm_newmap(rt,4,check));
+    POP(8);
+    PUSH(res);
     DISPATCH();
   }
 
   CASE(BC_NEWM) {
     DECODE_ARG();
-    res = vm_newmap(rt,opr,check);
+    CALLOUT(res = vm_newmap(rt,opr,check));
     /* key and value pair, so pop opr*2 elements out */
-    pop(thread,opr*2);
-    push(thread,res);
+    POP(opr*2);
+    PUSH(res);
+    DISPATCH();
+  }
+
+  CASE(BC_NEWL0S) {
+    DECODE_ARG();
+    CALLOUT(res = vm_newscratch(rt,proto,opr,VALUE_LIST));
+    PUSH(res);
+    DISPATCH();
+  }
+
+  CASE(BC_NEWM0S) {
+    DECODE_ARG();
+    CALLOUT(res = vm_newscratch(rt,proto,opr,VALUE_MAP));
+    PUSH(res);
     DISPATCH();
   }
 
   CASE(BC_AGETS) {
-    struct ObjStr* key;
+    struct InlineCache* ic;
     DECODE_ARG();
-    tos = top(thread,0);
-    key = proto->str_arr[opr];
-    res = vm_agets(rt,tos,key,check);
-    replace(thread,res);
+    tos = TOP(0);
+    ic = proto->ic_arr + opr;
+    CALLOUT(res = vm_agets_ic(rt,proto,SITE_PC(),tos,ic,kstr[ic->key],
+          check));
+    REPLACE(res);
     DISPATCH();
   }
 
@@ -2306,30 +3554,33 @@ static int vm_main( struct Runtime* rt , Value* ret ) {
     double idx;
     size_t iidx;
     DECODE_ARG();
-    idx = proto->num_arr[opr];
-    tos = top(thread,0);
+    idx = knum[opr];
+    tos = TOP(0);
     if(ToSize(idx,&iidx)) {
       FATAL(rt,PERR_INDEX_OUT_OF_RANGE);
     }
-    res = vm_agetn(rt,tos,iidx,check);
-    replace(thread,res);
+    FEEDBACK(&tos,NULL);
+    CALLOUT(res = vm_agetn(rt,tos,iidx,check));
+    REPLACE(res);
     DISPATCH();
   }
 
   CASE(BC_AGETI) {
     DECODE_ARG();
-    tos = top(thread,0);
-    res = vm_ageti(rt,tos,opr,check);
-    replace(thread,res);
+    tos = TOP(0);
+    FEEDBACK(&tos,NULL);
+    CALLOUT(res = vm_ageti(rt,tos,opr,check));
+    REPLACE(res);
     DISPATCH();
   }
 
   CASE(BC_AGET) {
-    l = top(thread,1);
-    r = top(thread,0);
-    res = vm_aget(rt,l,r,check);
-    pop(thread,2);
-    push(thread,res);
+    l = TOP(1);
+    r = TOP(0);
+    FEEDBACK(&l,&r);
+    CALLOUT(res = vm_aget(rt,l,r,check));
+    POP(2);
+    PUSH(res);
     DISPATCH();
   }
 
@@ -2337,53 +3588,60 @@ static int vm_main( struct Runtime* rt , Value* ret ) {
     double n;
     size_t index;
     DECODE_ARG();
-    n = proto->num_arr[opr];
+    n = knum[opr];
     if(ToSize(n,&index)) {
       FATAL(rt,PERR_INDEX_OUT_OF_RANGE);
     }
-    l = top(thread,1);
-    r = top(thread,0);
-    vm_asetn(rt,l,index,r,check);
-    pop(thread,2);
+    l = TOP(1);
+    r = TOP(0);
+    FEEDBACK(&l,NULL);
+    CALLOUT(vm_asetn(rt,l,index,r,check));
+    POP(2);
     DISPATCH();
   }
 
   CASE(BC_ASETS) {
-    struct ObjStr* str;
+    struct InlineCache* ic;
     DECODE_ARG();
-    str = proto->str_arr[opr];
-    l = top(thread,1);
-    r = top(thread,0);
-    vm_asets(rt,l,str,r,check);
-    pop(thread,2);
+    ic = proto->ic_arr + opr;
+    l = TOP(1);
+    r = TOP(0);
+    CALLOUT(vm_asets_ic(rt,proto,SITE_PC(),l,ic,kstr[ic->key],r,
+          check));
+    POP(2);
     DISPATCH();
   }
 
   CASE(BC_ASET) {
-    vm_aset(rt,top(thread,2),top(thread,1),top(thread,0),check);
-    pop(thread,3);
+    l = TOP(2);
+    r = TOP(1);
+    FEEDBACK(&l,&r);
+    CALLOUT(vm_aset(rt,l,r,TOP(0),check));
+    POP(3);
     DISPATCH();
   }
 
   CASE(BC_ASETI) {
     DECODE_ARG();
-    vm_aseti(rt,top(thread,1),top(thread,0),opr,check);
-    pop(thread,2);
+    l = TOP(1);
+    FEEDBACK(&l,NULL);
+    CALLOUT(vm_aseti(rt,l,TOP(0),opr,check));
+    POP(2);
     DISPATCH();
   }
 
   CASE(BC_UGET) {
     DECODE_ARG();
     res = vm_uget(rt,opr);
-    push(thread,res);
+    PUSH(res);
     DISPATCH();
   }
 
   CASE(BC_USET) {
     DECODE_ARG();
-    tos = top(thread,0);
+    tos = TOP(0);
     vm_uset(rt,opr,tos);
-    pop(thread,1);
+    POP(1);
     DISPATCH();
   }
 
@@ -2410,7 +3668,7 @@ static int vm_main( struct Runtime* rt , Value* ret ) {
 
   CASE(BC_POP) {
     DECODE_ARG();
-    pop(thread,opr);
+    POP(opr);
     DISPATCH();
   }
 
@@ -2418,16 +3676,18 @@ static int vm_main( struct Runtime* rt , Value* ret ) {
   CASE(BC_CALL) {
     int call_type;
     DECODE_ARG();
-    tos = top(thread,opr);
+    tos = TOP(opr);
+    FEEDBACK(&tos,NULL);
+    SAVE();
     call_type = vm_call( rt , tos , opr , &res );
     switch(call_type) {
       case SPARROWFUNC:
-        frame = current_frame(RTCallThread(rt));
-        closure = frame->closure;
-        proto = closure->proto;
+        LOAD();
         break;
       case CFUNC:
-        replace(thread,res);
+        RELOAD();
+        REPLACE(res);
+        NATIVE_ENTER();
         break;
       default:
         goto fail;
@@ -2438,16 +3698,18 @@ static int vm_main( struct Runtime* rt , Value* ret ) {
 #define DO(NUM) \
   CASE(BC_CALL##NUM) { \
     int call_type; \
-    tos = top(thread,NUM); \
+    tos = TOP(NUM); \
+    FEEDBACK(&tos,NULL); \
+    SAVE(); \
     call_type = vm_call(rt,tos,NUM,&res); \
     switch(call_type) { \
       case SPARROWFUNC: \
-        frame = current_frame(RTCallThread(rt)); \
-        closure = frame->closure; \
-        proto = closure->proto; \
+        LOAD(); \
         break; \
       case CFUNC: \
-        replace(thread,res); \
+        RELOAD(); \
+        REPLACE(res); \
+        NATIVE_ENTER(); \
         break; \
       default: \
         goto fail; \
@@ -2476,21 +3738,20 @@ static int vm_main( struct Runtime* rt , Value* ret ) {
   CASE(INSTR) { \
     RETURN; \
     if(del_callframe(rt)) goto done; \
-    replace(thread,res); \
-    frame = current_frame(thread); \
-    closure = frame->closure; \
-    proto = closure->proto; \
+    LOAD(); \
+    REPLACE(res); \
+    NATIVE_ENTER(); \
     DISPATCH(); \
   }
 
   /* BC_RET */
-  DO(BC_RET,res = top(thread,0);)
+  DO(BC_RET,res = TOP(0);)
 
   /* BC_RETN */
-  DO(BC_RETN,DECODE_ARG();Vset_number(&res,proto->num_arr[opr]))
+  DO(BC_RETN,DECODE_ARG();Vset_number(&res,knum[opr]))
 
   /* BC_RETS */
-  DO(BC_RETS,DECODE_ARG();Vset_str(&res,proto->str_arr[opr]))
+  DO(BC_RETS,DECODE_ARG();Vset_str(&res,kstr[opr]))
 
   /* BC_RETT */
   DO(BC_RETT,Vset_true(&res));
@@ -2518,17 +3779,16 @@ static int vm_main( struct Runtime* rt , Value* ret ) {
     size_t i;
     DECODE_ARG();
     new_proto = thread->component->module->cls_arr[opr];
-    new_cls = ObjNewClosure(RTSparrow(rt),new_proto);
+    CALLOUT(new_cls = ObjNewClosure(RTSparrow(rt),new_proto));
     Vset_closure(&res,new_cls);
-    push(thread,res);
+    PUSH(res);
     /* Now the stack is correct, then perform upvalue updating,
      * otherwise recursive call will not be performed since the
      * tos (top of stack) is not set up to closure properly */
     for( i = 0 ; i < new_proto->uv_size ; ++i ) {
       if(new_proto->uv_arr[i].state == UPVALUE_INDEX_EMBED) {
         /* index this upvalue inside of the stack */
-        new_cls->upval[i] = thread->stack[frame->base_ptr+
-          new_proto->uv_arr[i].idx];
+        new_cls->upval[i] = reg(new_proto->uv_arr[i].idx);
       } else {
         assert(closure);
         assert(new_proto->uv_arr[i].idx < proto->uv_size);
@@ -2541,14 +3801,12 @@ static int vm_main( struct Runtime* rt , Value* ret ) {
   /* iterator */
   CASE(BC_FORPREP) {
     int invalid = 0;
-    tos = top(thread,0);
-    res = vm_forprep(rt,tos,&invalid,check);
-    replace(thread,res); /* always push iterator to stack */
+    tos = TOP(0);
+    CALLOUT(res = vm_forprep(rt,tos,&invalid,check));
+    REPLACE(res); /* always push iterator to stack */
     if(invalid) {
       DECODE_ARG();
-      frame->pc = opr;   /* jump to end of the loop body */
-    } else {
-      SKIP_ARG();
+      JUMP(opr);   /* jump to end of the loop body */
     }
     DISPATCH();
   }
@@ -2556,15 +3814,15 @@ static int vm_main( struct Runtime* rt , Value* ret ) {
   CASE(BC_IDREFK) {
     struct ObjIterator* itr;
     Value key;
-    tos = top(thread,0);
+    tos = TOP(0);
     if(Vis_iterator(&tos)) {
       itr = Vget_iterator(&tos);
-      itr->deref(thread->sparrow,itr,&key,NULL);
-      push(thread,key);
+      CALLOUT(itr->deref(thread->sparrow,itr,&key,NULL));
+      PUSH(key);
     } else {
       struct ObjLoopIterator* litr = Vget_loop_iterator(&tos);
       Vset_number(&res,litr->index);
-      push(thread,res);
+      PUSH(res);
     }
     DISPATCH();
   }
@@ -2573,90 +3831,111 @@ static int vm_main( struct Runtime* rt , Value* ret ) {
     struct ObjIterator* itr;
     Value key;
     Value val;
-    tos = top(thread,0);
+    tos = TOP(0);
     if(Vis_iterator(&tos)) {
       itr = Vget_iterator(&tos);
-      itr->deref(thread->sparrow,itr,&key,&val);
-      push(thread,key);
-      push(thread,val);
+      CALLOUT(itr->deref(thread->sparrow,itr,&key,&val));
+      PUSH(key);
+      PUSH(val);
     } else {
       struct ObjLoopIterator* litr = Vget_loop_iterator(&tos);
       Vset_number(&res,litr->index);
-      push(thread,res);
-      push(thread,res);
+      PUSH(res);
+      PUSH(res);
     }
     DISPATCH();
   }
 
   CASE(BC_FORLOOP) {
-    struct ObjIterator* itr;
-    tos = top(thread,0);
-    if(Vis_iterator(&tos)) {
-      itr = Vget_iterator(&tos);
-      itr->move(thread->sparrow,itr);
-      if(itr->has_next(thread->sparrow,itr) == 0) {
-        /* go back to the head of the loop */
-        DECODE_ARG();
-        frame->pc = opr;
-      } else {
-        SKIP_ARG();
-      }
-    } else {
-      struct ObjLoopIterator* litr = Vget_loop_iterator(&tos);
-      litr->index += litr->step; /* move */
-      if(litr->index >= litr->end) {
-        SKIP_ARG();
-      } else {
-        DECODE_ARG();
-        frame->pc = opr;
-      }
+    int cond;
+    tos = TOP(0);
+    FORLOOP_MOVE(cond,tos);
+    if(cond) {
+      /* go back to the head of the loop */
+      DECODE_ARG();
+      JUMP(opr);
+    }
+    DISPATCH();
+  }
+
+  /* numeric for loop */
+  CASE(BC_FORPREPN) {
+    int cond;
+    CALLOUT(cond = vm_forprepn(rt,sp-3,check));
+    if(!cond) {
+      DECODE_ARG();
+      JUMP(opr);
+    }
+    DISPATCH();
+  }
+
+  CASE(BC_FORPREPR) {
+    int n;
+    CALLOUT(n = vm_forprepr(rt,sp-3,check));
+    Vset_number(&res,n);
+    PUSH(res);
+    Vset_number(&res,1);
+    PUSH(res);
+    if(!n) {
+      DECODE_ARG();
+      JUMP(opr);
+    }
+    DISPATCH();
+  }
+
+  CASE(BC_FORLOOPN) {
+    int cond;
+    FORLOOPN_MOVE(cond);
+    if(cond) {
+      DECODE_ARG();
+      JUMP(opr);
     }
     DISPATCH();
   }
 
   CASE(BC_GGET) {
-    struct ObjStr* key;
+    struct GlobalCell* cell;
     DECODE_ARG();
-    key = proto->str_arr[opr];
-    res = vm_gget(rt,key,check);
-    push(thread,res);
+    cell = proto->cell_arr + opr;
+    CALLOUT(res = vm_gget(rt,cell,kstr[cell->key],check));
+    PUSH(res);
     DISPATCH();
   }
 
   CASE(BC_GSET) {
-    struct ObjStr* key;
+    struct GlobalCell* cell;
     DECODE_ARG();
-    key = proto->str_arr[opr];
-    tos = top(thread,0);
-    ObjMapPut(thread->component->env,key,tos);
-    pop(thread,1);
+    cell = proto->cell_arr + opr;
+    tos = TOP(0);
+    CALLOUT(vm_gset(rt,cell,kstr[cell->key],tos));
+    POP(1);
     DISPATCH();
   }
 
   CASE(BC_GSETTRUE) {
-    struct ObjStr* key;
+    struct GlobalCell* cell;
     DECODE_ARG();
-    key = proto->str_arr[opr];
+    cell = proto->cell_arr + opr;
     Vset_true(&res);
-    ObjMapPut(thread->component->env,key,res);
+    CALLOUT(vm_gset(rt,cell,kstr[cell->key],res));
     DISPATCH();
   }
 
   CASE(BC_GSETFALSE) {
-    struct ObjStr* key;
+    struct GlobalCell* cell;
     DECODE_ARG();
-    key = proto->str_arr[opr];
+    cell = proto->cell_arr + opr;
     Vset_false(&res);
-    ObjMapPut(thread->component->env,key,res);
+    CALLOUT(vm_gset(rt,cell,kstr[cell->key],res));
     DISPATCH();
   }
 
   CASE(BC_GSETNULL) {
-    struct ObjStr* key;
+    struct GlobalCell* cell;
     DECODE_ARG();
-    key = proto->str_arr[opr];
+    cell = proto->cell_arr + opr;
     Vset_null(&res);
-    ObjMapPut(thread->component->env,key,res);
+    CALLOUT(vm_gset(rt,cell,kstr[cell->key],res));
     DISPATCH();
   }
 
@@ -2665,7 +3944,8 @@ static int vm_main( struct Runtime* rt , Value* ret ) {
 #define DO(CALLNAME,FUNCNAME) \
   CASE(BC_ICALL_##CALLNAME) { \
     DECODE_ARG(); \
-    Vset_str(&tos,&sparrow->BuiltinFuncName_##FUNCNAME); \
+    Vset_str(&tos,IFUNC_NAME(sparrow,FUNCNAME)); \
+    SAVE(); \
     if(add_callframe(rt,opr,NULL,tos)) return -1; \
     if(global_env(rt).icall[ IFUNC_##CALLNAME ] != Builtin_##FUNCNAME) { \
       global_env(rt).icall[ IFUNC_##CALLNAME ](rt,&res,check); \
@@ -2674,7 +3954,8 @@ static int vm_main( struct Runtime* rt , Value* ret ) {
       Builtin_##FUNCNAME(rt,&res,check); \
     } \
     del_callframe(rt); \
-    push(thread,res); \
+    RELOAD(); \
+    PUSH(res); \
     DISPATCH(); \
   }
 
@@ -2756,15 +4037,18 @@ static int vm_main( struct Runtime* rt , Value* ret ) {
   /* BC_ICALL_MSEC */
   DO(MSEC,MSec)
 
-  /* Misc Labels not in used right now */
+  /* Hotness tags */
   CASE(BC_LOOP) {
-    UNIMPLEMENTED();
+    HOT();
+    DISPATCH();
   }
 
   CASE(BC_CLOSURE) {
-    UNIMPLEMENTED();
+    HOT();
+    DISPATCH();
   }
 
+  /* Misc Labels not in used right now */
   CASE(BC_OP) {
     UNIMPLEMENTED();
   }
@@ -2795,12 +4079,195 @@ done:
   *ret = res;
   return 0;
 
+#if defined(SPARROW_NATIVE) && !defined(SPARROW_VM_NO_THREADING)
+  /* The next instruction has been fetched by DISPATCH in step mode , leave it
+   * to the caller */
+step_done:
+#ifndef SPARROW_VM_DIRECT_THREADING
+  --ip;
+#endif /* SPARROW_VM_DIRECT_THREADING */
+  SAVE();
+  return 0;
+#endif /* SPARROW_NATIVE && !SPARROW_VM_NO_THREADING */
+
   /* We failed the VM execution due to some reason. The error has already
    * logged into the runtime's error string buffer */
 fail:
   return -1;
 }
 
+#ifdef SPARROW_NATIVE
+int JitStep( struct JitState* st , uint32_t pc ) {
+  struct CallThread* thread = RTCallThread(st->rt);
+  struct CallFrame* frame = current_frame(thread);
+  Value ret;
+
+  thread->stack_size = (size_t)(st->top - thread->stack);
+  frame->pc = pc;
+  if(vm_main(st->rt,&ret,1)) return -1;
+
+  /* the stack and frames may have been reallocated */
+  frame = current_frame(thread);
+  st->base = thread->stack + frame->base_ptr;
+  st->top = thread->stack + thread->stack_size;
+  st->limit = thread->stack + thread->stack_cap;
+  return (int)frame->pc;
+}
+#endif /* SPARROW_NATIVE */
+
+#ifdef SPARROW_VM_ASM
+/* Layouts the assembly relies on , see vm_asm.h */
+#define VMASM_CHECK(NAME,COND) typedef char vm_asm_check_##NAME[(COND) ? 1 : -1]
+#define VMASM_OFFSET(NAME,T,F,OFF) VMASM_CHECK(NAME,offsetof(T,F) == (OFF))
+
+VMASM_OFFSET(rt,struct VMAsmState,rt,VMASM_RT);
+VMASM_OFFSET(thread,struct VMAsmState,thread,VMASM_THREAD);
+VMASM_OFFSET(code,struct VMAsmState,code,VMASM_CODE);
+VMASM_OFFSET(ip,struct VMAsmState,ip,VMASM_IP);
+VMASM_OFFSET(base,struct VMAsmState,base,VMASM_BASE);
+VMASM_OFFSET(top,struct VMAsmState,top,VMASM_TOP);
+VMASM_OFFSET(limit,struct VMAsmState,limit,VMASM_LIMIT);
+VMASM_OFFSET(knum,struct VMAsmState,knum,VMASM_KNUM);
+VMASM_OFFSET(kstr,struct VMAsmState,kstr,VMASM_KSTR);
+VMASM_OFFSET(proto,struct VMAsmState,proto,VMASM_PROTO);
+VMASM_OFFSET(upval,struct VMAsmState,upval,VMASM_UPVAL);
+VMASM_OFFSET(ret,struct VMAsmState,ret,VMASM_RET);
+VMASM_OFFSET(table,struct VMAsmState,table,VMASM_TABLE);
+VMASM_OFFSET(th_frame,struct CallThread,frame,THREAD_FRAME);
+VMASM_OFFSET(th_frame_size,struct CallThread,frame_size,THREAD_FRAME_SIZE);
+VMASM_OFFSET(th_frame_cap,struct CallThread,frame_cap,THREAD_FRAME_CAP);
+VMASM_OFFSET(th_stack,struct CallThread,stack,THREAD_STACK);
+VMASM_OFFSET(th_stack_size,struct CallThread,stack_size,THREAD_STACK_SIZE);
+VMASM_OFFSET(fr_base_ptr,struct CallFrame,base_ptr,FRAME_BASE_PTR);
+VMASM_OFFSET(fr_pc,struct CallFrame,pc,FRAME_PC);
+VMASM_OFFSET(fr_closure,struct CallFrame,closure,FRAME_CLOSURE);
+VMASM_OFFSET(fr_narg,struct CallFrame,narg,FRAME_NARG);
+VMASM_OFFSET(fr_callable,struct CallFrame,callable,FRAME_CALLABLE);
+VMASM_OFFSET(cls_proto,struct ObjClosure,proto,CLOSURE_PROTO);
+VMASM_OFFSET(cls_upval,struct ObjClosure,upval,CLOSURE_UPVAL);
+VMASM_OFFSET(pt_code,struct ObjProto,code_buf.buf,PROTO_CODE);
+VMASM_OFFSET(pt_num_arr,struct ObjProto,num_arr,PROTO_NUM_ARR);
+VMASM_OFFSET(pt_str_arr,struct ObjProto,str_arr,PROTO_STR_ARR);
+VMASM_OFFSET(pt_ic_arr,struct ObjProto,ic_arr,PROTO_IC_ARR);
+VMASM_OFFSET(pt_jit,struct ObjProto,jit,PROTO_JIT);
+VMASM_OFFSET(pt_aot,struct ObjProto,aot,PROTO_AOT);
+VMASM_OFFSET(pt_hotness,struct ObjProto,hotness,PROTO_HOTNESS);
+VMASM_OFFSET(gc_type,struct GCRef,gtype,GC_TYPE);
+VMASM_OFFSET(list_size,struct ObjList,size,LIST_SIZE);
+VMASM_OFFSET(list_arr,struct ObjList,arr,LIST_ARR);
+VMASM_OFFSET(map_shape,struct ObjMap,shape,MAP_SHAPE);
+VMASM_OFFSET(map_slot,struct ObjMap,slot,MAP_SLOT);
+VMASM_OFFSET(map_mops,struct ObjMap,mops,MAP_MOPS);
+VMASM_OFFSET(ic_size,struct InlineCache,size,IC_SIZE_FIELD);
+VMASM_OFFSET(ic_shape,struct InlineCache,shape,IC_SHAPE);
+VMASM_OFFSET(ic_idx,struct InlineCache,idx,IC_IDX);
+VMASM_OFFSET(litr_index,struct ObjLoopIterator,index,LITR_INDEX);
+VMASM_OFFSET(litr_end,struct ObjLoopIterator,end,LITR_END);
+VMASM_OFFSET(litr_step,struct ObjLoopIterator,step,LITR_STEP);
+VMASM_CHECK(frame_size,sizeof(struct CallFrame) == FRAME_SIZE);
+VMASM_CHECK(ic_stride,sizeof(struct InlineCache) == IC_STRIDE);
+VMASM_CHECK(number,VALUE_NUMBER == VMASM_NUMBER);
+VMASM_CHECK(true,VALUE_TRUE == VMASM_TRUE);
+VMASM_CHECK(false,VALUE_FALSE == VMASM_FALSE);
+VMASM_CHECK(null,VALUE_NULL == VMASM_NULL);
+VMASM_CHECK(gcobject,VALUE_GCOBJECT == VMASM_GCOBJECT);
+VMASM_CHECK(type_list,VALUE_LIST == VMASM_TYPE_LIST);
+VMASM_CHECK(type_map,VALUE_MAP == VMASM_TYPE_MAP);
+VMASM_CHECK(type_closure,VALUE_CLOSURE == VMASM_TYPE_CLOSURE);
+VMASM_CHECK(type_litr,VALUE_LOOP_ITERATOR == VMASM_TYPE_LOOP_ITERATOR);
+
+#undef VMASM_OFFSET
+#undef VMASM_CHECK
+
+/* Handlers of vm_x64.S , they are labels rather than functions */
+extern const char VMAsm_step[];
+#define __(A) extern const char VMAsm_##A[];
+VMASM_BYTECODE(__)
+#undef __
+
+static const void* const vm_asm_table[SIZE_OF_BYTECODE] = {
+  [0 ... SIZE_OF_BYTECODE-1] = VMAsm_step,
+#define __(A) [A] = VMAsm_##A,
+  VMASM_BYTECODE(__)
+#undef __
+};
+
+/* Load the state from current frame */
+static void vm_asm_load( struct VMAsmState* st ) {
+  struct CallThread* thread = st->thread;
+  struct CallFrame* frame = current_frame(thread);
+  struct ObjClosure* closure = frame->closure;
+  st->proto = closure->proto;
+  st->code = st->proto->code_buf.buf;
+  st->ip = st->code + frame->pc;
+  st->base = thread->stack + frame->base_ptr;
+  st->top = thread->stack + thread->stack_size;
+  st->limit = thread->stack + thread->stack_cap;
+  st->knum = st->proto->num_arr;
+  st->kstr = st->proto->str_arr;
+  st->upval = closure->upval;
+}
+
+/* Write ip and top back into current frame and thread */
+static void vm_asm_save( struct VMAsmState* st ) {
+  struct CallThread* thread = st->thread;
+  current_frame(thread)->pc = (size_t)(st->ip - st->code);
+  thread->stack_size = (size_t)(st->top - thread->stack);
+}
+
+int VMAsmStep( struct VMAsmState* st ) {
+  Value ret;
+  vm_asm_save(st);
+  if(vm_main(st->rt,&ret,1)) return -1;
+  vm_asm_load(st);
+  return 0;
+}
+
+int VMAsmNative( struct VMAsmState* st ) {
+  vm_asm_save(st);
+  if(vm_native(st->rt,st->proto)) return -1;
+  vm_asm_load(st);
+  return 0;
+}
+
+int VMAsmCall( struct VMAsmState* st , uint32_t argnum ) {
+  Value res;
+  vm_asm_save(st);
+  switch(vm_call(st->rt,st->top[-1-(int)argnum],(int)argnum,&res)) {
+    case SPARROWFUNC:
+      vm_asm_load(st);
+      return 0;
+    case CFUNC:
+      vm_asm_load(st);
+      st->top[-1] = res;
+      return vm_has_native(st->proto) ? VMAsmNative(st) : 0;
+    default:
+      return -1;
+  }
+}
+#endif /* SPARROW_VM_ASM */
+
+/* Run current frame until it returns to the host , in the assembly
+ * interpreter when it is built in */
+static int vm_run( struct Runtime* rt , Value* ret ) {
+#ifdef SPARROW_VM_ASM
+  struct VMAsmState st;
+  st.rt = rt;
+  st.thread = RTCallThread(rt);
+  st.table = vm_asm_table;
+  Vset_null(&st.ret);
+  vm_asm_load(&st);
+
+  /* entry of a module has no BC_CLOSURE tag , it goes native from here */
+  if(vm_has_native(st.proto) && VMAsmNative(&st)) return -1;
+  if(VMAsmMain(&st)) return -1;
+  *ret = st.ret;
+  return 0;
+#else
+  return vm_main(rt,ret,0);
+#endif /* SPARROW_VM_ASM */
+}
+
 /* Helper function to initialize Runtime structure */
 static void runtime_init( struct Sparrow* sparrow , struct Runtime* runtime ,
     struct ObjComponent* component) {
@@ -2858,6 +4325,9 @@ int Execute( struct Sparrow* sp, struct ObjComponent* component ,
   struct ObjClosure* main_closure = NULL;
   int stat;
 
+  /* the host may have changed any env before running the component */
+  SparrowGlobalChanged(sp);
+
   /* initialize the runtime object */
   runtime_init(sp,&rt,component);
   frame = rt.cur_thread->frame;
@@ -2872,7 +4342,7 @@ int Execute( struct Sparrow* sp, struct ObjComponent* component ,
   rt.cur_thread->frame_size = 1;
 
   /* run the code */
-  stat = vm_main( &rt, ret );
+  stat = vm_run( &rt, ret );
 
   /* set error string */
   *error = rt.error;
@@ -2908,7 +4378,7 @@ int CallFunc( struct Sparrow* sparrow , Value func ,
     default:
       assert(frame->base_ptr == 0);
       frame->base_ptr = RETURN_TO_HOST;
-      rstat = vm_main(runtime,ret);
+      rstat = vm_run(runtime,ret);
       assert(frame->base_ptr == RETURN_TO_HOST);
       frame->base_ptr = 0;
       return rstat;
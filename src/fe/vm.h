@@ -111,4 +111,10 @@ int PushArg( struct Sparrow* , Value arg );
  * of PushArg */
 int CallFunc( struct Sparrow* , Value func , int argnum, Value* );
 
+#ifdef SPARROW_VM_PROFILE
+/* Dump the most frequent instructions , instruction pairs and triples
+ * dispatched by all the executions so far */
+void VMProfileDump( FILE* , size_t top );
+#endif /* SPARROW_VM_PROFILE */
+
 #endif /* VM_H_ */
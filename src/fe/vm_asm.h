@@ -0,0 +1,198 @@
+#ifndef VM_ASM_H_
+#define VM_ASM_H_
+#include "../conf.h"
+
+#ifdef SPARROW_VM_ASM
+
+/* Interpreter core written in x86-64 assembly , see vm_x64.S.
+ *
+ * It replaces vm_main when the interpreter is entered from the host , ie by
+ * Execute and CallFunc. The hot instructions are implemented in assembly
+ * directly : loads , moves , number arithmetic and comparison , branches ,
+ * AGETN on lists , AGETS through the inline cache , calls of closures ,
+ * returns , hotness tags , for loops over loop() and ASETS of values that
+ * need no write barrier. Everything else , and every fast path whose guard
+ * fails , is executed by vm_main in step mode through VMAsmStep , exactly
+ * like the JIT does it with JitStep. So both
+ * interpreters share CallThread , CallFrame , Value and the bytecode , and
+ * native code of the JIT or of the AOT compiler is entered at the same
+ * places as vm_main does it.
+ *
+ * The assembly keeps ip , the frame base , the stack top and the number table
+ * in callee saved registers. They are written back into struct VMAsmState ,
+ * and by the C helpers into the frame and thread , before any call into C.
+ *
+ * The core is opt-in , the C interpreter stays the default. `make bench_asm`
+ * runs both of them at -O2 without JIT and AOT , best of five runs on one
+ * core :
+ *
+ *                  C        assembly
+ *   numeric loop   235 ms   216 ms
+ *   fib(27) call   20 ms    11 ms
+ *   attribute      68 ms    36 ms
+ *
+ * Calls and inline cached attribute access get about twice as fast. The
+ * numeric loop does not gain reliably , the difference is below the noise
+ * between runs and earlier runs had the assembly core slower.
+ *
+ * This header is included by vm_x64.S as well , so it only has defines
+ * outside of __ASSEMBLER__. The offsets are checked against the C structures
+ * in vm.c */
+
+/* struct VMAsmState */
+#define VMASM_RT 0
+#define VMASM_THREAD 8
+#define VMASM_CODE 16
+#define VMASM_IP 24
+#define VMASM_BASE 32
+#define VMASM_TOP 40
+#define VMASM_LIMIT 48
+#define VMASM_KNUM 56
+#define VMASM_KSTR 64
+#define VMASM_PROTO 72
+#define VMASM_UPVAL 80
+#define VMASM_RET 88
+#define VMASM_TABLE 96
+
+/* Value tags and GC types , see object.h */
+#define VMASM_NUMBER 0xfff8000000000000
+#define VMASM_TRUE 0xfff9100000000000
+#define VMASM_FALSE 0xfff9200000000000
+#define VMASM_NULL 0xfff9300000000000
+#define VMASM_GCOBJECT 0xfffa000000000000
+#define VMASM_TYPE_LIST 0
+#define VMASM_TYPE_MAP 1
+#define VMASM_TYPE_CLOSURE 3
+#define VMASM_TYPE_LOOP_ITERATOR 11
+
+/* struct CallThread */
+#define THREAD_FRAME 24
+#define THREAD_FRAME_SIZE 32
+#define THREAD_FRAME_CAP 40
+#define THREAD_STACK 48
+#define THREAD_STACK_SIZE 56
+
+/* struct CallFrame */
+#define FRAME_BASE_PTR 0
+#define FRAME_PC 8
+#define FRAME_CLOSURE 16
+#define FRAME_NARG 24
+#define FRAME_CALLABLE 32
+#define FRAME_SIZE 40
+
+/* struct ObjClosure */
+#define CLOSURE_PROTO 8
+#define CLOSURE_UPVAL 16
+
+/* struct ObjProto */
+#define PROTO_CODE 16 /* code_buf.buf */
+#define PROTO_NUM_ARR 40
+#define PROTO_STR_ARR 64
+#define PROTO_IC_ARR 136
+#define PROTO_JIT 184
+#define PROTO_AOT 192
+#define PROTO_HOTNESS 208
+
+/* struct GCRef , gtype is the first byte */
+#define GC_TYPE 0
+
+/* struct ObjList */
+#define LIST_SIZE 8
+#define LIST_ARR 24
+
+/* struct ObjMap */
+#define MAP_SHAPE 40
+#define MAP_SLOT 48
+#define MAP_MOPS 56
+
+/* struct InlineCache */
+#define IC_SIZE_FIELD 4
+#define IC_SHAPE 8
+#define IC_IDX (8+8*SPARROW_IC_SIZE)
+#define IC_STRIDE (IC_IDX+((4*SPARROW_IC_SIZE+7)&~7))
+
+/* struct ObjLoopIterator */
+#define LITR_INDEX 8
+#define LITR_END 12
+#define LITR_STEP 16
+
+#ifndef __ASSEMBLER__
+#include "object.h"
+
+/* Instructions that have a handler in vm_x64.S , the others go to
+ * VMAsm_step , which executes them in vm_main */
+#define VMASM_BYTECODE(__) \
+  __(BC_LOADN) __(BC_LOADS) __(BC_LOADV) __(BC_LOADNULL) __(BC_LOADTRUE) \
+  __(BC_LOADFALSE) __(BC_LOADN0) __(BC_LOADN1) __(BC_LOADN2) __(BC_LOADN3) \
+  __(BC_LOADN4) __(BC_LOADN5) __(BC_LOADNN1) __(BC_LOADNN2) __(BC_LOADNN3) \
+  __(BC_LOADNN4) __(BC_LOADNN5) __(BC_MOVE) __(BC_MOVETRUE) \
+  __(BC_MOVEFALSE) __(BC_MOVENULL) __(BC_MOVEN0) __(BC_MOVEN1) \
+  __(BC_MOVEN2) __(BC_MOVEN3) __(BC_MOVEN4) __(BC_MOVEN5) __(BC_MOVENN1) \
+  __(BC_MOVENN2) __(BC_MOVENN3) __(BC_MOVENN4) __(BC_MOVENN5) __(BC_POP) \
+  __(BC_LOADVLOADV) __(BC_NOP) \
+  __(BC_ADDNV) __(BC_ADDVN) __(BC_SUBNV) __(BC_SUBVN) __(BC_MULNV) \
+  __(BC_MULVN) __(BC_DIVNV) __(BC_DIVVN) __(BC_MODVN) __(BC_NEG) \
+  __(BC_ADDNN) __(BC_SUBNN) __(BC_MULNN) __(BC_DIVNN) \
+  __(BC_ADDLLNN) __(BC_SUBLLNN) __(BC_MULLLNN) __(BC_DIVLLNN) \
+  __(BC_RADDLLNN) __(BC_RSUBLLNN) __(BC_RMULLLNN) __(BC_RDIVLLNN) \
+  __(BC_ADDLN) __(BC_SUBLN) __(BC_MULLN) \
+  __(BC_RADDLN) __(BC_RSUBLN) __(BC_RMULLN) \
+  __(BC_LTNV) __(BC_LTVN) __(BC_LENV) __(BC_LEVN) __(BC_GTNV) __(BC_GTVN) \
+  __(BC_GENV) __(BC_GEVN) \
+  __(BC_LTNN) __(BC_LENN) __(BC_GTNN) __(BC_GENN) \
+  __(BC_LTLLNN) __(BC_LELLNN) __(BC_GTLLNN) __(BC_GELLNN) \
+  __(BC_LTLN) __(BC_LELN) __(BC_GTLN) __(BC_GELN) __(BC_EQLN) __(BC_NELN) \
+  __(BC_LTLNJF) __(BC_LELNJF) __(BC_GTLNJF) __(BC_GELNJF) __(BC_EQLNJF) \
+  __(BC_NELNJF) __(BC_LTLLJF) __(BC_LELLJF) __(BC_GTLLJF) __(BC_GELLJF) \
+  __(BC_EQLLJF) __(BC_NELLJF) \
+  __(BC_JMP) __(BC_JT) __(BC_JF) __(BC_BRT) __(BC_BRF) __(BC_NOT) \
+  __(BC_AGETS) __(BC_ASETS) __(BC_AGETN) __(BC_LOADVAGETS) __(BC_UGET) \
+  __(BC_CALL) __(BC_CALL0) __(BC_CALL1) __(BC_CALL2) __(BC_CALL3) \
+  __(BC_CALL4) __(BC_RET) __(BC_RETN) __(BC_RETS) __(BC_RETT) __(BC_RETF) \
+  __(BC_RETN0) __(BC_RETN1) __(BC_RETNN1) __(BC_RETNULL) \
+  __(BC_LOOP) __(BC_CLOSURE) __(BC_FORLOOP) __(BC_POPFORLOOP) \
+  __(BC_IDREFK) __(BC_IDREFKV) __(BC_FORLOOPN) __(BC_POPFORLOOPN)
+
+struct Runtime;
+struct CallThread;
+
+struct VMAsmState {
+  struct Runtime* rt;
+  struct CallThread* thread;
+  const uint32_t* code; /* code of current proto */
+  const uint32_t* ip;   /* next instruction */
+  Value* base;          /* first slot of current frame */
+  Value* top;           /* first free slot of the stack */
+  Value* limit;         /* end of the stack */
+  const double* knum;
+  struct ObjStr** kstr;
+  struct ObjProto* proto;
+  Value* upval;         /* upvalues of current closure */
+  Value ret;            /* return value of the outermost frame */
+  const void* const* table; /* handler of each opcode */
+};
+
+/* Run the interpreter from the state , returns -1 if an error happened ,
+ * otherwise the result is in ret. The state is loaded from current frame by
+ * the caller , see vm_run */
+int VMAsmMain( struct VMAsmState* );
+
+/* Called by the assembly , they write the state back into current frame and
+ * thread , do their job and load the state of the frame they leave. They
+ * return -1 if an error happened */
+
+/* Execute the instruction at ip in vm_main */
+int VMAsmStep( struct VMAsmState* );
+
+/* Call anything but a closure , or a closure when the frame array is full ,
+ * argument count is the operand of the call */
+int VMAsmCall( struct VMAsmState* , uint32_t argnum );
+
+/* Run native code of current proto */
+int VMAsmNative( struct VMAsmState* );
+
+#endif /* __ASSEMBLER__ */
+
+#endif /* SPARROW_VM_ASM */
+
+#endif /* VM_ASM_H_ */
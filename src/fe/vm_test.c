@@ -203,7 +203,7 @@ static void create_list( struct Sparrow* sparrow , struct flexer* l ,
     do {
       Value element;
       create_object(sparrow,l,&element,vl);
-      ObjListPush(list,element);
+      ObjListPush(sparrow,list,element);
       if( l->token == FTK_COMMA ) {
         flexer_next(l); continue;
       } else if( l->token == FTK_RSQR ) {
@@ -232,7 +232,7 @@ static void create_map( struct Sparrow* sparrow, struct flexer* l,
       struct ObjStr* okey = ObjNewStrNoGC(sparrow,key,strlen(key));
       Value val;
       create_object(sparrow,l,&val,vl);
-      ObjMapPut(m,okey,val);
+      ObjMapPut(sparrow,m,okey,val);
       if( l->token == FTK_COMMA ) {
         flexer_next(l); continue;
       } else if( l->token == FTK_RBRA ) {
@@ -465,6 +465,35 @@ static void test_basic_arithmatic() {
   expect("return {\"a\":[1,2,3,4]};","{[%d,%d,%d,%d]}","a",1,2,3,4);
   expect("return {\"A\":{\"A\":{}}};","{{{}}}","A","A");
   expect("return {\"A\":[],\"B\":[{},{\"D\":[]}]};","{[],[{},{[]}]}","A","B","D");
+
+  /* Quickened arithmetic falls back to the generic instruction */
+  expect(STRINGIFY(
+        var add = function(a,b) { return a + b; };
+        var sadd = function(a,b) { return a[0] + b[0]; };
+        var s = 0;
+        for( i in loop(0,10,1) ) s = s + add(i,1) + sadd([i],[2]);
+        assert(add("a","b") == "ab" && sadd(["c"],["d"]) == "cd","concat");
+        assert(add(true,1) == 2,"boolean");
+        return s + add(1,2) + sadd([3],[4]);
+        ),"%d",130);
+  expect(STRINGIFY(
+        var lt = function(a,b) { return a < b; };
+        var ge = function(a,b) { return a.v >= b; };
+        var r = 0;
+        for( i in loop(0,10,1) ) {
+          if(lt(i,5)) r = r + 1;
+          var o = {"v":i};
+          if(ge(o,5)) r = r + 10;
+        }
+        assert(lt("a","b") && !ge({"v":"a"},"b"),"string");
+        return r + lt(1,2);
+        ),"%d",56);
+  expect(STRINGIFY(
+        var div = function(a,b) { return a / b; };
+        var r = 0;
+        for( i in loop(1,5,1) ) r = r + div(12,i);
+        return r + div(true,1);
+        ),"%d",26);
 }
 
 static void test_basic_comparison() {
@@ -544,6 +573,40 @@ static void test_arithmatic() {
 
   expect("a = \"Hello World\"; return a + \" \";","%s","Hello World ");
   expect("a = \"Hello \"; return \"World \"+a;","%s","World Hello ");
+
+  /* Register instructions , operands are local variables */
+  expect("var a = 2; var b = 3; return a + b;" , "%d",5);
+  expect("var a = 2; var b = 3; return a - b;" , "%d",-1);
+  expect("var a = 2; var b = 3; return a * b;" , "%d",6);
+  expect("var a = 2; var b = 4; return b / a;" , "%d",2);
+  expect("var a = 3; var b = 5; return a % b;" , "%d",3);
+  expect("var a = 2; var b = 4; return b ^ a;" , "%d",16);
+  expect("var a = 2; return a + 10;" , "%d",12);
+  expect("var a = 2; return a - 10;" , "%d",-8);
+  expect("var a = 2; return a * 10;" , "%d",20);
+  expect("var a = \"Hello \"; var b = \"World\"; return a + b;",
+      "%s","Hello World");
+  expect("var a = 2; var b = 3; var c = 0; c = a + b; return c;","%d",5);
+  expect("var a = 2; var b = 3; var c = 0; c = a - b; return c;","%d",-1);
+  expect("var a = 2; var b = 3; var c = 0; c = a * b; return c;","%d",6);
+  expect("var a = 2; var b = 4; var c = 0; c = b / a; return c;","%d",2);
+  expect("var a = 3; var b = 5; var c = 0; c = a % b; return c;","%d",3);
+  expect("var a = 2; var b = 4; var c = 0; c = b ^ a; return c;","%d",16);
+  expect("var a = 2; a = a + 1; return a;","%d",3);
+  expect("var a = 2; a = a - 1; return a;","%d",1);
+  expect("var a = 2; a = a * 5; return a;","%d",10);
+  expect("var a = 2; a = a + a; return a;","%d",4);
+  expect(STRINGIFY(
+        var s = 0;
+        var x = 0;
+        var y = 0;
+        for( i in loop(0,100,1) ) {
+          x = x + 1;
+          y = x * 2;
+          s = s + y;
+        }
+        return s;
+        ),"%d",10100);
 }
 
 static void test_comparison() {
@@ -608,6 +671,24 @@ static void test_comparison() {
   expect("a = \"abc\"; b= \"ABC\";return a != b;","true");
   expect("a = null; b= null; return a == b;","true");
   expect("a = null; b= false;return a != b;","true");
+  /* Register instructions , operands are local variables */
+  expect("var a = 10; var b = 100; return a < b;","true");
+  expect("var a = 10; var b = 100; return a <= b;","true");
+  expect("var a = 10; var b = 100; return a > b;","false");
+  expect("var a = 10; var b = 100; return a >= b;","false");
+  expect("var a = 10; var b = 100; return a == b;","false");
+  expect("var a = 10; var b = 100; return a != b;","true");
+  expect("var a = \"abc\"; var b = \"ABC\"; return a > b;","true");
+  expect("var a = null; var b = null; return a == b;","true");
+  expect("var a = null; var b = false; return a != b;","true");
+  expect("var a = true; var b = 500; return a <= b;","true");
+  expect("var a = 10; return a < 10;","false");
+  expect("var a = 10; return a <= 10;","true");
+  expect("var a = 10; return a > 9;","true");
+  expect("var a = 10; return a >= 11;","false");
+  expect("var a = 10; return a == 10;","true");
+  expect("var a = 10; return a != 10;","false");
+  expect("var a = true; return a == 1;","true");
 }
 
 static void test_logic() {
@@ -719,6 +800,48 @@ static void test_branch() {
         }
         return a * 1000;
       ),"%d",99);
+
+  /* A branch jumping over a body of several thousands instructions */
+  {
+    struct StrBuf sbuf;
+    size_t i;
+    StrBufInit(&sbuf,1024);
+    StrBufAppendStr(&sbuf,"a = 0; if(a == 0) {");
+    for( i = 0 ; i < 1000 ; ++i )
+      StrBufAppendStr(&sbuf,"a = a + 1;");
+    StrBufAppendStr(&sbuf,"} return a;");
+    StrBufPush(&sbuf,0);
+    expect(sbuf.buf,"%d",1000);
+    StrBufDestroy(&sbuf);
+  }
+
+  /* Comparison fused with BC_JF */
+  expect(STRINGIFY(
+        var f = function(a,b) {
+          var r = 0;
+          if(a < b) r = r + 1;
+          if(a <= b) r = r + 2;
+          if(a > b) r = r + 4;
+          if(a >= b) r = r + 8;
+          if(a == b) r = r + 16;
+          if(a != b) r = r + 32;
+          return r;
+        };
+        return [f(1,2),f(2,2),f("b","a"),f(true,2)];
+        ),"[%d,%d,%d,%d]",35,26,44,35);
+  expect(STRINGIFY(
+        var f = function(a) {
+          var r = 0;
+          if(a < 1) r = r + 1;
+          if(a <= 1) r = r + 2;
+          if(a > 1) r = r + 4;
+          if(a >= 1) r = r + 8;
+          if(a == 1) r = r + 16;
+          if(a != 1) r = r + 32;
+          return r;
+        };
+        return [f(0),f(1),f(2),f(true)];
+        ),"[%d,%d,%d,%d]",35,26,44,26);
 }
 
 static void test_loop() {
@@ -855,6 +978,101 @@ static void test_loop() {
         }
         return sum;
         ),"%d",17);
+
+  /* loop() and range() targets run on hidden number slots , see
+   * BC_FORPREPN , an iterator in a variable still works */
+  expect(STRINGIFY(
+        var r = [];
+        for( i in range(2,12,3) ) list.push(r,i);
+        for( i , v in range(2,12,3) ) list.push(r,v);
+        for( i , v in range(-1,-9,-2) ) list.push(r,v);
+        for( i in loop(5,0,-1) ) list.push(r,i);
+        for( i , v in loop(0,6,2) ) { i = i + 1; list.push(r,i*10+v); }
+        var l = loop(0,3,1);
+        for( i in l ) list.push(r,i);
+        for( i in range(0,1,2) ) list.push(r,i);
+        return r;
+        ),"[%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d]",
+      0,1,2,3,2,5,8,11,10,32,54,0,1,2,0);
+  expect(STRINGIFY(
+        var fs = [];
+        var s = 0;
+        for( i , v in range(10,20,5) ) {
+          if( i == 0 ) continue;
+          for( j in loop(0,100,1) ) { if( j == 3 ) break; s = s + j; }
+          list.push(fs,function() { return v; });
+        }
+        return [s,fs[0]()];
+        ),"[%d,%d]",3,15);
+
+  /* Numeric loops , they are optimized by the tier 2 JIT */
+  expect(STRINGIFY(
+        var s = 0; var x = 0; var y = 1; var m = 0; var z = 0;
+        for( i in loop(0,3000,1) ) {
+          x = x + 1;
+          y = x * 2;
+          s = s + y;
+          if(x > y) s = s - 1;
+          if(i % 3 == 0) { m = m + i % 7; } else { m = m - 1; }
+          z = z + 6 / (i + 1) - (-x);
+          if(i == 2990) break;
+        }
+        return [s,x,y,m,z > 4474587 && z < 4474588];
+        ),"[%d,%d,%d,%d,true]",8949072,2991,5982,997);
+  expect(STRINGIFY(
+        var a = 0; var b = 0; var c = 0; var d = 0; var e = 0; var f = 0;
+        var lt = 0; var le = 0; var gt = 0; var ge = 0; var eq = 0; var ne = 0;
+        for( i in loop(0,100,1) ) {
+          var h = i - 50;
+          if(h < 0) lt = lt + 1;
+          if(h <= 0) le = le + 1;
+          if(h > 0) gt = gt + 1;
+          if(h >= 0) ge = ge + 1;
+          if(h == 0) eq = eq + 1;
+          if(h != 0) ne = ne + 1;
+        }
+        return [lt,le,gt,ge,eq,ne];
+        ),"[%d,%d,%d,%d,%d,%d]",50,51,49,50,1,99);
+  /* more values than XMM registers and swaps of loop variables */
+  expect(STRINGIFY(
+        var a1 = 0; var a2 = 0; var a3 = 0; var a4 = 0; var a5 = 0;
+        var a6 = 0; var a7 = 0; var a8 = 0; var a9 = 0; var a10 = 0;
+        var a11 = 0; var a12 = 0; var a13 = 0; var a14 = 0; var a15 = 0;
+        var a16 = 0; var p = 1; var q = 2;
+        for( i in loop(0,100,1) ) {
+          a1 = a1 + i; a2 = a2 + 2*i; a3 = a3 + 3*i; a4 = a4 + 4*i;
+          a5 = a5 + 5*i; a6 = a6 + 6*i; a7 = a7 + 7*i; a8 = a8 + 8*i;
+          a9 = a9 + 9*i; a10 = a10 + 10*i; a11 = a11 + 11*i;
+          a12 = a12 + 12*i; a13 = a13 + 13*i; a14 = a14 + 14*i;
+          a15 = a15 + 15*i; a16 = a16 + 16*i;
+          var t = p; p = q; q = t;
+        }
+        return [a1+a2+a3+a4+a5+a6+a7+a8+a9+a10+a11+a12+a13+a14+a15+a16,p,q];
+        ),"[%d,%d,%d]",673200,1,2);
+  /* range() element and a break out of the region */
+  expect(STRINGIFY(
+        var s = 0; var t = 0;
+        for( i , v in range(3,300,7) ) s = s + i * v;
+        for( i in loop(0,50,3) ) { if(i > 30) break; t = t + i; }
+        return [s,t];
+        ),"[%d,%d]",181804,165);
+  /* guard failure of modulo goes back to interpreter */
+  expect(STRINGIFY(
+        var s = 0; var b = -2147483648;
+        for( i in loop(0,100,1) ) s = s + (b + i % 2) % 7;
+        return s;
+        ),"%d",-150);
+  /* a slot read as number holds a string when the loop is entered */
+  expect(STRINGIFY(
+        var r = 0; var v = 1;
+        for( j in loop(0,3,1) ) {
+          if(j == 1) v = "x"; else v = j;
+          for( i in loop(0,5,1) ) {
+            if(j != 1) r = r + v * i;
+          }
+        }
+        return r;
+        ),"%d",20);
 }
 
 static void test_attr() {
@@ -931,6 +1149,76 @@ static void test_attr() {
         m[b] = c;
         return m.Hello == c;
         ),"true");
+
+  /* Inline cache of attribute access */
+  expect(STRINGIFY(
+        var getx = function(o) { return o.x; };
+        var a = {"x":1,"y":2};
+        var b = {"y":3,"x":4};
+        var c = {"z":1,"w":2,"y":3,"x":5};
+        var sum = 0;
+        for( i in loop(0,10,1) ) sum = sum + getx(a) + getx(b) + getx(c);
+        return sum;
+        ),"%d",100);
+  expect(STRINGIFY(
+        var getk = function(o) { return o.k; };
+        var l = [{"k":1},{"a":1,"k":2},{"a":1,"b":1,"k":3},
+                 {"a":1,"b":1,"c":1,"k":4},{"a":1,"b":1,"c":1,"d":1,"k":5},
+                 {"a":1,"b":1,"c":1,"d":1,"e":1,"k":6}];
+        var sum = 0;
+        for( i in loop(0,3,1) ) { for( _,v in l ) sum = sum + getk(v); }
+        return sum;
+        ),"%d",63);
+  expect(STRINGIFY(
+        var m = {};
+        var setv = function(o,v) { o.v = v; };
+        for( i in loop(0,100,1) ) setv(m,i);
+        return m.v == 99 && size(m) == 1;
+        ),"true");
+  expect(STRINGIFY(
+        var m = {"a":1,"b":2};
+        var r = 0;
+        for( i in loop(0,3,1) ) {
+          r = r + m.b;
+          m.b = m.b + 10;
+          var k1 = to_string(i);
+          var k2 = to_string(i+10);
+          m[k1] = i;
+          m[k2] = i;
+        }
+        return r + m.b;
+        ),"%d",68);
+
+  /* Record maps and the fallback to dictionary */
+  expect(STRINGIFY(
+        var mk = function(x,y) { var o = {}; o.x = x; o.y = y; return o; };
+        var s = 0;
+        for( i in loop(0,50,1) ) {
+          var p = mk(i,2);
+          s = s + p.x * p.y;
+        }
+        return s;
+        ),"%d",2450);
+  expect(STRINGIFY(
+        var getx = function(o) { return o.x; };
+        var a = {"x":1,"y":2};
+        var b = {"x":3,"y":4};
+        var r = getx(a) + getx(b);
+        map.pop(b,"y");
+        r = r + getx(b) + getx(a);
+        b.y = 5;
+        return r + b.y + size(b) + size(a);
+        ),"%d",17);
+  expect(STRINGIFY(
+        var m = {};
+        var s = 0;
+        for( i in loop(0,40,1) ) {
+          var k = to_string(i);
+          m[k] = i;
+        }
+        for( k , v in m ) s = s + v;
+        return s + size(m) + m["39"];
+        ),"%d",859);
 }
 
 static int fib(int a) {
@@ -1372,6 +1660,294 @@ static void test_call() {
         assert(f(1,1,1,1,1,1,1) == 7,"callN");
         return true;
         ),"true");
+  /* Hot functions run in native code , they call and are called by the
+   * interpreted ones and fall back to interpreter on other types */
+  expect(STRINGIFY(
+        fib = function(n) { if(n < 2) return n; return fib(n-1) + fib(n-2); };
+        return fib(20);
+        ),"%d",6765);
+  expect(STRINGIFY(
+        var add = function(a,b) { return a + b; };
+        var s = 0;
+        for( i in loop(0,100,1) ) s = add(s,i);
+        return [add("a","b"),s,add(s,0.5) > s,add(1,2) / 0.5];
+        ),"[%s,%d,true,%d]","ab",4950,6);
+  expect(STRINGIFY(
+        var f = function(a,b) {
+          var c = a * 2 - b;
+          if(c >= 10 && c != 13) return c + 1;
+          return [c,size([a,b])];
+        };
+        var s = 0;
+        var l = null;
+        for( i in loop(0,100,1) ) {
+          var r = f(i,1);
+          if(typeof(r) == "number") s = s + r; else l = r;
+        }
+        return [s,l];
+        ),"[%d,[%d,%d]]",9856,13,2);
+  /* A function entered once gets hot in the middle of its loops */
+  expect(STRINGIFY(
+        var f = function(n) {
+          var s = 0;
+          var c = 0;
+          for( i in loop(0,n,1) ) {
+            if(i % 3 == 0) continue;
+            for( j in loop(0,4,1) ) {
+              if(j == 3) break;
+              s = s + j;
+            }
+            c = c + 1;
+            if(c == 500) break;
+          }
+          return [s,c];
+        };
+        return f(1000);
+        ),"[%d,%d]",1500,500);
+  expect(STRINGIFY(
+        var s = 0;
+        for( i in loop(0,1000,1) ) s = s + i * 2;
+        for( k in [1,2,3] ) s = s - k;
+        return s;
+        ),"%d",998997);
+}
+
+static void test_gc() {
+  /* Old containers that gets new young objects stored into them must
+   * keep them alive across minor GCs */
+  expect(STRINGIFY(
+        gc.config({"threshold":100000000});
+        var old = [];
+        var holder = {};
+        for( i in loop(0,20000,1) ) { var t = {}; }
+        for( i in loop(0,1000,1) ) {
+          list.push(old,[i]);
+          var k = to_string(i);
+          holder[k] = {"v":i};
+          for( j in loop(0,20,1) ) { var t = [j]; }
+        }
+        assert(gc.minor_generation > 0,"minor_generation");
+        for( i in loop(0,1000,1) ) {
+          var k = to_string(i);
+          assert(old[i][0] == i,"list");
+          assert(holder[k].v == i,"map");
+        }
+        gc.force();
+        for( i in loop(0,1000,1) ) {
+          var k = to_string(i);
+          assert(old[i][0] == i,"list");
+          assert(holder[k].v == i,"map");
+        }
+        return true;
+        ),"true");
+  /* Incremental major GC , values stored into marked containers must
+   * survive the ongoing GC cycle */
+  expect(STRINGIFY(
+        gc.config({"budget":4});
+        var l = [];
+        var m = {};
+        for( i in loop(0,2000,1) ) {
+          var k = to_string(i);
+          list.push(l,[i]);
+          m[k] = {"v":i};
+          l[i][0] = {"v":i};
+        }
+        assert(gc.generation > 0,"generation");
+        for( i in loop(0,2000,1) ) {
+          var k = to_string(i);
+          assert(l[i][0].v == i,"list");
+          assert(m[k].v == i,"map");
+        }
+        gc.force();
+        assert(gc.phase == 0,"phase");
+        for( i in loop(0,2000,1) ) {
+          var k = to_string(i);
+          assert(l[i][0].v == i,"list");
+          assert(m[k].v == i,"map");
+        }
+        return true;
+        ),"true");
+#ifndef SPARROW_GC_NO_SLAB
+  /* Freed slots are reused , churning objects of the same size must not
+   * keep allocating new pages */
+  expect(STRINGIFY(
+        gc.force();
+        for( i in loop(0,20000,1) ) { var t = [i]; }
+        gc.force();
+        var pages = gc.page_size;
+        assert(pages > 0,"page_size");
+        for( i in loop(0,20000,1) ) { var t = [i]; }
+        /* objects created during concurrent marking survive that cycle */
+        gc.force();
+        gc.force();
+        assert(gc.page_size <= pages,"reuse");
+        return true;
+        ),"true");
+#endif /* SPARROW_GC_NO_SLAB */
+  /* Marking uses the gray stack , deeply nested containers must not
+   * overflow the C stack */
+  expect(STRINGIFY(
+        gc.config({"threshold":100000000});
+        var l = [];
+        var m = {};
+        for( i in loop(0,100000,1) ) {
+          l = [l];
+          m = {"m":m};
+        }
+        gc.force(); gc.force();
+        for( i in loop(0,100000,1) ) {
+          l = l[0];
+          m = m.m;
+        }
+        assert(size(l) == 0,"list");
+        assert(size(m) == 0,"map");
+        return true;
+        ),"true");
+  /* Major GC is triggered by bytes , a single large list counts by its
+   * backing storage rather than as one object */
+  expect(STRINGIFY(
+        gc.config({"threshold":1000000});
+        gc.force(); gc.force();
+        var g = gc.generation;
+        var b = gc.bytes;
+        var l = [];
+        list.resize(l,2000000);
+        assert(gc.bytes - b >= 2000000*8,"bytes");
+        for( i in loop(0,10,1) ) { var t = {}; }
+        assert(gc.generation > g || gc.phase != 0,"trigger");
+        l = null;
+        gc.force(); gc.force();
+        assert(gc.bytes < b + 2000000*8,"freed");
+        return true;
+        ),"true");
+  /* String pool is weak , dynamic strings are collected once they are
+   * not referenced and the pool shrinks back */
+  expect(STRINGIFY(
+        var keep = {};
+        for( i in loop(0,100,1) ) {
+          var k = "k" + to_string(i);
+          keep[k] = i;
+        }
+        /* the first force may just finish an ongoing incremental GC */
+        gc.force(); gc.force();
+        var sz = gc.string_size;
+        for( i in loop(0,20000,1) ) {
+          var t = "tmp" + to_string(i);
+        }
+        assert(gc.string_size > sz,"grow");
+        gc.force(); gc.force();
+        assert(gc.string_size <= sz,"collect");
+        assert(gc.string_cap < 20000,"shrink");
+        for( i in loop(0,100,1) ) {
+          var k = "k" + to_string(i);
+          assert(keep[k] == i,"keep");
+        }
+        return true;
+        ),"true");
+  /* Values moved out of a container while marking is in progress must
+   * stay alive , this is what the pre-barrier of concurrent GC is for */
+  expect(STRINGIFY(
+        gc.config({"threshold":1});
+        var a = [];
+        var b = {};
+        for( i in loop(0,20000,1) ) {
+          list.push(a,[i]);
+        }
+        for( i in loop(0,20000,1) ) {
+          var k = to_string(i);
+          b[k] = a[i];
+          a[i] = null;
+        }
+        list.clear(a);
+        gc.force(); gc.force();
+        for( i in loop(0,20000,1) ) {
+          var k = to_string(i);
+          assert(b[k][0] == i,"move");
+        }
+        return true;
+        ),"true");
+  /* Empty literal that never leaves its local variable reuses a scratch
+   * object , so the loop doesn't allocate after its first iteration */
+  expect(STRINGIFY(
+        var g = 0;
+        var m = 0;
+        for( i in loop(0,10000,1) ) {
+          if(i == 1) {
+            g = gc.generation;
+            m = gc.minor_generation;
+          }
+          var u = {};
+          var l = [];
+          u.a = i;
+          u["b"] = u.a + 1;
+          assert(u.b == i+1,"scratch");
+        }
+        assert(g == gc.generation && m == gc.minor_generation,"no gc");
+        return true;
+        ),"true");
+  /* Escaped ones must still be distinct objects */
+  expect(STRINGIFY(
+        var keep = [];
+        var make = function(v) {
+          var u = {};
+          u.v = v;
+          return u;
+        };
+        var rec = function(n) {
+          var u = {};
+          u.n = n;
+          if(n > 0) rec(n-1);
+          return u.n == n;
+        };
+        for( i in loop(0,100,1) ) {
+          var u = {};
+          u.v = i;
+          list.push(keep,u);
+          var l = [];
+          var f = function() { return l; };
+          list.push(keep,f);
+        }
+        assert(keep[0].v == 0 && keep[198].v == 99,"store");
+        list.push(keep[1](),1);
+        assert(size(keep[1]()) == 1 && size(keep[3]()) == 0,"upvalue");
+        var a = make(1);
+        var b = make(2);
+        assert(a.v == 1 && b.v == 2,"return");
+        assert(rec(10),"recursion");
+        return true;
+        ),"true");
+  /* Heap statistics */
+  expect(STRINGIFY(
+        var l = [];
+        for( i in loop(0,100,1) ) {
+          list.push(l,[i]);
+        }
+        var s = gc.stat();
+        assert(s.types.list.count >= 101,"count");
+        assert(s.types.list.bytes >= s.types.list.count * 16,"bytes");
+        gc.force();
+        s = gc.stat();
+        assert(size(s.history) > 0 && s.history[0].major,"history");
+        assert(s.history[0].mark >= 0 && s.history[0].sweep >= 0,"time");
+        var n = 0;
+        for( _ , c in s.major_mark_hist ) {
+          n = n + c;
+        }
+        assert(n == s.generation,"histogram");
+        return true;
+        ),"true");
+  /* Heap snapshot */
+  expect(STRINGIFY(
+        var l = [];
+        for( i in loop(0,100,1) ) {
+          list.push(l,{"v":[i]});
+        }
+        assert(gc.dump("/tmp/sparrow-heap-test.bin"),"dump");
+        gc.force();
+        assert(gc.dump("/tmp/sparrow-heap-test.bin"),"dump");
+        assert(!gc.dump("/nonexistent/sparrow-heap.bin"),"bad path");
+        return l[99].v[0] == 99;
+        ),"true");
 }
 
 static void test_gvar() {
@@ -1452,6 +2028,193 @@ static void test_gvar() {
         assert(string.empty(""),"string.empty");
         return true;
         ),"true");
+  /* Global variable cells */
+  expect(STRINGIFY(
+        var h = function() { return typeof(list); };
+        var r = h() == "__list__";
+        list = 3;
+        return r && h() == "number" && list == 3;
+        ),"true");
+  expect(STRINGIFY(
+        var f = function() { return g; };
+        var s = 0;
+        g = 0;
+        for( i in loop(0,100,1) ) {
+          g = g + i;
+          s = s + f();
+        }
+        return s + g;
+        ),"%d",171600);
+  expect(STRINGIFY(
+        var f = function() { return g; };
+        g = 1;
+        var s = f();
+        g0 = 0; g1 = 1; g2 = 2; g3 = 3; g4 = 4; g5 = 5; g6 = 6; g7 = 7;
+        g8 = 8; g9 = 9; g10 = 10; g11 = 11; g12 = 12; g13 = 13;
+        g14 = 14; g15 = 15; g16 = 16; g17 = 17; g18 = 18; g19 = 19;
+        g = g + g19;
+        return s + f() + g0 + g16;
+        ),"%d",37);
+}
+
+/* Find a feedback slot of the module whose slow path is taken */
+static const struct FeedbackSlot* find_feedback( struct ObjModule* mod ,
+    uint32_t kind , uint32_t type ) {
+  size_t i , j;
+  for( i = 0 ; i < mod->cls_size ; ++i ) {
+    struct ObjProto* proto = mod->cls_arr[i];
+    for( j = 0 ; j < proto->fb_size ; ++j ) {
+      const struct FeedbackSlot* slot = proto->fb_arr + j;
+      if(slot->kind == kind && slot->count && (slot->type[0] & type))
+        return slot;
+    }
+  }
+  return NULL;
+}
+
+static void test_feedback() {
+  struct Sparrow sparrow;
+  struct CStr err;
+  struct ObjModule* mod;
+  struct ObjComponent* comp;
+  const struct FeedbackSlot* slot;
+  Value ret;
+  SparrowInit(&sparrow);
+  mod = Parse(&sparrow,"test",STRINGIFY(
+        var plus = function(a,b) { return a+b; };
+        var px = function(o) { return o.x; };
+        var s = 0;
+        for( i in loop(0,200,1) ) {
+          s = s + plus(i,1);
+          plus("a","b");
+          s = s + px({"x":1}) + px({"a":1,"x":1}) + px({"b":1,"x":1});
+          s = s + px({"c":1,"x":1}) + px({"d":1,"x":1});
+          s = s + px({"e":1,"x":1});
+        }
+        return s;
+        ),&err);
+  assert(mod);
+  comp = ObjNewComponentNoGC(&sparrow,mod,ObjNewMapNoGC(&sparrow,2));
+  if(Execute(&sparrow,comp,&ret,&err)) {
+    fprintf(stderr,"Execution error:%s",err.str);
+    abort();
+  }
+  assert(Vget_number(&ret) == 200*201/2 + 200*6);
+  /* the string operands always take the slow path of the add */
+  slot = find_feedback(mod,FEEDBACK_ARITH,1U<<VALUE_STRING);
+  assert(slot && (slot->type[1] & (1U<<VALUE_STRING)));
+  /* more shapes than the inline cache holds , o.x misses forever */
+  slot = find_feedback(mod,FEEDBACK_ATTR,1U<<VALUE_MAP);
+  assert(slot && slot->target_size == FEEDBACK_MEGAMORPHIC);
+  SparrowDestroy(&sparrow);
+  ++COUNT;
+}
+
+/* Whether every callee recorded by the module's call sites is a proto of
+ * the module , return the number of callees */
+static size_t feedback_callee_local( struct ObjModule* mod ) {
+  size_t i , j , k , l;
+  size_t n = 0;
+  for( i = 0 ; i < mod->cls_size ; ++i ) {
+    struct ObjProto* proto = mod->cls_arr[i];
+    for( j = 0 ; j < proto->fb_size ; ++j ) {
+      const struct FeedbackSlot* slot = proto->fb_arr + j;
+      if(slot->kind != FEEDBACK_CALL ||
+         slot->target_size == FEEDBACK_MEGAMORPHIC) continue;
+      for( k = 0 ; k < slot->target_size ; ++k ) {
+        for( l = 0 ; l < mod->cls_size ; ++l ) {
+          if(mod->cls_arr[l] == slot->target[k]) break;
+        }
+        assert(l < mod->cls_size);
+        ++n;
+      }
+    }
+  }
+  return n;
+}
+
+static void test_feedback_gc() {
+  struct Sparrow sparrow;
+  struct CStr err;
+  struct ObjModule* mod;
+  struct ObjComponent* comp;
+  Value ret;
+  SparrowInit(&sparrow);
+  /* the callee of run_string is dead after tmp returns , GC must drop it
+   * from the feedback of call. A concurrent major GC may be in flight and
+   * keep it as floating garbage , the second gc.force sees it dead */
+  mod = Parse(&sparrow,"test",STRINGIFY(
+        var call = function(f) { return f(); };
+        var g = function() { return 2; };
+        var s = 0;
+        for( i in loop(0,200,1) ) {
+          s = s + call(g);
+        }
+        var tmp = function() {
+          return call(run_string("return function() { return 1; };"));
+        };
+        s = s + tmp();
+        gc.force();
+        gc.force();
+        return s;
+        ),&err);
+  assert(mod);
+  comp = ObjNewComponentNoGC(&sparrow,mod,ObjNewMapNoGC(&sparrow,2));
+  if(Execute(&sparrow,comp,&ret,&err)) {
+    fprintf(stderr,"Execution error:%s",err.str);
+    abort();
+  }
+  assert(Vget_number(&ret) == 401);
+#ifdef SPARROW_VM_ASM
+  /* calls of the assembly core record no feedback */
+  feedback_callee_local(mod);
+#else
+  assert(feedback_callee_local(mod) > 0);
+#endif /* SPARROW_VM_ASM */
+  SparrowDestroy(&sparrow);
+  ++COUNT;
+}
+
+static void test_shape_gc() {
+  struct Sparrow sparrow;
+  struct CStr err;
+  struct ObjModule* mod;
+  struct ObjComponent* comp;
+  Value ret;
+  SparrowInit(&sparrow);
+  /* every dead map leaves two shapes whose first key is dead as well , major
+   * GC must prune them while shapes and keys of keep stay usable */
+  mod = Parse(&sparrow,"test",STRINGIFY(
+        var f = function(n) {
+          var m = {};
+          for( i in loop(0,n,1) ) { m["k" + to_string(i)] = i; }
+          return m;
+        };
+        var keep = f(4);
+        var g = function() {
+          for( i in loop(0,200,1) ) {
+            var m = {};
+            m["a" + to_string(i)] = i;
+            m.x = i;
+          }
+        };
+        g();
+        gc.force();
+        gc.force();
+        var n = f(4);
+        return keep.k3 + n.k2 + size(keep);
+        ),&err);
+  assert(mod);
+  comp = ObjNewComponentNoGC(&sparrow,mod,ObjNewMapNoGC(&sparrow,2));
+  if(Execute(&sparrow,comp,&ret,&err)) {
+    fprintf(stderr,"Execution error:%s",err.str);
+    abort();
+  }
+  assert(Vget_number(&ret) == 3 + 2 + 4);
+  /* root takes at most SPARROW_SHAPE_MAX_TRANSITION transitions */
+  assert(sparrow.shape_size < 32);
+  SparrowDestroy(&sparrow);
+  ++COUNT;
 }
 
 int main() {
@@ -1470,6 +2233,10 @@ int main() {
   test_upval();
   test_locvar();
   test_call();
+  test_gc();
+  test_feedback();
+  test_feedback_gc();
+  test_shape_gc();
   printf("\n%d tests has been performed!\n",COUNT);
   return 0;
 }
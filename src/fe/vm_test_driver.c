@@ -5,6 +5,10 @@
 #include <stdlib.h>
 #include <stdio.h>
 
+#ifndef SPARROW_VM_PROFILE_TOP
+#define SPARROW_VM_PROFILE_TOP 40
+#endif /* SPARROW_VM_PROFILE_TOP */
+
 /* This is a simple test driver that reads all the sp file in a folder
  * and then perform execution of them one by one ! It is used for testing
  * purpose */
@@ -59,18 +63,19 @@ int main( int argc , char* argv[] ) {
     closedir(d);
     SparrowDestroy(&sparrow);
     printf("%d tests performed!\n",cnt);
-    return 0;
   } else {
-    if(argc != 2) {
-      fprintf(stderr,"specify file path to run, one argument required!\n");
-      return -1;
-    } else {
+    /* each file runs in its own Sparrow instance */
+    int i;
+    for( i = 1 ; i < argc ; ++i ) {
       struct Sparrow sparrow;
       SparrowInit(&sparrow);
-      if(run_code(&sparrow,argv[1])) abort();
-      SparrowInit(&sparrow);
-      printf("finish running %s!\n",argv[1]);
-      return 0;
+      if(run_code(&sparrow,argv[i])) abort();
+      SparrowDestroy(&sparrow);
+      printf("finish running %s!\n",argv[i]);
     }
   }
+#ifdef SPARROW_VM_PROFILE
+  VMProfileDump(stderr,SPARROW_VM_PROFILE_TOP);
+#endif /* SPARROW_VM_PROFILE */
+  return 0;
 }
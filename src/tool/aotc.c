@@ -0,0 +1,78 @@
+#include "../fe/aot.h"
+#include "../fe/parser.h"
+#include <stdio.h>
+#include <string.h>
+
+/* Compile a script ahead of time into a C translation unit , see aot.h. The
+ * output defines a struct AotModule named symbol , with -main it also gets
+ * a main function running the script so it builds into a standalone program :
+ *
+ *   aotc -main script.sp script.c script
+ *   cc -Isrc script.c <runtime sources> -lm
+ *
+ * Usage : aotc [-main] input output symbol */
+
+static const char* MAIN =
+  "\nint main( void ) {\n"
+  "  struct Sparrow sparrow;\n"
+  "  struct CStr err;\n"
+  "  Value ret;\n"
+  "  int status;\n"
+  "  SparrowInit(&sparrow);\n"
+  "  status = AotExecute(&sparrow,&%s,NULL,&ret,&err);\n"
+  "  if(status) {\n"
+  "    fprintf(stderr,\"%%s\\n\",err.str);\n"
+  "    CStrDestroy(&err);\n"
+  "  }\n"
+  "  SparrowDestroy(&sparrow);\n"
+  "  return status ? 1 : 0;\n"
+  "}\n";
+
+static void usage() {
+  fprintf(stderr,"Usage : aotc [-main] input output symbol\n");
+}
+
+int main( int argc , char* argv[] ) {
+  struct Sparrow sparrow;
+  struct ObjModule* mod;
+  struct CStr err;
+  FILE* output;
+  int with_main = 0;
+  int i = 1;
+  int ret = 0;
+
+  if(argc > 1 && strcmp(argv[1],"-main") == 0) {
+    with_main = 1;
+    ++i;
+  }
+  if(argc - i != 3) {
+    usage();
+    return -1;
+  }
+
+  SparrowInit(&sparrow);
+  mod = Parse(&sparrow,argv[i],NULL,&err);
+  if(!mod) {
+    fprintf(stderr,"Cannot parse file %s due to reason %s!\n",argv[i],
+        err.str);
+    CStrDestroy(&err);
+    SparrowDestroy(&sparrow);
+    return -1;
+  }
+
+  output = fopen(argv[i+1],"w");
+  if(!output) {
+    fprintf(stderr,"Cannot open file %s!\n",argv[i+1]);
+    SparrowDestroy(&sparrow);
+    return -1;
+  }
+  if(AotEmit(mod,argv[i+2],output)) {
+    fprintf(stderr,"Cannot write file %s!\n",argv[i+1]);
+    ret = -1;
+  } else if(with_main) {
+    fprintf(output,MAIN,argv[i+2]);
+  }
+  fclose(output);
+  SparrowDestroy(&sparrow);
+  return ret;
+}
@@ -0,0 +1,414 @@
+#include "../fe/gc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Offline analyzer for the heap snapshot written by GCDumpHeap ( gc.dump
+ * in script ). It builds the object graph with a virtual root pointing to
+ * all the GC roots , computes the dominator tree and the retained size of
+ * each object , ie the bytes that would be freed if the object dies. The
+ * dominator tree is computed by the iterative algorithm of Cooper , Harvey
+ * and Kennedy over the reverse post order of the graph.
+ *
+ * Usage : heap-analyze [-n top] [-d depth] snapshot */
+
+struct Node {
+  uint64_t id;
+  uint64_t size;
+  uint64_t retain;
+  int type;
+  size_t idom;   /* immediate dominator */
+  size_t order;  /* reverse post order , SIZE_MAX means unreachable */
+};
+
+struct Edge {
+  uint64_t from;
+  uint64_t to;
+};
+
+struct Heap {
+  char type_name[SIZE_OF_VALUE_TYPE][256];
+  /* node 0 is the virtual root */
+  struct Node* node;
+  size_t node_size;
+  size_t node_cap;
+  struct Edge* edge;
+  size_t edge_size;
+  size_t edge_cap;
+  size_t root_size;
+  size_t missing; /* references to objects not in the snapshot */
+  /* successors and predecessors in compressed sparse row format */
+  size_t* succ_start;
+  size_t* succ;
+  size_t* pred_start;
+  size_t* pred;
+  size_t* rpo; /* nodes in reverse post order */
+  size_t rpo_size;
+  /* children in the dominator tree */
+  size_t* dom_start;
+  size_t* dom;
+};
+
+#define GROW(ARR,SIZE,CAP) \
+  do { \
+    if((SIZE) == (CAP)) { \
+      (CAP) = (CAP) ? (CAP) * 2 : 1024; \
+      (ARR) = realloc((ARR),(CAP)*sizeof(*(ARR))); \
+    } \
+  } while(0)
+
+static void die( const char* msg ) {
+  fprintf(stderr,"heap-analyze: %s\n",msg);
+  exit(1);
+}
+
+static uint64_t read_u64( FILE* file ) {
+  uint64_t v;
+  if(fread(&v,sizeof(v),1,file) != 1) die("truncated snapshot");
+  return v;
+}
+
+static int read_u8( FILE* file ) {
+  int c = fgetc(file);
+  if(c == EOF) die("truncated snapshot");
+  return c;
+}
+
+static void add_edge( struct Heap* heap , uint64_t from , uint64_t to ) {
+  GROW(heap->edge,heap->edge_size,heap->edge_cap);
+  heap->edge[heap->edge_size].from = from;
+  heap->edge[heap->edge_size].to = to;
+  ++heap->edge_size;
+}
+
+static void read_snapshot( struct Heap* heap , FILE* file ) {
+  char magic[STRING_SIZE(GC_DUMP_MAGIC)];
+  if(fread(magic,1,sizeof(magic),file) != sizeof(magic) ||
+     memcmp(magic,GC_DUMP_MAGIC,sizeof(magic)))
+    die("not a heap snapshot");
+  /* virtual root , id 0 is never a valid object address */
+  GROW(heap->node,heap->node_size,heap->node_cap);
+  memset(heap->node,0,sizeof(struct Node));
+  heap->node_size = 1;
+  for( ;; ) {
+    int tag = read_u8(file);
+    switch(tag) {
+      case GC_DUMP_TYPE:
+        {
+          int type = read_u8(file);
+          int len = read_u8(file);
+          if(type >= SIZE_OF_VALUE_TYPE) die("bad type");
+          if(fread(heap->type_name[type],1,len,file) != (size_t)len)
+            die("truncated snapshot");
+          heap->type_name[type][len] = 0;
+        }
+        break;
+      case GC_DUMP_NODE:
+        {
+          struct Node* n;
+          GROW(heap->node,heap->node_size,heap->node_cap);
+          n = heap->node + heap->node_size++;
+          n->id = read_u64(file);
+          n->type = read_u8(file);
+          n->size = read_u64(file);
+          if(n->type >= SIZE_OF_VALUE_TYPE) die("bad type");
+        }
+        break;
+      case GC_DUMP_EDGE:
+        {
+          uint64_t from = read_u64(file);
+          add_edge(heap,from,read_u64(file));
+        }
+        break;
+      case GC_DUMP_ROOT:
+        read_u8(file); /* kind of the root */
+        add_edge(heap,0,read_u64(file));
+        ++heap->root_size;
+        break;
+      case GC_DUMP_END:
+        return;
+      default:
+        die("bad record");
+    }
+  }
+}
+
+static int cmp_node( const void* l , const void* r ) {
+  const struct Node* ln = l;
+  const struct Node* rn = r;
+  return ln->id < rn->id ? -1 : (ln->id > rn->id);
+}
+
+/* Nodes are sorted by id , so an id can be found by binary search */
+static size_t find_node( struct Heap* heap , uint64_t id ) {
+  size_t l = 0;
+  size_t r = heap->node_size;
+  while(l < r) {
+    size_t m = l + (r-l)/2;
+    if(heap->node[m].id == id) return m;
+    if(heap->node[m].id < id) l = m+1;
+    else r = m;
+  }
+  return SIZE_MAX;
+}
+
+/* Build successors and predecessors from the edge list. Duplicated edges
+ * are kept , they don't change the dominator tree */
+static void build_graph( struct Heap* heap ) {
+  size_t i;
+  size_t n = heap->node_size;
+  size_t* from = malloc(sizeof(size_t)*(heap->edge_size+1));
+  size_t* to = malloc(sizeof(size_t)*(heap->edge_size+1));
+  size_t* pos;
+  size_t cnt = 0;
+
+  qsort(heap->node,heap->node_size,sizeof(struct Node),cmp_node);
+  for( i = 0 ; i < heap->edge_size ; ++i ) {
+    size_t f = find_node(heap,heap->edge[i].from);
+    size_t t = find_node(heap,heap->edge[i].to);
+    if(f == SIZE_MAX || t == SIZE_MAX) {
+      ++heap->missing;
+      continue;
+    }
+    from[cnt] = f;
+    to[cnt] = t;
+    ++cnt;
+  }
+
+  heap->succ_start = calloc(n+1,sizeof(size_t));
+  heap->pred_start = calloc(n+1,sizeof(size_t));
+  heap->succ = malloc(sizeof(size_t)*(cnt+1));
+  heap->pred = malloc(sizeof(size_t)*(cnt+1));
+  for( i = 0 ; i < cnt ; ++i ) {
+    ++heap->succ_start[from[i]+1];
+    ++heap->pred_start[to[i]+1];
+  }
+  for( i = 0 ; i < n ; ++i ) {
+    heap->succ_start[i+1] += heap->succ_start[i];
+    heap->pred_start[i+1] += heap->pred_start[i];
+  }
+  pos = malloc(sizeof(size_t)*(n+1));
+  memcpy(pos,heap->succ_start,sizeof(size_t)*n);
+  for( i = 0 ; i < cnt ; ++i ) heap->succ[pos[from[i]]++] = to[i];
+  memcpy(pos,heap->pred_start,sizeof(size_t)*n);
+  for( i = 0 ; i < cnt ; ++i ) heap->pred[pos[to[i]]++] = from[i];
+  free(pos);
+  free(from);
+  free(to);
+}
+
+/* Iterative depth first search from the virtual root , the object graph
+ * can be way too deep for recursion */
+static void build_order( struct Heap* heap ) {
+  size_t n = heap->node_size;
+  size_t* stack = malloc(sizeof(size_t)*n);
+  size_t* next = malloc(sizeof(size_t)*n);
+  size_t* post = malloc(sizeof(size_t)*n);
+  size_t sp = 0;
+  size_t cnt = 0;
+  size_t i;
+
+  for( i = 0 ; i < n ; ++i ) heap->node[i].order = SIZE_MAX;
+  stack[sp++] = 0;
+  next[0] = heap->succ_start[0];
+  heap->node[0].order = 0; /* visited */
+  while(sp) {
+    size_t v = stack[sp-1];
+    if(next[v] < heap->succ_start[v+1]) {
+      size_t w = heap->succ[next[v]++];
+      if(heap->node[w].order == SIZE_MAX) {
+        heap->node[w].order = 0;
+        next[w] = heap->succ_start[w];
+        stack[sp++] = w;
+      }
+    } else {
+      post[cnt++] = v;
+      --sp;
+    }
+  }
+  heap->rpo = malloc(sizeof(size_t)*(cnt+1));
+  heap->rpo_size = cnt;
+  for( i = 0 ; i < cnt ; ++i ) {
+    heap->rpo[i] = post[cnt-1-i];
+    heap->node[heap->rpo[i]].order = i;
+  }
+  free(stack);
+  free(next);
+  free(post);
+}
+
+static size_t intersect( struct Heap* heap , size_t a , size_t b ) {
+  while(a != b) {
+    while(heap->node[a].order > heap->node[b].order) a = heap->node[a].idom;
+    while(heap->node[b].order > heap->node[a].order) b = heap->node[b].idom;
+  }
+  return a;
+}
+
+static void build_dominator( struct Heap* heap ) {
+  int changed = 1;
+  size_t i , j;
+  for( i = 0 ; i < heap->node_size ; ++i ) heap->node[i].idom = SIZE_MAX;
+  heap->node[0].idom = 0;
+  while(changed) {
+    changed = 0;
+    for( i = 1 ; i < heap->rpo_size ; ++i ) {
+      size_t v = heap->rpo[i];
+      size_t idom = SIZE_MAX;
+      for( j = heap->pred_start[v] ; j < heap->pred_start[v+1] ; ++j ) {
+        size_t p = heap->pred[j];
+        if(heap->node[p].idom == SIZE_MAX) continue;
+        idom = idom == SIZE_MAX ? p : intersect(heap,p,idom);
+      }
+      if(heap->node[v].idom != idom) {
+        heap->node[v].idom = idom;
+        changed = 1;
+      }
+    }
+  }
+  /* a node is dominated by all its dominators , so visiting in reverse
+   * post order accumulates the children before their dominator */
+  for( i = 0 ; i < heap->node_size ; ++i )
+    heap->node[i].retain = heap->node[i].size;
+  for( i = heap->rpo_size ; i-- > 1 ; ) {
+    struct Node* n = heap->node + heap->rpo[i];
+    heap->node[n->idom].retain += n->retain;
+  }
+
+  heap->dom_start = calloc(heap->node_size+1,sizeof(size_t));
+  heap->dom = malloc(sizeof(size_t)*heap->rpo_size);
+  for( i = 1 ; i < heap->rpo_size ; ++i )
+    ++heap->dom_start[heap->node[heap->rpo[i]].idom+1];
+  for( i = 0 ; i < heap->node_size ; ++i )
+    heap->dom_start[i+1] += heap->dom_start[i];
+  for( i = 1 ; i < heap->rpo_size ; ++i ) {
+    size_t v = heap->rpo[i];
+    heap->dom[heap->dom_start[heap->node[v].idom]++] = v;
+  }
+  /* dom_start[i] is the end of node i now , shift it back */
+  for( i = heap->node_size ; i > 0 ; --i )
+    heap->dom_start[i] = heap->dom_start[i-1];
+  heap->dom_start[0] = 0;
+}
+
+static struct Heap* sort_heap = NULL;
+
+static int cmp_retain( const void* l , const void* r ) {
+  const struct Node* ln = sort_heap->node + *(const size_t*)l;
+  const struct Node* rn = sort_heap->node + *(const size_t*)r;
+  return ln->retain > rn->retain ? -1 : (ln->retain < rn->retain);
+}
+
+static void print_node( struct Heap* heap , size_t v , int depth ) {
+  const struct Node* n = heap->node + v;
+  printf("%*s",depth*2,"");
+  if(v == 0) {
+    printf("<root> retained %llu\n",(unsigned long long)n->retain);
+  } else {
+    printf("%s@%llx size %llu retained %llu\n",heap->type_name[n->type],
+        (unsigned long long)n->id,(unsigned long long)n->size,
+        (unsigned long long)n->retain);
+  }
+}
+
+/* Print the dominator tree , only the largest top children of each node
+ * are shown */
+static void print_tree( struct Heap* heap , size_t v , int depth ,
+    int max_depth , size_t top ) {
+  size_t* child = heap->dom + heap->dom_start[v];
+  size_t size = heap->dom_start[v+1] - heap->dom_start[v];
+  size_t i;
+  print_node(heap,v,depth);
+  if(depth == max_depth) return;
+  sort_heap = heap;
+  qsort(child,size,sizeof(size_t),cmp_retain);
+  for( i = 0 ; i < size && i < top ; ++i )
+    print_tree(heap,child[i],depth+1,max_depth,top);
+  if(size > top) printf("%*s... %zu more\n",(depth+1)*2,"",size-top);
+}
+
+static void print_summary( struct Heap* heap ) {
+  size_t count[SIZE_OF_VALUE_TYPE] = {0};
+  uint64_t bytes[SIZE_OF_VALUE_TYPE] = {0};
+  size_t garbage = 0;
+  uint64_t garbage_bytes = 0;
+  size_t i;
+  for( i = 1 ; i < heap->node_size ; ++i ) {
+    const struct Node* n = heap->node + i;
+    ++count[n->type];
+    bytes[n->type] += n->size;
+    if(n->order == SIZE_MAX) {
+      ++garbage;
+      garbage_bytes += n->size;
+    }
+  }
+  printf("objects %zu , references %zu , roots %zu\n",heap->node_size-1,
+      heap->edge_size-heap->root_size,heap->root_size);
+  printf("reachable bytes %llu , unreachable %zu objects %llu bytes\n",
+      (unsigned long long)heap->node[0].retain,garbage,
+      (unsigned long long)garbage_bytes);
+  if(heap->missing)
+    printf("%zu references to objects not in the snapshot\n",heap->missing);
+  printf("\n%-16s %10s %12s\n","type","count","bytes");
+  for( i = 0 ; i < SIZE_OF_VALUE_TYPE ; ++i ) {
+    if(count[i] == 0) continue;
+    printf("%-16s %10zu %12llu\n",heap->type_name[i],count[i],
+        (unsigned long long)bytes[i]);
+  }
+}
+
+static void print_top( struct Heap* heap , size_t top ) {
+  size_t* arr = malloc(sizeof(size_t)*heap->rpo_size);
+  size_t i;
+  for( i = 1 ; i < heap->rpo_size ; ++i ) arr[i-1] = heap->rpo[i];
+  sort_heap = heap;
+  qsort(arr,heap->rpo_size-1,sizeof(size_t),cmp_retain);
+  printf("\ntop %zu objects by retained size\n",top);
+  for( i = 0 ; i < top && i < heap->rpo_size-1 ; ++i )
+    print_node(heap,arr[i],1);
+  free(arr);
+}
+
+int main( int argc , char* argv[] ) {
+  struct Heap heap;
+  FILE* file;
+  size_t top = 10;
+  int depth = 3;
+  int i;
+  const char* path = NULL;
+  for( i = 1 ; i < argc ; ++i ) {
+    if(strcmp(argv[i],"-n") == 0 && i+1 < argc) {
+      top = (size_t)atoi(argv[++i]);
+    } else if(strcmp(argv[i],"-d") == 0 && i+1 < argc) {
+      depth = atoi(argv[++i]);
+    } else {
+      path = argv[i];
+    }
+  }
+  if(!path) {
+    fprintf(stderr,"Usage: heap-analyze [-n top] [-d depth] snapshot\n");
+    return 1;
+  }
+  file = fopen(path,"rb");
+  if(!file) die("cannot open snapshot");
+  memset(&heap,0,sizeof(heap));
+  read_snapshot(&heap,file);
+  fclose(file);
+  build_graph(&heap);
+  build_order(&heap);
+  build_dominator(&heap);
+  print_summary(&heap);
+  print_top(&heap,top);
+  printf("\ndominator tree\n");
+  print_tree(&heap,0,0,depth,top);
+  free(heap.node);
+  free(heap.edge);
+  free(heap.succ_start);
+  free(heap.succ);
+  free(heap.pred_start);
+  free(heap.pred);
+  free(heap.rpo);
+  free(heap.dom_start);
+  free(heap.dom);
+  return 0;
+}
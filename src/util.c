@@ -74,10 +74,10 @@ void MemGrow( void** buf , size_t* ocap , size_t objsz ) {
     *buf = malloc(MEMORY_INITIAL_OBJ_SIZE*objsz);
     if(ocap) *ocap = MEMORY_INITIAL_OBJ_SIZE;
   } else {
-    size_t nsize = *ocap * 2;
-    if(nsize > MEMORY_MAX_OBJ_SIZE) {
-      nsize = MEMORY_MAX_OBJ_SIZE;
-    }
+    /* double the capacity , but grow at most MEMORY_MAX_OBJ_SIZE objects
+     * at once. The capacity itself is not limited , otherwise the array
+     * overflows once it holds that many objects */
+    size_t nsize = *ocap + MIN(*ocap,MEMORY_MAX_OBJ_SIZE);
     *ocap = nsize;
     *buf = realloc(*buf,nsize*objsz);
   }